@@ -0,0 +1,343 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "abtest.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the windows a run is cut into to find its warmup */
+#define AB_WINDOWS 20
+#define AB_SETTLE 0.05
+/* scales the median absolute deviation to a standard deviation */
+#define AB_MAD_SCALE 1.4826
+
+static int
+compare_float(const void *a, const void *b)
+{
+   float fa = *(const float *)a, fb = *(const float *)b;
+   return (fa > fb) - (fa < fb);
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+   double da = *(const double *)a, db = *(const double *)b;
+   return (da > db) - (da < db);
+}
+
+/* the value at fraction q of the times, 0.5 for the median */
+static double
+quantile(const float *times, unsigned count, double q)
+{
+   if (count == 0)
+      return 0.0;
+   float *sorted = malloc(count * sizeof(*sorted));
+   if (!sorted)
+      return 0.0;
+   memcpy(sorted, times, count * sizeof(*sorted));
+   qsort(sorted, count, sizeof(*sorted), compare_float);
+   unsigned i = (unsigned)(count * q);
+   double value = sorted[i < count ? i : count - 1];
+   free(sorted);
+   return value;
+}
+
+static double
+median_double(double *values, unsigned count)
+{
+   qsort(values, count, sizeof(*values), compare_double);
+   return values[count / 2];
+}
+
+unsigned
+ab_warmup(const float *times, unsigned count)
+{
+   unsigned window = count / AB_WINDOWS;
+   if (window < 8)
+      return 0;
+
+   double reference = quantile(times + count / 2, count - count / 2, 0.5);
+   unsigned settled = 0;
+   for (unsigned i = 0; (i + 1) * window <= count; i++) {
+      double median = quantile(times + i * window, window, 0.5);
+      settled = fabs(median - reference) <= AB_SETTLE * reference ? settled + 1 : 0;
+      if (settled == 3) {
+         unsigned start = (i - 2) * window;
+         return start < count / 2 ? start : count / 2;
+      }
+   }
+   return count / 2;
+}
+
+bool
+ab_add_run(struct ab_set *set, const float *times, unsigned count)
+{
+   if (set->run_count == AB_MAX_RUNS || count == 0)
+      return false;
+   struct ab_run *run = &set->runs[set->run_count];
+   run->times = malloc(count * sizeof(*run->times));
+   if (!run->times)
+      return false;
+   memcpy(run->times, times, count * sizeof(*run->times));
+   run->count = count;
+   run->warmup = ab_warmup(times, count);
+   run->rejected = false;
+   set->run_count++;
+   return true;
+}
+
+static double
+run_quantile(const struct ab_run *run, double q)
+{
+   return quantile(run->times + run->warmup, run->count - run->warmup, q);
+}
+
+unsigned
+ab_reject_outliers(struct ab_set *set)
+{
+   for (unsigned i = 0; i < set->run_count; i++)
+      set->runs[i].rejected = false;
+   if (set->run_count < 3)
+      return 0;
+
+   double medians[AB_MAX_RUNS], deviations[AB_MAX_RUNS];
+   for (unsigned i = 0; i < set->run_count; i++)
+      medians[i] = run_quantile(&set->runs[i], 0.5);
+   double sorted[AB_MAX_RUNS];
+   memcpy(sorted, medians, set->run_count * sizeof(double));
+   double center = median_double(sorted, set->run_count);
+   for (unsigned i = 0; i < set->run_count; i++)
+      deviations[i] = fabs(medians[i] - center);
+   double mad = AB_MAD_SCALE * median_double(deviations, set->run_count);
+
+   /* runs that all agree have nothing to reject */
+   unsigned rejected = 0;
+   for (unsigned i = 0; i < set->run_count && mad > 0.0; i++) {
+      if (fabs(medians[i] - center) > 3.0 * mad) {
+         set->runs[i].rejected = true;
+         rejected++;
+      }
+   }
+   return rejected;
+}
+
+/* xorshift64*, seeded the same every time so a comparison is repeatable */
+static uint64_t
+next_random(uint64_t *state)
+{
+   *state ^= *state >> 12;
+   *state ^= *state << 25;
+   *state ^= *state >> 27;
+   return *state * 0x2545f4914f6cdd1dull;
+}
+
+static double
+resampled_mean(const double *values, unsigned count, uint64_t *state)
+{
+   double sum = 0.0;
+   for (unsigned i = 0; i < count; i++)
+      sum += values[next_random(state) % count];
+   return sum / count;
+}
+
+static double
+mean(const double *values, unsigned count)
+{
+   double sum = 0.0;
+   for (unsigned i = 0; i < count; i++)
+      sum += values[i];
+   return count ? sum / count : 0.0;
+}
+
+/* a quantile of every accepted run, returning how many there are */
+static unsigned
+accepted_values(const struct ab_set *set, double q, double *values)
+{
+   unsigned count = 0;
+   for (unsigned i = 0; i < set->run_count; i++) {
+      if (!set->runs[i].rejected)
+         values[count++] = run_quantile(&set->runs[i], q);
+   }
+   return count;
+}
+
+/* the 2.5th and 97.5th percentiles of the resampled statistic */
+static void
+percentile_interval(double *resamples, struct ab_interval *out)
+{
+   qsort(resamples, AB_RESAMPLES, sizeof(*resamples), compare_double);
+   out->low = resamples[(unsigned)(AB_RESAMPLES * 0.025)];
+   out->high = resamples[(unsigned)(AB_RESAMPLES * 0.975)];
+}
+
+static void
+bootstrap(const double *values, unsigned count, struct ab_interval *out)
+{
+   static double resamples[AB_RESAMPLES];
+   uint64_t state = 0x9e3779b97f4a7c15ull;
+
+   out->estimate = mean(values, count);
+   out->low = out->high = out->estimate;
+   if (count < 2)
+      return;
+   for (unsigned r = 0; r < AB_RESAMPLES; r++)
+      resamples[r] = resampled_mean(values, count, &state);
+   percentile_interval(resamples, out);
+}
+
+void
+ab_summarize(const struct ab_set *set, struct ab_summary *out)
+{
+   double values[AB_MAX_RUNS];
+   memset(out, 0, sizeof(*out));
+   out->runs = set->run_count;
+   for (unsigned i = 0; i < set->run_count; i++)
+      out->rejected += set->runs[i].rejected;
+
+   unsigned count = accepted_values(set, 0.5, values);
+   bootstrap(values, count, &out->median);
+   count = accepted_values(set, 0.99, values);
+   bootstrap(values, count, &out->p99);
+}
+
+/* the relative change of the mean of b against that of a */
+static void
+bootstrap_change(const double *a, unsigned a_count, const double *b,
+                 unsigned b_count, struct ab_interval *out)
+{
+   static double resamples[AB_RESAMPLES];
+   uint64_t state = 0x9e3779b97f4a7c15ull;
+
+   out->estimate = mean(b, b_count) / mean(a, a_count) - 1.0;
+   out->low = out->high = out->estimate;
+   if (a_count < 2 || b_count < 2)
+      return;
+   for (unsigned r = 0; r < AB_RESAMPLES; r++) {
+      double ma = resampled_mean(a, a_count, &state);
+      double mb = resampled_mean(b, b_count, &state);
+      resamples[r] = mb / ma - 1.0;
+   }
+   percentile_interval(resamples, out);
+}
+
+unsigned
+ab_compare(const struct ab_set *a, const struct ab_set *b, double threshold,
+           FILE *out)
+{
+   static const struct {
+      const char *name;
+      double q;
+   } metrics[] = {
+      { "median", 0.5 },
+      { "p99", 0.99 },
+   };
+
+   if (strcmp(a->config, b->config) != 0)
+      fprintf(out, "warning: the configurations differ\n  A: %s\n  B: %s\n",
+              a->config, b->config);
+
+   unsigned regressions = 0;
+   for (unsigned m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+      double va[AB_MAX_RUNS], vb[AB_MAX_RUNS];
+      unsigned ca = accepted_values(a, metrics[m].q, va);
+      unsigned cb = accepted_values(b, metrics[m].q, vb);
+      if (!ca || !cb) {
+         fprintf(out, "%-6s  no accepted runs\n", metrics[m].name);
+         continue;
+      }
+
+      struct ab_interval change;
+      bootstrap_change(va, ca, vb, cb, &change);
+      bool significant = change.low > 0.0 || change.high < 0.0;
+      const char *verdict = "no significant change";
+      if (significant && change.low > 0.0 && change.estimate > threshold) {
+         verdict = "REGRESSION";
+         regressions++;
+      } else if (significant && change.high < 0.0) {
+         verdict = "improvement";
+      } else if (significant) {
+         verdict = "slower, below the threshold";
+      }
+      fprintf(out, "%-6s  %8.3f ms -> %8.3f ms  %+6.2f%% [%+6.2f%%, %+6.2f%%]  %s\n",
+              metrics[m].name, mean(va, ca), mean(vb, cb),
+              100.0 * change.estimate, 100.0 * change.low, 100.0 * change.high,
+              verdict);
+   }
+   return regressions;
+}
+
+bool
+ab_save(const struct ab_set *set, const char *filename)
+{
+   FILE *f = fopen(filename, "w");
+   if (!f)
+      return false;
+
+   fprintf(f, "%s %d\n", AB_MAGIC, AB_VERSION);
+   fprintf(f, "config %s\n", set->config);
+   for (unsigned i = 0; i < set->run_count; i++) {
+      const struct ab_run *run = &set->runs[i];
+      fprintf(f, "run %u %u\n", run->count, run->warmup);
+      for (unsigned j = 0; j < run->count; j++)
+         fprintf(f, j + 1 < run->count ? "%.4f " : "%.4f\n", run->times[j]);
+   }
+   return fclose(f) == 0;
+}
+
+bool
+ab_load(struct ab_set *set, const char *filename)
+{
+   memset(set, 0, sizeof(*set));
+   FILE *f = fopen(filename, "r");
+   if (!f)
+      return false;
+
+   char line[512];
+   int version;
+   if (!fgets(line, sizeof(line), f) ||
+       sscanf(line, AB_MAGIC " %d", &version) != 1 || version != AB_VERSION ||
+       !fgets(line, sizeof(line), f) || strncmp(line, "config ", 7) != 0) {
+      fclose(f);
+      return false;
+   }
+   size_t len = strcspn(line + 7, "\n");
+   if (len >= sizeof(set->config))
+      len = sizeof(set->config) - 1;
+   memcpy(set->config, line + 7, len);
+
+   unsigned count, warmup;
+   bool ok = true;
+   while (ok && fscanf(f, "run %u %u ", &count, &warmup) == 2) {
+      float *times = malloc((count ? count : 1) * sizeof(*times));
+      ok = times && count && warmup < count && set->run_count < AB_MAX_RUNS;
+      for (unsigned j = 0; ok && j < count; j++)
+         ok = fscanf(f, "%f ", &times[j]) == 1;
+      if (!ok) {
+         free(times);
+         break;
+      }
+      struct ab_run *run = &set->runs[set->run_count++];
+      *run = (struct ab_run) { .count = count, .warmup = warmup, .times = times };
+   }
+   ok = ok && feof(f) && set->run_count > 0;
+   fclose(f);
+   if (!ok) {
+      ab_free(set);
+      return false;
+   }
+   ab_reject_outliers(set);
+   return true;
+}
+
+void
+ab_free(struct ab_set *set)
+{
+   for (unsigned i = 0; i < set->run_count; i++)
+      free(set->runs[i].times);
+   set->run_count = 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ABTEST_H
+#define ABTEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Repeated runs of one configuration, kept so that two sets of them can be
+ * told apart from noise. Frames within a run are correlated (the same
+ * clocks, the same compositor state), so the run is the unit everything
+ * is resampled by: a statistic is averaged over the runs and its
+ * confidence interval bootstrapped by drawing runs with replacement.
+ *
+ * A result file is text: a header line, the configuration, then per run a
+ * line with its frame and warmup counts followed by a line of frame times
+ * in ms, warmup included.
+ */
+
+#define AB_MAGIC "dgcgears-ab"
+#define AB_VERSION 1
+#define AB_MAX_RUNS 64
+#define AB_RESAMPLES 2000
+
+struct ab_run {
+   unsigned count;
+   unsigned warmup;
+   float *times;
+   bool rejected;
+};
+
+struct ab_set {
+   char config[256];
+   unsigned run_count;
+   struct ab_run runs[AB_MAX_RUNS];
+};
+
+/* an estimate with its 95% confidence interval */
+struct ab_interval {
+   double estimate, low, high;
+};
+
+struct ab_summary {
+   unsigned runs, rejected;
+   struct ab_interval median, p99;
+};
+
+/**
+ * Finds where a run settles: the first frame of the first three windows in
+ * a row whose medians lie within 5% of the median of the run's second
+ * half. At most half of the run is warmup.
+ *
+ * @param times the frame times in ms, in frame order
+ * @param count the number of frames
+ * @return the number of leading frames to drop
+ */
+unsigned
+ab_warmup(const float *times, unsigned count);
+
+/**
+ * Copies a run into the set and detects its warmup.
+ *
+ * @param set the set
+ * @param times the frame times in ms, in frame order
+ * @param count the number of frames
+ * @return false if the set is full or out of memory
+ */
+bool
+ab_add_run(struct ab_set *set, const float *times, unsigned count);
+
+/**
+ * Rejects the runs whose median lies more than three scaled median
+ * absolute deviations from the median of all run medians.
+ *
+ * @param set the set
+ * @return the number of runs rejected
+ */
+unsigned
+ab_reject_outliers(struct ab_set *set);
+
+/**
+ * Bootstraps the median and 99th percentile frame times over the accepted
+ * runs.
+ *
+ * @param set the set, outliers already rejected
+ * @param out the estimates and their intervals
+ */
+void
+ab_summarize(const struct ab_set *set, struct ab_summary *out);
+
+/**
+ * Compares two sets metric by metric and prints the relative change of B
+ * against A with its interval. A change is significant when its interval
+ * excludes zero, a regression when it is significant and slower by more
+ * than threshold.
+ *
+ * @param a the baseline
+ * @param b the candidate
+ * @param threshold the smallest relative slowdown reported, 0.01 for 1%
+ * @param out where the comparison is printed
+ * @return the number of metrics that regressed
+ */
+unsigned
+ab_compare(const struct ab_set *a, const struct ab_set *b, double threshold,
+           FILE *out);
+
+bool
+ab_save(const struct ab_set *set, const char *filename);
+
+/**
+ * Reads a result file and rejects its outliers again.
+ *
+ * @param set the set to fill
+ * @param filename the file
+ * @return false if the file cannot be read or is not a result file
+ */
+bool
+ab_load(struct ab_set *set, const char *filename);
+
+void
+ab_free(struct ab_set *set);
+
+#endif
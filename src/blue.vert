@@ -21,13 +21,37 @@
  */
 
 #version 450
+#extension GL_EXT_multiview : require
 
-#define COLOR 0.2, 0.2, 1.0
-#define POSITION vec2(-3.1,  4.2)
-#define ANGLE (-2.0 * angle - 25.0)
+/* views a multiview pass can render, the size of views[] */
+#define MAX_VIEWS 8
+
+/* lighting model, the execution set index a gear's material selects */
+#define MATERIAL 2
 
 layout(set = 0, binding = 0) uniform block {
     uniform mat4 projection;
+    uniform vec4 camera;    /* x = distance, y = first view of the pass */
+    uniform mat4 views[MAX_VIEWS];
+};
+
+struct gear {
+    vec4 position;  /* xyz, w = angle ratio */
+    vec4 color;     /* rgb, w = phase in degrees */
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer gear_block {
+    gear gears[];
+};
+
+/* solved by the kinematics engine every frame, in degrees */
+layout(std430, set = 0, binding = 2) readonly buffer angle_block {
+    float angles[];
+};
+
+/* gears grouped by mesh and material, a sequence draws a range of them */
+layout(std430, set = 0, binding = 3) readonly buffer instance_block {
+    uint instance_gears[];
 };
 
 layout(push_constant) uniform constants
@@ -41,7 +65,6 @@ layout(location = 1) in vec3 in_normal;
 layout(location = 0) out vec4 out_color;
 
 const vec3 L = normalize(vec3(5.0, 5.0, 10.0));
-const vec3 material_color = vec3(COLOR);
 const float PI = radians(180);
 
 mat4
@@ -67,49 +90,39 @@ mat4_translate(mat4 m, float x, float y, float z)
    return m * t;
 }
 
-mat4
-mat4_frustum_vk(mat4 m, float l, float r, float b, float t, float n, float f)
-{
-   mat4 tmp = mat4(1.0);
-
-   float deltaX = r - l;
-   float deltaY = t - b;
-   float deltaZ = f - n;
-
-   tmp[0].x = (2 * n) / deltaX;
-   tmp[1].y = (-2 * n) / deltaY;
-   tmp[2].x = (r + l) / deltaX;
-   tmp[2].y = (t + b) / deltaY;
-   tmp[2].z = f / (n - f);
-   tmp[2].w = -1;
-   tmp[3].z = -(f * n) / deltaZ;
-   tmp[3].w = 0;
-
-   return tmp;
-}
-
-
 void main()
 {
+   uint gear_index = instance_gears[gl_InstanceIndex];
+   gear g = gears[gear_index];
+
    mat4 view = mat4(1.0);
-   view = mat4_translate(view, 0, 0, -40);
+   view = mat4_translate(view, 0, 0, -camera.x);
+   view = view * views[uint(camera.y) + gl_ViewIndex];
    view = mat4_rotate(view, 2 * PI * view_rot_0 / 360.0, 1, 0, 0);
    view = mat4_rotate(view, 2 * PI * view_rot_1 / 360.0, 0, 1, 0);
    view = mat4_rotate(view, 0, 0, 0, 1);
 
    /* Translate and rotate the gear */
    mat4 modelview = mat4(1.0) * view;
-   modelview = mat4_translate(modelview, POSITION.x, POSITION.y, 0);
-   modelview = mat4_rotate(modelview, 2 * PI * ANGLE / 360.0, 0, 0, 1);
-
-   mat4 projection = mat4(1.0);
-   projection = mat4_frustum_vk(projection, -1.0, 1.0, -h, +h, 5.0f, 60.0f);
+   modelview = mat4_translate(modelview, g.position.x, g.position.y, g.position.z);
+   modelview = mat4_rotate(modelview, 2 * PI * angles[gear_index] / 360.0, 0, 0, 1);
 
     vec3 N = normalize(mat3(modelview) * in_normal);
-
-    float diffuse = max(0.0, dot(N, L));
     float ambient = 0.2;
-    out_color = vec4((ambient + diffuse) * material_color, 1.0);
+#if MATERIAL == 0
+    /* matte */
+    float diffuse = max(0.0, dot(N, L));
+    out_color = vec4((ambient + diffuse) * g.color.rgb, 1.0);
+#elif MATERIAL == 1
+    /* polished: diffuse plus a Blinn-Phong highlight */
+    float diffuse = max(0.0, dot(N, L));
+    float specular = pow(max(0.0, dot(N, normalize(L + vec3(0.0, 0.0, 1.0)))), 32.0);
+    out_color = vec4((ambient + diffuse) * g.color.rgb + 0.4 * specular, 1.0);
+#else
+    /* soft: wrapped diffuse */
+    float diffuse = max(0.0, (dot(N, L) + 0.5) / 1.5);
+    out_color = vec4((ambient + diffuse) * g.color.rgb, 1.0);
+#endif
 
     gl_Position = projection * (modelview * in_position);
 }
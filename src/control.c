@@ -0,0 +1,233 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "control.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+bool
+stats_open(struct stats_writer *w, const char *name)
+{
+   memset(w, 0, sizeof(*w));
+   if (strlen(name) >= sizeof(w->name))
+      return false;
+
+   int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+   if (fd < 0)
+      return false;
+   if (ftruncate(fd, sizeof(struct stats_segment)) != 0) {
+      close(fd);
+      shm_unlink(name);
+      return false;
+   }
+   void *map = mmap(NULL, sizeof(struct stats_segment), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      shm_unlink(name);
+      return false;
+   }
+
+   w->segment = map;
+   strcpy(w->name, name);
+   memset(w->segment, 0, sizeof(*w->segment));
+   w->segment->version = STATS_VERSION;
+   w->segment->size = sizeof(struct stats_segment);
+   /* the magic goes last, so readers never see a half initialized segment */
+   atomic_thread_fence(memory_order_release);
+   memcpy(w->segment->magic, STATS_MAGIC, sizeof(w->segment->magic));
+   return true;
+}
+
+struct stats_segment *
+stats_begin(struct stats_writer *w)
+{
+   uint32_t seq = atomic_load_explicit(&w->segment->seq, memory_order_relaxed);
+   atomic_store_explicit(&w->segment->seq, seq + 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   return w->segment;
+}
+
+void
+stats_end(struct stats_writer *w)
+{
+   uint32_t seq = atomic_load_explicit(&w->segment->seq, memory_order_relaxed);
+   atomic_store_explicit(&w->segment->seq, seq + 1, memory_order_release);
+}
+
+void
+stats_close(struct stats_writer *w)
+{
+   if (!w->segment)
+      return;
+   munmap(w->segment, sizeof(struct stats_segment));
+   shm_unlink(w->name);
+   w->segment = NULL;
+}
+
+const struct stats_segment *
+stats_attach(const char *name)
+{
+   int fd = shm_open(name, O_RDONLY, 0);
+   if (fd < 0)
+      return NULL;
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct stats_segment)) {
+      close(fd);
+      return NULL;
+   }
+   const struct stats_segment *segment =
+      mmap(NULL, sizeof(struct stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (segment == MAP_FAILED)
+      return NULL;
+
+   if (memcmp(segment->magic, STATS_MAGIC, sizeof(segment->magic)) != 0 ||
+       segment->version != STATS_VERSION ||
+       segment->size != sizeof(struct stats_segment)) {
+      munmap((void *)segment, sizeof(struct stats_segment));
+      return NULL;
+   }
+   return segment;
+}
+
+bool
+stats_read(const struct stats_segment *segment, struct stats_segment *out)
+{
+   for (unsigned attempt = 0; attempt < 1000; attempt++) {
+      uint32_t seq = atomic_load_explicit(&segment->seq, memory_order_acquire);
+      if (seq & 1)
+         continue;
+      memcpy(out, (const void *)segment, sizeof(*out));
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&segment->seq, memory_order_relaxed) == seq)
+         return true;
+   }
+   return false;
+}
+
+static bool
+set_nonblocking(int fd)
+{
+   int flags = fcntl(fd, F_GETFL);
+   return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+bool
+control_open(struct control_server *s, const char *path)
+{
+   memset(s, 0, sizeof(*s));
+   s->fd = -1;
+   for (unsigned i = 0; i < CONTROL_MAX_CLIENTS; i++)
+      s->clients[i].fd = -1;
+
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   if (strlen(path) >= sizeof(addr.sun_path) || strlen(path) >= sizeof(s->path))
+      return false;
+   strcpy(addr.sun_path, path);
+   strcpy(s->path, path);
+
+   s->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (s->fd < 0)
+      return false;
+   unlink(path);
+   if (bind(s->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+       listen(s->fd, CONTROL_MAX_CLIENTS) != 0 || !set_nonblocking(s->fd)) {
+      close(s->fd);
+      s->fd = -1;
+      return false;
+   }
+
+   /* a client going away mid-reply must not take the process with it */
+   signal(SIGPIPE, SIG_IGN);
+   return true;
+}
+
+static void
+drop_client(struct control_server *s, unsigned i)
+{
+   close(s->clients[i].fd);
+   s->clients[i].fd = -1;
+   s->clients[i].len = 0;
+}
+
+void
+control_poll(struct control_server *s, control_handler handler)
+{
+   if (s->fd < 0)
+      return;
+
+   int fd;
+   while ((fd = accept(s->fd, NULL, NULL)) >= 0) {
+      unsigned i;
+      for (i = 0; i < CONTROL_MAX_CLIENTS && s->clients[i].fd >= 0; i++)
+         ;
+      if (i == CONTROL_MAX_CLIENTS || !set_nonblocking(fd)) {
+         close(fd);
+         continue;
+      }
+      s->clients[i].fd = fd;
+      s->clients[i].len = 0;
+   }
+
+   for (unsigned i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+      if (s->clients[i].fd < 0)
+         continue;
+
+      char buf[CONTROL_LINE_SIZE];
+      ssize_t n = read(s->clients[i].fd, buf, sizeof(buf));
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+         drop_client(s, i);
+         continue;
+      }
+
+      for (ssize_t j = 0; j < n && s->clients[i].fd >= 0; j++) {
+         if (buf[j] != '\n') {
+            /* a line too long for the buffer is cut off */
+            if (s->clients[i].len < CONTROL_LINE_SIZE - 1)
+               s->clients[i].line[s->clients[i].len++] = buf[j];
+            continue;
+         }
+
+         if (s->clients[i].len && s->clients[i].line[s->clients[i].len - 1] == '\r')
+            s->clients[i].len--;
+         s->clients[i].line[s->clients[i].len] = '\0';
+         s->clients[i].len = 0;
+
+         char reply[CONTROL_LINE_SIZE];
+         reply[0] = '\0';
+         handler(s->clients[i].line, reply, sizeof(reply) - 1);
+         strcat(reply, "\n");
+         size_t len = strlen(reply);
+         if (write(s->clients[i].fd, reply, len) != (ssize_t)len)
+            drop_client(s, i);
+      }
+   }
+}
+
+void
+control_close(struct control_server *s)
+{
+   for (unsigned i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+      if (s->clients[i].fd >= 0)
+         drop_client(s, i);
+   }
+   if (s->fd >= 0) {
+      close(s->fd);
+      unlink(s->path);
+      s->fd = -1;
+   }
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Live counters published in a POSIX shared memory object, rewritten once
+ * per frame. The writer never waits on a reader: it bumps seq to an odd
+ * value, updates the counters and bumps seq to the next even value. A
+ * reader copies the segment and retries if seq was odd or changed while it
+ * copied.
+ */
+
+#define STATS_MAGIC "DGCSTATS"
+#define STATS_VERSION 1
+#define STATS_MAX_WINDOWS 8
+
+struct stats_segment {
+   char magic[8];
+   uint32_t version;
+   uint32_t size;
+   _Atomic uint32_t seq;
+   uint32_t window_count;
+   uint64_t frame;
+   double time;
+
+   /* the last frame, in ms */
+   float frame_ms;
+   float record_ms;
+   float gpu_ms;
+   float gpu_animation_ms;
+   float gpu_window_ms[STATS_MAX_WINDOWS];
+
+   uint32_t gear_count;
+   uint32_t sequence_count;
+   uint32_t max_sequence_count;
+   uint32_t samples;
+   uint32_t present_mode;
+   uint32_t shader_object;
+   uint32_t instancing;
+   uint32_t pad;
+
+   uint64_t preprocess_bytes;
+   uint64_t attachment_bytes;
+   uint64_t attachment_resident_bytes;
+};
+
+struct stats_writer {
+   struct stats_segment *segment;
+   char name[64];
+};
+
+/**
+ * Creates the shared memory object and maps it.
+ *
+ * @param w the writer to initialize
+ * @param name the object name, starting with '/'
+ * @return true on success
+ */
+bool
+stats_open(struct stats_writer *w, const char *name);
+
+/**
+ * Starts an update. Readers retry until stats_end() is called.
+ *
+ * @param w the writer
+ * @return the segment to write the counters to
+ */
+struct stats_segment *
+stats_begin(struct stats_writer *w);
+
+/**
+ * Publishes the counters written since stats_begin().
+ *
+ * @param w the writer
+ */
+void
+stats_end(struct stats_writer *w);
+
+/**
+ * Unmaps and removes the shared memory object.
+ *
+ * @param w the writer
+ */
+void
+stats_close(struct stats_writer *w);
+
+/**
+ * Maps a segment published by another process, read-only.
+ *
+ * @param name the object name
+ * @return the segment or NULL
+ */
+const struct stats_segment *
+stats_attach(const char *name);
+
+/**
+ * Takes a consistent copy of a segment.
+ *
+ * @param segment the mapped segment
+ * @param out the copy
+ * @return false if the writer kept it busy for every attempt
+ */
+bool
+stats_read(const struct stats_segment *segment, struct stats_segment *out);
+
+/*
+ * A Unix domain socket taking one command per line. It is polled from the
+ * render loop, so commands run between frames and need no locking.
+ */
+
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_LINE_SIZE 256
+
+struct control_server {
+   int fd;
+   char path[108];
+   struct {
+      int fd;
+      size_t len;
+      char line[CONTROL_LINE_SIZE];
+   } clients[CONTROL_MAX_CLIENTS];
+};
+
+/**
+ * Handles one command line, writing a single line reply without the
+ * newline.
+ */
+typedef void (*control_handler)(const char *line, char *reply, size_t size);
+
+/**
+ * Binds and listens on a socket, replacing a stale one at the same path.
+ *
+ * @param s the server to initialize
+ * @param path the socket path
+ * @return true on success
+ */
+bool
+control_open(struct control_server *s, const char *path);
+
+/**
+ * Accepts pending clients and runs every complete command line received,
+ * without blocking.
+ *
+ * @param s the server
+ * @param handler called once per line
+ */
+void
+control_poll(struct control_server *s, control_handler handler);
+
+/**
+ * Disconnects every client and removes the socket.
+ *
+ * @param s the server
+ */
+void
+control_close(struct control_server *s);
+
+#endif
@@ -28,11 +28,22 @@
 #include <stdarg.h>
 #include <string.h>
 #include <math.h>
+#include <ctype.h>
 #include "matrix.h"
-
+#include "image.h"
+#include "trace.h"
+#include "scene.h"
+#include "kinematics.h"
+#include "control.h"
+#include "abtest.h"
+
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "vulkan/vulkan.h"
+#include "vk_dispatch.h"
 
 #include "wsi/wsi.h"
 
@@ -50,47 +61,558 @@ static VkPhysicalDevice physical_device;
 static VkPhysicalDeviceMemoryProperties mem_props;
 static VkDevice device;
 static VkQueue queue;
+/*
+ * Every device-level entry point, the hot ones called through it. They
+ * come from the driver unless -loader-dispatch asks for the loader's
+ * trampolines, which the statically linked vk* functions also go through.
+ */
+static struct vk_device_dispatch vk;
+static bool loader_dispatch;
+static unsigned vk_entry_points;
 
 /* swapchain */
-static int width, height, new_width, new_height;
+static int width, height;
 static bool fullscreen;
 static VkPresentModeKHR desidered_present_mode;
+static uint32_t desired_image_count = 2;
 static VkSampleCountFlagBits sample_count;
-static uint32_t image_count;
 static VkCommandPool cmd_pool;
-static VkPresentModeKHR present_mode;
 static VkFormat image_format;
 static VkColorSpaceKHR color_space;
 static VkFormat depth_format;
-uint32_t min_image_count = 2;
-static VkSurfaceKHR surface;
-static VkSwapchainKHR swapchain;
-static VkImage color_msaa, depth_image;
-static VkImageView color_msaa_view, depth_view;
-static VkDeviceMemory color_msaa_memory, depth_memory;
 static VkSemaphore present_semaphore;
 
-struct {
-   VkImage image;
-   VkImageView view;
-} image_data[5];
+/* depth attachment format; auto prefers D32 and falls back to X8_D24 */
+enum depth_mode {
+   DEPTH_AUTO,
+   DEPTH_D16,
+   DEPTH_D24,
+   DEPTH_D32,
+};
+static const char *depth_mode_names[] = { "auto", "d16", "d24", "d32" };
+static const VkFormat depth_mode_formats[] = {
+   VK_FORMAT_UNDEFINED,
+   VK_FORMAT_D16_UNORM,
+   VK_FORMAT_X8_D24_UNORM_PACK32,
+   VK_FORMAT_D32_SFLOAT,
+};
+static enum depth_mode depth_mode;
+
+/* how the MSAA color attachment reaches the single-sample image */
+enum resolve_mode {
+   RESOLVE_PASS,
+   RESOLVE_CMD,
+   RESOLVE_SHADER,
+};
+static const char *resolve_mode_names[] = { "pass", "cmd", "shader" };
+static enum resolve_mode resolve_mode;
+static VkDescriptorSetLayout resolve_set_layout;
+static VkPipelineLayout resolve_pipeline_layout;
+static VkPipeline resolve_pipeline;
+static VkSampler resolve_sampler;
+
+/*
+ * multiview: view_count cameras rendered into the layers of one target and
+ * tiled over the window, either in a single pass with a view mask, where
+ * the generated commands execute once for all views, or with one pass and
+ * one execute per view
+ */
+#define MAX_VIEWS 8
+enum multiview_mode {
+   MULTIVIEW_PASS,
+   MULTIVIEW_PER_VIEW,
+};
+static const char *multiview_mode_names[] = { "pass", "per-view" };
+static enum multiview_mode multiview_mode;
+static unsigned view_count = 1;
+static bool multiview_stereo;
+
+/*
+ * -hiz-cull: two phase occlusion culling. A compute pass tests every
+ * sequence against a max-depth pyramid built from the previous frame and
+ * writes the survivors and their count for the first execute, the
+ * pyramid is rebuilt from that depth and the sequences it now shows are
+ * drawn by a second execute. Every few frames one is drawn unculled, to
+ * tell what culling saves.
+ */
+#define HIZ_MAX_LEVELS 16
+#define HIZ_BASELINE_INTERVAL 16
+static bool hiz_cull;
+static VkSampler hiz_sampler;
+static VkDescriptorSetLayout hiz_build_set_layout, hiz_cull_set_layout;
+static VkPipelineLayout hiz_build_pipeline_layout, hiz_cull_pipeline_layout;
+static VkPipeline hiz_build_pipeline, hiz_cull_pipeline;
+/* per window: the streams of both phases, then a drawn flag per sequence */
+static VkBuffer cull_buffer;
+static VkDeviceMemory cull_mem;
+static VkDeviceAddress cull_addr;
+static VkDeviceSize cull_stream_size, cull_window_size;
+/* both phases' sequence counts per frame slot and window, read back */
+static VkBuffer cull_count_buffer;
+static VkDeviceMemory cull_count_mem;
+static uint32_t *cull_count_map;
+static VkDeviceAddress cull_count_addr;
+/* bounding sphere radius per gear, also what -sw-raster measures */
+static VkBuffer radius_buffer;
+static VkDeviceMemory radius_mem;
+static unsigned cull_frame;
+/* since the last report */
+static uint64_t cull_tested, cull_drawn[2];
+static double cull_gpu_ms[2];
+static unsigned cull_gpu_frames[2];
+
+/*
+ * -sequence-order: a radix sort on the GPU reorders the sequences right
+ * before they execute, by execution set index to group the state switches,
+ * by depth to draw front to back for early depth rejection, or by both.
+ * Counting the fragment shader invocations tells the overdraw.
+ */
+enum sequence_order {
+   ORDER_SCENE,
+   ORDER_STATE,
+   ORDER_DEPTH,
+   ORDER_STATE_DEPTH,
+};
+static const char *sequence_order_names[] = { "scene", "state", "depth", "state-depth" };
+static enum sequence_order sequence_order;
+static bool sort_enabled;
+#define SORT_BLOCK 256
+static VkPipelineLayout sort_pipeline_layout;
+static VkPipeline sort_pipeline;
+/* keys and values twice, the histogram, then a sorted stream per phase */
+static VkBuffer sort_buffer;
+static VkDeviceMemory sort_mem;
+static VkDeviceAddress sort_addr;
+static uint32_t sort_capacity;
+static VkQueryPool overdraw_pool;
+static uint64_t overdraw_fragments, overdraw_pixels;
+
+/*
+ * -damage: only what moved is redrawn, into what the swapchain image kept
+ * from the last time it was drawn. A frame's damage is the screen
+ * rectangles of the gears whose angle changed, or everything when the view
+ * did; an image repaints the damage of every frame since it was last
+ * drawn, each rectangle with its own scissored execute. The compositor
+ * gets the frame's damage through VK_KHR_incremental_present. Every few
+ * frames one is redrawn whole, to tell what the tracking saves.
+ */
+#define DAMAGE_MAX_RECTS 4
+#define DAMAGE_HISTORY 8
+#define DAMAGE_BASELINE_INTERVAL 16
+struct damage {
+   bool full;
+   uint32_t count;
+   /* one spare, merged away before the next rectangle is added */
+   VkRect2D rects[DAMAGE_MAX_RECTS + 1];
+};
+static bool damage_tracking;
+static bool enable_incremental_present;
+/* the gears that can move and their bounding sphere radius */
+static uint32_t *damage_gears;
+static float *damage_radius;
+static uint32_t damage_gear_count;
+static unsigned damage_frame;
+/* since the last report */
+static uint64_t damage_shaded, damage_pixels;
+static double damage_gpu_ms[2];
+static unsigned damage_gpu_frames[2];
+
+/*
+ * -hud: an overlay drawn after the gears, in the last pass of every
+ * window. From the top: a graph of the frame (white) and GPU (orange)
+ * times of the last HUD_HISTORY frames against lines at 16.7 and 33.3 ms,
+ * a bar per GPU phase, then the sequences, the culled sequences, the
+ * memory in MiB and the HUD's own CPU and GPU ms, each after a swatch of
+ * its color. The quads and lines are built on the CPU into a persistently
+ * mapped buffer, a region per frame slot, which the vertex shader pulls
+ * from by address. Building and recording the HUD is left out of the
+ * record times and its draws are timed apart, so it does not distort
+ * what it shows.
+ */
+#define HUD_HISTORY 240
+#define HUD_MAX_QUADS 1024
+#define HUD_MAX_LINES 512
+#define HUD_SLOT_VERTICES (6 * HUD_MAX_QUADS + 2 * HUD_MAX_LINES)
+struct hud_vertex {
+   float x, y;     /* in pixels from the top left */
+   uint32_t color; /* RGBA8, red in the low byte */
+   uint32_t pad;
+};
+struct hud_push {
+   VkDeviceAddress vertices;
+   float scale[2]; /* pixels to normalized device coordinates */
+};
+static bool hud_enabled;
+static VkBuffer hud_buffer;
+static VkDeviceMemory hud_mem;
+static struct hud_vertex *hud_map;
+static VkDeviceAddress hud_addr;
+static VkPipelineLayout hud_pipeline_layout;
+/* triangles, then lines */
+static VkPipeline hud_pipelines[2];
+/* what the current frame's slot holds */
+static uint32_t hud_quad_count, hud_line_count;
+static float hud_frame_ms[HUD_HISTORY], hud_gpu_ms[HUD_HISTORY];
+static unsigned hud_head;
+/* last frame's culled sequences and the HUD's own cost, as shown */
+static uint32_t hud_culled;
+static float hud_cpu_ms, hud_draw_ms;
+/* a timestamp before and after the HUD per window, each once per view */
+#define HUD_QUERIES (2 * WSI_MAX_WINDOWS * MAX_VIEWS)
+static VkQueryPool hud_pool;
+/* since the last report, and recording alone, to leave out of the record times */
+static double hud_cpu_time, hud_gpu_time, hud_record_time;
+static unsigned hud_gpu_frames;
+/* building and recording the current frame's HUD */
+static double hud_frame_cost;
+
+/*
+ * -rt-shadows: shadow rays from every pixel the gears cover towards the
+ * light. A BLAS per scene shape is built once from the vertex buffer; the
+ * TLAS holds an instance per gear, written by a compute pass from the
+ * solved angles, and is refit every frame and rebuilt every
+ * RT_REBUILD_INTERVAL frames, as refitting lets its boxes grow. After the
+ * scene pass the rays are launched by a single generated trace rays
+ * command per window, start on the positions the depth buffer gives and
+ * write a visibility per pixel, which a full-screen pass then multiplies
+ * the color by.
+ */
+#define RT_REBUILD_INTERVAL 64
+struct rt_params {
+   float inverse_view[16];
+   float projection[4];    /* x, y scale and the depth terms of the projection */
+   float light[4];         /* towards the light, in world space */
+   VkDeviceAddress tlas;
+   VkDeviceAddress mask;
+   uint32_t pad[4];
+};
+struct rt_instance_push {
+   VkDeviceAddress gears;
+   VkDeviceAddress angles;
+   VkDeviceAddress blas;
+   VkDeviceAddress instances;
+   uint32_t gear_count;
+   uint32_t pad;
+};
+struct rt_composite_push {
+   VkDeviceAddress mask;
+   uint32_t width;
+   uint32_t pad;
+};
+static bool rt_shadows;
+static VkPhysicalDeviceRayTracingPipelinePropertiesKHR rt_pipeline_props;
+static VkPhysicalDeviceAccelerationStructurePropertiesKHR rt_as_props;
+static VkSampler rt_sampler;
+static VkDescriptorSetLayout rt_set_layout;
+static VkPipelineLayout rt_pipeline_layout, rt_instance_pipeline_layout;
+static VkPipelineLayout rt_composite_pipeline_layout;
+static VkPipeline rt_pipeline, rt_instance_pipeline, rt_composite_pipeline;
+/* the raygen record, then the miss record */
+static VkBuffer rt_sbt_buffer;
+static VkDeviceMemory rt_sbt_mem;
+static VkDeviceAddress rt_sbt_addr;
+static VkDeviceSize rt_record_size;
+/* the trace layout, its preprocess buffer and a command per frame slot and window */
+static VkIndirectCommandsLayoutEXT rt_indirect_layout;
+static VkBuffer rt_preprocess_buffer;
+static VkDeviceMemory rt_preprocess_mem;
+static VkDeviceAddress rt_preprocess_addr;
+static VkDeviceSize rt_preprocess_size;
+static VkBuffer rt_stream_buffer;
+static VkDeviceMemory rt_stream_mem;
+static VkTraceRaysIndirectCommand2KHR *rt_stream_map;
+static VkDeviceAddress rt_stream_addr;
+/* the parameters of the rays, per frame slot and window */
+static VkBuffer rt_params_buffer;
+static VkDeviceMemory rt_params_mem;
+static struct rt_params *rt_params_map;
+static VkDeviceAddress rt_params_addr;
+/* the acceleration structures, all in one buffer, and what builds them */
+static VkBuffer rt_as_buffer, rt_scratch_buffer, rt_index_buffer;
+static VkBuffer rt_blas_ref_buffer, rt_instance_buffer;
+static VkDeviceMemory rt_as_mem, rt_scratch_mem, rt_index_mem;
+static VkDeviceMemory rt_blas_ref_mem, rt_instance_mem;
+/* a BLAS per scene shape, where its indices start and its build scratch */
+static struct rt_blas {
+   VkAccelerationStructureKHR as;
+   VkDeviceSize index_offset;
+   VkDeviceSize scratch_offset;
+} *rt_blas;
+static VkDeviceAddress rt_index_addr, rt_scratch_addr, rt_instance_addr, rt_blas_ref_addr;
+static VkAccelerationStructureKHR rt_tlas;
+static VkDeviceAddress rt_tlas_addr;
+static bool rt_blas_built;
+static unsigned rt_frame;
+/* a timestamp before the BLAS, after them, after the TLAS, then two per window */
+#define RT_QUERIES (3 + 2 * WSI_MAX_WINDOWS)
+static VkQueryPool rt_pool;
+static double rt_blas_ms = -1.0;
+/* since the last report */
+static double rt_build_ms, rt_refit_ms, rt_trace_ms;
+static unsigned rt_builds, rt_refits, rt_trace_frames;
+
+/*
+ * -sw-raster: gears whose bounding sphere covers fewer pixels of screen
+ * radius than the threshold skip the generated commands. A compute pass
+ * sorts the sequences into those left to the generated commands and the
+ * small gears, which a compute rasterizer draws a workgroup each, with
+ * 64-bit atomics packing depth over color into a buffer per window. A
+ * full-screen draw in the scene pass merges that buffer through the depth
+ * test. Every few timed frames probe another threshold, the first one
+ * drawing everything through the generated commands, to tell where each
+ * path wins.
+ */
+#define SWR_PROBE_INTERVAL 16
+#define SWR_PROBES 6
+static const float swr_probe_thresholds[SWR_PROBES] = { 0.0f, 2.0f, 4.0f, 8.0f, 16.0f, 32.0f };
+struct swr_counts {
+   uint32_t dispatch[3];
+   uint32_t reserved;
+   uint32_t sequences;
+   uint32_t pad[3];
+};
+/* matches the push constants of swr_classify.comp */
+struct swr_classify_push {
+   VkDeviceAddress input;
+   VkDeviceAddress output;
+   VkDeviceAddress small;
+   VkDeviceAddress count;
+   VkDeviceAddress ubo;
+   VkDeviceAddress gears;
+   VkDeviceAddress instances;
+   VkDeviceAddress radius;
+   VkDeviceAddress materials;
+   float view_rot_0, view_rot_1;
+   uint32_t sequence_count;
+   uint32_t capacity;
+   float threshold;
+   uint32_t render_height;
+   uint32_t pad;
+};
+/* matches the push constants of swr_raster.comp */
+struct swr_raster_push {
+   VkDeviceAddress small;
+   VkDeviceAddress vertices;
+   VkDeviceAddress visibility;
+   VkDeviceAddress ubo;
+   VkDeviceAddress gears;
+   VkDeviceAddress angles;
+   float view_rot_0, view_rot_1;
+   int32_t render_size[2];
+};
+struct swr_resolve_push {
+   VkDeviceAddress visibility;
+   uint32_t width;
+   uint32_t pad;
+};
+static float swr_threshold;
+static VkPipelineLayout swr_classify_pipeline_layout, swr_raster_pipeline_layout;
+static VkPipelineLayout swr_resolve_pipeline_layout;
+static VkPipeline swr_classify_pipeline, swr_raster_pipeline, swr_resolve_pipeline;
+/* per window: the sequences left to the generated commands, then the small gears */
+static VkBuffer swr_buffer;
+static VkDeviceMemory swr_mem;
+static VkDeviceAddress swr_addr;
+static VkDeviceSize swr_stream_size, swr_window_size;
+static uint32_t swr_capacity;
+/* the counts per frame slot and window, read back */
+static VkBuffer swr_count_buffer;
+static VkDeviceMemory swr_count_mem;
+static struct swr_counts *swr_count_map;
+static VkDeviceAddress swr_count_addr;
+/* the material of every gear, which the rasterizer shades by */
+static VkBuffer swr_material_buffer;
+static VkDeviceMemory swr_material_mem;
+static unsigned swr_frame, swr_next_probe;
+/* since the last report */
+static uint64_t swr_small_gears, swr_gears;
+static double swr_gpu_ms, swr_probe_ms[SWR_PROBES];
+static unsigned swr_gpu_frames, swr_probe_frames[SWR_PROBES];
+
+/*
+ * Attachment memory as allocated and whether it came from a lazily
+ * allocated type, in which case only the committed part is resident.
+ */
+struct attachment_memory {
+   VkDeviceMemory memory;
+   VkDeviceSize size;
+   bool lazy;
+};
+
+/* capture */
+static unsigned capture_at;
+static const char *capture_file;
+static const char *compare_file;
+static unsigned compare_tolerance = 2;
+static bool deterministic;
+static VkBuffer capture_buffer;
+static VkDeviceMemory capture_mem;
+static int capture_status;
 
-#define MAX_CONCURRENT_FRAMES 2
+/*
+ * Frames the CPU may record ahead of the GPU. Per-frame resources exist for
+ * the largest count, so changing it only moves where frame_index wraps.
+ */
+#define MAX_CONCURRENT_FRAMES 3
+static unsigned concurrent_frames = 2;
 struct {
    VkFence fence;
    VkCommandBuffer cmd_buffer;
-   VkSemaphore semaphore;
 } frame_data[MAX_CONCURRENT_FRAMES];
 
+/*
+ * dynamic resolution: the scene is rendered into a target sized for the
+ * largest scale and only a scaled sub-rectangle is used, so the scale can
+ * follow the measured GPU time every frame without reallocating anything
+ */
+static float dynamic_res_target;
+static float dynamic_res_min = 0.5f, dynamic_res_max = 1.0f;
+
+/*
+ * Everything owned by one output. The device, the gear buffers and the
+ * indirect commands are shared; a window only has its swapchain, the
+ * attachments sized for it and the direction it looks at the gears from.
+ */
+struct window {
+   VkSurfaceKHR surface;
+   VkSwapchainKHR swapchain;
+   int width, height, new_width, new_height;
+   VkPresentModeKHR present_mode;
+   VkImageUsageFlags swapchain_usage;
+   uint32_t min_image_count;
+   uint32_t image_count;
+   struct {
+      VkImage image;
+      VkImageView view;
+      bool presented;
+      /* -damage: the frame that last drew it, 0 if none did */
+      uint64_t damage_serial;
+   } image_data[5];
+   VkSemaphore acquire_semaphore[MAX_CONCURRENT_FRAMES];
+   uint32_t image_index;
+   bool suboptimal;
+
+   VkImage color_msaa, depth_image;
+   VkImageView color_msaa_view, depth_view;
+   struct attachment_memory color_msaa_alloc, depth_alloc;
+   VkDescriptorPool resolve_desc_pool;
+   VkDescriptorSet resolve_descriptor_set;
+
+   float res_scale;
+   int target_width, target_height;
+   int render_width, render_height;
+   VkImage res_color;
+   VkImageView res_color_view;
+   VkImageView res_layer_views[MAX_VIEWS];
+   VkDeviceMemory res_color_memory;
+
+   /* -hiz-cull: the depth pyramid, with a view and a build set per level */
+   VkImage hiz_image;
+   VkDeviceMemory hiz_memory;
+   VkImageView hiz_view;
+   VkImageView hiz_level_views[HIZ_MAX_LEVELS];
+   uint32_t hiz_levels;
+   VkDescriptorPool hiz_desc_pool;
+   VkDescriptorSet hiz_build_sets[HIZ_MAX_LEVELS];
+   VkDescriptorSet hiz_cull_set;
+   bool hiz_valid;
+
+   /* -rt-shadows: the visibility per pixel and the set reading the depth */
+   VkBuffer rt_mask_buffer;
+   VkDeviceMemory rt_mask_memory;
+   VkDeviceAddress rt_mask_addr;
+   VkDescriptorPool rt_desc_pool;
+   VkDescriptorSet rt_set;
+
+   /* -sw-raster: depth over color per pixel of the software rasterizer */
+   VkBuffer swr_visibility_buffer;
+   VkDeviceMemory swr_visibility_memory;
+   VkDeviceAddress swr_visibility_addr;
+
+   /* -damage: the last frames' damage, the newest at damage_serial */
+   struct damage damage_history[DAMAGE_HISTORY];
+   uint64_t damage_serial;
+   float damage_angle, damage_view[3];
+   uint32_t damage_sequences;
+   int damage_width, damage_height;
+
+   float yaw;
+   double record_time, gpu_time;
+   double record_mark, gpu_mark;
+};
+static struct window windows[WSI_MAX_WINDOWS];
+static unsigned window_count = 1;
+
+/*
+ * GPU frame timer: a timestamp at the start of every frame's command buffer,
+ * one after the work shared by all windows, one after each window and one
+ * at the end
+ */
+#define TIMER_QUERIES (3 + WSI_MAX_WINDOWS)
+static VkQueryPool timer_pool;
+static bool timer_pending[MAX_CONCURRENT_FRAMES];
+static double timestamp_period;
+static uint64_t timestamp_mask;
+static double gpu_time;
+static unsigned gpu_frames;
+/* the last timed frame: the shared work, then each window */
+static float gpu_phase_ms[1 + WSI_MAX_WINDOWS];
+
+/* -hiz-cull, per frame slot: drawn unculled, sequences tested, counts to read back */
+static bool cull_baseline[MAX_CONCURRENT_FRAMES];
+static uint32_t cull_tested_sequences[MAX_CONCURRENT_FRAMES];
+static bool cull_pending[MAX_CONCURRENT_FRAMES];
+
+/* -damage, per frame slot: redrawn whole on purpose, or because it had to be */
+static bool damage_baseline[MAX_CONCURRENT_FRAMES];
+static bool damage_full[MAX_CONCURRENT_FRAMES];
+static bool damage_pending[MAX_CONCURRENT_FRAMES];
+
+/* -sequence-order, per frame slot: pixels drawn, fragments to read back */
+static uint64_t overdraw_frame_pixels[MAX_CONCURRENT_FRAMES];
+static bool overdraw_pending[MAX_CONCURRENT_FRAMES];
+
+/* -hud, per frame slot: timestamps to read back */
+static bool hud_pending[MAX_CONCURRENT_FRAMES];
+
+/* -rt-shadows, per frame slot: built the BLAS, rebuilt the TLAS, timestamps to read back */
+static bool rt_blas_frame[MAX_CONCURRENT_FRAMES];
+static bool rt_rebuild_frame[MAX_CONCURRENT_FRAMES];
+static bool rt_pending[MAX_CONCURRENT_FRAMES];
+
+/* -sw-raster, per frame slot: the threshold probed or -1, counts to read back */
+static int swr_probe[MAX_CONCURRENT_FRAMES];
+static bool swr_pending[MAX_CONCURRENT_FRAMES];
+
 typedef struct indirect_data {
    uint32_t ies[2];
    VkDrawIndirectCommand draw;
 } indirect_data;
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define MIN2(a, b) ((a) < (b) ? (a) : (b))
+#define MAX2(a, b) ((a) > (b) ? (a) : (b))
 
 /* gear data */
+static VkDescriptorPool desc_pool;
 static VkDescriptorSet descriptor_set;
+
+/* how the gear descriptors reach the shaders */
+enum descriptor_model {
+   DESCRIPTOR_MODEL_SETS,
+   DESCRIPTOR_MODEL_BUFFER,
+   DESCRIPTOR_MODEL_PUSH,
+};
+static const char *descriptor_model_names[] = { "sets", "buffer", "push" };
+static enum descriptor_model descriptor_model;
+static bool enable_descriptor_buffer;
+static bool enable_push_descriptor;
+static uint32_t requested_descriptor_models;
+static VkPhysicalDeviceDescriptorBufferPropertiesEXT desc_buffer_props;
+static VkBuffer desc_buffer;
+static VkDeviceMemory desc_buffer_mem;
+static VkDeviceAddress desc_buffer_addr;
+static double bind_time;
 static VkDeviceMemory ubo_mem;
 static VkDeviceMemory vertex_mem;
 static VkBuffer ubo_buffer;
@@ -109,44 +631,135 @@ static VkDeviceMemory preprocess_mem;
 static VkBuffer preprocess_buffer;
 static VkDeviceSize preprocess_size;
 static VkDeviceAddress preprocess_addr;
+static indirect_data *indirect_map;
+static uint32_t max_sequence_count;
+static uint32_t sequence_count;
+
+/* trace record and replay */
+static const char *record_file;
+static struct trace_writer trace_writer;
+static struct trace replay_trace;
+static bool replaying;
+static uint32_t replay_frame;
+static VkBuffer replay_buffer;
+static VkDeviceMemory replay_mem;
+static VkDeviceAddress replay_addr;
+
+/* live control socket and shared memory stats */
+static const char *control_path;
+static const char *stats_name;
+static struct control_server control;
+static struct stats_writer stats;
+static char *control_capture_file;
+static char *control_trace_file;
+static bool control_quit;
+
+/*
+ * A/B runner: the configuration is run ab_runs times and every run's frame
+ * times kept, to be summarized with bootstrapped intervals and saved for
+ * -ab-compare, which tells whether another build or configuration
+ * regressed against it.
+ */
+static unsigned ab_runs;
+static const char *ab_output;
+static const char *ab_inputs[2];
+static double ab_threshold = 0.01;
+/* where run() hands its frame times while the runner collects them */
+static struct ab_set *ab_collect;
+
+/* streaming */
+#define STREAM_GENERATIONS 3
+static bool use_streaming;
+static uint32_t transfer_family;
+static VkQueue transfer_queue;
+static VkCommandPool transfer_cmd_pool;
+static VkSemaphore transfer_timeline, graphics_timeline;
+static uint64_t transfer_value, graphics_value;
+static VkDeviceMemory staging_mem;
+static VkBuffer staging_buffer;
+static uint8_t *staging_map;
+static VkDeviceSize staging_slot_size;
 
-static PFN_vkCreateIndirectCommandsLayoutEXT CreateIndirectCommandsLayoutEXT;
-static PFN_vkCreateIndirectExecutionSetEXT CreateIndirectExecutionSetEXT;
-static PFN_vkUpdateIndirectExecutionSetPipelineEXT UpdateIndirectExecutionSetPipelineEXT;
-static PFN_vkUpdateIndirectExecutionSetShaderEXT UpdateIndirectExecutionSetShaderEXT;
-static PFN_vkGetGeneratedCommandsMemoryRequirementsEXT GetGeneratedCommandsMemoryRequirementsEXT;
-static PFN_vkCmdExecuteGeneratedCommandsEXT CmdExecuteGeneratedCommandsEXT;
+struct {
+   VkBuffer vertex_buffer;
+   VkDeviceMemory vertex_mem;
+   VkBuffer indirect_buffer;
+   VkDeviceMemory indirect_mem;
+   VkDeviceAddress indirect_addr;
+   VkCommandBuffer cmd_buffer;
+   uint64_t serial;
+   uint64_t upload_value;
+   uint64_t last_use;
+   double submit_time;
+   bool completed;
+} stream_gen[STREAM_GENERATIONS];
+
+static struct {
+   unsigned current;
+   unsigned next;
+   uint64_t serial;
+   unsigned uploads;
+   unsigned stalls;
+   VkDeviceSize bytes;
+   double latency;
+} stream;
 
 static VkShaderEXT vs_shaders[3];
 static VkShaderEXT fs_shader;
 static bool use_shader_object;
-static PFN_vkCreateShadersEXT CreateShadersEXT;
-static PFN_vkCmdBindShadersEXT CmdBindShadersEXT;
-static PFN_vkCmdSetVertexInputEXT CmdSetVertexInputEXT;
-static PFN_vkCmdSetPolygonModeEXT CmdSetPolygonModeEXT;
-static PFN_vkCmdSetRasterizationSamplesEXT CmdSetRasterizationSamplesEXT;
-static PFN_vkCmdSetLogicOpEnableEXT CmdSetLogicOpEnableEXT;
-static PFN_vkCmdSetAlphaToCoverageEnableEXT CmdSetAlphaToCoverageEnableEXT;
-static PFN_vkCmdSetAlphaToOneEnableEXT CmdSetAlphaToOneEnableEXT;
-static PFN_vkCmdSetDepthClampEnableEXT CmdSetDepthClampEnableEXT;
-static PFN_vkCmdSetSampleMaskEXT CmdSetSampleMaskEXT;
-static PFN_vkCmdSetColorWriteMaskEXT CmdSetColorWriteMaskEXT;
-static PFN_vkCmdSetColorBlendEnableEXT CmdSetColorBlendEnableEXT;
-
-static PFN_vkCmdSetPrimitiveTopologyEXT CmdSetPrimitiveTopologyEXT;
-static PFN_vkCmdSetPrimitiveRestartEnableEXT CmdSetPrimitiveRestartEnableEXT;
-static PFN_vkCmdSetRasterizerDiscardEnableEXT CmdSetRasterizerDiscardEnableEXT;
-static PFN_vkCmdSetCullModeEXT CmdSetCullModeEXT;
-static PFN_vkCmdSetFrontFaceEXT CmdSetFrontFaceEXT;
-static PFN_vkCmdSetDepthTestEnableEXT CmdSetDepthTestEnableEXT;
-static PFN_vkCmdSetDepthWriteEnableEXT CmdSetDepthWriteEnableEXT;
-static PFN_vkCmdSetDepthCompareOpEXT CmdSetDepthCompareOpEXT;
-static PFN_vkCmdSetDepthBoundsTestEnableEXT CmdSetDepthBoundsTestEnableEXT;
+static bool enable_shader_object;
 
-struct {
+/* the vertex range of each scene shape in the vertex buffer */
+static struct mesh {
    uint32_t first_vertex;
    uint32_t vertex_count;
-} gears[3];
+} *meshes;
+static unsigned total_verts;
+
+static struct scene scene;
+static const char *scene_file;
+static const char *scene_export;
+static VkBuffer gear_buffer;
+static VkDeviceMemory gear_mem;
+
+/*
+ * Gears sorted by (shape, material). Every gear is drawn through its slot in
+ * this order; with instancing, each group of gears sharing a mesh and a
+ * material is one sequence covering all of its slots.
+ */
+static struct gear_group {
+   uint32_t shape;
+   uint32_t material;
+   uint32_t first;
+   uint32_t count;
+} *groups;
+static uint32_t group_count;
+static uint32_t *instance_gears;
+static bool use_instancing;
+static VkBuffer instance_buffer;
+static VkDeviceMemory instance_mem;
+
+/* per-gear angles, ticked on the CPU into a staging slice per frame */
+static struct kinematics kinematics;
+static unsigned kinematics_threads;
+static VkBuffer angle_buffer;
+static VkDeviceMemory angle_mem;
+static VkBuffer angle_staging;
+static VkDeviceMemory angle_staging_mem;
+static uint8_t *angle_staging_map;
+static VkDeviceSize angle_size;
+static double tick_time;
+static VkDeviceSize anim_bytes;
+
+/* -gpu-animation: a compute pass derives the angles from the frame angle */
+static bool gpu_animation;
+static VkDescriptorSetLayout anim_set_layout;
+static VkPipelineLayout anim_pipeline_layout;
+static VkPipeline anim_pipeline;
+static VkDescriptorPool anim_desc_pool;
+static VkDescriptorSet anim_descriptor_set;
+static VkBuffer anim_buffer;
+static VkDeviceMemory anim_mem;
 
 static float view_rot[] = { 20.0, 30.0};
 static bool animate = true;
@@ -176,6 +789,9 @@ current_time(void)
    return (double) tv.tv_sec + tv.tv_usec / 1000000.0;
 }
 
+static uint32_t physical_device_count;
+static VkPhysicalDevice *physical_devices;
+
 static void
 init_vk(const char *extension)
 {
@@ -199,15 +815,161 @@ init_vk(const char *extension)
    if (res != VK_SUCCESS)
       error("Failed to create Vulkan instance.\n");
 
-   uint32_t count;
-   res = vkEnumeratePhysicalDevices(instance, &count, NULL);
-   if (res != VK_SUCCESS || count == 0)
+   res = vkEnumeratePhysicalDevices(instance, &physical_device_count, NULL);
+   if (res != VK_SUCCESS || physical_device_count == 0)
       error("No Vulkan devices found.\n");
 
-   VkPhysicalDevice pd[count];
-   res = vkEnumeratePhysicalDevices(instance, &count, pd);
+   physical_devices = calloc(physical_device_count, sizeof(VkPhysicalDevice));
+   if (!physical_devices)
+      error("Failed to allocate memory");
+   res = vkEnumeratePhysicalDevices(instance, &physical_device_count, physical_devices);
    assert(res == VK_SUCCESS);
-   physical_device = pd[0];
+}
+
+static void
+format_uuid(char out[33], const uint8_t uuid[VK_UUID_SIZE])
+{
+   for (unsigned i = 0; i < VK_UUID_SIZE; i++)
+      snprintf(out + 2 * i, 3, "%02x", uuid[i]);
+}
+
+static void
+get_device_uuid(VkPhysicalDevice pd, char out[33])
+{
+   VkPhysicalDeviceIDProperties id_props = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+   };
+   vkGetPhysicalDeviceProperties2(pd,
+      &(VkPhysicalDeviceProperties2) {
+         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+         .pNext = &id_props,
+      });
+   format_uuid(out, id_props.deviceUUID);
+}
+
+/*
+ * Pick a physical device by index, by UUID (with or without dashes) or by a
+ * substring of its name.
+ */
+static VkPhysicalDevice
+select_physical_device(const char *selector)
+{
+   if (!selector)
+      return physical_devices[0];
+
+   char *end;
+   long index = strtol(selector, &end, 10);
+   if (end != selector && *end == '\0') {
+      if (index < 0 || index >= physical_device_count)
+         error("Device index %ld out of range (%u devices)", index,
+               physical_device_count);
+      return physical_devices[index];
+   }
+
+   char uuid[33];
+   unsigned len = 0;
+   for (const char *c = selector; *c && len < 32; c++) {
+      if (*c != '-')
+         uuid[len++] = tolower(*c);
+   }
+   uuid[len] = '\0';
+
+   for (uint32_t i = 0; i < physical_device_count; i++) {
+      char device_uuid[33];
+      get_device_uuid(physical_devices[i], device_uuid);
+      if (len == 32 && strcmp(uuid, device_uuid) == 0)
+         return physical_devices[i];
+   }
+
+   for (uint32_t i = 0; i < physical_device_count; i++) {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(physical_devices[i], &properties);
+      if (strstr(properties.deviceName, selector))
+         return physical_devices[i];
+   }
+
+   error("No Vulkan device matches '%s'", selector);
+   return VK_NULL_HANDLE;
+}
+
+static bool
+device_supports_extension(VkPhysicalDevice pd, const char *name)
+{
+   uint32_t count = 0;
+   vkEnumerateDeviceExtensionProperties(pd, NULL, &count, NULL);
+   VkExtensionProperties *extensions = calloc(count, sizeof(VkExtensionProperties));
+   if (!extensions)
+      error("Failed to allocate memory");
+   vkEnumerateDeviceExtensionProperties(pd, NULL, &count, extensions);
+
+   bool found = false;
+   for (uint32_t i = 0; i < count && !found; i++)
+      found = strcmp(extensions[i].extensionName, name) == 0;
+   free(extensions);
+   return found;
+}
+
+/* frames are timed only when the graphics queue has timestamps */
+static void
+init_gpu_timer(void)
+{
+   uint32_t count;
+   vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, NULL);
+   VkQueueFamilyProperties families[count];
+   vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, families);
+   uint32_t valid_bits = families[0].timestampValidBits;
+   memset(timer_pending, 0, sizeof(timer_pending));
+   if (valid_bits == 0)
+      return;
+   timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+   VkPhysicalDeviceProperties properties;
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+   timestamp_period = properties.limits.timestampPeriod;
+
+   vkCreateQueryPool(device,
+      &(VkQueryPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+         .queryType = VK_QUERY_TYPE_TIMESTAMP,
+         .queryCount = TIMER_QUERIES * MAX_CONCURRENT_FRAMES,
+      },
+      NULL,
+      &timer_pool);
+}
+
+/* the fragment shader invocations of every frame, to tell the overdraw */
+static void
+init_overdraw_query(void)
+{
+   memset(overdraw_pending, 0, sizeof(overdraw_pending));
+   vkCreateQueryPool(device,
+      &(VkQueryPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+         .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+         .queryCount = MAX_CONCURRENT_FRAMES,
+         .pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+      },
+      NULL,
+      &overdraw_pool);
+}
+
+static PFN_vkVoidFunction
+load_device_entry_point(void *data, const char *name)
+{
+   return vkGetDeviceProcAddr(device, name);
+}
+
+static PFN_vkVoidFunction
+load_loader_entry_point(void *data, const char *name)
+{
+   return vkGetInstanceProcAddr(instance, name);
+}
+
+static void
+init_device(void)
+{
+   VkResult res;
+   uint32_t count;
 
    vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
 
@@ -217,59 +979,142 @@ init_vk(const char *extension)
    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, props);
    assert(props[0].queueFlags & VK_QUEUE_GRAPHICS_BIT);
 
+   /* prefer a transfer-only family (DMA engine), then an async compute one */
+   transfer_family = 0;
+   if (use_streaming) {
+      for (uint32_t i = 1; i < count; i++) {
+         VkQueueFlags flags = props[i].queueFlags;
+         if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+             !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            transfer_family = i;
+            break;
+         }
+      }
+      for (uint32_t i = 1; i < count && !transfer_family; i++) {
+         if (!(props[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+             (props[i].queueFlags & VK_QUEUE_COMPUTE_BIT))
+            transfer_family = i;
+      }
+      if (!transfer_family)
+         printf("no dedicated transfer queue, streaming on the graphics queue\n");
+   }
+
+   const char *extensions[11];
+   uint32_t extension_count = 0;
+   extensions[extension_count++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+   extensions[extension_count++] = VK_EXT_DEVICE_GENERATED_COMMANDS_EXTENSION_NAME;
+   extensions[extension_count++] = VK_KHR_MAINTENANCE_5_EXTENSION_NAME;
+   if (enable_shader_object)
+      extensions[extension_count++] = VK_EXT_SHADER_OBJECT_EXTENSION_NAME;
+   if (enable_descriptor_buffer)
+      extensions[extension_count++] = VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME;
+   if (enable_push_descriptor)
+      extensions[extension_count++] = VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME;
+   if (enable_incremental_present)
+      extensions[extension_count++] = VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME;
+   if (rt_shadows) {
+      extensions[extension_count++] = VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME;
+      extensions[extension_count++] = VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME;
+      extensions[extension_count++] = VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME;
+      extensions[extension_count++] = VK_KHR_RAY_TRACING_MAINTENANCE_1_EXTENSION_NAME;
+   }
+
+   VkPhysicalDeviceDescriptorBufferFeaturesEXT descbuf = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+      .descriptorBuffer = VK_TRUE
+   };
+
    VkPhysicalDeviceShaderObjectFeaturesEXT shobj = {
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT,
+      enable_descriptor_buffer ? &descbuf : NULL,
       .shaderObject = VK_TRUE
    };
 
    VkPhysicalDeviceVulkan13Features feats13 = {
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
-      use_shader_object ? &shobj : NULL,
+      enable_shader_object ? (void *)&shobj :
+      enable_descriptor_buffer ? (void *)&descbuf : NULL,
       .dynamicRendering = VK_TRUE
    };
 
    VkPhysicalDeviceVulkan12Features feats12 = {
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
       .pNext = &feats13,
-      .bufferDeviceAddress = VK_TRUE
+      .bufferDeviceAddress = VK_TRUE,
+      .timelineSemaphore = use_streaming,
+      /* the software rasterizer's depth and color go in one atomic */
+      .shaderBufferInt64Atomics = swr_threshold > 0.0f,
+   };
+   /* required since 1.1, and the gear shaders read gl_ViewIndex */
+   VkPhysicalDeviceVulkan11Features feats11 = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
+      .pNext = &feats12,
+      .multiview = VK_TRUE,
    };
    VkPhysicalDeviceMaintenance5FeaturesKHR maintfeats = {
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAINTENANCE_5_FEATURES_KHR,
-      .pNext = &feats12,
+      .pNext = &feats11,
       .maintenance5 = VK_TRUE
    };
 
+   /* the shadows trace through a generated VkTraceRaysIndirectCommand2KHR */
+   VkPhysicalDeviceAccelerationStructureFeaturesKHR asfeats = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+      .pNext = &maintfeats,
+      .accelerationStructure = VK_TRUE,
+   };
+   VkPhysicalDeviceRayTracingPipelineFeaturesKHR rtfeats = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR,
+      .pNext = &asfeats,
+      .rayTracingPipeline = VK_TRUE,
+   };
+   VkPhysicalDeviceRayTracingMaintenance1FeaturesKHR rtmaintfeats = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_MAINTENANCE_1_FEATURES_KHR,
+      .pNext = &rtfeats,
+      .rayTracingMaintenance1 = VK_TRUE,
+      .rayTracingPipelineTraceRaysIndirect2 = VK_TRUE,
+   };
+
    VkPhysicalDeviceDeviceGeneratedCommandsFeaturesEXT dgcfeats = {
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DEVICE_GENERATED_COMMANDS_FEATURES_EXT,
-      .pNext = &maintfeats,
+      .pNext = rt_shadows ? (void *)&rtmaintfeats : (void *)&maintfeats,
       .deviceGeneratedCommands = VK_TRUE
    };
+   VkPhysicalDeviceFeatures supported;
+   vkGetPhysicalDeviceFeatures(physical_device, &supported);
+   bool overdraw_query = sort_enabled && supported.pipelineStatisticsQuery;
    VkPhysicalDeviceFeatures2 feats2 = {
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
       &dgcfeats,
       .features = {
          .multiDrawIndirect = VK_TRUE,
+         .pipelineStatisticsQuery = overdraw_query,
+         .shaderInt64 = swr_threshold > 0.0f,
       }
    };
    res = vkCreateDevice(physical_device,
       &(VkDeviceCreateInfo) {
          .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
          .pNext = &feats2,
-         .queueCreateInfoCount = 1,
-         .pQueueCreateInfos = &(VkDeviceQueueCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = 0,
-            .queueCount = 1,
-            .flags = 0,
-            .pQueuePriorities = (float []) { 1.0f },
-         },
-         .enabledExtensionCount = use_shader_object ? 4 : 3,
-         .ppEnabledExtensionNames = (const char * const []) {
-            VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-            VK_EXT_DEVICE_GENERATED_COMMANDS_EXTENSION_NAME,
-            VK_KHR_MAINTENANCE_5_EXTENSION_NAME,
-            VK_EXT_SHADER_OBJECT_EXTENSION_NAME,
+         .queueCreateInfoCount = transfer_family ? 2 : 1,
+         .pQueueCreateInfos = (VkDeviceQueueCreateInfo[]) {
+            {
+               .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+               .queueFamilyIndex = 0,
+               .queueCount = 1,
+               .flags = 0,
+               .pQueuePriorities = (float []) { 1.0f },
+            },
+            {
+               .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+               .queueFamilyIndex = transfer_family,
+               .queueCount = 1,
+               .flags = 0,
+               .pQueuePriorities = (float []) { 1.0f },
+            },
          },
+         .enabledExtensionCount = extension_count,
+         .ppEnabledExtensionNames = extensions,
       },
       NULL,
       &device);
@@ -277,6 +1122,9 @@ init_vk(const char *extension)
    if (res != VK_SUCCESS)
       error("Failed to create Vulkan device.\n");
 
+   vk_entry_points = vk_load_device_dispatch(&vk,
+      loader_dispatch ? load_loader_entry_point : load_device_entry_point, NULL);
+
    vkGetDeviceQueue2(device,
       &(VkDeviceQueueInfo2) {
          .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_INFO_2,
@@ -286,6 +1134,18 @@ init_vk(const char *extension)
       },
       &queue);
 
+   transfer_queue = queue;
+   if (transfer_family) {
+      vkGetDeviceQueue2(device,
+         &(VkDeviceQueueInfo2) {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_INFO_2,
+            .flags = 0,
+            .queueFamilyIndex = transfer_family,
+            .queueIndex = 0,
+         },
+         &transfer_queue);
+   }
+
    vkCreateCommandPool(device,
       &(const VkCommandPoolCreateInfo) {
          .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -301,37 +1161,55 @@ init_vk(const char *extension)
       },
       NULL,
       &present_semaphore);
-   
-   CreateIndirectCommandsLayoutEXT = (void*)vkGetDeviceProcAddr(device, "vkCreateIndirectCommandsLayoutEXT");
-   CreateIndirectExecutionSetEXT = (void*)vkGetDeviceProcAddr(device, "vkCreateIndirectExecutionSetEXT");
-   UpdateIndirectExecutionSetPipelineEXT = (void*)vkGetDeviceProcAddr(device, "vkUpdateIndirectExecutionSetPipelineEXT");
-   UpdateIndirectExecutionSetShaderEXT = (void*)vkGetDeviceProcAddr(device, "vkUpdateIndirectExecutionSetShaderEXT");
-   GetGeneratedCommandsMemoryRequirementsEXT = (void*)vkGetDeviceProcAddr(device, "vkGetGeneratedCommandsMemoryRequirementsEXT");
-   CmdExecuteGeneratedCommandsEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdExecuteGeneratedCommandsEXT");
-
-   CreateShadersEXT  = (void*)vkGetDeviceProcAddr(device, "vkCreateShadersEXT");
-   CmdBindShadersEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdBindShadersEXT");
-   CmdSetVertexInputEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetVertexInputEXT");
-   CmdSetPolygonModeEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetPolygonModeEXT");
-   CmdSetRasterizationSamplesEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetRasterizationSamplesEXT");
-   CmdSetLogicOpEnableEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetLogicOpEnableEXT");
-   CmdSetAlphaToCoverageEnableEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetAlphaToCoverageEnableEXT");
-   CmdSetAlphaToOneEnableEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetAlphaToOneEnableEXT");
-   CmdSetDepthClampEnableEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetDepthClampEnableEXT");
-   CmdSetSampleMaskEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetSampleMaskEXT");
-   CmdSetColorWriteMaskEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetColorWriteMaskEXT");
-   CmdSetColorBlendEnableEXT  = (void*)vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEnableEXT");
-
-
-   CmdSetPrimitiveTopologyEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdSetPrimitiveTopologyEXT");
-   CmdSetPrimitiveRestartEnableEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdSetPrimitiveRestartEnableEXT");
-   CmdSetRasterizerDiscardEnableEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdSetRasterizerDiscardEnableEXT");
-   CmdSetCullModeEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdSetCullModeEXT");
-   CmdSetFrontFaceEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdSetFrontFaceEXT");
-   CmdSetDepthTestEnableEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdSetDepthTestEnableEXT");
-   CmdSetDepthWriteEnableEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdSetDepthWriteEnableEXT");
-   CmdSetDepthCompareOpEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdSetDepthCompareOpEXT");
-   CmdSetDepthBoundsTestEnableEXT = (void*)vkGetDeviceProcAddr(device, "vkCmdSetDepthBoundsTestEnableEXT");
+
+   for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; ++i) {
+      vkCreateFence(device,
+         &(VkFenceCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            .flags = VK_FENCE_CREATE_SIGNALED_BIT
+         },
+         NULL,
+         &frame_data[i].fence);
+
+      vkAllocateCommandBuffers(device,
+         &(VkCommandBufferAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = cmd_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+         },
+         &frame_data[i].cmd_buffer);
+   }
+
+   if (enable_descriptor_buffer) {
+      desc_buffer_props = (VkPhysicalDeviceDescriptorBufferPropertiesEXT) {
+         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT,
+      };
+      vkGetPhysicalDeviceProperties2(physical_device,
+         &(VkPhysicalDeviceProperties2) {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            &desc_buffer_props,
+         });
+   }
+
+   if (rt_shadows) {
+      rt_as_props = (VkPhysicalDeviceAccelerationStructurePropertiesKHR) {
+         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR,
+      };
+      rt_pipeline_props = (VkPhysicalDeviceRayTracingPipelinePropertiesKHR) {
+         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
+         &rt_as_props,
+      };
+      vkGetPhysicalDeviceProperties2(physical_device,
+         &(VkPhysicalDeviceProperties2) {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            &rt_pipeline_props,
+         });
+   }
+
+   init_gpu_timer();
+   if (overdraw_query)
+      init_overdraw_query();
 }
 
 static int
@@ -371,6 +1249,7 @@ image_allocate(VkImage image, VkMemoryRequirements reqs, int memory_type, VkDevi
 static int
 create_image(VkFormat format,
              VkExtent3D extent,
+             uint32_t layers,
              VkSampleCountFlagBits samples,
              VkImageUsageFlags usage,
              VkImage *image)
@@ -383,7 +1262,7 @@ create_image(VkFormat format,
          .format = format,
          .extent = extent,
          .mipLevels = 1,
-         .arrayLayers = 1,
+         .arrayLayers = layers,
          .samples = samples,
          .tiling = VK_IMAGE_TILING_OPTIMAL,
          .usage = usage,
@@ -400,13 +1279,15 @@ static int
 create_image_view(VkImage image,
                   VkFormat view_format,
                   VkImageAspectFlags aspect_mask,
+                  uint32_t base_layer,
+                  uint32_t layers,
                   VkImageView *image_view)
 {
    int res = vkCreateImageView(device,
       &(VkImageViewCreateInfo) {
          .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
          .image = image,
-         .viewType = VK_IMAGE_VIEW_TYPE_2D,
+         .viewType = layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D,
          .format = view_format,
          .components = {
             .r = VK_COMPONENT_SWIZZLE_R,
@@ -418,8 +1299,8 @@ create_image_view(VkImage image,
             .aspectMask = aspect_mask,
             .baseMipLevel = 0,
             .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1,
+            .baseArrayLayer = base_layer,
+            .layerCount = layers,
          },
       },
       NULL,
@@ -430,53 +1311,170 @@ create_image_view(VkImage image,
    return 0;
 }
 
+/*
+ * The scene goes through a separate render target when it is scaled or
+ * split into views, and is then blitted into the swapchain image.
+ */
+static bool
+render_offscreen(void)
+{
+   return dynamic_res_target > 0.0f || view_count > 1;
+}
+
+/* the depth is stored to build the pyramid from or to start the shadow rays on */
+static bool
+depth_sampled(void)
+{
+   return hiz_cull || rt_shadows;
+}
+
+/* all views in one pass through the view mask, or a pass each */
+static uint32_t
+pass_view_mask(void)
+{
+   if (view_count > 1 && multiview_mode == MULTIVIEW_PASS)
+      return (1u << view_count) - 1;
+   return 0;
+}
+
+/* the views are tiled over the window in a grid as square as possible */
+static void
+view_grid(unsigned *cols, unsigned *rows)
+{
+   *cols = 1;
+   while (*cols * *cols < view_count)
+      (*cols)++;
+   *rows = (view_count + *cols - 1) / *cols;
+}
+
+static void
+view_extent(const struct window *win, int *w, int *h)
+{
+   unsigned cols, rows;
+   view_grid(&cols, &rows);
+   *w = win->width / (int)cols;
+   *h = win->height / (int)rows;
+   if (*w < 1)
+      *w = 1;
+   if (*h < 1)
+      *h = 1;
+}
+
+/* check the upscaling blit and the GPU timer the controller depends on */
+static void
+configure_render_target(void)
+{
+   VkFormatProperties props;
+   vkGetPhysicalDeviceFormatProperties(physical_device, image_format, &props);
+   VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                 VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                 VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+   if ((props.optimalTilingFeatures & needed) != needed)
+      error("Swapchain format cannot be upscaled with a linear blit");
+   if (dynamic_res_target > 0.0f && !timer_pool)
+      error("Queue has no timestamp support");
+}
+
+static bool
+check_depth_mode_support(enum depth_mode mode)
+{
+   if (mode == DEPTH_AUTO)
+      return true;
+
+   VkFormatProperties props;
+   vkGetPhysicalDeviceFormatProperties(physical_device, depth_mode_formats[mode], &props);
+   return props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+}
+
+static const char *
+depth_format_name(VkFormat format)
+{
+   for (unsigned i = DEPTH_D16; i < ARRAY_SIZE(depth_mode_formats); i++) {
+      if (depth_mode_formats[i] == format)
+         return depth_mode_names[i];
+   }
+   return "?";
+}
+
+/*
+ * The first window picks the color and depth formats; every other window
+ * has to offer the same color format, so that all of them can share the
+ * gear pipelines and the resolve pipeline.
+ */
 static void
-configure_swapchain()
+configure_swapchain(struct window *win)
 {
    VkSurfaceCapabilitiesKHR surface_caps;
-   vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface,
+   vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, win->surface,
                                              &surface_caps);
    assert(surface_caps.supportedCompositeAlpha &
           VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR);
 
    VkBool32 supported;
-   vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, 0, surface,
+   vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, 0, win->surface,
                                         &supported);
    assert(supported);
 
    uint32_t count;
-   vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface,
+   vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, win->surface,
                                              &count, NULL);
    VkPresentModeKHR present_modes[count];
-   vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface,
+   vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, win->surface,
                                              &count, present_modes);
    int i;
-   present_mode = VK_PRESENT_MODE_FIFO_KHR;
+   win->present_mode = VK_PRESENT_MODE_FIFO_KHR;
    for (i = 0; i < count; i++) {
       if (present_modes[i] == desidered_present_mode) {
-         present_mode = desidered_present_mode;
+         win->present_mode = desidered_present_mode;
          break;
       }
    }
 
-   min_image_count = 2;
-   if (min_image_count < surface_caps.minImageCount) {
-      if (surface_caps.minImageCount > ARRAY_SIZE(image_data))
+   win->swapchain_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+   if (capture_at && win == &windows[0]) {
+      if (!(surface_caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+         error("Swapchain images cannot be captured");
+      win->swapchain_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+   } else if (control_path && win == &windows[0] &&
+              (surface_caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+      /* captures may be asked for over the control socket */
+      win->swapchain_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+   }
+   if (render_offscreen() ||
+       (sample_count != VK_SAMPLE_COUNT_1_BIT && resolve_mode == RESOLVE_CMD)) {
+      if (!(surface_caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+         error("Swapchain images cannot be blitted or resolved to");
+      win->swapchain_usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+   }
+
+   win->min_image_count = desired_image_count;
+   if (win->min_image_count < surface_caps.minImageCount) {
+      if (surface_caps.minImageCount > ARRAY_SIZE(win->image_data))
           error("surface_caps.minImageCount is too large (is: %d, max: %d)",
-                surface_caps.minImageCount, ARRAY_SIZE(image_data));
-      min_image_count = surface_caps.minImageCount;
+                surface_caps.minImageCount, ARRAY_SIZE(win->image_data));
+      win->min_image_count = surface_caps.minImageCount;
    }
 
    if (surface_caps.maxImageCount > 0 &&
-       min_image_count > surface_caps.maxImageCount) {
-      min_image_count = surface_caps.maxImageCount;
+       win->min_image_count > surface_caps.maxImageCount) {
+      win->min_image_count = surface_caps.maxImageCount;
    }
 
-   vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface,
+   vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, win->surface,
                                         &count, NULL);
    VkSurfaceFormatKHR surface_formats[count];
-   vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface,
+   vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, win->surface,
                                         &count, surface_formats);
+   if (win != &windows[0]) {
+      for (i = 0; i < count; i++) {
+         if (surface_formats[i].format == image_format &&
+             surface_formats[i].colorSpace == color_space)
+            return;
+      }
+      error("Window %u does not support the format of the first window",
+            (unsigned)(win - windows));
+   }
+
    image_format = surface_formats[0].format;
    color_space = surface_formats[0].colorSpace;
    for (i = 0; i < count; i++) {
@@ -488,111 +1486,338 @@ configure_swapchain()
       }
    }
 
-   // either VK_FORMAT_D32_SFLOAT or VK_FORMAT_X8_D24_UNORM_PACK32 needs to be supported; find out which one
-   VkFormatProperties props;
-   vkGetPhysicalDeviceFormatProperties(physical_device, VK_FORMAT_D32_SFLOAT, &props);
-   depth_format = (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) ?
-      VK_FORMAT_D32_SFLOAT : VK_FORMAT_X8_D24_UNORM_PACK32;
+   if (depth_mode == DEPTH_AUTO) {
+      // either VK_FORMAT_D32_SFLOAT or VK_FORMAT_X8_D24_UNORM_PACK32 needs to be supported; find out which one
+      VkFormatProperties props;
+      vkGetPhysicalDeviceFormatProperties(physical_device, VK_FORMAT_D32_SFLOAT, &props);
+      depth_format = (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) ?
+         VK_FORMAT_D32_SFLOAT : VK_FORMAT_X8_D24_UNORM_PACK32;
+   } else {
+      if (!check_depth_mode_support(depth_mode))
+         error("Depth format %s not supported", depth_mode_names[depth_mode]);
+      depth_format = depth_mode_formats[depth_mode];
+   }
+
+   if (depth_sampled()) {
+      VkFormatProperties props;
+      vkGetPhysicalDeviceFormatProperties(physical_device, depth_format, &props);
+      if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+         error("Depth format %s cannot be sampled for %s",
+               depth_format_name(depth_format), hiz_cull ? "culling" : "shadows");
+   }
+
+   if (render_offscreen())
+      configure_render_target();
 }
 
+/* the part of each layer of the render target used at the current scale */
 static void
-create_swapchain()
+set_render_extent(struct window *win)
 {
-   vkCreateSwapchainKHR(device,
-      &(VkSwapchainCreateInfoKHR) {
-         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-         .flags = 0,
-         .surface = surface,
-         .minImageCount = min_image_count,
-         .imageFormat = image_format,
-         .imageColorSpace = color_space,
-         .imageExtent = { width, height },
-         .imageArrayLayers = 1,
-         .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+   int w, h;
+   view_extent(win, &w, &h);
+   win->render_width = (int)(win->res_scale * w + 0.5f);
+   win->render_height = (int)(win->res_scale * h + 0.5f);
+   if (win->render_width < 1)
+      win->render_width = 1;
+   if (win->render_height < 1)
+      win->render_height = 1;
+   if (win->render_width > win->target_width)
+      win->render_width = win->target_width;
+   if (win->render_height > win->target_height)
+      win->render_height = win->target_height;
+}
+
+/*
+ * Size the render target for the largest scale and create the single-sample
+ * color image, with a layer per view, the scene resolves into before it is
+ * blitted to the swapchain.
+ */
+static void
+init_render_target(struct window *win)
+{
+   VkPhysicalDeviceProperties properties;
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+   uint32_t max_dim = properties.limits.maxImageDimension2D;
+
+   int w, h;
+   view_extent(win, &w, &h);
+   float max_scale = dynamic_res_target > 0.0f ? dynamic_res_max : 1.0f;
+   win->target_width = (int)ceilf(max_scale * w);
+   win->target_height = (int)ceilf(max_scale * h);
+   if ((uint32_t)win->target_width > max_dim)
+      win->target_width = max_dim;
+   if ((uint32_t)win->target_height > max_dim)
+      win->target_height = max_dim;
+
+   int res = create_image(image_format,
+      (VkExtent3D) {
+         .width = win->target_width,
+         .height = win->target_height,
+         .depth = 1,
+      },
+      view_count,
+      VK_SAMPLE_COUNT_1_BIT,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+      (resolve_mode == RESOLVE_CMD ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0),
+      &win->res_color);
+   if (res)
+      error("Failed to create the render target");
+
+   VkMemoryRequirements reqs;
+   vkGetImageMemoryRequirements(device, win->res_color, &reqs);
+   int memory_type = find_memory_type(&reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   if (memory_type < 0)
+      error("find_memory_type failed");
+   if (image_allocate(win->res_color, reqs, memory_type, &win->res_color_memory))
+      error("Failed to allocate memory for the render target");
+   if (create_image_view(win->res_color, image_format, VK_IMAGE_ASPECT_COLOR_BIT,
+                         0, view_count, &win->res_color_view))
+      error("Failed to create the image view for the render target");
+
+   /* a pass per view renders into one layer at a time */
+   for (unsigned i = 0; i < view_count && !pass_view_mask(); i++) {
+      if (create_image_view(win->res_color, image_format, VK_IMAGE_ASPECT_COLOR_BIT,
+                            i, 1, &win->res_layer_views[i]))
+         error("Failed to create the image view for the render target");
+   }
+}
+
+static void
+fini_render_target(struct window *win)
+{
+   for (unsigned i = 0; i < view_count && !pass_view_mask(); i++)
+      vkDestroyImageView(device, win->res_layer_views[i], NULL);
+   vkDestroyImageView(device, win->res_color_view, NULL);
+   vkDestroyImage(device, win->res_color, NULL);
+   vkFreeMemory(device, win->res_color_memory, NULL);
+}
+
+/*
+ * Bytes of an attachment actually backed by memory: lazily allocated memory
+ * is only committed when the implementation has to spill it out of tile
+ * memory, so anything above zero means the transient usage did not help.
+ */
+static VkDeviceSize
+attachment_resident(const struct attachment_memory *a)
+{
+   if (!a->memory)
+      return 0;
+   if (!a->lazy)
+      return a->size;
+
+   VkDeviceSize committed;
+   vkGetDeviceMemoryCommitment(device, a->memory, &committed);
+   return committed;
+}
+
+static void
+print_attachment(const char *name, const struct attachment_memory *a)
+{
+   const double mb = 1024.0 * 1024.0;
+   if (a->lazy)
+      printf("%s %.1f MB lazily allocated, %.1f MB committed", name,
+             a->size / mb, attachment_resident(a) / mb);
+   else
+      printf("%s %.1f MB device local", name, a->size / mb);
+}
+
+static void
+print_attachment_memory(void)
+{
+   for (unsigned w = 0; w < window_count; w++) {
+      const struct window *win = &windows[w];
+      if (window_count > 1)
+         printf("attachments (window %u): ", w);
+      else
+         printf("attachments: ");
+      char depth_name[16];
+      snprintf(depth_name, sizeof(depth_name), "depth %s", depth_format_name(depth_format));
+      print_attachment(depth_name, &win->depth_alloc);
+      if (win->color_msaa_alloc.memory) {
+         printf(", ");
+         print_attachment("msaa color", &win->color_msaa_alloc);
+         printf(", %s resolve", resolve_mode_names[resolve_mode]);
+      }
+      printf("\n");
+   }
+}
+
+/* attachment memory of all windows, as allocated and as resident */
+static void
+attachment_totals(VkDeviceSize *size, VkDeviceSize *resident)
+{
+   *size = *resident = 0;
+   for (unsigned w = 0; w < window_count; w++) {
+      *size += windows[w].depth_alloc.size + windows[w].color_msaa_alloc.size;
+      *resident += attachment_resident(&windows[w].depth_alloc) +
+                   attachment_resident(&windows[w].color_msaa_alloc);
+   }
+}
+
+static void init_shader_resolve(struct window *win);
+static void fini_shader_resolve(struct window *win);
+static void init_hiz(struct window *win);
+static void fini_hiz(struct window *win);
+static void init_hud(void);
+static void init_hud_pipelines(void);
+static void fini_hud_pipelines(void);
+static void init_rt_window(struct window *win);
+static void fini_rt_window(struct window *win);
+static void init_rt_composite_pipeline(void);
+static void fini_rt_composite_pipeline(void);
+static void init_swr_window(struct window *win);
+static void fini_swr_window(struct window *win);
+static void init_swr_resolve_pipeline(void);
+static void fini_swr_resolve_pipeline(void);
+
+static void
+create_swapchain(struct window *win)
+{
+   vkCreateSwapchainKHR(device,
+      &(VkSwapchainCreateInfoKHR) {
+         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+         .flags = 0,
+         .surface = win->surface,
+         .minImageCount = win->min_image_count,
+         .imageFormat = image_format,
+         .imageColorSpace = color_space,
+         .imageExtent = { win->width, win->height },
+         .imageArrayLayers = 1,
+         .imageUsage = win->swapchain_usage,
          .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
          .queueFamilyIndexCount = 1,
          .pQueueFamilyIndices = (uint32_t[]) { 0 },
          .preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
          .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-         .presentMode = present_mode,
-      }, NULL, &swapchain);
+         .presentMode = win->present_mode,
+      }, NULL, &win->swapchain);
+
+   vkGetSwapchainImagesKHR(device, win->swapchain,
+                           &win->image_count, NULL);
+   assert(win->image_count > 0);
+   VkImage swapchain_images[win->image_count];
+   vkGetSwapchainImagesKHR(device, win->swapchain,
+                           &win->image_count, swapchain_images);
 
-   vkGetSwapchainImagesKHR(device, swapchain,
-                           &image_count, NULL);
-   assert(image_count > 0);
-   VkImage swapchain_images[image_count];
-   vkGetSwapchainImagesKHR(device, swapchain,
-                           &image_count, swapchain_images);
 
+   if (render_offscreen()) {
+      init_render_target(win);
+   } else {
+      win->target_width = win->width;
+      win->target_height = win->height;
+   }
+   set_render_extent(win);
 
+   /* a pass per view reuses one layer of depth and samples */
+   uint32_t layers = pass_view_mask() ? view_count : 1;
    int res;
    if (sample_count != VK_SAMPLE_COUNT_1_BIT) {
-       res = create_image(image_format,
+      /* only an in-pass resolve lets the samples stay in tile memory */
+      VkImageUsageFlags msaa_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+      switch (resolve_mode) {
+      case RESOLVE_PASS:
+         msaa_usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+         break;
+      case RESOLVE_CMD:
+         msaa_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+         break;
+      case RESOLVE_SHADER:
+         msaa_usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+         break;
+      }
+      res = create_image(image_format,
          (VkExtent3D) {
-            .width = width,
-            .height = height,
+            .width = win->target_width,
+            .height = win->target_height,
             .depth = 1,
          },
+         layers,
          sample_count,
-         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
-         &color_msaa);
+         msaa_usage,
+         &win->color_msaa);
       if (res)
          error("Failed to create resolve image");
 
       VkMemoryRequirements msaa_reqs;
-      vkGetImageMemoryRequirements(device, color_msaa, &msaa_reqs);
-      int memory_type = find_memory_type(&msaa_reqs, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+      vkGetImageMemoryRequirements(device, win->color_msaa, &msaa_reqs);
+      int memory_type = -1;
+      if (msaa_usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+         memory_type = find_memory_type(&msaa_reqs, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+      win->color_msaa_alloc.lazy = memory_type >= 0;
       if (memory_type < 0) {
          memory_type = find_memory_type(&msaa_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
          if (memory_type < 0)
             error("find_memory_type failed");
       }
-      res = image_allocate(color_msaa, msaa_reqs, memory_type, &color_msaa_memory);
+      win->color_msaa_alloc.size = msaa_reqs.size;
+      res = image_allocate(win->color_msaa, msaa_reqs, memory_type,
+                           &win->color_msaa_alloc.memory);
       if (res)
          error("Failed to allocate memory for the resolve image");
 
-      res = create_image_view(color_msaa, image_format, VK_IMAGE_ASPECT_COLOR_BIT,
-                                        &color_msaa_view);
+      res = create_image_view(win->color_msaa, image_format, VK_IMAGE_ASPECT_COLOR_BIT,
+                              0, layers, &win->color_msaa_view);
 
       if (res)
          error("Failed to create the image view for the resolve image");
+
+      if (resolve_mode == RESOLVE_SHADER)
+         init_shader_resolve(win);
    }
 
    res = create_image(depth_format,
       (VkExtent3D) {
-         .width = width,
-         .height = height,
+         .width = win->target_width,
+         .height = win->target_height,
          .depth = 1,
       },
+      layers,
       sample_count,
-      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
-      &depth_image);
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+      (depth_sampled() ? VK_IMAGE_USAGE_SAMPLED_BIT : VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT),
+      &win->depth_image);
 
    if (res)
       error("Failed to create depth image");
 
+   /* the depth pyramid and the shadow rays read the stored depth */
    VkMemoryRequirements depth_reqs;
-   vkGetImageMemoryRequirements(device, depth_image, &depth_reqs);
-   int memory_type = find_memory_type(&depth_reqs, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+   vkGetImageMemoryRequirements(device, win->depth_image, &depth_reqs);
+   int memory_type = depth_sampled() ? -1 :
+      find_memory_type(&depth_reqs, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+   win->depth_alloc.lazy = memory_type >= 0;
    if (memory_type < 0) {
       memory_type = find_memory_type(&depth_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
       if (memory_type < 0)
          error("find_memory_type failed");
    }
-   res = image_allocate(depth_image, depth_reqs, memory_type, &depth_memory);
+   win->depth_alloc.size = depth_reqs.size;
+   res = image_allocate(win->depth_image, depth_reqs, memory_type,
+                        &win->depth_alloc.memory);
    if (res)
       error("Failed to allocate memory for the depth image");
 
-   res = create_image_view(depth_image,
+   res = create_image_view(win->depth_image,
       depth_format,
       VK_IMAGE_ASPECT_DEPTH_BIT,
-      &depth_view);
+      0, layers,
+      &win->depth_view);
 
    if (res)
       error("Failed to create the image view for the depth image");
 
-   for (uint32_t i = 0; i < image_count; i++) {
-      image_data[i].image = swapchain_images[i];
+   if (hiz_cull)
+      init_hiz(win);
+   if (rt_shadows)
+      init_rt_window(win);
+   if (swr_threshold > 0.0f)
+      init_swr_window(win);
+
+   for (uint32_t i = 0; i < win->image_count; i++) {
+      win->image_data[i].image = swapchain_images[i];
+      win->image_data[i].presented = false;
+      win->image_data[i].damage_serial = 0;
       vkCreateImageView(device,
          &(VkImageViewCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -614,68 +1839,146 @@ create_swapchain()
             },
          },
          NULL,
-         &image_data[i].view);
+         &win->image_data[i].view);
    }
 
    for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; ++i) {
-      vkCreateFence(device,
-         &(VkFenceCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .flags = VK_FENCE_CREATE_SIGNALED_BIT
-         },
-         NULL,
-         &frame_data[i].fence);
-
-      vkAllocateCommandBuffers(device,
-         &(VkCommandBufferAllocateInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .commandPool = cmd_pool,
-            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = 1,
-         },
-         &frame_data[i].cmd_buffer);
-
       vkCreateSemaphore(device,
          &(VkSemaphoreCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
          },
          NULL,
-         &frame_data[i].semaphore);
+         &win->acquire_semaphore[i]);
    }
+   win->suboptimal = false;
 }
 
 static void
-free_swapchain_data()
+free_swapchain_data(struct window *win)
 {
-   for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; i++) {
-      vkFreeCommandBuffers(device, cmd_pool, 1, &frame_data[i].cmd_buffer);
-      vkDestroyFence(device, frame_data[i].fence, NULL);
-      vkDestroySemaphore(device, frame_data[i].semaphore, NULL);
-   }
+   for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; i++)
+      vkDestroySemaphore(device, win->acquire_semaphore[i], NULL);
 
-   for (uint32_t i = 0; i < image_count; i++) {
-      vkDestroyImageView(device, image_data[i].view, NULL);
+   for (uint32_t i = 0; i < win->image_count; i++) {
+      vkDestroyImageView(device, win->image_data[i].view, NULL);
    }
 
-   vkDestroyImageView(device, depth_view, NULL);
-   vkDestroyImage(device, depth_image, NULL);
-   vkFreeMemory(device, depth_memory, NULL);
+   if (hiz_cull)
+      fini_hiz(win);
+   if (rt_shadows)
+      fini_rt_window(win);
+   if (swr_threshold > 0.0f)
+      fini_swr_window(win);
+   vkDestroyImageView(device, win->depth_view, NULL);
+   vkDestroyImage(device, win->depth_image, NULL);
+   vkFreeMemory(device, win->depth_alloc.memory, NULL);
 
    if (sample_count != VK_SAMPLE_COUNT_1_BIT) {
-      vkDestroyImageView(device, color_msaa_view, NULL);
-      vkDestroyImage(device, color_msaa, NULL);
-      vkFreeMemory(device, color_msaa_memory, NULL);
+      vkDestroyImageView(device, win->color_msaa_view, NULL);
+      vkDestroyImage(device, win->color_msaa, NULL);
+      vkFreeMemory(device, win->color_msaa_alloc.memory, NULL);
+      win->color_msaa_alloc = (struct attachment_memory) { 0 };
+      if (resolve_mode == RESOLVE_SHADER)
+         fini_shader_resolve(win);
+   }
+
+   if (render_offscreen())
+      fini_render_target(win);
+}
+
+static void
+recreate_swapchain(struct window *win)
+{
+   vkDeviceWaitIdle(device);
+   free_swapchain_data(win);
+   vkDestroySwapchainKHR(device, win->swapchain, NULL);
+   win->width = win->new_width, win->height = win->new_height;
+   create_swapchain(win);
+}
+
+/* the first window chooses the formats the others have to match */
+static void
+init_swapchains(void)
+{
+   for (unsigned w = 0; w < window_count; w++) {
+      configure_swapchain(&windows[w]);
+      create_swapchain(&windows[w]);
+   }
+   if (hud_enabled) {
+      if (!hud_buffer)
+         init_hud();
+      init_hud_pipelines();
+   }
+   if (rt_shadows)
+      init_rt_composite_pipeline();
+   if (swr_threshold > 0.0f)
+      init_swr_resolve_pipeline();
+}
+
+static void
+fini_swapchains(void)
+{
+   fini_hud_pipelines();
+   fini_rt_composite_pipeline();
+   fini_swr_resolve_pipeline();
+   for (unsigned w = 0; w < window_count; w++) {
+      free_swapchain_data(&windows[w]);
+      vkDestroySwapchainKHR(device, windows[w].swapchain, NULL);
+   }
+}
+
+/* a surface for every window, or none if one of them cannot be created */
+static bool
+create_surfaces(void)
+{
+   for (unsigned w = 0; w < window_count; w++) {
+      if (!wsi.create_surface(physical_device, instance, w, &windows[w].surface)) {
+         while (w-- > 0) {
+            vkDestroySurfaceKHR(instance, windows[w].surface, NULL);
+            windows[w].surface = VK_NULL_HANDLE;
+         }
+         return false;
+      }
    }
+   return true;
 }
 
+static void fini_gears(void);
+static void fini_resolve_pipeline(void);
+static void fini_hiz_pipelines(void);
+static void fini_hud(void);
+static void fini_rt(void);
+static void fini_swr(void);
+
+/* tear down everything created on top of the instance */
 static void
-recreate_swapchain()
+fini_device(void)
 {
    vkDeviceWaitIdle(device);
-   free_swapchain_data();
-   vkDestroySwapchainKHR(device, swapchain, NULL);
-   width = new_width, height = new_height;
-   create_swapchain();
+   fini_swapchains();
+   for (unsigned w = 0; w < window_count; w++) {
+      vkDestroySurfaceKHR(instance, windows[w].surface, NULL);
+      windows[w].swapchain = VK_NULL_HANDLE;
+      windows[w].surface = VK_NULL_HANDLE;
+   }
+   fini_resolve_pipeline();
+   fini_hiz_pipelines();
+   fini_hud();
+   fini_gears();
+   fini_rt();
+   fini_swr();
+   for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; i++) {
+      vkFreeCommandBuffers(device, cmd_pool, 1, &frame_data[i].cmd_buffer);
+      vkDestroyFence(device, frame_data[i].fence, NULL);
+   }
+   vkDestroySemaphore(device, present_semaphore, NULL);
+   vkDestroyCommandPool(device, cmd_pool, NULL);
+   vkDestroyQueryPool(device, timer_pool, NULL);
+   timer_pool = VK_NULL_HANDLE;
+   vkDestroyQueryPool(device, overdraw_pool, NULL);
+   overdraw_pool = VK_NULL_HANDLE;
+   vkDestroyDevice(device, NULL);
+   device = VK_NULL_HANDLE;
 }
 
 static VkBuffer
@@ -701,16 +2004,15 @@ create_buffer(VkDeviceSize size, VkBufferUsageFlags usage)
 }
 
 static VkDeviceMemory
-allocate_buffer_mem(VkBuffer buffer, VkDeviceSize mem_size)
+allocate_buffer_mem_type(VkBuffer buffer, VkDeviceSize mem_size,
+                         VkMemoryPropertyFlags flags)
 {
    VkMemoryRequirements reqs;
    vkGetBufferMemoryRequirements(device, buffer, &reqs);
 
-   int memory_type = find_memory_type(&reqs,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+   int memory_type = find_memory_type(&reqs, flags);
    if (memory_type < 0)
-      error("failed to find coherent memory type");
+      error("failed to find memory type %x", flags);
 
    VkDeviceMemory mem;
    VkMemoryAllocateFlagsInfo info = {
@@ -729,6 +2031,14 @@ allocate_buffer_mem(VkBuffer buffer, VkDeviceSize mem_size)
    return mem;
 }
 
+static VkDeviceMemory
+allocate_buffer_mem(VkBuffer buffer, VkDeviceSize mem_size)
+{
+   return allocate_buffer_mem_type(buffer, mem_size,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
 static uint32_t red_spirv_source[] = {
 #include "red.vert.spv.h"
 };
@@ -745,1118 +2055,8125 @@ static uint32_t fs_spirv_source[] = {
 #include "gear.frag.spv.h"
 };
 
-struct ubo {
-   float projection[16];
+static uint32_t anim_spirv_source[] = {
+#include "gear_anim.comp.spv.h"
 };
 
-struct push_constants {
-   float angle;
-   float view_rot_0;
-   float view_rot_1;
-   float h;
+static uint32_t resolve_vs_spirv_source[] = {
+#include "resolve.vert.spv.h"
 };
 
-struct gear {
-   int nvertices;
+static uint32_t resolve_fs_spirv_source[] = {
+#include "resolve.frag.spv.h"
 };
 
-#define GEAR_VERTEX_STRIDE 6
+static uint32_t hiz_spirv_source[] = {
+#include "hiz.comp.spv.h"
+};
 
-static int
-create_gear(float verts[],
-            float inner_radius, float outer_radius, float width,
-            int teeth, float tooth_depth)
-{
-   // normal state
-   float current_normal[3];
-#define SET_NORMAL(x, y, z) do { \
-      current_normal[0] = x; \
-      current_normal[1] = y; \
-      current_normal[2] = z; \
-   } while (0)
+static uint32_t cull_spirv_source[] = {
+#include "cull.comp.spv.h"
+};
 
-   // vertex buffer state
-   unsigned num_verts = 0;
+static uint32_t sort_spirv_source[] = {
+#include "sort.comp.spv.h"
+};
 
-#define EMIT_VERTEX(x, y, z) do { \
-      verts[num_verts * GEAR_VERTEX_STRIDE + 0] = x; \
-      verts[num_verts * GEAR_VERTEX_STRIDE + 1] = y; \
-      verts[num_verts * GEAR_VERTEX_STRIDE + 2] = z; \
-      memcpy(verts + num_verts * GEAR_VERTEX_STRIDE + 3, \
-             current_normal, sizeof(current_normal)); \
-      num_verts++; \
-   } while (0)
+static uint32_t hud_vs_spirv_source[] = {
+#include "hud.vert.spv.h"
+};
 
-   // strip restart-logic
-   int cur_strip_start = 0;
-#define START_STRIP() do { \
-   cur_strip_start = num_verts; \
-   if (cur_strip_start) \
-      num_verts += 2; \
-} while(0);
+static uint32_t hud_fs_spirv_source[] = {
+#include "hud.frag.spv.h"
+};
 
-#define END_STRIP() do { \
-   if (cur_strip_start) { \
-      memcpy(verts + cur_strip_start * GEAR_VERTEX_STRIDE, \
-             verts + (cur_strip_start - 1) * GEAR_VERTEX_STRIDE, \
-             sizeof(float) * GEAR_VERTEX_STRIDE); \
-      memcpy(verts + (cur_strip_start + 1) * GEAR_VERTEX_STRIDE, \
-             verts + (cur_strip_start + 2) * GEAR_VERTEX_STRIDE, \
-             sizeof(float) * GEAR_VERTEX_STRIDE); \
-   } \
-} while (0)
+static uint32_t rt_instances_spirv_source[] = {
+#include "rt_instances.comp.spv.h"
+};
 
-   float r0 = inner_radius;
-   float r1 = outer_radius - tooth_depth / 2.0;
-   float r2 = outer_radius + tooth_depth / 2.0;
+static uint32_t rt_raygen_spirv_source[] = {
+#include "rt_shadow.rgen.spv.h"
+};
 
-   float da = 2.0 * M_PI / teeth / 4.0;
+static uint32_t rt_miss_spirv_source[] = {
+#include "rt_shadow.rmiss.spv.h"
+};
 
-   SET_NORMAL(0.0, 0.0, 1.0);
+static uint32_t rt_composite_fs_spirv_source[] = {
+#include "rt_composite.frag.spv.h"
+};
 
-   /* draw front face */
-   START_STRIP();
-   for (int i = 0; i <= teeth; i++) {
-      float angle = i * 2.0 * M_PI / teeth;
-      EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), width * 0.5);
-      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-      if (i < teeth) {
-         EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), width * 0.5);
-         EMIT_VERTEX(r1 * cos(angle + 3 * da),
-                     r1 * sin(angle + 3 * da), width * 0.5);
-      }
-   }
-   END_STRIP();
+static uint32_t swr_classify_spirv_source[] = {
+#include "swr_classify.comp.spv.h"
+};
 
-   /* draw front sides of teeth */
-   for (int i = 0; i < teeth; i++) {
-      float angle = i * 2.0 * M_PI / teeth;
-      START_STRIP();
-      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
-      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
-		 width * 0.5);
-      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
-		 width * 0.5);
-      END_STRIP();
-   }
+static uint32_t swr_raster_spirv_source[] = {
+#include "swr_raster.comp.spv.h"
+};
 
-   SET_NORMAL(0.0, 0.0, -1.0);
+static uint32_t swr_resolve_fs_spirv_source[] = {
+#include "swr_resolve.frag.spv.h"
+};
 
-   /* draw back face */
-   START_STRIP();
-   for (int i = 0; i <= teeth; i++) {
-      float angle = i * 2.0 * M_PI / teeth;
-      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
-      EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
-      if (i < teeth) {
-         EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
-               -width * 0.5);
-         EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
-      }
-   }
-   END_STRIP();
+/*
+ * Pipeline for the shader resolve: a full-screen triangle averaging the
+ * samples of a window's color_msaa, which it reads through the only
+ * descriptor. It is created with the first window that needs it and
+ * shared by the others, since they all use the same format.
+ */
+static void
+init_resolve_pipeline(void)
+{
+   vkCreateSampler(device,
+      &(VkSamplerCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+         .magFilter = VK_FILTER_NEAREST,
+         .minFilter = VK_FILTER_NEAREST,
+         .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+         .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+         .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      },
+      NULL,
+      &resolve_sampler);
 
-   /* draw back sides of teeth */
-   for (int i = 0; i < teeth; i++) {
-      float angle = i * 2.0 * M_PI / teeth;
-      START_STRIP();
-      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
-		 -width * 0.5);
-      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
-		 -width * 0.5);
-      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
-      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
-      END_STRIP();
-   }
+   vkCreateDescriptorSetLayout(device,
+      &(VkDescriptorSetLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+         .bindingCount = 1,
+         .pBindings = &(VkDescriptorSetLayoutBinding) {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .pImmutableSamplers = &resolve_sampler,
+         },
+      },
+      NULL,
+      &resolve_set_layout);
 
-   /* draw outward faces of teeth */
-   for (int i = 0; i < teeth; i++) {
-      float angle = i * 2.0 * M_PI / teeth;
-      float u = r2 * cos(angle + da) - r1 * cos(angle);
-      float v = r2 * sin(angle + da) - r1 * sin(angle);
-      float len = sqrt(u * u + v * v);
-      u /= len;
-      v /= len;
-      SET_NORMAL(v, -u, 0.0);
-      START_STRIP();
-      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
+   vkCreatePipelineLayout(device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .setLayoutCount = 1,
+         .pSetLayouts = &resolve_set_layout,
+      },
+      NULL,
+      &resolve_pipeline_layout);
+
+   VkShaderModule vs_module, fs_module;
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = sizeof(resolve_vs_spirv_source),
+         .pCode = resolve_vs_spirv_source,
+      },
+      NULL,
+      &vs_module);
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = sizeof(resolve_fs_spirv_source),
+         .pCode = resolve_fs_spirv_source,
+      },
+      NULL,
+      &fs_module);
 
-      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
-      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
-      END_STRIP();
+   VkResult r = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+      &(VkGraphicsPipelineCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+         .pNext = &(VkPipelineRenderingCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+            .colorAttachmentCount = 1,
+            .pColorAttachmentFormats = &image_format,
+         },
+         .stageCount = 2,
+         .pStages = (VkPipelineShaderStageCreateInfo[]) {
+            {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+               .stage = VK_SHADER_STAGE_VERTEX_BIT,
+               .module = vs_module,
+               .pName = "main",
+            },
+            {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+               .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+               .module = fs_module,
+               .pName = "main",
+            },
+         },
+         .pVertexInputState = &(VkPipelineVertexInputStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+         },
+         .pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+            .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+         },
+         .pViewportState = &(VkPipelineViewportStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+            .viewportCount = 1,
+            .scissorCount = 1,
+         },
+         .pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+            .polygonMode = VK_POLYGON_MODE_FILL,
+            .cullMode = VK_CULL_MODE_NONE,
+            .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+            .lineWidth = 1.0f,
+         },
+         .pMultisampleState = &(VkPipelineMultisampleStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+            .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+         },
+         .pColorBlendState = &(VkPipelineColorBlendStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+            .attachmentCount = 1,
+            .pAttachments = (VkPipelineColorBlendAttachmentState []) {
+               { .colorWriteMask = VK_COLOR_COMPONENT_A_BIT |
+                                   VK_COLOR_COMPONENT_R_BIT |
+                                   VK_COLOR_COMPONENT_G_BIT |
+                                   VK_COLOR_COMPONENT_B_BIT },
+            }
+         },
+         .pDynamicState = &(VkPipelineDynamicStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+            .dynamicStateCount = 2,
+            .pDynamicStates = (VkDynamicState[]) {
+               VK_DYNAMIC_STATE_VIEWPORT,
+               VK_DYNAMIC_STATE_SCISSOR,
+            },
+         },
+         .layout = resolve_pipeline_layout,
+      },
+      NULL,
+      &resolve_pipeline);
+   vkDestroyShaderModule(device, vs_module, NULL);
+   vkDestroyShaderModule(device, fs_module, NULL);
+   if (r != VK_SUCCESS)
+      error("Failed to create resolve pipeline");
+}
 
-      SET_NORMAL(cos(angle), sin(angle), 0.0);
-      START_STRIP();
-      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da),
-		 width * 0.5);
-      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da),
-		 -width * 0.5);
-      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
-      width * 0.5);
-      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
-      -width * 0.5);
-      END_STRIP();
+static void
+init_shader_resolve(struct window *win)
+{
+   if (!resolve_pipeline)
+      init_resolve_pipeline();
+
+   vkCreateDescriptorPool(device,
+      &(VkDescriptorPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+         .maxSets = 1,
+         .poolSizeCount = 1,
+         .pPoolSizes = &(VkDescriptorPoolSize) {
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1
+         },
+      },
+      NULL,
+      &win->resolve_desc_pool);
 
-      u = r1 * cos(angle + 3 * da) - r2 * cos(angle + 2 * da);
-      v = r1 * sin(angle + 3 * da) - r2 * sin(angle + 2 * da);
-      SET_NORMAL(v, -u, 0.0);
-      START_STRIP();
-      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
-		 width * 0.5);
-      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
-		 -width * 0.5);
-      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
-		 width * 0.5);
-      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
-		 -width * 0.5);
-      END_STRIP();
+   vkAllocateDescriptorSets(device,
+      &(VkDescriptorSetAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+         .descriptorPool = win->resolve_desc_pool,
+         .descriptorSetCount = 1,
+         .pSetLayouts = &resolve_set_layout,
+      }, &win->resolve_descriptor_set);
 
-      SET_NORMAL(cos(angle), sin(angle), 0.0);
-      START_STRIP();
-      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
-		 width * 0.5);
-      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
-		 -width * 0.5);
-      EMIT_VERTEX(r1 * cos(angle + 4 * da), r1 * sin(angle + 4 * da),
-      width * 0.5);
-      EMIT_VERTEX(r1 * cos(angle + 4 * da), r1 * sin(angle + 4 * da),
-      -width * 0.5);
-      END_STRIP();
+   vkUpdateDescriptorSets(device, 1,
+      &(VkWriteDescriptorSet) {
+         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstSet = win->resolve_descriptor_set,
+         .dstBinding = 0,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+         .pImageInfo = &(VkDescriptorImageInfo) {
+            .imageView = win->color_msaa_view,
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+         },
+      }, 0, NULL);
+}
+
+static void
+fini_shader_resolve(struct window *win)
+{
+   vkDestroyDescriptorPool(device, win->resolve_desc_pool, NULL);
+   win->resolve_desc_pool = VK_NULL_HANDLE;
+}
+
+static void
+fini_resolve_pipeline(void)
+{
+   if (!resolve_pipeline)
+      return;
+   vkDestroyPipeline(device, resolve_pipeline, NULL);
+   vkDestroyPipelineLayout(device, resolve_pipeline_layout, NULL);
+   vkDestroyDescriptorSetLayout(device, resolve_set_layout, NULL);
+   vkDestroySampler(device, resolve_sampler, NULL);
+   resolve_pipeline = VK_NULL_HANDLE;
+}
+
+/*
+ * The HUD pipelines draw inside the scene passes, so they follow the
+ * swapchains: same view mask, formats and sample count, no depth test and
+ * blended over the gears.
+ */
+static void
+init_hud_pipelines(void)
+{
+   static const VkPrimitiveTopology topologies[] = {
+      VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+      VK_PRIMITIVE_TOPOLOGY_LINE_LIST,
+   };
+   VkShaderModule vs_module, fs_module;
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = sizeof(hud_vs_spirv_source),
+         .pCode = hud_vs_spirv_source,
+      },
+      NULL,
+      &vs_module);
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = sizeof(hud_fs_spirv_source),
+         .pCode = hud_fs_spirv_source,
+      },
+      NULL,
+      &fs_module);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(topologies); i++) {
+      VkResult r = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+         &(VkGraphicsPipelineCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .pNext = &(VkPipelineRenderingCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+               .viewMask = pass_view_mask(),
+               .colorAttachmentCount = 1,
+               .pColorAttachmentFormats = &image_format,
+               .depthAttachmentFormat = depth_format,
+            },
+            .stageCount = 2,
+            .pStages = (VkPipelineShaderStageCreateInfo[]) {
+               {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                  .stage = VK_SHADER_STAGE_VERTEX_BIT,
+                  .module = vs_module,
+                  .pName = "main",
+               },
+               {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                  .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+                  .module = fs_module,
+                  .pName = "main",
+               },
+            },
+            .pVertexInputState = &(VkPipelineVertexInputStateCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+            },
+            .pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+               .topology = topologies[i],
+            },
+            .pViewportState = &(VkPipelineViewportStateCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+               .viewportCount = 1,
+               .scissorCount = 1,
+            },
+            .pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+               .polygonMode = VK_POLYGON_MODE_FILL,
+               .cullMode = VK_CULL_MODE_NONE,
+               .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+               .lineWidth = 1.0f,
+            },
+            .pMultisampleState = &(VkPipelineMultisampleStateCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+               .rasterizationSamples = sample_count,
+            },
+            .pDepthStencilState = &(VkPipelineDepthStencilStateCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+               .depthTestEnable = VK_FALSE,
+               .depthWriteEnable = VK_FALSE,
+            },
+            .pColorBlendState = &(VkPipelineColorBlendStateCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+               .attachmentCount = 1,
+               .pAttachments = (VkPipelineColorBlendAttachmentState []) {
+                  {
+                     .blendEnable = VK_TRUE,
+                     .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+                     .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+                     .colorBlendOp = VK_BLEND_OP_ADD,
+                     .srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+                     .dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+                     .alphaBlendOp = VK_BLEND_OP_ADD,
+                     .colorWriteMask = VK_COLOR_COMPONENT_A_BIT |
+                                       VK_COLOR_COMPONENT_R_BIT |
+                                       VK_COLOR_COMPONENT_G_BIT |
+                                       VK_COLOR_COMPONENT_B_BIT,
+                  },
+               }
+            },
+            .pDynamicState = &(VkPipelineDynamicStateCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+               .dynamicStateCount = 2,
+               .pDynamicStates = (VkDynamicState[]) {
+                  VK_DYNAMIC_STATE_VIEWPORT,
+                  VK_DYNAMIC_STATE_SCISSOR,
+               },
+            },
+            .layout = hud_pipeline_layout,
+         },
+         NULL,
+         &hud_pipelines[i]);
+      if (r != VK_SUCCESS)
+         error("Failed to create HUD pipeline");
    }
+   vkDestroyShaderModule(device, vs_module, NULL);
+   vkDestroyShaderModule(device, fs_module, NULL);
+}
 
-   /* draw inside radius cylinder */
-   START_STRIP();
-   for (int i = 0; i <= teeth; i++) {
-      float angle = i * 2.0 * M_PI / teeth;
-      SET_NORMAL(-cos(angle), -sin(angle), 0.0);
-      EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
-      EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), width * 0.5);
+static void
+fini_hud_pipelines(void)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(hud_pipelines); i++) {
+      vkDestroyPipeline(device, hud_pipelines[i], NULL);
+      hud_pipelines[i] = VK_NULL_HANDLE;
    }
-   END_STRIP();
+}
 
-   return num_verts;
+/* level 0 of a depth pyramid is half the depth in each direction */
+static uint32_t
+hiz_level_count(int width, int height)
+{
+   uint32_t w = MAX2(width >> 1, 1), h = MAX2(height >> 1, 1);
+   uint32_t levels = 1;
+   while ((w > 1 || h > 1) && levels < HIZ_MAX_LEVELS) {
+      w = MAX2(w >> 1, 1);
+      h = MAX2(h >> 1, 1);
+      levels++;
+   }
+   return levels;
 }
 
+struct hiz_push {
+   int32_t src_size[2];
+   int32_t dst_size[2];
+};
+
+/* matches the push constants of cull.comp */
+struct cull_push {
+   VkDeviceAddress input;
+   VkDeviceAddress output;
+   VkDeviceAddress count;
+   VkDeviceAddress drawn;
+   VkDeviceAddress ubo;
+   VkDeviceAddress gears;
+   VkDeviceAddress instances;
+   VkDeviceAddress radius;
+   float view_rot_0, view_rot_1;
+   uint32_t sequence_count;
+   uint32_t phase;
+   int32_t render_size[2];
+   uint32_t levels;
+   uint32_t pad;
+};
+
+static VkPipeline
+create_compute_pipeline(const uint32_t *code, size_t size, VkPipelineLayout layout)
+{
+   VkShaderModule module;
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = size,
+         .pCode = code,
+      },
+      NULL,
+      &module);
+
+   VkPipeline pipeline;
+   VkResult r = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1,
+      &(VkComputePipelineCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+         .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = module,
+            .pName = "main",
+         },
+         .layout = layout,
+      },
+      NULL,
+      &pipeline);
+   vkDestroyShaderModule(device, module, NULL);
+   if (r != VK_SUCCESS)
+      error("Failed to create compute pipeline");
+   return pipeline;
+}
 
+/*
+ * Pipelines building the depth pyramid a level at a time and culling the
+ * sequences against it. Like the resolve pipeline they are created with
+ * the first window that needs them.
+ */
 static void
-init_gears()
+init_hiz_pipelines(void)
 {
-   VkResult r;
+   vkCreateSampler(device,
+      &(VkSamplerCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+         .magFilter = VK_FILTER_NEAREST,
+         .minFilter = VK_FILTER_NEAREST,
+         .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+         .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+         .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+         .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+         .maxLod = VK_LOD_CLAMP_NONE,
+      },
+      NULL,
+      &hiz_sampler);
 
    vkCreateDescriptorSetLayout(device,
       &(VkDescriptorSetLayoutCreateInfo) {
          .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-         .bindingCount = 1,
+         .bindingCount = 2,
          .pBindings = (VkDescriptorSetLayoutBinding[]) {
             {
-               .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+               .binding = 0,
+               .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                .descriptorCount = 1,
-               .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-               .pImmutableSamplers = NULL
-            }
-         }
+               .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+               .pImmutableSamplers = &hiz_sampler,
+            },
+            {
+               .binding = 1,
+               .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+               .descriptorCount = 1,
+               .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+         },
       },
       NULL,
-      &set_layout);
+      &hiz_build_set_layout);
+
+   vkCreateDescriptorSetLayout(device,
+      &(VkDescriptorSetLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+         .bindingCount = 1,
+         .pBindings = &(VkDescriptorSetLayoutBinding) {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .pImmutableSamplers = &hiz_sampler,
+         },
+      },
+      NULL,
+      &hiz_cull_set_layout);
 
    vkCreatePipelineLayout(device,
       &(VkPipelineLayoutCreateInfo) {
          .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
          .setLayoutCount = 1,
-         .pSetLayouts = &set_layout,
-         .pPushConstantRanges = (VkPushConstantRange[]) {
-            {
-               .offset = 0,
-               .size = sizeof(struct push_constants),
-               .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-            },
+         .pSetLayouts = &hiz_build_set_layout,
+         .pushConstantRangeCount = 1,
+         .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(struct hiz_push),
          },
+      },
+      NULL,
+      &hiz_build_pipeline_layout);
+
+   vkCreatePipelineLayout(device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .setLayoutCount = 1,
+         .pSetLayouts = &hiz_cull_set_layout,
          .pushConstantRangeCount = 1,
+         .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(struct cull_push),
+         },
       },
       NULL,
-      &pipeline_layout);
+      &hiz_cull_pipeline_layout);
+
+   hiz_build_pipeline = create_compute_pipeline(hiz_spirv_source,
+                                                sizeof(hiz_spirv_source),
+                                                hiz_build_pipeline_layout);
+   hiz_cull_pipeline = create_compute_pipeline(cull_spirv_source,
+                                               sizeof(cull_spirv_source),
+                                               hiz_cull_pipeline_layout);
+}
 
-   if (use_shader_object) {
-      VkShaderEXT shaders[4];
-      CreateShadersEXT(device, 4,
-         (VkShaderCreateInfoEXT[]) {
+static void
+fini_hiz_pipelines(void)
+{
+   if (!hiz_build_pipeline)
+      return;
+   vkDestroyPipeline(device, hiz_build_pipeline, NULL);
+   vkDestroyPipeline(device, hiz_cull_pipeline, NULL);
+   vkDestroyPipelineLayout(device, hiz_build_pipeline_layout, NULL);
+   vkDestroyPipelineLayout(device, hiz_cull_pipeline_layout, NULL);
+   vkDestroyDescriptorSetLayout(device, hiz_build_set_layout, NULL);
+   vkDestroyDescriptorSetLayout(device, hiz_cull_set_layout, NULL);
+   vkDestroySampler(device, hiz_sampler, NULL);
+   hiz_build_pipeline = VK_NULL_HANDLE;
+}
+
+static VkImageView
+create_hiz_view(VkImage image, uint32_t base_level, uint32_t levels)
+{
+   VkImageView view;
+   VkResult r = vkCreateImageView(device,
+      &(VkImageViewCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+         .image = image,
+         .viewType = VK_IMAGE_VIEW_TYPE_2D,
+         .format = VK_FORMAT_R32_SFLOAT,
+         .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = base_level,
+            .levelCount = levels,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+         },
+      },
+      NULL,
+      &view);
+   if (r != VK_SUCCESS)
+      error("Failed to create the image view for the depth pyramid");
+   return view;
+}
+
+/*
+ * A window's depth pyramid, sized for its render target so dynamic
+ * resolution only uses fewer texels of it. The first level is built from
+ * the depth attachment, every other one from the level before.
+ */
+static void
+init_hiz(struct window *win)
+{
+   if (!hiz_build_pipeline)
+      init_hiz_pipelines();
+
+   win->hiz_levels = hiz_level_count(win->target_width, win->target_height);
+   VkResult r = vkCreateImage(device,
+      &(VkImageCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+         .imageType = VK_IMAGE_TYPE_2D,
+         .format = VK_FORMAT_R32_SFLOAT,
+         .extent = {
+            .width = MAX2(win->target_width >> 1, 1),
+            .height = MAX2(win->target_height >> 1, 1),
+            .depth = 1,
+         },
+         .mipLevels = win->hiz_levels,
+         .arrayLayers = 1,
+         .samples = VK_SAMPLE_COUNT_1_BIT,
+         .tiling = VK_IMAGE_TILING_OPTIMAL,
+         .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      },
+      NULL,
+      &win->hiz_image);
+   if (r != VK_SUCCESS)
+      error("Failed to create the depth pyramid");
+
+   VkMemoryRequirements reqs;
+   vkGetImageMemoryRequirements(device, win->hiz_image, &reqs);
+   int memory_type = find_memory_type(&reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   if (memory_type < 0)
+      error("find_memory_type failed");
+   if (image_allocate(win->hiz_image, reqs, memory_type, &win->hiz_memory))
+      error("Failed to allocate memory for the depth pyramid");
+
+   win->hiz_view = create_hiz_view(win->hiz_image, 0, win->hiz_levels);
+   for (uint32_t l = 0; l < win->hiz_levels; l++)
+      win->hiz_level_views[l] = create_hiz_view(win->hiz_image, l, 1);
+
+   vkCreateDescriptorPool(device,
+      &(VkDescriptorPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+         .maxSets = win->hiz_levels + 1,
+         .poolSizeCount = 2,
+         .pPoolSizes = (VkDescriptorPoolSize[]) {
             {
-               VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
-               NULL,
-               VK_SHADER_CREATE_INDIRECT_BINDABLE_BIT_EXT,
-               VK_SHADER_STAGE_VERTEX_BIT,
-               VK_SHADER_STAGE_FRAGMENT_BIT,
-               VK_SHADER_CODE_TYPE_SPIRV_EXT,
-               sizeof(red_spirv_source),
-               red_spirv_source,
-               "main",
-               1,
-               &set_layout,
-               1,
-               (VkPushConstantRange[]) {
-               {
-                  .offset = 0,
-                  .size = sizeof(struct push_constants),
-                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-               }},
-               NULL
-            },
-            {
-               VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
-               NULL,
-               VK_SHADER_CREATE_INDIRECT_BINDABLE_BIT_EXT,
-               VK_SHADER_STAGE_VERTEX_BIT,
-               VK_SHADER_STAGE_FRAGMENT_BIT,
-               VK_SHADER_CODE_TYPE_SPIRV_EXT,
-               sizeof(green_spirv_source),
-               green_spirv_source,
-               "main",
-               1,
-               &set_layout,
-               1,
-               (VkPushConstantRange[]) {
-               {
-                  .offset = 0,
-                  .size = sizeof(struct push_constants),
-                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-               }},
-               NULL
-            },
-            {
-               VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
-               NULL,
-               VK_SHADER_CREATE_INDIRECT_BINDABLE_BIT_EXT,
-               VK_SHADER_STAGE_VERTEX_BIT,
-               VK_SHADER_STAGE_FRAGMENT_BIT,
-               VK_SHADER_CODE_TYPE_SPIRV_EXT,
-               sizeof(blue_spirv_source),
-               blue_spirv_source,
-               "main",
-               1,
-               &set_layout,
-               1,
-               (VkPushConstantRange[]) {
-               {
-                  .offset = 0,
-                  .size = sizeof(struct push_constants),
-                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-               }},
-               NULL
+               .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+               .descriptorCount = win->hiz_levels + 1,
             },
             {
-               VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
-               NULL,
-               VK_SHADER_CREATE_INDIRECT_BINDABLE_BIT_EXT,
-               VK_SHADER_STAGE_FRAGMENT_BIT,
-               0,
-               VK_SHADER_CODE_TYPE_SPIRV_EXT,
-               sizeof(fs_spirv_source),
-               fs_spirv_source,
-               "main",
-               1,
-               &set_layout,
-               1,
-               (VkPushConstantRange[]) {
-               {
-                  .offset = 0,
-                  .size = sizeof(struct push_constants),
-                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-               }},
-               NULL
+               .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+               .descriptorCount = win->hiz_levels,
             },
          },
-         NULL,
-         shaders
-      );
-      for (int i = 0; i < 3; i++)
-         vs_shaders[i] = shaders[i];
-      fs_shader = shaders[3];
-   } else {
-      VkShaderModule red_module;
-      vkCreateShaderModule(device,
-         &(VkShaderModuleCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = sizeof(red_spirv_source),
-            .pCode = red_spirv_source,
+      },
+      NULL,
+      &win->hiz_desc_pool);
+
+   VkDescriptorSetLayout layouts[HIZ_MAX_LEVELS];
+   for (uint32_t l = 0; l < win->hiz_levels; l++)
+      layouts[l] = hiz_build_set_layout;
+   vkAllocateDescriptorSets(device,
+      &(VkDescriptorSetAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+         .descriptorPool = win->hiz_desc_pool,
+         .descriptorSetCount = win->hiz_levels,
+         .pSetLayouts = layouts,
+      }, win->hiz_build_sets);
+   vkAllocateDescriptorSets(device,
+      &(VkDescriptorSetAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+         .descriptorPool = win->hiz_desc_pool,
+         .descriptorSetCount = 1,
+         .pSetLayouts = &hiz_cull_set_layout,
+      }, &win->hiz_cull_set);
+
+   VkDescriptorImageInfo infos[2 * HIZ_MAX_LEVELS + 1];
+   VkWriteDescriptorSet writes[2 * HIZ_MAX_LEVELS + 1];
+   unsigned n = 0;
+   for (uint32_t l = 0; l < win->hiz_levels; l++) {
+      infos[n] = (VkDescriptorImageInfo) {
+         .imageView = l == 0 ? win->depth_view : win->hiz_level_views[l - 1],
+         .imageLayout = l == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL :
+                                 VK_IMAGE_LAYOUT_GENERAL,
+      };
+      writes[n] = (VkWriteDescriptorSet) {
+         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstSet = win->hiz_build_sets[l],
+         .dstBinding = 0,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+         .pImageInfo = &infos[n],
+      };
+      n++;
+      infos[n] = (VkDescriptorImageInfo) {
+         .imageView = win->hiz_level_views[l],
+         .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+      };
+      writes[n] = (VkWriteDescriptorSet) {
+         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstSet = win->hiz_build_sets[l],
+         .dstBinding = 1,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+         .pImageInfo = &infos[n],
+      };
+      n++;
+   }
+   infos[n] = (VkDescriptorImageInfo) {
+      .imageView = win->hiz_view,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+   };
+   writes[n] = (VkWriteDescriptorSet) {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = win->hiz_cull_set,
+      .dstBinding = 0,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &infos[n],
+   };
+   n++;
+   vkUpdateDescriptorSets(device, n, writes, 0, NULL);
+   win->hiz_valid = false;
+}
+
+static void
+fini_hiz(struct window *win)
+{
+   vkDestroyDescriptorPool(device, win->hiz_desc_pool, NULL);
+   for (uint32_t l = 0; l < win->hiz_levels; l++)
+      vkDestroyImageView(device, win->hiz_level_views[l], NULL);
+   vkDestroyImageView(device, win->hiz_view, NULL);
+   vkDestroyImage(device, win->hiz_image, NULL);
+   vkFreeMemory(device, win->hiz_memory, NULL);
+   win->hiz_desc_pool = VK_NULL_HANDLE;
+   win->hiz_levels = 0;
+}
+
+struct ubo {
+   float projection[16];
+   float camera[4];     /* distance, first view of the pass */
+   float views[MAX_VIEWS][16];
+};
+
+/* the frame angle is turns * 360 + angle */
+struct anim_ubo {
+   float angle;
+   uint32_t turns;
+   uint32_t gear_count;
+};
+
+struct push_constants {
+   float angle;
+   float view_rot_0;
+   float view_rot_1;
+   float h;
+};
+
+struct gear {
+   int nvertices;
+};
+
+#define GEAR_VERTEX_STRIDE 6
+
+static int
+create_gear(float verts[],
+            float inner_radius, float outer_radius, float width,
+            int teeth, float tooth_depth)
+{
+   // normal state
+   float current_normal[3];
+#define SET_NORMAL(x, y, z) do { \
+      current_normal[0] = x; \
+      current_normal[1] = y; \
+      current_normal[2] = z; \
+   } while (0)
+
+   // vertex buffer state
+   unsigned num_verts = 0;
+
+#define EMIT_VERTEX(x, y, z) do { \
+      verts[num_verts * GEAR_VERTEX_STRIDE + 0] = x; \
+      verts[num_verts * GEAR_VERTEX_STRIDE + 1] = y; \
+      verts[num_verts * GEAR_VERTEX_STRIDE + 2] = z; \
+      memcpy(verts + num_verts * GEAR_VERTEX_STRIDE + 3, \
+             current_normal, sizeof(current_normal)); \
+      num_verts++; \
+   } while (0)
+
+   // strip restart-logic
+   int cur_strip_start = 0;
+#define START_STRIP() do { \
+   cur_strip_start = num_verts; \
+   if (cur_strip_start) \
+      num_verts += 2; \
+} while(0);
+
+#define END_STRIP() do { \
+   if (cur_strip_start) { \
+      memcpy(verts + cur_strip_start * GEAR_VERTEX_STRIDE, \
+             verts + (cur_strip_start - 1) * GEAR_VERTEX_STRIDE, \
+             sizeof(float) * GEAR_VERTEX_STRIDE); \
+      memcpy(verts + (cur_strip_start + 1) * GEAR_VERTEX_STRIDE, \
+             verts + (cur_strip_start + 2) * GEAR_VERTEX_STRIDE, \
+             sizeof(float) * GEAR_VERTEX_STRIDE); \
+   } \
+} while (0)
+
+   float r0 = inner_radius;
+   float r1 = outer_radius - tooth_depth / 2.0;
+   float r2 = outer_radius + tooth_depth / 2.0;
+
+   float da = 2.0 * M_PI / teeth / 4.0;
+
+   SET_NORMAL(0.0, 0.0, 1.0);
+
+   /* draw front face */
+   START_STRIP();
+   for (int i = 0; i <= teeth; i++) {
+      float angle = i * 2.0 * M_PI / teeth;
+      EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), width * 0.5);
+      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), width * 0.5);
+      if (i < teeth) {
+         EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), width * 0.5);
+         EMIT_VERTEX(r1 * cos(angle + 3 * da),
+                     r1 * sin(angle + 3 * da), width * 0.5);
+      }
+   }
+   END_STRIP();
+
+   /* draw front sides of teeth */
+   for (int i = 0; i < teeth; i++) {
+      float angle = i * 2.0 * M_PI / teeth;
+      START_STRIP();
+      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), width * 0.5);
+      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
+      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+		 width * 0.5);
+      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+		 width * 0.5);
+      END_STRIP();
+   }
+
+   SET_NORMAL(0.0, 0.0, -1.0);
+
+   /* draw back face */
+   START_STRIP();
+   for (int i = 0; i <= teeth; i++) {
+      float angle = i * 2.0 * M_PI / teeth;
+      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
+      EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
+      if (i < teeth) {
+         EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+               -width * 0.5);
+         EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
+      }
+   }
+   END_STRIP();
+
+   /* draw back sides of teeth */
+   for (int i = 0; i < teeth; i++) {
+      float angle = i * 2.0 * M_PI / teeth;
+      START_STRIP();
+      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+		 -width * 0.5);
+      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+		 -width * 0.5);
+      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
+      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
+      END_STRIP();
+   }
+
+   /* draw outward faces of teeth */
+   for (int i = 0; i < teeth; i++) {
+      float angle = i * 2.0 * M_PI / teeth;
+      float u = r2 * cos(angle + da) - r1 * cos(angle);
+      float v = r2 * sin(angle + da) - r1 * sin(angle);
+      float len = sqrt(u * u + v * v);
+      u /= len;
+      v /= len;
+      SET_NORMAL(v, -u, 0.0);
+      START_STRIP();
+      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), width * 0.5);
+      EMIT_VERTEX(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
+
+      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
+      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
+      END_STRIP();
+
+      SET_NORMAL(cos(angle), sin(angle), 0.0);
+      START_STRIP();
+      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da),
+		 width * 0.5);
+      EMIT_VERTEX(r2 * cos(angle + da), r2 * sin(angle + da),
+		 -width * 0.5);
+      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+      width * 0.5);
+      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+      -width * 0.5);
+      END_STRIP();
+
+      u = r1 * cos(angle + 3 * da) - r2 * cos(angle + 2 * da);
+      v = r1 * sin(angle + 3 * da) - r2 * sin(angle + 2 * da);
+      SET_NORMAL(v, -u, 0.0);
+      START_STRIP();
+      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+		 width * 0.5);
+      EMIT_VERTEX(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+		 -width * 0.5);
+      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+		 width * 0.5);
+      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+		 -width * 0.5);
+      END_STRIP();
+
+      SET_NORMAL(cos(angle), sin(angle), 0.0);
+      START_STRIP();
+      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+		 width * 0.5);
+      EMIT_VERTEX(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+		 -width * 0.5);
+      EMIT_VERTEX(r1 * cos(angle + 4 * da), r1 * sin(angle + 4 * da),
+      width * 0.5);
+      EMIT_VERTEX(r1 * cos(angle + 4 * da), r1 * sin(angle + 4 * da),
+      -width * 0.5);
+      END_STRIP();
+   }
+
+   /* draw inside radius cylinder */
+   START_STRIP();
+   for (int i = 0; i <= teeth; i++) {
+      float angle = i * 2.0 * M_PI / teeth;
+      SET_NORMAL(-cos(angle), -sin(angle), 0.0);
+      EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
+      EMIT_VERTEX(r0 * cos(angle), r0 * sin(angle), width * 0.5);
+   }
+   END_STRIP();
+
+   return num_verts;
+}
+
+/* the classic three gears, used when no -scene is given */
+static const char default_scene[] =
+   "view 40\n"
+   "shape 1.0 4.0 1.0 20 0.7\n"
+   "shape 0.5 2.0 2.0 10 0.7\n"
+   "shape 1.3 2.0 0.5 10 0.7\n"
+   "#    shape x     y    z  r   g   b   ratio phase material\n"
+   "gear 0    -3.0 -2.0 0  0.8 0.1 0.0  1.0   0.0  0\n"
+   "gear 1     3.1 -2.0 0  0.0 0.8 0.2 -2.0  -9.0  0\n"
+   "gear 2    -3.1  4.2 0  0.2 0.2 1.0 -2.0 -25.0  0\n";
+
+#define NUM_MATERIALS 3
+
+/* the number of vertices create_gear() emits for a gear */
+static unsigned
+gear_vertex_count(unsigned teeth)
+{
+   return 46 * teeth + 10;
+}
+
+static void
+load_scene(void)
+{
+   if (scene_file) {
+      double start = current_time();
+      if (!scene_load(&scene, scene_file))
+         error("Failed to load scene %s", scene_file);
+      printf("scene: %u gears, %u shapes loaded in %.1f ms\n",
+             scene.gear_count, scene.shape_count,
+             (current_time() - start) * 1000.0);
+   } else if (!scene_parse_text(&scene, default_scene, sizeof(default_scene) - 1)) {
+      error("Failed to parse the default scene");
+   }
+
+   if (scene.gear_count == 0)
+      error("Scene has no gears");
+   for (uint32_t i = 0; i < scene.gear_count; i++) {
+      if (scene.gear_material[i] >= NUM_MATERIALS)
+         error("Gear %u uses undefined material %u", i, scene.gear_material[i]);
+   }
+
+   double start = current_time();
+   if (!kinematics_init(&kinematics, &scene, kinematics_threads))
+      error("Failed to solve the scene kinematics");
+   if (scene_file || kinematics.conflicts)
+      printf("kinematics: %u components solved on %u threads in %.1f ms, %u conflicts\n",
+             kinematics.component_count, kinematics.thread_count,
+             (current_time() - start) * 1000.0, kinematics.conflicts);
+
+   /* group the gears by shape and material with a counting sort */
+   uint32_t keys = scene.shape_count * NUM_MATERIALS;
+   uint32_t *key_start = calloc(keys + 1, sizeof(uint32_t));
+   instance_gears = malloc(scene.gear_count * sizeof(uint32_t));
+   if (!key_start || !instance_gears)
+      error("Failed to allocate gear groups");
+   for (uint32_t i = 0; i < scene.gear_count; i++)
+      key_start[scene.gear_shape[i] * NUM_MATERIALS + scene.gear_material[i] + 1]++;
+   group_count = 0;
+   for (uint32_t k = 0; k < keys; k++) {
+      group_count += key_start[k + 1] != 0;
+      key_start[k + 1] += key_start[k];
+   }
+   groups = malloc(group_count * sizeof(*groups));
+   if (!groups)
+      error("Failed to allocate gear groups");
+   for (uint32_t k = 0, g = 0; k < keys; k++) {
+      if (key_start[k + 1] == key_start[k])
+         continue;
+      groups[g++] = (struct gear_group) {
+         .shape = k / NUM_MATERIALS,
+         .material = k % NUM_MATERIALS,
+         .first = key_start[k],
+         .count = key_start[k + 1] - key_start[k],
+      };
+   }
+   for (uint32_t i = 0; i < scene.gear_count; i++)
+      instance_gears[key_start[scene.gear_shape[i] * NUM_MATERIALS + scene.gear_material[i]]++] = i;
+   free(key_start);
+
+   /* one mesh per shape, shared by every gear using it */
+   meshes = malloc(scene.shape_count * sizeof(*meshes));
+   if (!meshes)
+      error("Failed to allocate meshes");
+   total_verts = 0;
+   for (uint32_t i = 0; i < scene.shape_count; i++) {
+      meshes[i].first_vertex = total_verts;
+      meshes[i].vertex_count = gear_vertex_count(scene.shapes[i].teeth);
+      total_verts += meshes[i].vertex_count;
+   }
+
+   if (scene_export) {
+      if (!scene_write_binary(&scene, scene_export))
+         error("Failed to write scene %s", scene_export);
+      printf("scene: wrote %s\n", scene_export);
+   }
+}
+
+static unsigned
+build_gears(float verts[], float tooth_scale)
+{
+   for (uint32_t i = 0; i < scene.shape_count; i++) {
+      const struct gear_shape *shape = &scene.shapes[i];
+      unsigned count =
+         create_gear(verts + meshes[i].first_vertex * GEAR_VERTEX_STRIDE,
+                     shape->inner_radius,
+                     shape->outer_radius,
+                     shape->width,
+                     shape->teeth,
+                     shape->tooth_depth * tooth_scale);
+      assert(count == meshes[i].vertex_count);
+      (void)count;
+   }
+   return total_verts;
+}
+
+/* the number of sequences fill_indirect_data() writes */
+static uint32_t
+scene_sequence_count(void)
+{
+   return use_instancing ? group_count : scene.gear_count;
+}
+
+static void
+fill_indirect_data(indirect_data *indirect_map)
+{
+   int pipeline_idx[] = {
+      0, 1, 2
+   };
+   /* VS are offset */
+   int shader_idx[] = {
+      0, 2, 3
+   };
+   uint32_t n = 0;
+   for (uint32_t g = 0; g < group_count; g++) {
+      const struct mesh *mesh = &meshes[groups[g].shape];
+      uint32_t material = groups[g].material;
+      /* the vertex shaders look the gear up through instance_gears[] */
+      for (uint32_t i = 0; i < (use_instancing ? 1 : groups[g].count); i++, n++) {
+         indirect_map[n].ies[0] = use_shader_object ? shader_idx[material] :
+                                                      pipeline_idx[material];
+         indirect_map[n].ies[1] = 1;
+         indirect_map[n].draw.vertexCount = mesh->vertex_count;
+         indirect_map[n].draw.firstVertex = mesh->first_vertex;
+         indirect_map[n].draw.firstInstance = groups[g].first + i;
+         indirect_map[n].draw.instanceCount = use_instancing ? groups[g].count : 1;
+      }
+   }
+   assert(n == scene_sequence_count());
+}
+
+static VkBuffer
+create_stream_buffer(VkDeviceSize size, VkBufferUsageFlags usage)
+{
+   VkBuffer buffer;
+
+   /* concurrent sharing avoids queue family ownership transfers */
+   VkResult result =
+      vkCreateBuffer(device,
+         &(VkBufferCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = size,
+            .usage = usage,
+            .sharingMode = transfer_family ? VK_SHARING_MODE_CONCURRENT :
+                                             VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = transfer_family ? 2 : 0,
+            .pQueueFamilyIndices = (uint32_t[]) { 0, transfer_family },
+         },
+         NULL,
+         &buffer);
+
+   if (result != VK_SUCCESS)
+      error("Failed to create stream buffer");
+
+   return buffer;
+}
+
+static VkSemaphore
+create_timeline_semaphore(void)
+{
+   VkSemaphore semaphore;
+   VkResult result =
+      vkCreateSemaphore(device,
+         &(VkSemaphoreCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &(VkSemaphoreTypeCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+               .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+               .initialValue = 0,
+            },
+         },
+         NULL,
+         &semaphore);
+
+   if (result != VK_SUCCESS)
+      error("Failed to create timeline semaphore");
+
+   return semaphore;
+}
+
+#define STREAM_VERTEX_SIZE (sizeof(float) * GEAR_VERTEX_STRIDE * total_verts)
+#define STREAM_INDIRECT_SIZE (scene.gear_count * sizeof(indirect_data))
+
+static void
+init_streaming(void)
+{
+   transfer_timeline = create_timeline_semaphore();
+   graphics_timeline = create_timeline_semaphore();
+
+   vkCreateCommandPool(device,
+      &(const VkCommandPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+         .queueFamilyIndex = transfer_family,
+         .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+      },
+      NULL,
+      &transfer_cmd_pool);
+
+   /* one staging slot per generation, indirect data after the vertices */
+   staging_slot_size = (STREAM_VERTEX_SIZE + STREAM_INDIRECT_SIZE + 255) & ~255;
+   VkDeviceSize staging_size = staging_slot_size * STREAM_GENERATIONS;
+   staging_buffer = create_stream_buffer(staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+   staging_mem = allocate_buffer_mem(staging_buffer, staging_size);
+   vkBindBufferMemory(device, staging_buffer, staging_mem, 0);
+   if (vkMapMemory(device, staging_mem, 0, staging_size, 0, (void *)&staging_map) != VK_SUCCESS)
+      error("vkMapMemory failed");
+
+   for (unsigned i = 0; i < STREAM_GENERATIONS; i++) {
+      stream_gen[i].vertex_buffer =
+         create_stream_buffer(STREAM_VERTEX_SIZE,
+                              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+      stream_gen[i].vertex_mem =
+         allocate_buffer_mem_type(stream_gen[i].vertex_buffer, STREAM_VERTEX_SIZE,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      vkBindBufferMemory(device, stream_gen[i].vertex_buffer,
+                         stream_gen[i].vertex_mem, 0);
+
+      stream_gen[i].indirect_buffer =
+         create_stream_buffer(STREAM_INDIRECT_SIZE,
+                              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+      stream_gen[i].indirect_mem =
+         allocate_buffer_mem_type(stream_gen[i].indirect_buffer, STREAM_INDIRECT_SIZE,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      vkBindBufferMemory(device, stream_gen[i].indirect_buffer,
+                         stream_gen[i].indirect_mem, 0);
+      stream_gen[i].indirect_addr =
+         vk.GetBufferDeviceAddress(device,
+                                   &(VkBufferDeviceAddressInfo) {
+                                      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                                      .buffer = stream_gen[i].indirect_buffer
+                                   });
+
+      vkAllocateCommandBuffers(device,
+         &(VkCommandBufferAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = transfer_cmd_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+         },
+         &stream_gen[i].cmd_buffer);
+   }
+}
+
+/*
+ * Regenerate the gear meshes and indirect stream into a free staging slot and
+ * copy them into a device-local generation on the transfer queue. The copy
+ * waits for the last graphics frame that read the target generation and
+ * signals transfer_timeline once the data is ready. Returns the generation
+ * written to, or -1 if every candidate slot is still in flight.
+ */
+static int
+stream_upload(double t)
+{
+   uint64_t completed;
+   vk.GetSemaphoreCounterValue(device, transfer_timeline, &completed);
+
+   unsigned g = stream.next;
+   if (g == stream.current)
+      g = (g + 1) % STREAM_GENERATIONS;
+   if (stream_gen[g].upload_value > completed) {
+      stream.stalls++;
+      return -1;
+   }
+   stream.next = (g + 1) % STREAM_GENERATIONS;
+
+   uint8_t *slot = staging_map + g * staging_slot_size;
+   unsigned num_verts = build_gears((float *)slot, 1.0 + 0.4 * sin(t));
+   VkDeviceSize vertex_size = sizeof(float) * GEAR_VERTEX_STRIDE * num_verts;
+   fill_indirect_data((indirect_data *)(slot + STREAM_VERTEX_SIZE));
+
+   VkCommandBuffer cmd = stream_gen[g].cmd_buffer;
+   vk.BeginCommandBuffer(cmd,
+      &(VkCommandBufferBeginInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+      });
+   vk.CmdCopyBuffer(cmd, staging_buffer, stream_gen[g].vertex_buffer, 1,
+      &(VkBufferCopy) {
+         .srcOffset = g * staging_slot_size,
+         .dstOffset = 0,
+         .size = vertex_size,
+      });
+   vk.CmdCopyBuffer(cmd, staging_buffer, stream_gen[g].indirect_buffer, 1,
+      &(VkBufferCopy) {
+         .srcOffset = g * staging_slot_size + STREAM_VERTEX_SIZE,
+         .dstOffset = 0,
+         .size = STREAM_INDIRECT_SIZE,
+      });
+   vk.EndCommandBuffer(cmd);
+
+   stream_gen[g].upload_value = ++transfer_value;
+   vk.QueueSubmit(transfer_queue, 1,
+      &(VkSubmitInfo) {
+         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+         .pNext = &(VkTimelineSemaphoreSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = 1,
+            .pWaitSemaphoreValues = &stream_gen[g].last_use,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &stream_gen[g].upload_value,
+         },
+         .waitSemaphoreCount = 1,
+         .pWaitSemaphores = &graphics_timeline,
+         .pWaitDstStageMask = (VkPipelineStageFlags []) {
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+         },
+         .commandBufferCount = 1,
+         .pCommandBuffers = &cmd,
+         .signalSemaphoreCount = 1,
+         .pSignalSemaphores = &transfer_timeline,
+      }, VK_NULL_HANDLE);
+
+   stream_gen[g].serial = ++stream.serial;
+   stream_gen[g].submit_time = current_time();
+   stream_gen[g].completed = false;
+   stream.uploads++;
+   stream.bytes += vertex_size + STREAM_INDIRECT_SIZE;
+   return g;
+}
+
+/* switch rendering to the newest generation the transfer queue finished */
+static void
+stream_acquire(void)
+{
+   uint64_t completed;
+   vk.GetSemaphoreCounterValue(device, transfer_timeline, &completed);
+
+   for (unsigned i = 0; i < STREAM_GENERATIONS; i++) {
+      if (stream_gen[i].serial && !stream_gen[i].completed &&
+          stream_gen[i].upload_value <= completed) {
+         stream_gen[i].completed = true;
+         stream.latency += current_time() - stream_gen[i].submit_time;
+      }
+      if (stream_gen[i].completed &&
+          stream_gen[i].serial > stream_gen[stream.current].serial)
+         stream.current = i;
+   }
+
+   vertex_buffer = stream_gen[stream.current].vertex_buffer;
+   indirect_addr = stream_gen[stream.current].indirect_addr;
+}
+
+/* rewrite the execution set indices after the binding model changed */
+static void
+refresh_indirect_data(void)
+{
+   if (use_streaming) {
+      int g = stream_upload(current_time());
+      assert(g >= 0);
+      stream.current = g;
+      stream_acquire();
+   } else {
+      fill_indirect_data(indirect_map);
+   }
+}
+
+/* the indirect stream the current frame executes, as seen by the CPU */
+static const indirect_data *
+current_indirect_data(void)
+{
+   if (use_streaming)
+      return (const indirect_data *)(staging_map + stream.current * staging_slot_size +
+                                     STREAM_VERTEX_SIZE);
+   return indirect_map;
+}
+
+static void
+fini_streaming(void)
+{
+   for (unsigned i = 0; i < STREAM_GENERATIONS; i++) {
+      vkDestroyBuffer(device, stream_gen[i].vertex_buffer, NULL);
+      vkFreeMemory(device, stream_gen[i].vertex_mem, NULL);
+      vkDestroyBuffer(device, stream_gen[i].indirect_buffer, NULL);
+      vkFreeMemory(device, stream_gen[i].indirect_mem, NULL);
+   }
+   memset(stream_gen, 0, sizeof(stream_gen));
+   memset(&stream, 0, sizeof(stream));
+
+   vkDestroyBuffer(device, staging_buffer, NULL);
+   vkFreeMemory(device, staging_mem, NULL);
+   vkDestroyCommandPool(device, transfer_cmd_pool, NULL);
+   vkDestroySemaphore(device, transfer_timeline, NULL);
+   vkDestroySemaphore(device, graphics_timeline, NULL);
+   transfer_value = graphics_value = 0;
+}
+
+enum program {
+   PROGRAM_RED,
+   PROGRAM_GREEN,
+   PROGRAM_BLUE,
+   PROGRAM_FRAGMENT,
+};
+
+/* the program bound at each execution set index by create_gear_programs() */
+static uint32_t
+get_ies_programs(bool shader_object, uint32_t ies[TRACE_MAX_IES])
+{
+   if (shader_object) {
+      ies[0] = PROGRAM_RED;
+      ies[1] = PROGRAM_FRAGMENT;
+      ies[2] = PROGRAM_GREEN;
+      ies[3] = PROGRAM_BLUE;
+      return 4;
+   }
+   ies[0] = PROGRAM_RED;
+   ies[1] = PROGRAM_GREEN;
+   ies[2] = PROGRAM_BLUE;
+   return 3;
+}
+
+static bool
+start_recording(void)
+{
+   struct trace_header header = {
+      .flags = use_shader_object ? TRACE_FLAG_SHADER_OBJECT : 0,
+      .indirect_stride = sizeof(indirect_data),
+      .max_sequence_count = max_sequence_count,
+      .push_size = sizeof(struct push_constants),
+   };
+   header.ies_count = get_ies_programs(use_shader_object, header.ies);
+
+   return trace_writer_open(&trace_writer, record_file, &header);
+}
+
+static void
+stop_recording(void)
+{
+   unsigned frames = trace_writer.header.frame_count;
+   if (!trace_writer_close(&trace_writer))
+      error("Failed to write %s", record_file);
+   printf("recorded %u frames to %s\n", frames, record_file);
+}
+
+static void
+open_replay(const char *filename)
+{
+   if (!trace_open(&replay_trace, filename))
+      error("Failed to open trace %s", filename);
+
+   const struct trace_header *h = replay_trace.header;
+   if (h->indirect_stride != sizeof(indirect_data) ||
+       h->push_size != sizeof(struct push_constants))
+      error("Trace %s does not match this indirect layout", filename);
+
+   use_shader_object = h->flags & TRACE_FLAG_SHADER_OBJECT;
+
+   uint32_t ies[TRACE_MAX_IES];
+   if (h->ies_count != get_ies_programs(use_shader_object, ies) ||
+       memcmp(ies, h->ies, h->ies_count * sizeof(uint32_t)) != 0)
+      error("Trace %s uses an unknown execution set", filename);
+
+   replaying = true;
+}
+
+/* upload every recorded stream once so frames only select an address */
+static void
+init_replay(void)
+{
+   const struct trace_header *h = replay_trace.header;
+   VkDeviceSize size = h->streams_size ? h->streams_size : sizeof(indirect_data);
+
+   /*
+    * The trace only references gears and meshes, which come from the scene,
+    * and programs of the execution set. Streams are padded in the file, so
+    * each is found through the frames using it.
+    */
+   uint32_t stages = use_shader_object ? 2 : 1;
+   for (uint32_t f = 0; f < h->frame_count; f++) {
+      const struct trace_frame *frame = &replay_trace.frames[f];
+      const indirect_data *seqs =
+         (const indirect_data *)(replay_trace.streams + frame->stream_offset);
+      for (uint32_t i = 0; i < frame->sequence_count; i++) {
+         if ((uint64_t)seqs[i].draw.firstInstance + seqs[i].draw.instanceCount > scene.gear_count ||
+             (uint64_t)seqs[i].draw.firstVertex + seqs[i].draw.vertexCount > total_verts)
+            error("Trace does not match the scene, pass the recorded -scene");
+         for (uint32_t k = 0; k < stages; k++) {
+            if (seqs[i].ies[k] >= h->ies_count)
+               error("Trace indexes past the execution set");
+         }
+      }
+   }
+
+   replay_buffer = create_buffer(size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                       VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   replay_mem = allocate_buffer_mem(replay_buffer, size);
+
+   void *map;
+   if (vkMapMemory(device, replay_mem, 0, size, 0, &map) != VK_SUCCESS)
+      error("vkMapMemory failed");
+   memcpy(map, replay_trace.streams, h->streams_size);
+   vkUnmapMemory(device, replay_mem);
+   vkBindBufferMemory(device, replay_buffer, replay_mem, 0);
+
+   replay_addr = vk.GetBufferDeviceAddress(device,
+                                           &(VkBufferDeviceAddressInfo) {
+                                              .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                                              .buffer = replay_buffer
+                                           });
+   replay_frame = 0;
+}
+
+static void
+fini_replay(void)
+{
+   vkDestroyBuffer(device, replay_buffer, NULL);
+   vkFreeMemory(device, replay_mem, NULL);
+}
+
+/*
+ * Create everything that depends on the binding model or the sample count:
+ * pipelines or shader objects, the indirect commands layout, the execution
+ * set and the preprocess buffer sized for them.
+ */
+static void
+create_gear_programs(void)
+{
+   if (use_shader_object) {
+      VkShaderEXT shaders[4];
+      vk.CreateShadersEXT(device, 4,
+         (VkShaderCreateInfoEXT[]) {
+            {
+               VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
+               NULL,
+               VK_SHADER_CREATE_INDIRECT_BINDABLE_BIT_EXT,
+               VK_SHADER_STAGE_VERTEX_BIT,
+               VK_SHADER_STAGE_FRAGMENT_BIT,
+               VK_SHADER_CODE_TYPE_SPIRV_EXT,
+               sizeof(red_spirv_source),
+               red_spirv_source,
+               "main",
+               1,
+               &set_layout,
+               1,
+               (VkPushConstantRange[]) {
+               {
+                  .offset = 0,
+                  .size = sizeof(struct push_constants),
+                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+               }},
+               NULL
+            },
+            {
+               VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
+               NULL,
+               VK_SHADER_CREATE_INDIRECT_BINDABLE_BIT_EXT,
+               VK_SHADER_STAGE_VERTEX_BIT,
+               VK_SHADER_STAGE_FRAGMENT_BIT,
+               VK_SHADER_CODE_TYPE_SPIRV_EXT,
+               sizeof(green_spirv_source),
+               green_spirv_source,
+               "main",
+               1,
+               &set_layout,
+               1,
+               (VkPushConstantRange[]) {
+               {
+                  .offset = 0,
+                  .size = sizeof(struct push_constants),
+                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+               }},
+               NULL
+            },
+            {
+               VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
+               NULL,
+               VK_SHADER_CREATE_INDIRECT_BINDABLE_BIT_EXT,
+               VK_SHADER_STAGE_VERTEX_BIT,
+               VK_SHADER_STAGE_FRAGMENT_BIT,
+               VK_SHADER_CODE_TYPE_SPIRV_EXT,
+               sizeof(blue_spirv_source),
+               blue_spirv_source,
+               "main",
+               1,
+               &set_layout,
+               1,
+               (VkPushConstantRange[]) {
+               {
+                  .offset = 0,
+                  .size = sizeof(struct push_constants),
+                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+               }},
+               NULL
+            },
+            {
+               VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
+               NULL,
+               VK_SHADER_CREATE_INDIRECT_BINDABLE_BIT_EXT,
+               VK_SHADER_STAGE_FRAGMENT_BIT,
+               0,
+               VK_SHADER_CODE_TYPE_SPIRV_EXT,
+               sizeof(fs_spirv_source),
+               fs_spirv_source,
+               "main",
+               1,
+               &set_layout,
+               1,
+               (VkPushConstantRange[]) {
+               {
+                  .offset = 0,
+                  .size = sizeof(struct push_constants),
+                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+               }},
+               NULL
+            },
+         },
+         NULL,
+         shaders
+      );
+      for (int i = 0; i < 3; i++)
+         vs_shaders[i] = shaders[i];
+      fs_shader = shaders[3];
+   } else {
+      VkShaderModule red_module;
+      vkCreateShaderModule(device,
+         &(VkShaderModuleCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .codeSize = sizeof(red_spirv_source),
+            .pCode = red_spirv_source,
+         },
+         NULL,
+         &red_module);
+      VkShaderModule green_module;
+      vkCreateShaderModule(device,
+         &(VkShaderModuleCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .codeSize = sizeof(green_spirv_source),
+            .pCode = green_spirv_source,
+         },
+         NULL,
+         &green_module);
+      VkShaderModule blue_module;
+      vkCreateShaderModule(device,
+         &(VkShaderModuleCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .codeSize = sizeof(blue_spirv_source),
+            .pCode = blue_spirv_source,
+         },
+         NULL,
+         &blue_module);
+      VkShaderModule vs_modules[] = {red_module, green_module, blue_module};
+
+      VkShaderModule fs_module;
+      vkCreateShaderModule(device,
+         &(VkShaderModuleCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .codeSize = sizeof(fs_spirv_source),
+            .pCode = fs_spirv_source,
+         },
+         NULL,
+         &fs_module);
+
+      VkPipelineRenderingCreateInfo pci = {
+         VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+         NULL,
+         pass_view_mask(),
+         1,
+         &image_format,
+         depth_format,
+      };
+      VkPipelineCreateFlags2CreateInfoKHR pipeline2 = {
+         VK_STRUCTURE_TYPE_PIPELINE_CREATE_FLAGS_2_CREATE_INFO_KHR,
+         &pci,
+         VK_PIPELINE_CREATE_2_INDIRECT_BINDABLE_BIT_EXT |
+         (descriptor_model == DESCRIPTOR_MODEL_BUFFER ?
+          VK_PIPELINE_CREATE_2_DESCRIPTOR_BUFFER_BIT_EXT : 0)
+      };
+      for (unsigned i = 0; i < ARRAY_SIZE(vs_modules); i++) {
+         vkCreateGraphicsPipelines(device,
+            (VkPipelineCache) { VK_NULL_HANDLE },
+            1,
+            &(VkGraphicsPipelineCreateInfo) {
+               .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+               .pNext = &pipeline2,
+               .stageCount = 2,
+               .pStages = (VkPipelineShaderStageCreateInfo[]) {
+                     {
+                        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+                        .module = vs_modules[i],
+                        .pName = "main",
+                     },
+                     {
+                        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+                        .module = fs_module,
+                        .pName = "main",
+                     },
+               },
+               .pVertexInputState = &(VkPipelineVertexInputStateCreateInfo) {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+                  .vertexBindingDescriptionCount = 2,
+                  .pVertexBindingDescriptions = (VkVertexInputBindingDescription[]) {
+                     {
+                        .binding = 0,
+                        .stride = 6 * sizeof(float),
+                        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+                     },
+                     {
+                        .binding = 1,
+                        .stride = 6 * sizeof(float),
+                        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+                     },
+                  },
+                  .vertexAttributeDescriptionCount = 2,
+                  .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[]) {
+                     {
+                        .location = 0,
+                        .binding = 0,
+                        .format = VK_FORMAT_R32G32B32_SFLOAT,
+                        .offset = 0
+                     },
+                     {
+                        .location = 1,
+                        .binding = 1,
+                        .format = VK_FORMAT_R32G32B32_SFLOAT,
+                        .offset = 0
+                     },
+                  }
+               },
+               .pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo) {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+                  .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+                  .primitiveRestartEnable = false,
+               },
+
+               .pViewportState = &(VkPipelineViewportStateCreateInfo) {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+                  .viewportCount = 1,
+                  .scissorCount = 1,
+               },
+
+               .pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+                  .rasterizerDiscardEnable = false,
+                  .polygonMode = VK_POLYGON_MODE_FILL,
+                  .cullMode = VK_CULL_MODE_BACK_BIT,
+                  .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+                  .lineWidth = 1.0f,
+               },
+
+               .pMultisampleState = &(VkPipelineMultisampleStateCreateInfo) {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+                  .rasterizationSamples = sample_count,
+               },
+               .pDepthStencilState = &(VkPipelineDepthStencilStateCreateInfo) {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+                  .depthTestEnable = VK_TRUE,
+                  .depthWriteEnable = VK_TRUE,
+                  .depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
+               },
+
+               .pColorBlendState = &(VkPipelineColorBlendStateCreateInfo) {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+                  .attachmentCount = 1,
+                  .pAttachments = (VkPipelineColorBlendAttachmentState []) {
+                     { .colorWriteMask = VK_COLOR_COMPONENT_A_BIT |
+                                          VK_COLOR_COMPONENT_R_BIT |
+                                          VK_COLOR_COMPONENT_G_BIT |
+                                          VK_COLOR_COMPONENT_B_BIT },
+                  }
+               },
+
+               .pDynamicState = &(VkPipelineDynamicStateCreateInfo) {
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+                  .dynamicStateCount = 2,
+                  .pDynamicStates = (VkDynamicState[]) {
+                        VK_DYNAMIC_STATE_VIEWPORT,
+                        VK_DYNAMIC_STATE_SCISSOR,
+                  },
+               },
+
+               .flags = 0,
+               .layout = pipeline_layout,
+               .subpass = 0,
+               .basePipelineHandle = (VkPipeline) { 0 },
+               .basePipelineIndex = 0
+            },
+            NULL,
+            &pipeline[i]);
+      }
+
+      for (unsigned i = 0; i < ARRAY_SIZE(vs_modules); i++)
+         vkDestroyShaderModule(device, vs_modules[i], NULL);
+      vkDestroyShaderModule(device, fs_module, NULL);
+   }
+
+   vk.CreateIndirectCommandsLayoutEXT(device,
+                                        &(VkIndirectCommandsLayoutCreateInfoEXT) {
+                                          .sType = VK_STRUCTURE_TYPE_INDIRECT_COMMANDS_LAYOUT_CREATE_INFO_EXT,
+                                          .flags = 0,
+                                          .shaderStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                                          .indirectStride = sizeof(indirect_data),
+                                          .pipelineLayout = pipeline_layout,
+                                          .tokenCount = 2,
+                                          .pTokens = (VkIndirectCommandsLayoutTokenEXT[]) {
+                                             {
+                                                .sType = VK_STRUCTURE_TYPE_INDIRECT_COMMANDS_LAYOUT_TOKEN_EXT,
+                                                .type = VK_INDIRECT_COMMANDS_TOKEN_TYPE_EXECUTION_SET_EXT,
+                                                .data = {
+                                                   .pExecutionSet = &(VkIndirectCommandsExecutionSetTokenEXT) {
+                                                      .type = use_shader_object ? VK_INDIRECT_EXECUTION_SET_INFO_TYPE_SHADER_OBJECTS_EXT : VK_INDIRECT_EXECUTION_SET_INFO_TYPE_PIPELINES_EXT,
+                                                      .shaderStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                                                   }
+                                                },
+                                                .offset = 0
+                                             },
+                                             {
+                                                .sType = VK_STRUCTURE_TYPE_INDIRECT_COMMANDS_LAYOUT_TOKEN_EXT,
+                                                .type = VK_INDIRECT_COMMANDS_TOKEN_TYPE_DRAW_EXT,
+                                                .offset = offsetof(indirect_data, draw)
+                                             },
+                                          }
+                                        },
+                                        NULL, &indirect_layout);
+
+   if (use_shader_object) {
+      vk.CreateIndirectExecutionSetEXT(device,
+                                       &(VkIndirectExecutionSetCreateInfoEXT) {
+                                          .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_CREATE_INFO_EXT,
+                                          .type = VK_INDIRECT_EXECUTION_SET_INFO_TYPE_SHADER_OBJECTS_EXT,
+                                          .info = {
+                                             .pShaderInfo = &(VkIndirectExecutionSetShaderInfoEXT) {
+                                                .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_SHADER_INFO_EXT,
+                                                .shaderCount = 2,
+                                                .pInitialShaders = (VkShaderEXT[]) {
+                                                   vs_shaders[0],
+                                                   fs_shader,
+                                                },
+                                                .pSetLayoutInfos = (VkIndirectExecutionSetShaderLayoutInfoEXT[]) {
+                                                   {
+                                                      .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_SHADER_LAYOUT_INFO_EXT,
+                                                      .setLayoutCount = 1,
+                                                      .pSetLayouts = (VkDescriptorSetLayout[]) {
+                                                         set_layout
+                                                      }
+                                                   },
+                                                   {
+                                                      .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_SHADER_LAYOUT_INFO_EXT,
+                                                      .setLayoutCount = 0,
+                                                      .pSetLayouts = (VkDescriptorSetLayout[]) {
+                                                      }
+                                                   },
+                                                },
+                                                .maxShaderCount = 4,
+                                                .pushConstantRangeCount = 1,
+                                                .pPushConstantRanges = (VkPushConstantRange[]) {
+                                                   {
+                                                      .offset = 0,
+                                                      .size = sizeof(struct push_constants),
+                                                      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+                                                   },
+                                                },
+                                             },
+                                          },
+                                       },
+                                       NULL, &indirect_execution);
+      vk.UpdateIndirectExecutionSetShaderEXT(device, indirect_execution,
+                                                2, (VkWriteIndirectExecutionSetShaderEXT[]) {
+                                                   {
+                                                   .sType = VK_STRUCTURE_TYPE_WRITE_INDIRECT_EXECUTION_SET_SHADER_EXT,
+                                                   .index = 2,
+                                                   .shader = vs_shaders[1],
+                                                   },
+                                                   {
+                                                   .sType = VK_STRUCTURE_TYPE_WRITE_INDIRECT_EXECUTION_SET_SHADER_EXT,
+                                                   .index = 3,
+                                                   .shader = vs_shaders[2],
+                                                   },
+                                                });
+   } else {
+      vk.CreateIndirectExecutionSetEXT(device,
+                                       &(VkIndirectExecutionSetCreateInfoEXT) {
+                                          .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_CREATE_INFO_EXT,
+                                          .type = VK_INDIRECT_EXECUTION_SET_INFO_TYPE_PIPELINES_EXT,
+                                          .info = {
+                                             .pPipelineInfo = &(VkIndirectExecutionSetPipelineInfoEXT) {
+                                                .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_PIPELINE_INFO_EXT,
+                                                .initialPipeline = pipeline[0],
+                                                .maxPipelineCount = 3
+                                             },
+                                          },
+                                       },
+                                       NULL, &indirect_execution);
+      vk.UpdateIndirectExecutionSetPipelineEXT(device, indirect_execution,
+                                                2, (VkWriteIndirectExecutionSetPipelineEXT[]) {
+                                                   {
+                                                   .sType = VK_STRUCTURE_TYPE_WRITE_INDIRECT_EXECUTION_SET_PIPELINE_EXT,
+                                                   .index = 1,
+                                                   .pipeline = pipeline[1],
+                                                   },
+                                                   {
+                                                   .sType = VK_STRUCTURE_TYPE_WRITE_INDIRECT_EXECUTION_SET_PIPELINE_EXT,
+                                                   .index = 2,
+                                                   .pipeline = pipeline[2],
+                                                   },
+                                                });
+
+   }
+
+   VkMemoryRequirements2 memreqs = {
+      VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+   };
+   vk.GetGeneratedCommandsMemoryRequirementsEXT(device,
+                                                  &(VkGeneratedCommandsMemoryRequirementsInfoEXT) {
+                                                     .sType = VK_STRUCTURE_TYPE_GENERATED_COMMANDS_MEMORY_REQUIREMENTS_INFO_EXT,
+                                                     .indirectExecutionSet = indirect_execution,
+                                                     .indirectCommandsLayout = indirect_layout,
+                                                     .maxSequenceCount = max_sequence_count,
+                                                  },
+                                                  &memreqs);
+
+   VkBufferUsageFlags2CreateInfoKHR busage = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_USAGE_FLAGS_2_CREATE_INFO_KHR,
+      .usage = VK_BUFFER_USAGE_2_PREPROCESS_BUFFER_BIT_EXT | VK_BUFFER_USAGE_2_SHADER_DEVICE_ADDRESS_BIT_KHR,
+   };
+   vkCreateBuffer(device,
+      &(VkBufferCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+         .pNext = &busage,
+         .size = memreqs.memoryRequirements.size,
+      },
+      NULL,
+      &preprocess_buffer);
+   VkMemoryAllocateFlagsInfo info = {
+      VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+      .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+   };
+   vkAllocateMemory(device,
+      &(VkMemoryAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+         .pNext = &info,
+         .allocationSize = memreqs.memoryRequirements.size,
+         .memoryTypeIndex = ffs(memreqs.memoryRequirements.memoryTypeBits) - 1,
+      },
+      NULL,
+      &preprocess_mem);
+   vkBindBufferMemory(device, preprocess_buffer, preprocess_mem, 0);
+   preprocess_size = memreqs.memoryRequirements.size;
+   preprocess_addr = vk.GetBufferDeviceAddress(device,
+                                               &(VkBufferDeviceAddressInfo) {
+                                                  .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                                                  .buffer = preprocess_buffer
+                                               });
+}
+
+static void
+destroy_gear_programs(void)
+{
+   vkDestroyBuffer(device, preprocess_buffer, NULL);
+   vkFreeMemory(device, preprocess_mem, NULL);
+
+   vk.DestroyIndirectExecutionSetEXT(device, indirect_execution, NULL);
+   vk.DestroyIndirectCommandsLayoutEXT(device, indirect_layout, NULL);
+
+   if (use_shader_object) {
+      for (unsigned i = 0; i < ARRAY_SIZE(vs_shaders); i++)
+         vk.DestroyShaderEXT(device, vs_shaders[i], NULL);
+      vk.DestroyShaderEXT(device, fs_shader, NULL);
+   } else {
+      for (unsigned i = 0; i < ARRAY_SIZE(pipeline); i++)
+         vkDestroyPipeline(device, pipeline[i], NULL);
+   }
+}
+
+static void
+init_animation(void)
+{
+   anim_buffer = create_buffer(sizeof(struct anim_ubo),
+                               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+   anim_mem = allocate_buffer_mem_type(anim_buffer, sizeof(struct anim_ubo),
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, anim_buffer, anim_mem, 0);
+
+   vkCreateDescriptorSetLayout(device,
+      &(VkDescriptorSetLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+         .bindingCount = 3,
+         .pBindings = (VkDescriptorSetLayoutBinding[]) {
+            {
+               .binding = 0,
+               .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+               .descriptorCount = 1,
+               .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+            {
+               .binding = 1,
+               .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+               .descriptorCount = 1,
+               .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+            {
+               .binding = 2,
+               .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+               .descriptorCount = 1,
+               .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+         }
+      },
+      NULL,
+      &anim_set_layout);
+
+   vkCreatePipelineLayout(device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .setLayoutCount = 1,
+         .pSetLayouts = &anim_set_layout,
+      },
+      NULL,
+      &anim_pipeline_layout);
+
+   VkShaderModule module;
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = sizeof(anim_spirv_source),
+         .pCode = anim_spirv_source,
+      },
+      NULL,
+      &module);
+
+   VkResult r = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1,
+      &(VkComputePipelineCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+         .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = module,
+            .pName = "main",
+         },
+         .layout = anim_pipeline_layout,
+      },
+      NULL,
+      &anim_pipeline);
+   vkDestroyShaderModule(device, module, NULL);
+   if (r != VK_SUCCESS)
+      error("Failed to create animation pipeline");
+
+   vkCreateDescriptorPool(device,
+      &(VkDescriptorPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+         .maxSets = 1,
+         .poolSizeCount = 2,
+         .pPoolSizes = (VkDescriptorPoolSize[]) {
+            {
+               .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+               .descriptorCount = 1
+            },
+            {
+               .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+               .descriptorCount = 2
+            },
+         }
+      },
+      NULL,
+      &anim_desc_pool);
+
+   vkAllocateDescriptorSets(device,
+      &(VkDescriptorSetAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+         .descriptorPool = anim_desc_pool,
+         .descriptorSetCount = 1,
+         .pSetLayouts = &anim_set_layout,
+      }, &anim_descriptor_set);
+
+   VkBuffer buffers[] = { anim_buffer, gear_buffer, angle_buffer };
+   VkDescriptorBufferInfo infos[ARRAY_SIZE(buffers)];
+   VkWriteDescriptorSet writes[ARRAY_SIZE(buffers)];
+   for (unsigned i = 0; i < ARRAY_SIZE(buffers); i++) {
+      infos[i] = (VkDescriptorBufferInfo) {
+         .buffer = buffers[i],
+         .offset = 0,
+         .range = VK_WHOLE_SIZE,
+      };
+      writes[i] = (VkWriteDescriptorSet) {
+         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstSet = anim_descriptor_set,
+         .dstBinding = i,
+         .descriptorCount = 1,
+         .descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER :
+                                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .pBufferInfo = &infos[i],
+      };
+   }
+   vkUpdateDescriptorSets(device, ARRAY_SIZE(writes), writes, 0, NULL);
+}
+
+static void
+fini_animation(void)
+{
+   vkDestroyDescriptorPool(device, anim_desc_pool, NULL);
+   vkDestroyPipeline(device, anim_pipeline, NULL);
+   vkDestroyPipelineLayout(device, anim_pipeline_layout, NULL);
+   vkDestroyDescriptorSetLayout(device, anim_set_layout, NULL);
+   vkDestroyBuffer(device, anim_buffer, NULL);
+   vkFreeMemory(device, anim_mem, NULL);
+}
+
+#define GEAR_BINDINGS 4
+
+/* the buffers behind set 0 of the gear shaders, by binding */
+static void
+get_gear_bindings(VkWriteDescriptorSet writes[GEAR_BINDINGS],
+                  VkDescriptorBufferInfo infos[GEAR_BINDINGS])
+{
+   infos[0] = (VkDescriptorBufferInfo) { ubo_buffer, 0, sizeof(struct ubo) };
+   infos[1] = (VkDescriptorBufferInfo) {
+      gear_buffer, 0, scene.gear_count * sizeof(struct gear_params)
+   };
+   infos[2] = (VkDescriptorBufferInfo) { angle_buffer, 0, angle_size };
+   infos[3] = (VkDescriptorBufferInfo) {
+      instance_buffer, 0, scene.gear_count * sizeof(uint32_t)
+   };
+
+   for (unsigned i = 0; i < GEAR_BINDINGS; i++) {
+      writes[i] = (VkWriteDescriptorSet) {
+         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstSet = descriptor_set,
+         .dstBinding = i,
+         .dstArrayElement = 0,
+         .descriptorCount = 1,
+         .descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER :
+                                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .pBufferInfo = &infos[i],
+      };
+   }
+}
+
+static VkDeviceAddress
+get_buffer_address(VkBuffer buffer)
+{
+   return vk.GetBufferDeviceAddress(device,
+                                    &(VkBufferDeviceAddressInfo) {
+                                       .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                                       .buffer = buffer
+                                    });
+}
+
+/*
+ * Set up the gear descriptors for the selected model: a pool and a set
+ * written once, descriptors written once straight into a mapped descriptor
+ * buffer, or nothing at all for push descriptors, which are recorded into
+ * every frame's command buffer.
+ */
+static void
+init_descriptors(void)
+{
+   VkWriteDescriptorSet writes[GEAR_BINDINGS];
+   VkDescriptorBufferInfo infos[GEAR_BINDINGS];
+
+   switch (descriptor_model) {
+   case DESCRIPTOR_MODEL_SETS: {
+      const VkDescriptorPoolCreateInfo create_info = {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+         .pNext = NULL,
+         .flags = 0,
+         .maxSets = 1,
+         .poolSizeCount = 2,
+         .pPoolSizes = (VkDescriptorPoolSize[]) {
+            {
+               .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+               .descriptorCount = 1
+            },
+            {
+               .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+               .descriptorCount = 3
+            },
+         }
+      };
+
+      vkCreateDescriptorPool(device, &create_info, NULL, &desc_pool);
+
+      vkAllocateDescriptorSets(device,
+         &(VkDescriptorSetAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = desc_pool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &set_layout,
+         }, &descriptor_set);
+
+      get_gear_bindings(writes, infos);
+      vkUpdateDescriptorSets(device, GEAR_BINDINGS, writes, 0, NULL);
+      break;
+   }
+   case DESCRIPTOR_MODEL_BUFFER: {
+      VkDeviceSize size;
+      vk.GetDescriptorSetLayoutSizeEXT(device, set_layout, &size);
+      desc_buffer = create_buffer(size,
+                                  VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT |
+                                  VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+      desc_buffer_mem = allocate_buffer_mem(desc_buffer, size);
+      vkBindBufferMemory(device, desc_buffer, desc_buffer_mem, 0);
+      desc_buffer_addr = get_buffer_address(desc_buffer);
+
+      uint8_t *map;
+      if (vkMapMemory(device, desc_buffer_mem, 0, size, 0, (void *)&map) != VK_SUCCESS)
+         error("vkMapMemory failed");
+
+      get_gear_bindings(writes, infos);
+      for (unsigned i = 0; i < GEAR_BINDINGS; i++) {
+         VkDeviceSize offset;
+         vk.GetDescriptorSetLayoutBindingOffsetEXT(device, set_layout, i, &offset);
+
+         VkDescriptorAddressInfoEXT address = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT,
+            .address = get_buffer_address(infos[i].buffer),
+            .range = infos[i].range,
+            .format = VK_FORMAT_UNDEFINED,
+         };
+         bool ubo = writes[i].descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+         vk.GetDescriptorEXT(device,
+            &(VkDescriptorGetInfoEXT) {
+               .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT,
+               .type = writes[i].descriptorType,
+               /* a union: set only the member matching the type */
+               .data = ubo ? (VkDescriptorDataEXT) { .pUniformBuffer = &address } :
+                             (VkDescriptorDataEXT) { .pStorageBuffer = &address },
+            },
+            ubo ? desc_buffer_props.uniformBufferDescriptorSize :
+                  desc_buffer_props.storageBufferDescriptorSize,
+            map + offset);
+      }
+      vkUnmapMemory(device, desc_buffer_mem);
+      break;
+   }
+   case DESCRIPTOR_MODEL_PUSH:
+      break;
+   }
+}
+
+static void
+fini_descriptors(void)
+{
+   vkDestroyDescriptorPool(device, desc_pool, NULL);
+   vkDestroyBuffer(device, desc_buffer, NULL);
+   vkFreeMemory(device, desc_buffer_mem, NULL);
+   desc_pool = VK_NULL_HANDLE;
+   desc_buffer = VK_NULL_HANDLE;
+   desc_buffer_mem = VK_NULL_HANDLE;
+}
+
+static void
+bind_gear_descriptors(VkCommandBuffer cmdbuf)
+{
+   switch (descriptor_model) {
+   case DESCRIPTOR_MODEL_SETS:
+      vk.CmdBindDescriptorSets(cmdbuf,
+         VK_PIPELINE_BIND_POINT_GRAPHICS,
+         pipeline_layout,
+         0, 1,
+         &descriptor_set, 0, NULL);
+      break;
+   case DESCRIPTOR_MODEL_BUFFER:
+      vk.CmdBindDescriptorBuffersEXT(cmdbuf, 1,
+         &(VkDescriptorBufferBindingInfoEXT) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT,
+            .address = desc_buffer_addr,
+            .usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT,
+         });
+      vk.CmdSetDescriptorBufferOffsetsEXT(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                          pipeline_layout, 0, 1,
+                                          (uint32_t[]) { 0 },
+                                          (VkDeviceSize[]) { 0 });
+      break;
+   case DESCRIPTOR_MODEL_PUSH: {
+      VkWriteDescriptorSet writes[GEAR_BINDINGS];
+      VkDescriptorBufferInfo infos[GEAR_BINDINGS];
+      get_gear_bindings(writes, infos);
+      vk.CmdPushDescriptorSetKHR(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                 pipeline_layout, 0, GEAR_BINDINGS, writes);
+      break;
+   }
+   }
+}
+
+/* the bounding sphere of a gear around its position */
+static float
+gear_bound_radius(uint32_t i)
+{
+   /* the streamed meshes grow their teeth by up to 40% */
+   const struct gear_shape *shape = &scene.shapes[scene.gear_shape[i]];
+   float r = shape->outer_radius +
+             shape->tooth_depth * (use_streaming ? 1.4f : 1.0f) / 2.0f;
+   return sqrtf(r * r + shape->width * shape->width / 4.0f);
+}
+
+/* the bounding sphere of every gear, for culling and sizing them on screen */
+static void
+init_radius_buffer(void)
+{
+   VkDeviceSize radius_size = scene.gear_count * sizeof(float);
+   radius_buffer = create_buffer(radius_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   radius_mem = allocate_buffer_mem(radius_buffer, radius_size);
+   vkBindBufferMemory(device, radius_buffer, radius_mem, 0);
+   float *radius_map;
+   if (vkMapMemory(device, radius_mem, 0, radius_size, 0,
+                   (void *)&radius_map) != VK_SUCCESS)
+      error("vkMapMemory failed");
+   for (uint32_t i = 0; i < scene.gear_count; i++)
+      radius_map[i] = gear_bound_radius(i);
+   vkUnmapMemory(device, radius_mem);
+}
+
+static void
+fini_radius_buffer(void)
+{
+   vkDestroyBuffer(device, radius_buffer, NULL);
+   vkFreeMemory(device, radius_mem, NULL);
+}
+
+/*
+ * Buffers of -hiz-cull that follow the scene: the culled streams, as long
+ * as the full one without instancing so a sweep can switch it, and the
+ * counts the executes read.
+ */
+static void
+init_cull_buffers(void)
+{
+   uint32_t sequences = MAX2(max_sequence_count, scene.gear_count);
+   cull_stream_size = sequences * sizeof(indirect_data);
+   cull_window_size = (2 * cull_stream_size + sequences * sizeof(uint32_t) + 255) & ~255;
+   cull_buffer = create_buffer(window_count * cull_window_size,
+                               VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   cull_mem = allocate_buffer_mem_type(cull_buffer, window_count * cull_window_size,
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, cull_buffer, cull_mem, 0);
+   cull_addr = get_buffer_address(cull_buffer);
+
+   VkDeviceSize count_size = MAX_CONCURRENT_FRAMES * WSI_MAX_WINDOWS * 2 * sizeof(uint32_t);
+   cull_count_buffer = create_buffer(count_size,
+                                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   cull_count_mem = allocate_buffer_mem(cull_count_buffer, count_size);
+   vkBindBufferMemory(device, cull_count_buffer, cull_count_mem, 0);
+   if (vkMapMemory(device, cull_count_mem, 0, count_size, 0,
+                   (void *)&cull_count_map) != VK_SUCCESS)
+      error("vkMapMemory failed");
+   cull_count_addr = get_buffer_address(cull_count_buffer);
+}
+
+static void
+fini_cull_buffers(void)
+{
+   vkDestroyBuffer(device, cull_buffer, NULL);
+   vkFreeMemory(device, cull_mem, NULL);
+   vkDestroyBuffer(device, cull_count_buffer, NULL);
+   vkFreeMemory(device, cull_count_mem, NULL);
+}
+
+/*
+ * The gears -damage tracks: every gear if the streamed meshes change
+ * shape, otherwise those the kinematics turn.
+ */
+static void
+init_damage(void)
+{
+   damage_gears = calloc(scene.gear_count, sizeof(*damage_gears));
+   damage_radius = calloc(scene.gear_count, sizeof(*damage_radius));
+   if (!damage_gears || !damage_radius)
+      error("Failed to allocate memory");
+   damage_gear_count = 0;
+   for (uint32_t i = 0; i < scene.gear_count; i++) {
+      if (!use_streaming && kinematics.ratio[i] == 0.0f)
+         continue;
+      damage_gears[damage_gear_count] = i;
+      damage_radius[damage_gear_count++] = gear_bound_radius(i);
+   }
+}
+
+static void
+fini_damage(void)
+{
+   free(damage_gears);
+   free(damage_radius);
+   damage_gears = NULL;
+   damage_radius = NULL;
+}
+
+/* the push constants of sort.comp, one mode per dispatch */
+struct sort_push {
+   VkDeviceAddress input;
+   VkDeviceAddress output;
+   VkDeviceAddress count;
+   VkDeviceAddress keys_in;
+   VkDeviceAddress keys_out;
+   VkDeviceAddress values_in;
+   VkDeviceAddress values_out;
+   VkDeviceAddress histogram;
+   VkDeviceAddress ubo;
+   VkDeviceAddress gears;
+   VkDeviceAddress instances;
+   float view_rot_0;
+   float view_rot_1;
+   uint32_t total;
+   uint32_t mode;
+   uint32_t shift;
+   uint32_t blocks;
+   uint32_t use_count;
+   uint32_t order;
+};
+
+enum sort_mode {
+   SORT_KEYS,
+   SORT_HISTOGRAM,
+   SORT_SCAN,
+   SORT_SCATTER,
+   SORT_GATHER,
+};
+
+static uint32_t
+sort_blocks(void)
+{
+   return (sort_capacity + SORT_BLOCK - 1) / SORT_BLOCK;
+}
+
+/* the vertex buffer of -hud, its layout and, if frames are timed, its timestamps */
+static void
+init_hud(void)
+{
+   VkDeviceSize size = MAX_CONCURRENT_FRAMES * HUD_SLOT_VERTICES * sizeof(struct hud_vertex);
+   hud_buffer = create_buffer(size,
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   hud_mem = allocate_buffer_mem(hud_buffer, size);
+   vkBindBufferMemory(device, hud_buffer, hud_mem, 0);
+   if (vkMapMemory(device, hud_mem, 0, size, 0, (void *)&hud_map) != VK_SUCCESS)
+      error("vkMapMemory failed");
+   hud_addr = get_buffer_address(hud_buffer);
+
+   vkCreatePipelineLayout(device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .pushConstantRangeCount = 1,
+         .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+            .offset = 0,
+            .size = sizeof(struct hud_push),
+         },
+      },
+      NULL,
+      &hud_pipeline_layout);
+
+   memset(hud_pending, 0, sizeof(hud_pending));
+   if (timer_pool) {
+      vkCreateQueryPool(device,
+         &(VkQueryPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = HUD_QUERIES * MAX_CONCURRENT_FRAMES,
+         },
+         NULL,
+         &hud_pool);
+   }
+}
+
+static void
+fini_hud(void)
+{
+   if (!hud_buffer)
+      return;
+   vkDestroyQueryPool(device, hud_pool, NULL);
+   vkDestroyPipelineLayout(device, hud_pipeline_layout, NULL);
+   vkDestroyBuffer(device, hud_buffer, NULL);
+   vkFreeMemory(device, hud_mem, NULL);
+   hud_pool = VK_NULL_HANDLE;
+   hud_buffer = VK_NULL_HANDLE;
+   hud_map = NULL;
+}
+
+/* a persistently mapped buffer for what the CPU writes every frame */
+static VkBuffer
+create_mapped_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                     VkDeviceMemory *mem, void **map)
+{
+   VkBuffer buffer = create_buffer(size, usage);
+   *mem = allocate_buffer_mem(buffer, size);
+   vkBindBufferMemory(device, buffer, *mem, 0);
+   if (vkMapMemory(device, *mem, 0, size, 0, map) != VK_SUCCESS)
+      error("vkMapMemory failed");
+   return buffer;
+}
+
+static VkDeviceSize
+align_size(VkDeviceSize size, VkDeviceSize alignment)
+{
+   return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/*
+ * The pipelines of -rt-shadows, its shader binding table, the layout of
+ * the generated trace rays command and the parameters and commands of
+ * every frame slot and window. Like the depth pyramid pipelines they are
+ * created with the first window that needs them.
+ */
+static void
+init_rt(void)
+{
+   vkCreateSampler(device,
+      &(VkSamplerCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+         .magFilter = VK_FILTER_NEAREST,
+         .minFilter = VK_FILTER_NEAREST,
+         .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+         .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+         .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      },
+      NULL,
+      &rt_sampler);
+
+   vkCreateDescriptorSetLayout(device,
+      &(VkDescriptorSetLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+         .bindingCount = 1,
+         .pBindings = &(VkDescriptorSetLayoutBinding) {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+            .pImmutableSamplers = &rt_sampler,
+         },
+      },
+      NULL,
+      &rt_set_layout);
+
+   vkCreatePipelineLayout(device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .setLayoutCount = 1,
+         .pSetLayouts = &rt_set_layout,
+         .pushConstantRangeCount = 1,
+         .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+            .offset = 0,
+            .size = sizeof(VkDeviceAddress),
+         },
+      },
+      NULL,
+      &rt_pipeline_layout);
+
+   VkShaderModule raygen_module, miss_module;
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = sizeof(rt_raygen_spirv_source),
+         .pCode = rt_raygen_spirv_source,
+      },
+      NULL,
+      &raygen_module);
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = sizeof(rt_miss_spirv_source),
+         .pCode = rt_miss_spirv_source,
+      },
+      NULL,
+      &miss_module);
+
+   /* no hit group: a ray that hits anything is done, and shadowed */
+   VkResult r = vk.CreateRayTracingPipelinesKHR(device, VK_NULL_HANDLE, VK_NULL_HANDLE, 1,
+      &(VkRayTracingPipelineCreateInfoKHR) {
+         .sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR,
+         .stageCount = 2,
+         .pStages = (VkPipelineShaderStageCreateInfo[]) {
+            {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+               .stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+               .module = raygen_module,
+               .pName = "main",
+            },
+            {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+               .stage = VK_SHADER_STAGE_MISS_BIT_KHR,
+               .module = miss_module,
+               .pName = "main",
+            },
+         },
+         .groupCount = 2,
+         .pGroups = (VkRayTracingShaderGroupCreateInfoKHR[]) {
+            {
+               .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+               .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
+               .generalShader = 0,
+               .closestHitShader = VK_SHADER_UNUSED_KHR,
+               .anyHitShader = VK_SHADER_UNUSED_KHR,
+               .intersectionShader = VK_SHADER_UNUSED_KHR,
+            },
+            {
+               .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+               .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
+               .generalShader = 1,
+               .closestHitShader = VK_SHADER_UNUSED_KHR,
+               .anyHitShader = VK_SHADER_UNUSED_KHR,
+               .intersectionShader = VK_SHADER_UNUSED_KHR,
+            },
+         },
+         .maxPipelineRayRecursionDepth = 1,
+         .layout = rt_pipeline_layout,
+      },
+      NULL,
+      &rt_pipeline);
+   vkDestroyShaderModule(device, raygen_module, NULL);
+   vkDestroyShaderModule(device, miss_module, NULL);
+   if (r != VK_SUCCESS)
+      error("Failed to create ray tracing pipeline");
+
+   /* a record per group, each starting at the base alignment */
+   uint32_t handle_size = rt_pipeline_props.shaderGroupHandleSize;
+   VkDeviceSize base_alignment = rt_pipeline_props.shaderGroupBaseAlignment;
+   uint8_t handles[2 * handle_size];
+   if (vk.GetRayTracingShaderGroupHandlesKHR(device, rt_pipeline, 0, 2, sizeof(handles),
+                                             handles) != VK_SUCCESS)
+      error("Failed to get the shader group handles");
+   rt_record_size = align_size(handle_size, base_alignment);
+   VkDeviceSize sbt_size = 2 * rt_record_size + base_alignment;
+   uint8_t *sbt_map;
+   rt_sbt_buffer = create_mapped_buffer(sbt_size,
+                                        VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR |
+                                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                        &rt_sbt_mem, (void **)&sbt_map);
+   VkDeviceAddress sbt_base = get_buffer_address(rt_sbt_buffer);
+   rt_sbt_addr = align_size(sbt_base, base_alignment);
+   memcpy(sbt_map + (rt_sbt_addr - sbt_base), handles, handle_size);
+   memcpy(sbt_map + (rt_sbt_addr - sbt_base) + rt_record_size, handles + handle_size,
+          handle_size);
+   vkUnmapMemory(device, rt_sbt_mem);
+
+   vk.CreateIndirectCommandsLayoutEXT(device,
+                                        &(VkIndirectCommandsLayoutCreateInfoEXT) {
+                                          .sType = VK_STRUCTURE_TYPE_INDIRECT_COMMANDS_LAYOUT_CREATE_INFO_EXT,
+                                          .flags = 0,
+                                          .shaderStages = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
+                                          .indirectStride = sizeof(VkTraceRaysIndirectCommand2KHR),
+                                          .pipelineLayout = rt_pipeline_layout,
+                                          .tokenCount = 1,
+                                          .pTokens = &(VkIndirectCommandsLayoutTokenEXT) {
+                                             .sType = VK_STRUCTURE_TYPE_INDIRECT_COMMANDS_LAYOUT_TOKEN_EXT,
+                                             .type = VK_INDIRECT_COMMANDS_TOKEN_TYPE_TRACE_RAYS2_EXT,
+                                             .offset = 0
+                                          },
+                                        },
+                                        NULL, &rt_indirect_layout);
+
+   /* without an execution set the memory is sized for the bound pipeline */
+   VkMemoryRequirements2 memreqs = {
+      VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+   };
+   vk.GetGeneratedCommandsMemoryRequirementsEXT(device,
+                                                  &(VkGeneratedCommandsMemoryRequirementsInfoEXT) {
+                                                     .sType = VK_STRUCTURE_TYPE_GENERATED_COMMANDS_MEMORY_REQUIREMENTS_INFO_EXT,
+                                                     .pNext = &(VkGeneratedCommandsPipelineInfoEXT) {
+                                                        .sType = VK_STRUCTURE_TYPE_GENERATED_COMMANDS_PIPELINE_INFO_EXT,
+                                                        .pipeline = rt_pipeline,
+                                                     },
+                                                     .indirectCommandsLayout = rt_indirect_layout,
+                                                     .maxSequenceCount = 1,
+                                                  },
+                                                  &memreqs);
+   rt_preprocess_size = MAX2(memreqs.memoryRequirements.size, 4);
+   vkCreateBuffer(device,
+      &(VkBufferCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+         .pNext = &(VkBufferUsageFlags2CreateInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_USAGE_FLAGS_2_CREATE_INFO_KHR,
+            .usage = VK_BUFFER_USAGE_2_PREPROCESS_BUFFER_BIT_EXT | VK_BUFFER_USAGE_2_SHADER_DEVICE_ADDRESS_BIT_KHR,
+         },
+         .size = rt_preprocess_size,
+      },
+      NULL,
+      &rt_preprocess_buffer);
+   vkAllocateMemory(device,
+      &(VkMemoryAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+         .pNext = &(VkMemoryAllocateFlagsInfo) {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+            .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+         },
+         .allocationSize = rt_preprocess_size,
+         .memoryTypeIndex = ffs(memreqs.memoryRequirements.memoryTypeBits) - 1,
+      },
+      NULL,
+      &rt_preprocess_mem);
+   vkBindBufferMemory(device, rt_preprocess_buffer, rt_preprocess_mem, 0);
+   rt_preprocess_addr = get_buffer_address(rt_preprocess_buffer);
+
+   unsigned slots = MAX_CONCURRENT_FRAMES * WSI_MAX_WINDOWS;
+   rt_stream_buffer = create_mapped_buffer(slots * sizeof(VkTraceRaysIndirectCommand2KHR),
+                                           VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                           &rt_stream_mem, (void **)&rt_stream_map);
+   rt_stream_addr = get_buffer_address(rt_stream_buffer);
+   rt_params_buffer = create_mapped_buffer(slots * sizeof(struct rt_params),
+                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                           &rt_params_mem, (void **)&rt_params_map);
+   rt_params_addr = get_buffer_address(rt_params_buffer);
+
+   vkCreatePipelineLayout(device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .pushConstantRangeCount = 1,
+         .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(struct rt_instance_push),
+         },
+      },
+      NULL,
+      &rt_instance_pipeline_layout);
+   rt_instance_pipeline = create_compute_pipeline(rt_instances_spirv_source,
+                                                  sizeof(rt_instances_spirv_source),
+                                                  rt_instance_pipeline_layout);
+
+   vkCreatePipelineLayout(device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .pushConstantRangeCount = 1,
+         .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .offset = 0,
+            .size = sizeof(struct rt_composite_push),
+         },
+      },
+      NULL,
+      &rt_composite_pipeline_layout);
+
+   memset(rt_pending, 0, sizeof(rt_pending));
+   if (timer_pool) {
+      vkCreateQueryPool(device,
+         &(VkQueryPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = RT_QUERIES * MAX_CONCURRENT_FRAMES,
+         },
+         NULL,
+         &rt_pool);
+   }
+}
+
+static void
+fini_rt(void)
+{
+   if (!rt_pipeline)
+      return;
+   vkDestroyQueryPool(device, rt_pool, NULL);
+   vkDestroyPipelineLayout(device, rt_composite_pipeline_layout, NULL);
+   vkDestroyPipeline(device, rt_instance_pipeline, NULL);
+   vkDestroyPipelineLayout(device, rt_instance_pipeline_layout, NULL);
+   vkDestroyBuffer(device, rt_params_buffer, NULL);
+   vkFreeMemory(device, rt_params_mem, NULL);
+   vkDestroyBuffer(device, rt_stream_buffer, NULL);
+   vkFreeMemory(device, rt_stream_mem, NULL);
+   vkDestroyBuffer(device, rt_preprocess_buffer, NULL);
+   vkFreeMemory(device, rt_preprocess_mem, NULL);
+   vk.DestroyIndirectCommandsLayoutEXT(device, rt_indirect_layout, NULL);
+   vkDestroyBuffer(device, rt_sbt_buffer, NULL);
+   vkFreeMemory(device, rt_sbt_mem, NULL);
+   vkDestroyPipeline(device, rt_pipeline, NULL);
+   vkDestroyPipelineLayout(device, rt_pipeline_layout, NULL);
+   vkDestroyDescriptorSetLayout(device, rt_set_layout, NULL);
+   vkDestroySampler(device, rt_sampler, NULL);
+   rt_pool = VK_NULL_HANDLE;
+   rt_pipeline = VK_NULL_HANDLE;
+   rt_params_map = NULL;
+   rt_stream_map = NULL;
+}
+
+/*
+ * A window's visibility mask, sized for its render target like the depth
+ * pyramid, and the set the rays read its depth through.
+ */
+static void
+init_rt_window(struct window *win)
+{
+   if (!rt_pipeline)
+      init_rt();
+
+   VkDeviceSize size = (VkDeviceSize)win->target_width * win->target_height * sizeof(float);
+   win->rt_mask_buffer = create_buffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   win->rt_mask_memory = allocate_buffer_mem_type(win->rt_mask_buffer, size,
+                                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, win->rt_mask_buffer, win->rt_mask_memory, 0);
+   win->rt_mask_addr = get_buffer_address(win->rt_mask_buffer);
+
+   vkCreateDescriptorPool(device,
+      &(VkDescriptorPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+         .maxSets = 1,
+         .poolSizeCount = 1,
+         .pPoolSizes = &(VkDescriptorPoolSize) {
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1
+         },
+      },
+      NULL,
+      &win->rt_desc_pool);
+
+   vkAllocateDescriptorSets(device,
+      &(VkDescriptorSetAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+         .descriptorPool = win->rt_desc_pool,
+         .descriptorSetCount = 1,
+         .pSetLayouts = &rt_set_layout,
+      }, &win->rt_set);
+
+   vkUpdateDescriptorSets(device, 1,
+      &(VkWriteDescriptorSet) {
+         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstSet = win->rt_set,
+         .dstBinding = 0,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+         .pImageInfo = &(VkDescriptorImageInfo) {
+            .imageView = win->depth_view,
+            .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+         },
+      }, 0, NULL);
+}
+
+static void
+fini_rt_window(struct window *win)
+{
+   vkDestroyDescriptorPool(device, win->rt_desc_pool, NULL);
+   vkDestroyBuffer(device, win->rt_mask_buffer, NULL);
+   vkFreeMemory(device, win->rt_mask_memory, NULL);
+   win->rt_desc_pool = VK_NULL_HANDLE;
+   win->rt_mask_buffer = VK_NULL_HANDLE;
+}
+
+/*
+ * A full-screen triangle drawn into a scene pass, the vertex shader being
+ * the resolve's: blended as given, and with depth it is tested and written
+ * like the gears. It depends on the pass formats, so it follows the
+ * swapchains like the HUD pipelines.
+ */
+static VkPipeline
+create_overlay_pipeline(const uint32_t *fs_code, size_t fs_size, VkPipelineLayout layout,
+                        const VkPipelineColorBlendAttachmentState *blend, bool depth)
+{
+   VkShaderModule vs_module, fs_module;
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = sizeof(resolve_vs_spirv_source),
+         .pCode = resolve_vs_spirv_source,
+      },
+      NULL,
+      &vs_module);
+   vkCreateShaderModule(device,
+      &(VkShaderModuleCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+         .codeSize = fs_size,
+         .pCode = fs_code,
+      },
+      NULL,
+      &fs_module);
+
+   VkPipeline pipeline;
+   VkResult r = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+      &(VkGraphicsPipelineCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+         .pNext = &(VkPipelineRenderingCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+            .viewMask = pass_view_mask(),
+            .colorAttachmentCount = 1,
+            .pColorAttachmentFormats = &image_format,
+            .depthAttachmentFormat = depth_format,
+         },
+         .stageCount = 2,
+         .pStages = (VkPipelineShaderStageCreateInfo[]) {
+            {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+               .stage = VK_SHADER_STAGE_VERTEX_BIT,
+               .module = vs_module,
+               .pName = "main",
+            },
+            {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+               .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+               .module = fs_module,
+               .pName = "main",
+            },
+         },
+         .pVertexInputState = &(VkPipelineVertexInputStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+         },
+         .pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+            .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+         },
+         .pViewportState = &(VkPipelineViewportStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+            .viewportCount = 1,
+            .scissorCount = 1,
+         },
+         .pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+            .polygonMode = VK_POLYGON_MODE_FILL,
+            .cullMode = VK_CULL_MODE_NONE,
+            .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+            .lineWidth = 1.0f,
+         },
+         .pMultisampleState = &(VkPipelineMultisampleStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+            .rasterizationSamples = sample_count,
+         },
+         .pDepthStencilState = &(VkPipelineDepthStencilStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+            .depthTestEnable = depth,
+            .depthWriteEnable = depth,
+            .depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
+         },
+         .pColorBlendState = &(VkPipelineColorBlendStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+            .attachmentCount = 1,
+            .pAttachments = blend,
+         },
+         .pDynamicState = &(VkPipelineDynamicStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+            .dynamicStateCount = 2,
+            .pDynamicStates = (VkDynamicState[]) {
+               VK_DYNAMIC_STATE_VIEWPORT,
+               VK_DYNAMIC_STATE_SCISSOR,
+            },
+         },
+         .layout = layout,
+      },
+      NULL,
+      &pipeline);
+   vkDestroyShaderModule(device, vs_module, NULL);
+   vkDestroyShaderModule(device, fs_module, NULL);
+   if (r != VK_SUCCESS)
+      error("Failed to create overlay pipeline");
+   return pipeline;
+}
+
+/* the pass darkening the shadowed pixels, multiplying the color by what it returns */
+static void
+init_rt_composite_pipeline(void)
+{
+   rt_composite_pipeline = create_overlay_pipeline(rt_composite_fs_spirv_source,
+      sizeof(rt_composite_fs_spirv_source), rt_composite_pipeline_layout,
+      &(VkPipelineColorBlendAttachmentState) {
+         .blendEnable = VK_TRUE,
+         .srcColorBlendFactor = VK_BLEND_FACTOR_ZERO,
+         .dstColorBlendFactor = VK_BLEND_FACTOR_SRC_COLOR,
+         .colorBlendOp = VK_BLEND_OP_ADD,
+         .srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+         .dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+         .alphaBlendOp = VK_BLEND_OP_ADD,
+         .colorWriteMask = VK_COLOR_COMPONENT_A_BIT |
+                           VK_COLOR_COMPONENT_R_BIT |
+                           VK_COLOR_COMPONENT_G_BIT |
+                           VK_COLOR_COMPONENT_B_BIT,
+      },
+      false);
+}
+
+static void
+fini_rt_composite_pipeline(void)
+{
+   vkDestroyPipeline(device, rt_composite_pipeline, NULL);
+   rt_composite_pipeline = VK_NULL_HANDLE;
+}
+
+/* a shape's triangles, the strip's n - 2 of them indexed one by one */
+static void
+rt_blas_geometry(uint32_t shape, VkAccelerationStructureGeometryKHR *geometry,
+                 VkAccelerationStructureBuildRangeInfoKHR *range)
+{
+   *geometry = (VkAccelerationStructureGeometryKHR) {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+      .geometry.triangles = {
+         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+         .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+         .vertexData.deviceAddress = get_buffer_address(vertex_buffer),
+         .vertexStride = GEAR_VERTEX_STRIDE * sizeof(float),
+         .maxVertex = total_verts - 1,
+         .indexType = VK_INDEX_TYPE_UINT32,
+         .indexData.deviceAddress = rt_index_addr,
+      },
+      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+   };
+   *range = (VkAccelerationStructureBuildRangeInfoKHR) {
+      .primitiveCount = meshes[shape].vertex_count - 2,
+      .primitiveOffset = rt_blas[shape].index_offset,
+      .firstVertex = meshes[shape].first_vertex,
+   };
+}
+
+static VkAccelerationStructureGeometryKHR
+rt_tlas_geometry(void)
+{
+   return (VkAccelerationStructureGeometryKHR) {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+      .geometry.instances = {
+         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+         .arrayOfPointers = VK_FALSE,
+         .data.deviceAddress = rt_instance_addr,
+      },
+      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+   };
+}
+
+static VkAccelerationStructureKHR
+create_acceleration_structure(VkAccelerationStructureTypeKHR type, VkDeviceSize offset,
+                              VkDeviceSize size)
+{
+   VkAccelerationStructureKHR as;
+   VkResult r = vk.CreateAccelerationStructureKHR(device,
+      &(VkAccelerationStructureCreateInfoKHR) {
+         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+         .buffer = rt_as_buffer,
+         .offset = offset,
+         .size = size,
+         .type = type,
+      },
+      NULL,
+      &as);
+   if (r != VK_SUCCESS)
+      error("Failed to create acceleration structure");
+   return as;
+}
+
+/*
+ * The acceleration structures of -rt-shadows, all in one buffer: a BLAS
+ * per scene shape over its part of the vertex buffer, then the TLAS over
+ * an instance per gear. Only their storage is created here, the first
+ * frame builds them. The BLAS are built together, each with its own part
+ * of the scratch buffer, which the TLAS reuses after them.
+ */
+static void
+init_rt_scene(void)
+{
+   rt_blas = calloc(scene.shape_count, sizeof(*rt_blas));
+   if (!rt_blas)
+      error("out of memory");
+
+   VkDeviceSize index_count = 0;
+   for (uint32_t s = 0; s < scene.shape_count; s++) {
+      rt_blas[s].index_offset = index_count * sizeof(uint32_t);
+      index_count += 3 * (meshes[s].vertex_count - 2);
+   }
+   uint32_t *indices;
+   rt_index_buffer = create_mapped_buffer(index_count * sizeof(uint32_t),
+                                          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                          &rt_index_mem, (void **)&indices);
+   for (uint32_t s = 0; s < scene.shape_count; s++) {
+      uint32_t *tri = indices + rt_blas[s].index_offset / sizeof(uint32_t);
+      for (uint32_t i = 0; i + 2 < meshes[s].vertex_count; i++) {
+         tri[3 * i + 0] = i;
+         tri[3 * i + 1] = i + 1;
+         tri[3 * i + 2] = i + 2;
+      }
+   }
+   vkUnmapMemory(device, rt_index_mem);
+   rt_index_addr = get_buffer_address(rt_index_buffer);
+
+   VkDeviceSize scratch_alignment = rt_as_props.minAccelerationStructureScratchOffsetAlignment;
+   VkDeviceSize as_size = 0, blas_scratch = 0;
+   VkDeviceSize as_offsets[scene.shape_count], as_sizes[scene.shape_count];
+   for (uint32_t s = 0; s < scene.shape_count; s++) {
+      VkAccelerationStructureGeometryKHR geometry;
+      VkAccelerationStructureBuildRangeInfoKHR range;
+      rt_blas_geometry(s, &geometry, &range);
+      VkAccelerationStructureBuildSizesInfoKHR sizes = {
+         VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+      };
+      vk.GetAccelerationStructureBuildSizesKHR(device,
+         VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+         &(VkAccelerationStructureBuildGeometryInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+            .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+            .geometryCount = 1,
+            .pGeometries = &geometry,
+         },
+         &range.primitiveCount, &sizes);
+      /* acceleration structures start at multiples of 256 bytes */
+      as_offsets[s] = as_size;
+      as_sizes[s] = sizes.accelerationStructureSize;
+      as_size = align_size(as_size + sizes.accelerationStructureSize, 256);
+      rt_blas[s].scratch_offset = blas_scratch;
+      blas_scratch = align_size(blas_scratch + sizes.buildScratchSize, scratch_alignment);
+   }
+
+   VkAccelerationStructureGeometryKHR tlas_geometry = rt_tlas_geometry();
+   VkAccelerationStructureBuildSizesInfoKHR tlas_sizes = {
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+   };
+   vk.GetAccelerationStructureBuildSizesKHR(device,
+      VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+      &(VkAccelerationStructureBuildGeometryInfoKHR) {
+         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+         .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+         .flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR |
+                  VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR,
+         .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+         .geometryCount = 1,
+         .pGeometries = &tlas_geometry,
+      },
+      &scene.gear_count, &tlas_sizes);
+   VkDeviceSize tlas_offset = as_size;
+   as_size += tlas_sizes.accelerationStructureSize;
+
+   rt_as_buffer = create_buffer(as_size,
+                                VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+                                VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   rt_as_mem = allocate_buffer_mem_type(rt_as_buffer, as_size,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, rt_as_buffer, rt_as_mem, 0);
+
+   VkDeviceSize scratch_size = MAX2(blas_scratch, MAX2(tlas_sizes.buildScratchSize,
+                                                       tlas_sizes.updateScratchSize));
+   rt_scratch_buffer = create_buffer(scratch_size + scratch_alignment,
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   rt_scratch_mem = allocate_buffer_mem_type(rt_scratch_buffer, scratch_size + scratch_alignment,
+                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, rt_scratch_buffer, rt_scratch_mem, 0);
+   rt_scratch_addr = align_size(get_buffer_address(rt_scratch_buffer), scratch_alignment);
+
+   /* every gear points at the BLAS of its shape */
+   uint64_t *refs;
+   rt_blas_ref_buffer = create_mapped_buffer(scene.gear_count * sizeof(uint64_t),
+                                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                             &rt_blas_ref_mem, (void **)&refs);
+   VkDeviceAddress shape_addr[scene.shape_count];
+   for (uint32_t s = 0; s < scene.shape_count; s++) {
+      rt_blas[s].as = create_acceleration_structure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                                                    as_offsets[s], as_sizes[s]);
+      shape_addr[s] = vk.GetAccelerationStructureDeviceAddressKHR(device,
+         &(VkAccelerationStructureDeviceAddressInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+            .accelerationStructure = rt_blas[s].as,
+         });
+   }
+   for (uint32_t i = 0; i < scene.gear_count; i++)
+      refs[i] = shape_addr[scene.gear_shape[i]];
+   vkUnmapMemory(device, rt_blas_ref_mem);
+   rt_blas_ref_addr = get_buffer_address(rt_blas_ref_buffer);
+
+   rt_tlas = create_acceleration_structure(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+                                           tlas_offset, tlas_sizes.accelerationStructureSize);
+   rt_tlas_addr = vk.GetAccelerationStructureDeviceAddressKHR(device,
+      &(VkAccelerationStructureDeviceAddressInfoKHR) {
+         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+         .accelerationStructure = rt_tlas,
+      });
+
+   VkDeviceSize instance_size = scene.gear_count * sizeof(VkAccelerationStructureInstanceKHR);
+   rt_instance_buffer = create_buffer(instance_size,
+                                      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   rt_instance_mem = allocate_buffer_mem_type(rt_instance_buffer, instance_size,
+                                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, rt_instance_buffer, rt_instance_mem, 0);
+   rt_instance_addr = get_buffer_address(rt_instance_buffer);
+
+   rt_blas_built = false;
+   rt_frame = 0;
+}
+
+static void
+fini_rt_scene(void)
+{
+   vk.DestroyAccelerationStructureKHR(device, rt_tlas, NULL);
+   for (uint32_t s = 0; s < scene.shape_count; s++)
+      vk.DestroyAccelerationStructureKHR(device, rt_blas[s].as, NULL);
+   free(rt_blas);
+   rt_blas = NULL;
+   vkDestroyBuffer(device, rt_instance_buffer, NULL);
+   vkFreeMemory(device, rt_instance_mem, NULL);
+   vkDestroyBuffer(device, rt_blas_ref_buffer, NULL);
+   vkFreeMemory(device, rt_blas_ref_mem, NULL);
+   vkDestroyBuffer(device, rt_scratch_buffer, NULL);
+   vkFreeMemory(device, rt_scratch_mem, NULL);
+   vkDestroyBuffer(device, rt_as_buffer, NULL);
+   vkFreeMemory(device, rt_as_mem, NULL);
+   vkDestroyBuffer(device, rt_index_buffer, NULL);
+   vkFreeMemory(device, rt_index_mem, NULL);
+}
+
+/*
+ * The compute pipelines of -sw-raster, created with the first window like
+ * those of the depth pyramid, and the layout of the merging draw.
+ */
+static void
+init_swr(void)
+{
+   static const struct {
+      VkPipelineLayout *layout;
+      VkShaderStageFlags stages;
+      uint32_t size;
+   } layouts[] = {
+      { &swr_classify_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+        sizeof(struct swr_classify_push) },
+      { &swr_raster_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+        sizeof(struct swr_raster_push) },
+      { &swr_resolve_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT,
+        sizeof(struct swr_resolve_push) },
+   };
+   for (unsigned i = 0; i < ARRAY_SIZE(layouts); i++) {
+      vkCreatePipelineLayout(device,
+         &(VkPipelineLayoutCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &(VkPushConstantRange) {
+               .stageFlags = layouts[i].stages,
+               .offset = 0,
+               .size = layouts[i].size,
+            },
+         },
+         NULL,
+         layouts[i].layout);
+   }
+
+   swr_classify_pipeline = create_compute_pipeline(swr_classify_spirv_source,
+                                                   sizeof(swr_classify_spirv_source),
+                                                   swr_classify_pipeline_layout);
+   swr_raster_pipeline = create_compute_pipeline(swr_raster_spirv_source,
+                                                 sizeof(swr_raster_spirv_source),
+                                                 swr_raster_pipeline_layout);
+   memset(swr_pending, 0, sizeof(swr_pending));
+}
+
+static void
+fini_swr(void)
+{
+   if (!swr_classify_pipeline)
+      return;
+   vkDestroyPipeline(device, swr_raster_pipeline, NULL);
+   vkDestroyPipeline(device, swr_classify_pipeline, NULL);
+   vkDestroyPipelineLayout(device, swr_resolve_pipeline_layout, NULL);
+   vkDestroyPipelineLayout(device, swr_raster_pipeline_layout, NULL);
+   vkDestroyPipelineLayout(device, swr_classify_pipeline_layout, NULL);
+   swr_classify_pipeline = VK_NULL_HANDLE;
+}
+
+/* a window's depth over color, a 64-bit texel per pixel of the render target */
+static void
+init_swr_window(struct window *win)
+{
+   if (!swr_classify_pipeline)
+      init_swr();
+
+   VkDeviceSize size = (VkDeviceSize)win->target_width * win->target_height * sizeof(uint64_t);
+   win->swr_visibility_buffer = create_buffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                                    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   win->swr_visibility_memory = allocate_buffer_mem_type(win->swr_visibility_buffer, size,
+                                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, win->swr_visibility_buffer, win->swr_visibility_memory, 0);
+   win->swr_visibility_addr = get_buffer_address(win->swr_visibility_buffer);
+}
+
+static void
+fini_swr_window(struct window *win)
+{
+   vkDestroyBuffer(device, win->swr_visibility_buffer, NULL);
+   vkFreeMemory(device, win->swr_visibility_memory, NULL);
+   win->swr_visibility_buffer = VK_NULL_HANDLE;
+}
+
+/* the merge, tested and writing depth like the gears, unblended */
+static void
+init_swr_resolve_pipeline(void)
+{
+   swr_resolve_pipeline = create_overlay_pipeline(swr_resolve_fs_spirv_source,
+      sizeof(swr_resolve_fs_spirv_source), swr_resolve_pipeline_layout,
+      &(VkPipelineColorBlendAttachmentState) {
+         .blendEnable = VK_FALSE,
+         .colorWriteMask = VK_COLOR_COMPONENT_A_BIT |
+                           VK_COLOR_COMPONENT_R_BIT |
+                           VK_COLOR_COMPONENT_G_BIT |
+                           VK_COLOR_COMPONENT_B_BIT,
+      },
+      true);
+}
+
+static void
+fini_swr_resolve_pipeline(void)
+{
+   vkDestroyPipeline(device, swr_resolve_pipeline, NULL);
+   swr_resolve_pipeline = VK_NULL_HANDLE;
+}
+
+/*
+ * Buffers of -sw-raster that follow the scene: per window the stream left
+ * to the generated commands, as long as the full one without instancing
+ * like the culled streams, and the small gears, at most a dispatch's worth
+ * of workgroups. Then the counts and the material of every gear.
+ */
+static void
+init_swr_buffers(void)
+{
+   VkPhysicalDeviceProperties properties;
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+   swr_capacity = MIN2(scene.gear_count, properties.limits.maxComputeWorkGroupCount[0]);
+
+   uint32_t sequences = MAX2(max_sequence_count, scene.gear_count);
+   swr_stream_size = sequences * sizeof(indirect_data);
+   swr_window_size = (swr_stream_size + swr_capacity * 4 * sizeof(uint32_t) + 255) & ~255;
+   swr_buffer = create_buffer(window_count * swr_window_size,
+                              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   swr_mem = allocate_buffer_mem_type(swr_buffer, window_count * swr_window_size,
+                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, swr_buffer, swr_mem, 0);
+   swr_addr = get_buffer_address(swr_buffer);
+
+   VkDeviceSize count_size = MAX_CONCURRENT_FRAMES * WSI_MAX_WINDOWS * sizeof(struct swr_counts);
+   swr_count_buffer = create_buffer(count_size,
+                                    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   swr_count_mem = allocate_buffer_mem(swr_count_buffer, count_size);
+   vkBindBufferMemory(device, swr_count_buffer, swr_count_mem, 0);
+   if (vkMapMemory(device, swr_count_mem, 0, count_size, 0,
+                   (void *)&swr_count_map) != VK_SUCCESS)
+      error("vkMapMemory failed");
+   swr_count_addr = get_buffer_address(swr_count_buffer);
+
+   VkDeviceSize material_size = scene.gear_count * sizeof(uint32_t);
+   swr_material_buffer = create_buffer(material_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   swr_material_mem = allocate_buffer_mem(swr_material_buffer, material_size);
+   vkBindBufferMemory(device, swr_material_buffer, swr_material_mem, 0);
+   void *material_map;
+   if (vkMapMemory(device, swr_material_mem, 0, material_size, 0,
+                   &material_map) != VK_SUCCESS)
+      error("vkMapMemory failed");
+   memcpy(material_map, scene.gear_material, material_size);
+   vkUnmapMemory(device, swr_material_mem);
+}
+
+static void
+fini_swr_buffers(void)
+{
+   vkDestroyBuffer(device, swr_buffer, NULL);
+   vkFreeMemory(device, swr_mem, NULL);
+   vkDestroyBuffer(device, swr_count_buffer, NULL);
+   vkFreeMemory(device, swr_count_mem, NULL);
+   vkDestroyBuffer(device, swr_material_buffer, NULL);
+   vkFreeMemory(device, swr_material_mem, NULL);
+}
+
+/*
+ * Buffers and pipeline of -sequence-order, sized like the culled streams
+ * so a sweep of the sequence count never outgrows them.
+ */
+static void
+init_sort(void)
+{
+   sort_capacity = MAX2(max_sequence_count, scene.gear_count);
+   VkDeviceSize n = sort_capacity;
+   VkDeviceSize size = 16 * n + 256 * sort_blocks() * sizeof(uint32_t) +
+                       2 * n * sizeof(indirect_data);
+   sort_buffer = create_buffer(size,
+                               VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   sort_mem = allocate_buffer_mem_type(sort_buffer, size,
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, sort_buffer, sort_mem, 0);
+   sort_addr = get_buffer_address(sort_buffer);
+
+   vkCreatePipelineLayout(device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .pushConstantRangeCount = 1,
+         .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(struct sort_push),
+         },
+      },
+      NULL,
+      &sort_pipeline_layout);
+   sort_pipeline = create_compute_pipeline(sort_spirv_source,
+                                           sizeof(sort_spirv_source),
+                                           sort_pipeline_layout);
+}
+
+static void
+fini_sort(void)
+{
+   vkDestroyPipeline(device, sort_pipeline, NULL);
+   vkDestroyPipelineLayout(device, sort_pipeline_layout, NULL);
+   vkDestroyBuffer(device, sort_buffer, NULL);
+   vkFreeMemory(device, sort_mem, NULL);
+}
+
+static void
+init_gears()
+{
+   VkResult r;
+
+   max_sequence_count = replaying ? replay_trace.header->max_sequence_count :
+                                    scene_sequence_count();
+   sequence_count = max_sequence_count;
+
+   /* the shader layouts of the execution set reuse this layout */
+   VkDescriptorSetLayoutCreateFlags layout_flags[] = {
+      [DESCRIPTOR_MODEL_SETS] = 0,
+      [DESCRIPTOR_MODEL_BUFFER] = VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT,
+      [DESCRIPTOR_MODEL_PUSH] = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
+   };
+   vkCreateDescriptorSetLayout(device,
+      &(VkDescriptorSetLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+         .flags = layout_flags[descriptor_model],
+         .bindingCount = 4,
+         .pBindings = (VkDescriptorSetLayoutBinding[]) {
+            {
+               .binding = 0,
+               .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+               .descriptorCount = 1,
+               .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+               .pImmutableSamplers = NULL
+            },
+            {
+               .binding = 1,
+               .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+               .descriptorCount = 1,
+               .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+               .pImmutableSamplers = NULL
+            },
+            {
+               .binding = 2,
+               .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+               .descriptorCount = 1,
+               .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+               .pImmutableSamplers = NULL
+            },
+            {
+               .binding = 3,
+               .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+               .descriptorCount = 1,
+               .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+               .pImmutableSamplers = NULL
+            }
+         }
+      },
+      NULL,
+      &set_layout);
+
+   vkCreatePipelineLayout(device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+         .setLayoutCount = 1,
+         .pSetLayouts = &set_layout,
+         .pPushConstantRanges = (VkPushConstantRange[]) {
+            {
+               .offset = 0,
+               .size = sizeof(struct push_constants),
+               .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+            },
+         },
+         .pushConstantRangeCount = 1,
+      },
+      NULL,
+      &pipeline_layout);
+
+   create_gear_programs();
+
+   vertex_offset = 0;
+   normals_offset = sizeof(float) * 3;
+   ubo_buffer = create_buffer(sizeof(struct ubo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                                                  VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                                  VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   ubo_mem = allocate_buffer_mem(ubo_buffer, sizeof(struct ubo));
+   vkBindBufferMemory(device, ubo_buffer, ubo_mem, 0);
+
+   /* per-gear placement, copied from the scene with the solved ratios */
+   VkDeviceSize gear_size = scene.gear_count * sizeof(struct gear_params);
+   gear_buffer = create_buffer(gear_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   gear_mem = allocate_buffer_mem(gear_buffer, gear_size);
+   vkBindBufferMemory(device, gear_buffer, gear_mem, 0);
+   struct gear_params *gear_map;
+   r = vkMapMemory(device, gear_mem, 0, gear_size, 0, (void *)&gear_map);
+   if (r != VK_SUCCESS)
+      error("vkMapMemory failed");
+   memcpy(gear_map, scene.params, gear_size);
+   for (uint32_t i = 0; i < scene.gear_count; i++) {
+      gear_map[i].angle_ratio = kinematics.ratio[i];
+      gear_map[i].phase = kinematics.phase[i];
+   }
+   vkUnmapMemory(device, gear_mem);
+
+   VkDeviceSize instance_size = scene.gear_count * sizeof(uint32_t);
+   instance_buffer = create_buffer(instance_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                  VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   instance_mem = allocate_buffer_mem(instance_buffer, instance_size);
+   vkBindBufferMemory(device, instance_buffer, instance_mem, 0);
+   void *instance_map;
+   r = vkMapMemory(device, instance_mem, 0, instance_size, 0, &instance_map);
+   if (r != VK_SUCCESS)
+      error("vkMapMemory failed");
+   memcpy(instance_map, instance_gears, instance_size);
+   vkUnmapMemory(device, instance_mem);
+
+   angle_size = (scene.gear_count * sizeof(float) + 255) & ~255;
+   angle_buffer = create_buffer(angle_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                            VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+   angle_mem = allocate_buffer_mem_type(angle_buffer, angle_size,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   vkBindBufferMemory(device, angle_buffer, angle_mem, 0);
+   if (gpu_animation) {
+      init_animation();
+   } else {
+      angle_staging = create_buffer(angle_size * MAX_CONCURRENT_FRAMES,
+                                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+      angle_staging_mem = allocate_buffer_mem(angle_staging,
+                                              angle_size * MAX_CONCURRENT_FRAMES);
+      vkBindBufferMemory(device, angle_staging, angle_staging_mem, 0);
+      r = vkMapMemory(device, angle_staging_mem, 0, angle_size * MAX_CONCURRENT_FRAMES,
+                      0, (void *)&angle_staging_map);
+      if (r != VK_SUCCESS)
+         error("vkMapMemory failed");
+   }
+
+   if (use_streaming) {
+      init_streaming();
+      int g = stream_upload(0.0);
+      assert(g >= 0);
+      stream.current = g;
+      stream_acquire();
+   } else {
+      VkDeviceSize mem_size = sizeof(float) * GEAR_VERTEX_STRIDE * total_verts;
+      /* the shadow rays' BLAS and the software rasterizer read it too */
+      vertex_buffer = create_buffer(mem_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                    (rt_shadows ? VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR : 0) |
+                                    (rt_shadows || swr_threshold > 0.0f ?
+                                     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT : 0));
+      vertex_mem = allocate_buffer_mem(vertex_buffer, mem_size);
+
+      size_t indirect_size = scene.gear_count * sizeof(indirect_data);
+      indirect_buffer = create_buffer(indirect_size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+      indirect_mem = allocate_buffer_mem(indirect_buffer, indirect_size);
+
+      vkMapMemory(device, indirect_mem, 0, indirect_size, 0, (void*)&indirect_map);
+      fill_indirect_data(indirect_map);
+      vkBindBufferMemory(device, indirect_buffer, indirect_mem, 0);
+      indirect_addr = vk.GetBufferDeviceAddress(device,
+                                                 &(VkBufferDeviceAddressInfo) {
+                                                    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                                                    .buffer = indirect_buffer
+                                                 });
+
+      void *map;
+      r = vkMapMemory(device, vertex_mem, 0, mem_size, 0, &map);
+      if (r != VK_SUCCESS)
+         error("vkMapMemory failed");
+      build_gears(map, 1.0);
+      vkUnmapMemory(device, vertex_mem);
+
+      vkBindBufferMemory(device, vertex_buffer, vertex_mem, 0);
+   }
+
+   if (replaying)
+      init_replay();
+   if (hiz_cull || swr_threshold > 0.0f)
+      init_radius_buffer();
+   if (hiz_cull)
+      init_cull_buffers();
+   if (swr_threshold > 0.0f)
+      init_swr_buffers();
+   if (sort_enabled)
+      init_sort();
+   if (damage_tracking)
+      init_damage();
+   if (rt_shadows)
+      init_rt_scene();
+
+   init_descriptors();
+}
+
+static void
+fini_gears(void)
+{
+   if (replaying)
+      fini_replay();
+   if (hiz_cull || swr_threshold > 0.0f)
+      fini_radius_buffer();
+   if (hiz_cull)
+      fini_cull_buffers();
+   if (swr_threshold > 0.0f)
+      fini_swr_buffers();
+   if (sort_enabled)
+      fini_sort();
+   if (damage_tracking)
+      fini_damage();
+   if (rt_shadows)
+      fini_rt_scene();
+   if (use_streaming) {
+      fini_streaming();
+   } else {
+      vkDestroyBuffer(device, vertex_buffer, NULL);
+      vkFreeMemory(device, vertex_mem, NULL);
+      vkDestroyBuffer(device, indirect_buffer, NULL);
+      vkFreeMemory(device, indirect_mem, NULL);
+   }
+   vkDestroyBuffer(device, ubo_buffer, NULL);
+   vkFreeMemory(device, ubo_mem, NULL);
+   vkDestroyBuffer(device, gear_buffer, NULL);
+   vkFreeMemory(device, gear_mem, NULL);
+   vkDestroyBuffer(device, instance_buffer, NULL);
+   vkFreeMemory(device, instance_mem, NULL);
+   vkDestroyBuffer(device, angle_buffer, NULL);
+   vkFreeMemory(device, angle_mem, NULL);
+   if (gpu_animation) {
+      fini_animation();
+   } else {
+      vkDestroyBuffer(device, angle_staging, NULL);
+      vkFreeMemory(device, angle_staging_mem, NULL);
+   }
+   destroy_gear_programs();
+
+   fini_descriptors();
+   vkDestroyPipelineLayout(device, pipeline_layout, NULL);
+   vkDestroyDescriptorSetLayout(device, set_layout, NULL);
+}
+
+/* never wrapped: each gear reduces its own ratio * angle, so a wrap of the
+ * frame angle would make gears with a fractional ratio jump */
+double angle = 0.0;
+static struct push_constants frame_push;
+/* the unreduced angle of frame_push, which only carries it modulo 360 */
+static double frame_angle;
+
+/* the view of the first window, which is what traces record */
+static void
+update_push_constants(void)
+{
+   frame_angle = angle;
+   frame_push.angle = (float)fmod(angle, 360.0);
+   frame_push.view_rot_0 = view_rot[0];
+   frame_push.view_rot_1 = view_rot[1];
+   frame_push.h = (float)windows[0].height / windows[0].width;
+}
+
+#define G2L(x) ((x) < 0.04045 ? (x) / 12.92 : powf(((x) + 0.055) / 1.055, 2.4))
+
+/*
+ * The number of sequences run is read from count_addr unless it is 0, and
+ * only scissor is drawn unless it is NULL.
+ */
+static void
+draw_gears(VkCommandBuffer cmdbuf, const struct window *win,
+           const struct push_constants *push, VkDeviceAddress stream,
+           VkDeviceAddress count_addr, const VkRect2D *scissor)
+{
+   VkRect2D area = { { 0, 0 }, { win->render_width, win->render_height } };
+   if (scissor)
+      area = *scissor;
+
+   vk.CmdBindVertexBuffers(cmdbuf, 0, 2,
+      (VkBuffer[]) {
+         vertex_buffer,
+         vertex_buffer,
+      },
+      (VkDeviceSize[]) {
+         vertex_offset,
+         normals_offset
+      });
+
+   if (use_shader_object)
+      vk.CmdBindShadersEXT(cmdbuf, 2, (VkShaderStageFlagBits[]) { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT }, (VkShaderEXT[]){vs_shaders[0], fs_shader});
+   else
+      vk.CmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline[0]);
+
+   double bind_start = current_time();
+   bind_gear_descriptors(cmdbuf);
+   bind_time += current_time() - bind_start;
+
+   if (use_shader_object) {
+      vk.CmdSetViewportWithCount(cmdbuf, 1,
+         (VkViewport[]) {
+            {
+               .x = 0,
+               .y = 0,
+               .width = win->render_width,
+               .height = win->render_height,
+               .minDepth = 0,
+               .maxDepth = 1,
+            }
+         });
+
+      vk.CmdSetScissorWithCount(cmdbuf, 1, &area);
+      vk.CmdSetVertexInputEXT(cmdbuf,
+            2, (VkVertexInputBindingDescription2EXT[]) {
+            {
+               .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT,
+               .binding = 0,
+               .stride = 6 * sizeof(float),
+               .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+               .divisor = 1,
+            },
+            {
+               .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT,
+               .binding = 1,
+               .stride = 6 * sizeof(float),
+               .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+               .divisor = 1,
+            },
+         },
+         2, (VkVertexInputAttributeDescription2EXT[]) {
+            {
+               .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT,
+               .location = 0,
+               .binding = 0,
+               .format = VK_FORMAT_R32G32B32_SFLOAT,
+               .offset = 0
+            },
+            {
+               .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT,
+               .location = 1,
+               .binding = 1,
+               .format = VK_FORMAT_R32G32B32_SFLOAT,
+               .offset = 0
+            },
+         }
+      );
+      vk.CmdSetPrimitiveTopologyEXT(cmdbuf, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+      vk.CmdSetPrimitiveRestartEnableEXT(cmdbuf, VK_FALSE);
+      vk.CmdSetRasterizerDiscardEnableEXT(cmdbuf, VK_FALSE);
+      vk.CmdSetCullModeEXT(cmdbuf, VK_CULL_MODE_BACK_BIT);
+      vk.CmdSetFrontFaceEXT(cmdbuf, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+      vk.CmdSetDepthTestEnableEXT(cmdbuf, VK_TRUE);
+      vk.CmdSetDepthWriteEnableEXT(cmdbuf, VK_TRUE);
+      vk.CmdSetDepthCompareOpEXT(cmdbuf, VK_COMPARE_OP_LESS_OR_EQUAL);
+      vk.CmdSetDepthBoundsTestEnableEXT(cmdbuf, VK_FALSE);
+      vk.CmdSetPolygonModeEXT(cmdbuf, VK_POLYGON_MODE_FILL);
+      vk.CmdSetRasterizationSamplesEXT(cmdbuf, sample_count);
+      vk.CmdSetLogicOpEnableEXT(cmdbuf, VK_FALSE);
+      vk.CmdSetAlphaToCoverageEnableEXT(cmdbuf, VK_FALSE);
+      vk.CmdSetAlphaToOneEnableEXT(cmdbuf, VK_FALSE);
+      vk.CmdSetDepthClampEnableEXT(cmdbuf, VK_FALSE);
+      vk.CmdSetSampleMaskEXT(cmdbuf, sample_count, (VkSampleMask[]){UINT32_MAX});
+      vk.CmdSetColorWriteMaskEXT(cmdbuf, 0, 1, (VkColorComponentFlags[]){ VK_COLOR_COMPONENT_A_BIT |
+                                          VK_COLOR_COMPONENT_R_BIT |
+                                          VK_COLOR_COMPONENT_G_BIT |
+                                          VK_COLOR_COMPONENT_B_BIT});
+      vk.CmdSetColorBlendEnableEXT(cmdbuf, 0, 1, (VkBool32[]){VK_FALSE});
+   } else {
+      vk.CmdSetViewport(cmdbuf, 0, 1,
+         &(VkViewport) {
+            .x = 0,
+            .y = 0,
+            .width = win->render_width,
+            .height = win->render_height,
+            .minDepth = 0,
+            .maxDepth = 1,
+         });
+
+      vk.CmdSetScissor(cmdbuf, 0, 1, &area);
+   }
+
+   vk.CmdPushConstants(cmdbuf, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+                       0, sizeof(*push), push);
+
+   // vk.CmdDraw(cmdbuf, meshes[0].vertex_count, 1, meshes[0].first_vertex, 0);
+   // vk.CmdDrawIndirect(cmdbuf, indirect_buffer, 0, 1, 0);
+   vk.CmdExecuteGeneratedCommandsEXT(cmdbuf, VK_FALSE,
+                                       &(VkGeneratedCommandsInfoEXT) {
+                                          .sType = VK_STRUCTURE_TYPE_GENERATED_COMMANDS_INFO_EXT,
+                                          .shaderStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                                          .indirectExecutionSet = indirect_execution,
+                                          .indirectCommandsLayout = indirect_layout,
+                                          .indirectAddress = stream,
+                                          .indirectAddressSize = sequence_count * sizeof(indirect_data),
+                                          .preprocessAddress = preprocess_addr,
+                                          .preprocessSize = preprocess_size,
+                                          .maxSequenceCount = sequence_count,
+                                          .sequenceCountAddress = count_addr,
+                                       });
+}
+
+static const char *
+present_mode_str(VkPresentModeKHR mode)
+{
+   switch (mode) {
+   case VK_PRESENT_MODE_IMMEDIATE_KHR:
+      return "immediate";
+   case VK_PRESENT_MODE_MAILBOX_KHR:
+      return "mailbox";
+   case VK_PRESENT_MODE_FIFO_KHR:
+      return "fifo";
+   case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+      return "fifo-relaxed";
+   default:
+      return "other";
+   }
+}
+
+static const char *
+get_devtype_str(VkPhysicalDeviceType devtype)
+{
+   static char buf[256];
+   switch (devtype) {
+   case VK_PHYSICAL_DEVICE_TYPE_OTHER:
+      return "other";
+   case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+      return "integrated GPU";
+   case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+      return "discrete GPU";
+   case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+      return "virtual GPU";
+   case VK_PHYSICAL_DEVICE_TYPE_CPU:
+      return "CPU";
+   default:
+      snprintf(buf, sizeof(buf), "Unknown (%08x)", devtype);
+      return buf;
+   }
+}
+
+static void
+usage(void)
+{
+   printf("Usage:\n");
+   printf("  -samples N              run in multisample mode with N samples\n");
+   printf("  -present-mailbox        run with present mode mailbox\n");
+   printf("  -present-immediate      run with present mode immediate\n");
+   printf("  -shader-object          run with shader objects\n");
+   printf("  -stream                 stream gear geometry through a transfer queue\n");
+   printf("  -fullscreen             run in fullscreen mode\n");
+   printf("  -info                   display Vulkan device info\n");
+   printf("  -size WxH               window size\n");
+   printf("  -device D               use device D (index, UUID or name substring)\n");
+   printf("  -sweep-devices          benchmark every device supporting DGC\n");
+   printf("  -duration S             run for S seconds and print frame statistics\n");
+   printf("  -headless               render without a window\n");
+   printf("  -capture FILE           write a frame to FILE (PPM)\n");
+   printf("  -capture-frame N        frame to capture (default 30)\n");
+   printf("  -compare FILE           compare the captured frame against FILE\n");
+   printf("  -tolerance N            largest per-channel difference accepted (default 2)\n");
+   printf("  -record FILE            record the DGC inputs of every frame to FILE\n");
+   printf("  -replay FILE            replay a recorded DGC trace\n");
+   printf("  -scene FILE             load gears from a scene file (text or binary)\n");
+   printf("  -scene-export FILE      write the loaded scene in the binary format\n");
+   printf("  -threads N              kinematics worker threads (default one per CPU)\n");
+   printf("  -gpu-animation          derive gear angles in a compute pass\n");
+   printf("  -hiz-cull               cull gears against the last frame's depth pyramid\n");
+   printf("  -sequence-order M       sort the sequences by scene, state, depth or state-depth\n");
+   printf("  -damage                 redraw and present only what moved since the last frame\n");
+   printf("  -hud                    draw frame times, GPU phases and counters over the gears\n");
+   printf("  -rt-shadows             darken what ray traced shadow rays find blocked\n");
+   printf("  -sw-raster PX           rasterize gears below PX pixels of radius in compute\n");
+   printf("  -loader-dispatch        call the device through the loader's trampolines\n");
+   printf("  -sweep-config           benchmark binding model x samples x present mode\n");
+   printf("  -sweep-samples N,...    sample counts to sweep (default 1,2,4,8)\n");
+   printf("  -sweep-present M,...    present modes to sweep (fifo,mailbox,immediate)\n");
+   printf("  -sweep-binding B,...    binding models to sweep (pipeline,shader-object)\n");
+   printf("  -sweep-instancing I,... instancing settings to sweep (off,on)\n");
+   printf("  -instancing             draw gears sharing a mesh as one instanced sequence\n");
+   printf("  -descriptor-model M     gear descriptors through sets, buffer or push\n");
+   printf("  -sweep-descriptor M,... descriptor models to sweep (sets,buffer,push)\n");
+   printf("  -depth F                depth format: auto, d16, d24 or d32\n");
+   printf("  -resolve R              MSAA resolve: pass, cmd or shader\n");
+   printf("  -sweep-depth F,...      depth formats to sweep (d16,d24,d32)\n");
+   printf("  -sweep-resolve R,...    MSAA resolve modes to sweep (pass,cmd,shader)\n");
+   printf("  -dynamic-res MS         scale the render resolution to hit MS of GPU time\n");
+   printf("  -dynamic-res-range A,B  smallest and largest render scale (default 0.5,1.0)\n");
+   printf("  -windows N              render N windows from one submit and present\n");
+   printf("  -multiview N            render N views (2 to 8) into a layered target\n");
+   printf("  -stereo                 render a left and right eye view\n");
+   printf("  -multiview-mode M       pass (one multiview pass) or per-view (pass each)\n");
+   printf("  -sweep-multiview M,...  multiview modes to sweep (pass,per-view)\n");
+   printf("  -swapchain-images N     request N swapchain images (default 2)\n");
+   printf("  -frames-in-flight N     record up to N frames ahead of the GPU (default 2)\n");
+   printf("  -autotune G             tune images, frames in flight and present mode for\n");
+   printf("                          goal G: fps, latency or latency:FPS (with an FPS floor)\n");
+   printf("  -autotune-time S        seconds to measure each configuration (default 1)\n");
+   printf("  -autotune-retune        measure again even if a tuned result is stored\n");
+   printf("  -stall-dump FILE        dump recent frame timings to FILE.N on a stall\n");
+   printf("  -stall-threshold X      a stall takes X times the median frame (default 3)\n");
+   printf("  -control PATH           take commands on a Unix socket (try 'help')\n");
+   printf("  -stats NAME             publish live counters in shared memory object NAME\n");
+   printf("  -monitor NAME           print the counters another process publishes\n");
+   printf("  -ab-runs K              run the configuration K times for -duration seconds each\n");
+   printf("                          and bootstrap its median and p99 frame times\n");
+   printf("  -ab-output FILE         save the frame times of the runs to FILE\n");
+   printf("  -ab-compare A B         compare two saved results, failing on a regression of B\n");
+   printf("  -ab-threshold P         smallest slowdown in percent reported (default 1)\n");
+}
+
+static void
+print_info()
+{
+   VkPhysicalDeviceProperties properties;
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+   printf("apiVersion       = %d.%d.%d\n",
+            VK_API_VERSION_MAJOR(properties.apiVersion),
+            VK_API_VERSION_MINOR(properties.apiVersion),
+            VK_API_VERSION_PATCH(properties.apiVersion));
+   printf("driverVersion    = %04x\n", properties.driverVersion);
+   printf("vendorID         = %04x\n", properties.vendorID);
+   printf("deviceID         = %04x\n", properties.deviceID);
+   printf("deviceType       = %s\n", get_devtype_str(properties.deviceType));
+   printf("deviceName       = %s\n", properties.deviceName);
+
+   char uuid[33];
+   get_device_uuid(physical_device, uuid);
+   printf("deviceUUID       = %s\n", uuid);
+
+   uint32_t num_extensions = 0;
+   VkExtensionProperties *extensions;
+   vkEnumerateDeviceExtensionProperties(physical_device, NULL, &num_extensions, NULL);
+   if (num_extensions > 0) {
+      extensions = calloc(num_extensions, sizeof(VkExtensionProperties));
+      if (!extensions)
+         error("Failed to allocate memory");
+
+      vkEnumerateDeviceExtensionProperties(physical_device, NULL, &num_extensions, extensions);
+      printf("deviceExtensions =\n");
+      for (int i = 0; i < num_extensions; ++i)
+         printf("\t%s\n", extensions[i].extensionName);
+   }
+}
+
+static VkSampleCountFlagBits
+sample_count_flag(int sample_count)
+{
+   switch (sample_count) {
+   case 1:
+      return VK_SAMPLE_COUNT_1_BIT;
+   case 2:
+      return VK_SAMPLE_COUNT_2_BIT;
+   case 4:
+      return VK_SAMPLE_COUNT_4_BIT;
+   case 8:
+      return VK_SAMPLE_COUNT_8_BIT;
+   case 16:
+      return VK_SAMPLE_COUNT_16_BIT;
+   case 32:
+      return VK_SAMPLE_COUNT_32_BIT;
+   case 64:
+      return VK_SAMPLE_COUNT_64_BIT;
+   default:
+      error("Invalid sample count");
+   }
+   return VK_SAMPLE_COUNT_1_BIT;
+}
+
+static bool
+check_sample_count_support(VkSampleCountFlagBits sample_count)
+{
+   VkPhysicalDeviceProperties properties;
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+   return (sample_count & properties.limits.framebufferColorSampleCounts) &&
+      (sample_count & properties.limits.framebufferDepthSampleCounts);
+}
+
+static bool
+check_indirect_commands_graphics_support(bool shader_object)
+{
+   VkPhysicalDeviceDeviceGeneratedCommandsPropertiesEXT dgcproperties = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DEVICE_GENERATED_COMMANDS_PROPERTIES_EXT,
+   };
+   VkPhysicalDeviceProperties2 properties = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &dgcproperties,
+   };
+   vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+   const VkShaderStageFlags flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+   if (shader_object)
+      return (dgcproperties.supportedIndirectCommandsShaderStagesShaderBinding & flags) == flags;
+   else
+      return (dgcproperties.supportedIndirectCommandsShaderStagesPipelineBinding & flags) == flags;
+}
+
+/* what -rt-shadows needs: the pipelines, trace rays 2 and generating it */
+static bool
+check_ray_tracing_support(void)
+{
+   static const char *const extensions[] = {
+      VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+      VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,
+      VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+      VK_KHR_RAY_TRACING_MAINTENANCE_1_EXTENSION_NAME,
+   };
+   for (unsigned i = 0; i < ARRAY_SIZE(extensions); i++) {
+      if (!device_supports_extension(physical_device, extensions[i]))
+         return false;
+   }
+
+   VkPhysicalDeviceRayTracingMaintenance1FeaturesKHR rtmaintfeats = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_MAINTENANCE_1_FEATURES_KHR,
+   };
+   VkPhysicalDeviceRayTracingPipelineFeaturesKHR rtfeats = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR,
+      .pNext = &rtmaintfeats,
+   };
+   VkPhysicalDeviceAccelerationStructureFeaturesKHR asfeats = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+      .pNext = &rtfeats,
+   };
+   vkGetPhysicalDeviceFeatures2(physical_device, &(VkPhysicalDeviceFeatures2) {
+         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+         .pNext = &asfeats,
+      });
+   if (!asfeats.accelerationStructure || !rtfeats.rayTracingPipeline ||
+       !rtmaintfeats.rayTracingPipelineTraceRaysIndirect2)
+      return false;
+
+   VkPhysicalDeviceDeviceGeneratedCommandsPropertiesEXT dgcproperties = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DEVICE_GENERATED_COMMANDS_PROPERTIES_EXT,
+   };
+   vkGetPhysicalDeviceProperties2(physical_device, &(VkPhysicalDeviceProperties2) {
+         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+         .pNext = &dgcproperties,
+      });
+   const VkShaderStageFlags flags = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR;
+   return (dgcproperties.supportedIndirectCommandsShaderStages & flags) == flags;
+}
+
+/* what -sw-raster needs: 64-bit atomics on the visibility buffer */
+static bool
+check_swr_support(void)
+{
+   VkPhysicalDeviceVulkan12Features feats12 = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+   };
+   VkPhysicalDeviceFeatures2 feats = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &feats12,
+   };
+   vkGetPhysicalDeviceFeatures2(physical_device, &feats);
+   return feats.features.shaderInt64 && feats12.shaderBufferInt64Atomics;
+}
+
+static void
+wsi_resize(unsigned window, int p_new_width, int p_new_height)
+{
+   if (window >= window_count)
+      return;
+   windows[window].new_width = p_new_width;
+   windows[window].new_height = p_new_height;
+}
+
+static void
+wsi_key_press(bool down, enum wsi_key key) {
+   if (!down)
+      return;
+   switch (key) {
+      case WSI_KEY_ESC:
+         exit(0);
+      case WSI_KEY_UP:
+         view_rot[0] += 5.0;
+         break;
+      case WSI_KEY_DOWN:
+         view_rot[0] -= 5.0;
+         break;
+      case WSI_KEY_LEFT:
+         view_rot[1] += 5.0;
+         break;
+      case WSI_KEY_RIGHT:
+         view_rot[1] -= 5.0;
+         break;
+      case WSI_KEY_A:
+         animate = !animate;
+         break;
+      default:
+         break;
+   }
+}
+
+static void
+wsi_exit()
+{
+   exit(0);
+}
+
+static struct wsi_callbacks wsi_callbacks = {
+   .resize = wsi_resize,
+   .key_press = wsi_key_press,
+   .exit = wsi_exit,
+};
+
+static void
+buffer_barrier(VkCommandBuffer cmd_buffer,
+               VkPipelineStageFlags src_flags,
+               VkPipelineStageFlags dst_flags,
+               VkAccessFlags src_access,
+               VkAccessFlags dst_access,
+               VkBuffer buffer,
+               VkDeviceSize offset,
+               VkDeviceSize size)
+{
+   vk.CmdPipelineBarrier(cmd_buffer,
+      src_flags, dst_flags,
+      0, 0, NULL,
+      1, &(VkBufferMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+         .pNext = NULL,
+         .srcAccessMask = src_access,
+         .dstAccessMask = dst_access,
+         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .buffer = buffer,
+         .offset = offset,
+         .size = size,
+      },
+      0, NULL);
+}
+
+static void
+image_barrier(VkCommandBuffer cmd_buffer,
+              VkPipelineStageFlags src_flags,
+              VkPipelineStageFlags dst_flags,
+              VkAccessFlags src_access,
+              VkAccessFlags dst_access,
+              VkImageLayout old_layout,
+              VkImageLayout new_layout,
+              VkImage image)
+{
+   vk.CmdPipelineBarrier(cmd_buffer,
+      src_flags, dst_flags,
+      0,
+      0, NULL,
+      0, NULL,
+      1, &(VkImageMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+         .srcAccessMask = src_access,
+         .dstAccessMask = dst_access,
+         .oldLayout = old_layout,
+         .newLayout = new_layout,
+         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .image = image,
+         .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = VK_REMAINING_ARRAY_LAYERS,
+         },
+      });
+}
+
+static void
+begin_gpu_timer(VkCommandBuffer cmd_buffer, unsigned frame_index)
+{
+   if (!timer_pool)
+      return;
+   vk.CmdResetQueryPool(cmd_buffer, timer_pool, TIMER_QUERIES * frame_index,
+                        TIMER_QUERIES);
+   vk.CmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        timer_pool, TIMER_QUERIES * frame_index);
+}
+
+/* everything recorded so far is charged to the part ending at this query */
+static void
+mark_gpu_timer(VkCommandBuffer cmd_buffer, unsigned frame_index, unsigned query)
+{
+   if (!timer_pool)
+      return;
+   vk.CmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        timer_pool, TIMER_QUERIES * frame_index + query);
+}
+
+static void
+end_gpu_timer(VkCommandBuffer cmd_buffer, unsigned frame_index)
+{
+   if (!timer_pool)
+      return;
+   vk.CmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        timer_pool, TIMER_QUERIES * frame_index + 2 + window_count);
+   timer_pending[frame_index] = true;
+}
+
+/*
+ * GPU time in ms of the frame that last used this slot, once its fence has
+ * signaled, or a negative value if it was not timed. The time between the
+ * marks around each window is added to that window's total.
+ */
+static double
+read_gpu_timer(unsigned frame_index)
+{
+   if (!timer_pending[frame_index])
+      return -1.0;
+   timer_pending[frame_index] = false;
+
+   uint32_t count = 3 + window_count;
+   uint64_t ts[TIMER_QUERIES];
+   if (vk.GetQueryPoolResults(device, timer_pool, TIMER_QUERIES * frame_index,
+                              count, count * sizeof(ts[0]), ts, sizeof(ts[0]),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+      return -1.0;
+
+   gpu_phase_ms[0] = ((ts[1] - ts[0]) & timestamp_mask) * timestamp_period / 1e6;
+   for (unsigned w = 0; w < window_count; w++) {
+      gpu_phase_ms[1 + w] = ((ts[2 + w] - ts[1 + w]) & timestamp_mask) *
+                            timestamp_period / 1e6;
+      windows[w].gpu_time += gpu_phase_ms[1 + w];
+   }
+   double gpu_ms = ((ts[count - 1] - ts[0]) & timestamp_mask) * timestamp_period / 1e6;
+   gpu_time += gpu_ms;
+   gpu_frames++;
+   return gpu_ms;
+}
+
+/*
+ * Add up the sequences both culled phases drew in the frame that last used
+ * this slot, once its fence has signaled, and its GPU time to the culled
+ * or baseline total.
+ */
+static void
+read_cull_counts(unsigned frame_index, double gpu_ms)
+{
+   if (!cull_pending[frame_index])
+      return;
+   cull_pending[frame_index] = false;
+
+   bool baseline = cull_baseline[frame_index];
+   if (gpu_ms >= 0.0) {
+      cull_gpu_ms[baseline] += gpu_ms;
+      cull_gpu_frames[baseline]++;
+   }
+   if (baseline)
+      return;
+
+   cull_tested += cull_tested_sequences[frame_index];
+   hud_culled = cull_tested_sequences[frame_index];
+   for (unsigned w = 0; w < window_count; w++) {
+      const uint32_t *counts = cull_count_map + (frame_index * WSI_MAX_WINDOWS + w) * 2;
+      cull_drawn[0] += counts[0];
+      cull_drawn[1] += counts[1];
+      hud_culled -= counts[0] + counts[1];
+   }
+}
+
+/* the fragments a frame shaded, the frame having completed */
+static void
+read_overdraw(unsigned frame_index)
+{
+   if (!overdraw_pending[frame_index])
+      return;
+   overdraw_pending[frame_index] = false;
+
+   uint64_t fragments;
+   if (vk.GetQueryPoolResults(device, overdraw_pool, frame_index, 1,
+                              sizeof(fragments), &fragments, sizeof(fragments),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+      return;
+   overdraw_fragments += fragments;
+   overdraw_pixels += overdraw_frame_pixels[frame_index];
+}
+
+/*
+ * Move the scale part of the way towards the one that would have hit the
+ * target, assuming the cost follows the pixel count. The damping keeps a
+ * single slow frame from making the resolution oscillate.
+ */
+static void
+update_dynamic_res(struct window *win, double gpu_ms)
+{
+   if (gpu_ms <= 0.0)
+      return;
+
+   float ideal = win->res_scale * sqrtf(dynamic_res_target / gpu_ms);
+   win->res_scale += 0.25f * (ideal - win->res_scale);
+   if (win->res_scale < dynamic_res_min)
+      win->res_scale = dynamic_res_min;
+   if (win->res_scale > dynamic_res_max)
+      win->res_scale = dynamic_res_max;
+   set_render_extent(win);
+}
+
+/* the previous frame's blit must be done reading the render target */
+static void
+begin_render_target(VkCommandBuffer cmd_buffer, const struct window *win)
+{
+   image_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      0,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      win->res_color);
+}
+
+/*
+ * Upscale the rendered sub-rectangle of every layer to its tile of the
+ * swapchain image, leaving it in the color attachment layout the rest of
+ * the frame expects.
+ */
+static void
+blit_render_target(VkCommandBuffer cmd_buffer, const struct window *win,
+                   VkImage image)
+{
+   image_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      win->res_color);
+   image_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      image);
+
+   /* the grid need not cover the whole window */
+   if (view_count > 1) {
+      vk.CmdClearColorImage(cmd_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+         &(VkClearColorValue) { .float32 = { 0.0f, 0.0f, 0.0f, 1.0f } },
+         1, &(VkImageSubresourceRange) {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+         });
+      image_barrier(cmd_buffer,
+         VK_PIPELINE_STAGE_TRANSFER_BIT,
+         VK_PIPELINE_STAGE_TRANSFER_BIT,
+         VK_ACCESS_TRANSFER_WRITE_BIT,
+         VK_ACCESS_TRANSFER_WRITE_BIT,
+         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+         image);
+   }
+
+   unsigned cols, rows;
+   int tile_width, tile_height;
+   view_grid(&cols, &rows);
+   view_extent(win, &tile_width, &tile_height);
+   VkImageBlit regions[MAX_VIEWS];
+   for (unsigned i = 0; i < view_count; i++) {
+      int x = (i % cols) * tile_width, y = (i / cols) * tile_height;
+      regions[i] = (VkImageBlit) {
+         .srcSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = i,
+            .layerCount = 1,
+         },
+         .srcOffsets = { { 0, 0, 0 }, { win->render_width, win->render_height, 1 } },
+         .dstSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+         },
+         .dstOffsets = { { x, y, 0 }, { x + tile_width, y + tile_height, 1 } },
+      };
+   }
+   vk.CmdBlitImage(cmd_buffer,
+      win->res_color, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      view_count, regions,
+      VK_FILTER_LINEAR);
+
+   image_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      image);
+}
+
+/*
+ * Resolve color_msaa into the single-sample target outside the scene pass,
+ * with a transfer or with a full-screen shader pass. Both leave the target
+ * in the color attachment layout.
+ */
+static void
+resolve_msaa(VkCommandBuffer cmd_buffer, const struct window *win,
+             VkImage target, VkImageView target_view)
+{
+   if (resolve_mode == RESOLVE_CMD) {
+      image_barrier(cmd_buffer,
+         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+         VK_PIPELINE_STAGE_TRANSFER_BIT,
+         VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+         VK_ACCESS_TRANSFER_READ_BIT,
+         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+         win->color_msaa);
+      image_barrier(cmd_buffer,
+         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+         VK_PIPELINE_STAGE_TRANSFER_BIT,
+         0,
+         VK_ACCESS_TRANSFER_WRITE_BIT,
+         VK_IMAGE_LAYOUT_UNDEFINED,
+         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+         target);
+
+      const VkImageSubresourceLayers layers = {
+         .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+         .mipLevel = 0,
+         .baseArrayLayer = 0,
+         .layerCount = 1,
+      };
+      vk.CmdResolveImage(cmd_buffer,
+         win->color_msaa, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+         target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+         1, &(VkImageResolve) {
+            .srcSubresource = layers,
+            .dstSubresource = layers,
+            .extent = { win->render_width, win->render_height, 1 },
+         });
+
+      image_barrier(cmd_buffer,
+         VK_PIPELINE_STAGE_TRANSFER_BIT,
+         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+         VK_ACCESS_TRANSFER_WRITE_BIT,
+         VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,
+         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+         target);
+      return;
+   }
+
+   image_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      win->color_msaa);
+
+   vk.CmdBeginRendering(cmd_buffer,
+      &(VkRenderingInfo) {
+         .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+         .renderArea = { { 0, 0 }, { win->render_width, win->render_height } },
+         .layerCount = 1,
+         .colorAttachmentCount = 1,
+         .pColorAttachments = &(VkRenderingAttachmentInfo) {
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = target_view,
+            .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+         },
+      });
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, resolve_pipeline);
+   vk.CmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            resolve_pipeline_layout, 0, 1,
+                            &win->resolve_descriptor_set, 0, NULL);
+   vk.CmdSetViewport(cmd_buffer, 0, 1,
+      &(VkViewport) {
+         .width = win->render_width,
+         .height = win->render_height,
+         .minDepth = 0,
+         .maxDepth = 1,
+      });
+   vk.CmdSetScissor(cmd_buffer, 0, 1,
+      &(VkRect2D) {
+         .offset = { 0, 0 },
+         .extent = { win->render_width, win->render_height },
+      });
+   vk.CmdDraw(cmd_buffer, 3, 1, 0, 0);
+   vk.CmdEndRendering(cmd_buffer);
+}
+
+/*
+ * The stages reading the angles, the shadow rays' instances and the
+ * software rasterizer among them.
+ */
+static VkPipelineStageFlags
+angle_stages(void)
+{
+   return VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+          (rt_shadows || swr_threshold > 0.0f ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0);
+}
+
+/*
+ * Writes this frame's gear angles to angle_buffer: either ticked on the CPU
+ * and copied from a staging slice, or derived by a compute pass from the
+ * frame angle alone, in which case the upload does not grow with the scene.
+ */
+static void
+animate_gears(VkCommandBuffer cmd_buffer, unsigned frame_index)
+{
+   if (gpu_animation) {
+      double turns = floor(frame_angle / 360.0);
+      struct anim_ubo anim = {
+         .angle = (float)(frame_angle - turns * 360.0),
+         .turns = (uint32_t)turns,
+         .gear_count = scene.gear_count,
+      };
+
+      buffer_barrier(cmd_buffer,
+         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         VK_PIPELINE_STAGE_TRANSFER_BIT,
+         0, 0,
+         anim_buffer, 0, sizeof(anim));
+      vk.CmdUpdateBuffer(cmd_buffer, anim_buffer, 0, sizeof(anim), &anim);
+      buffer_barrier(cmd_buffer,
+         VK_PIPELINE_STAGE_TRANSFER_BIT,
+         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         VK_ACCESS_TRANSFER_WRITE_BIT,
+         VK_ACCESS_UNIFORM_READ_BIT,
+         anim_buffer, 0, sizeof(anim));
+
+      /* the previous frame's vertex shaders must be done with the angles */
+      buffer_barrier(cmd_buffer,
+         angle_stages(),
+         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         0, 0,
+         angle_buffer, 0, angle_size);
+
+      vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, anim_pipeline);
+      vk.CmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                               anim_pipeline_layout, 0, 1, &anim_descriptor_set,
+                               0, NULL);
+      vk.CmdDispatch(cmd_buffer, (scene.gear_count + 63) / 64, 1, 1);
+
+      buffer_barrier(cmd_buffer,
+         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         angle_stages(),
+         VK_ACCESS_SHADER_WRITE_BIT,
+         VK_ACCESS_SHADER_READ_BIT,
+         angle_buffer, 0, angle_size);
+      anim_bytes += sizeof(anim);
+      return;
+   }
+
+   /* the frame fence guarantees this frame's staging slice is idle */
+   double tick_start = current_time();
+   kinematics_tick(&kinematics, frame_angle,
+                   (float *)(angle_staging_map + frame_index * angle_size));
+   tick_time += current_time() - tick_start;
+
+   buffer_barrier(cmd_buffer,
+      angle_stages(),
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0, 0,
+      angle_buffer, 0, angle_size);
+
+   vk.CmdCopyBuffer(cmd_buffer, angle_staging, angle_buffer, 1,
+      &(VkBufferCopy) {
+         .srcOffset = frame_index * angle_size,
+         .dstOffset = 0,
+         .size = angle_size,
+      });
+
+   buffer_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      angle_stages(),
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      angle_buffer, 0, angle_size);
+   anim_bytes += scene.gear_count * sizeof(float);
+}
+
+/* copy the resolved color image into a host-visible buffer */
+static void
+record_capture(VkCommandBuffer cmd_buffer, const struct window *win)
+{
+   VkImage image = win->image_data[win->image_index].image;
+   VkDeviceSize size = (VkDeviceSize)win->width * win->height * 4;
+   capture_buffer = create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+   capture_mem = allocate_buffer_mem(capture_buffer, size);
+   vkBindBufferMemory(device, capture_buffer, capture_mem, 0);
+
+   image_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      image);
+
+   vk.CmdCopyImageToBuffer(cmd_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      capture_buffer, 1,
+      &(VkBufferImageCopy) {
+         .bufferOffset = 0,
+         .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+         },
+         .imageExtent = { win->width, win->height, 1 },
+      });
+
+   buffer_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_HOST_READ_BIT,
+      capture_buffer, 0, size);
+
+   image_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      image);
+}
+
+/*
+ * Wait for the captured frame, convert it to RGB and write it to file
+ * and/or compare it with reference. capture_status is set to non-zero if
+ * the comparison fails.
+ */
+static void
+finish_capture(VkFence fence, unsigned frame, const char *file,
+               const char *reference)
+{
+   vk.WaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+
+   bool bgra;
+   switch (image_format) {
+   case VK_FORMAT_B8G8R8A8_UNORM:
+   case VK_FORMAT_B8G8R8A8_SRGB:
+      bgra = true;
+      break;
+   case VK_FORMAT_R8G8B8A8_UNORM:
+   case VK_FORMAT_R8G8B8A8_SRGB:
+   case VK_FORMAT_A8B8G8R8_UNORM_PACK32:
+   case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+      bgra = false;
+      break;
+   default:
+      error("Cannot capture swapchain format %d", image_format);
+      return;
+   }
+
+   const struct window *win = &windows[0];
+   struct image img = {
+      .width = win->width,
+      .height = win->height,
+      .data = malloc((size_t)win->width * win->height * 3),
+   };
+   if (!img.data)
+      error("Failed to allocate memory");
+
+   const uint8_t *map;
+   if (vkMapMemory(device, capture_mem, 0, VK_WHOLE_SIZE, 0, (void *)&map) != VK_SUCCESS)
+      error("vkMapMemory failed");
+   for (size_t i = 0; i < (size_t)win->width * win->height; i++) {
+      img.data[i * 3 + 0] = map[i * 4 + (bgra ? 2 : 0)];
+      img.data[i * 3 + 1] = map[i * 4 + 1];
+      img.data[i * 3 + 2] = map[i * 4 + (bgra ? 0 : 2)];
+   }
+   vkUnmapMemory(device, capture_mem);
+   vkDestroyBuffer(device, capture_buffer, NULL);
+   vkFreeMemory(device, capture_mem, NULL);
+
+   if (file) {
+      if (!image_write_ppm(file, &img))
+         error("Failed to write %s", file);
+      printf("captured frame %u to %s\n", frame, file);
+   }
+
+   if (reference) {
+      struct image ref;
+      struct image_diff diff;
+      if (!image_read_ppm(reference, &ref))
+         error("Failed to read %s", reference);
+      if (!image_compare(&img, &ref, compare_tolerance, &diff)) {
+         printf("FAIL: size %ux%u does not match reference %ux%u\n",
+                img.width, img.height, ref.width, ref.height);
+         capture_status = 1;
+      } else {
+         printf("%s: max diff %u, mean diff %.4f, %u pixels above tolerance %u\n",
+                diff.bad_pixels ? "FAIL" : "PASS", diff.max_diff,
+                diff.mean_diff, diff.bad_pixels, compare_tolerance);
+         capture_status = diff.bad_pixels ? 1 : 0;
+      }
+      image_free(&ref);
+   }
+
+   image_free(&img);
+}
+
+struct bench_result {
+   unsigned frames;
+   double seconds;
+   double fps;
+   double mean_ms, p50_ms, p99_ms, max_ms;
+   double bind_us;
+   double gpu_ms;
+   double latency_ms, latency_p99_ms;
+};
+
+#define MAX_FRAME_SAMPLES (1 << 16)
+static float frame_times[MAX_FRAME_SAMPLES];
+static float latency_times[MAX_FRAME_SAMPLES];
+
+static int
+compare_float(const void *a, const void *b)
+{
+   float fa = *(const float *)a, fb = *(const float *)b;
+   return (fa > fb) - (fa < fb);
+}
+
+static void
+summarize_frame_times(unsigned count, struct bench_result *result)
+{
+   memset(result, 0, sizeof(*result));
+   if (count == 0)
+      return;
+
+   qsort(frame_times, count, sizeof(float), compare_float);
+   double sum = 0.0;
+   for (unsigned i = 0; i < count; i++)
+      sum += frame_times[i];
+
+   result->frames = count;
+   result->seconds = sum / 1000.0;
+   result->fps = count / result->seconds;
+   result->mean_ms = sum / count;
+   result->p50_ms = frame_times[count / 2];
+   result->p99_ms = frame_times[(unsigned)(count * 0.99)];
+   result->max_ms = frame_times[count - 1];
+}
+
+static void
+summarize_latency(unsigned count, struct bench_result *result)
+{
+   if (count == 0)
+      return;
+
+   qsort(latency_times, count, sizeof(float), compare_float);
+   double sum = 0.0;
+   for (unsigned i = 0; i < count; i++)
+      sum += latency_times[i];
+
+   result->latency_ms = sum / count;
+   result->latency_p99_ms = latency_times[(unsigned)(count * 0.99)];
+}
+
+/* copy this frame's counters to the shared memory segment */
+static void
+publish_stats(uint64_t frame, double time, double frame_ms, double record_ms,
+              double gpu_ms)
+{
+   VkDeviceSize attach_size, attach_resident;
+   attachment_totals(&attach_size, &attach_resident);
+
+   struct stats_segment *seg = stats_begin(&stats);
+   seg->window_count = window_count;
+   seg->frame = frame;
+   seg->time = time;
+   seg->frame_ms = frame_ms;
+   seg->record_ms = record_ms;
+   /* the timer lags a frame or more behind, keep the last value it gave */
+   if (gpu_ms >= 0.0) {
+      seg->gpu_ms = gpu_ms;
+      seg->gpu_animation_ms = gpu_phase_ms[0];
+      for (unsigned w = 0; w < window_count && w < STATS_MAX_WINDOWS; w++)
+         seg->gpu_window_ms[w] = gpu_phase_ms[1 + w];
+   }
+   seg->gear_count = scene.gear_count;
+   seg->sequence_count = sequence_count;
+   seg->max_sequence_count = max_sequence_count;
+   seg->samples = sample_count;
+   seg->present_mode = windows[0].present_mode;
+   seg->shader_object = use_shader_object;
+   seg->instancing = use_instancing;
+   seg->preprocess_bytes = preprocess_size;
+   seg->attachment_bytes = attach_size;
+   seg->attachment_resident_bytes = attach_resident;
+   stats_end(&stats);
+}
+
+/*
+ * stall detector: the per-phase CPU time of the last STALL_RING frames
+ * with their GPU time once the timer has it. A frame taking longer than
+ * stall_factor times the median dumps the ring and the swapchain state.
+ */
+enum frame_phase {
+   PHASE_CONTROL,
+   PHASE_WSI,
+   PHASE_RECREATE,
+   PHASE_FENCE,
+   PHASE_ACQUIRE,
+   PHASE_RECORD,
+   PHASE_SUBMIT,
+   PHASE_PRESENT,
+   PHASE_OTHER,
+   PHASE_COUNT,
+};
+static const char *frame_phase_names[] = {
+   "control", "wsi", "recreate", "fence", "acquire", "record", "submit",
+   "present", "other",
+};
+
+#define STALL_RING 256
+#define STALL_MAX_DUMPS 16
+struct frame_record {
+   uint64_t frame;
+   float total_ms;
+   float phase_ms[PHASE_COUNT];
+   float gpu_ms;
+   uint32_t image_index[WSI_MAX_WINDOWS];
+   int32_t acquire_result[WSI_MAX_WINDOWS];
+   int32_t present_result[WSI_MAX_WINDOWS];
+};
+static const char *stall_file;
+static float stall_factor = 3.0f;
+static struct frame_record stall_ring[STALL_RING];
+static float stall_median_ms;
+static unsigned stall_dumps;
+static uint64_t stall_last_dump;
+static uint64_t frame_serial;
+
+/* charge the time since *mark to a phase of the frame */
+static void
+mark_phase(struct frame_record *r, enum frame_phase phase, double *mark)
+{
+   double now = current_time();
+   r->phase_ms[phase] += 1000.0 * (now - *mark);
+   *mark = now;
+}
+
+static struct frame_record *
+begin_frame_record(uint64_t frame)
+{
+   struct frame_record *r = &stall_ring[frame % STALL_RING];
+   memset(r, 0, sizeof(*r));
+   r->frame = frame;
+   r->gpu_ms = -1.0f;
+   return r;
+}
+
+/* the GPU time arrives frames later, the frame may have left the ring */
+static void
+set_frame_gpu_time(uint64_t frame, double gpu_ms)
+{
+   struct frame_record *r = &stall_ring[frame % STALL_RING];
+   if (frame && r->frame == frame)
+      r->gpu_ms = gpu_ms;
+}
+
+static void
+dump_stall(const struct frame_record *stall)
+{
+   char path[1024];
+   snprintf(path, sizeof(path), "%s.%llu", stall_file,
+            (unsigned long long)stall->frame);
+   FILE *f = fopen(path, "w");
+   if (!f) {
+      fprintf(stderr, "stall: cannot write %s\n", path);
+      return;
+   }
+
+   fprintf(f, "stall at frame %llu: %.3f ms, median %.3f ms, threshold %.1fx\n",
+           (unsigned long long)stall->frame, stall->total_ms, stall_median_ms,
+           stall_factor);
+   fprintf(f, "frames in flight %u, sequences %u/%u, %s, %d samples\n",
+           concurrent_frames, sequence_count, max_sequence_count,
+           use_shader_object ? "shader-object" : "pipeline", sample_count);
+   for (unsigned w = 0; w < window_count; w++) {
+      const struct window *win = &windows[w];
+      fprintf(f, "window %u: %dx%d (pending %dx%d), rendered at %dx%d, %s, "
+              "%u images (min %u), image %u, %s\n",
+              w, win->width, win->height, win->new_width, win->new_height,
+              win->render_width, win->render_height,
+              present_mode_str(win->present_mode), win->image_count,
+              win->min_image_count, win->image_index,
+              win->suboptimal ? "suboptimal" : "optimal");
+   }
+
+   fprintf(f, "\n%10s %9s", "frame", "total ms");
+   for (unsigned p = 0; p < PHASE_COUNT; p++)
+      fprintf(f, " %9s", frame_phase_names[p]);
+   fprintf(f, " %9s %6s %7s %7s\n", "gpu ms", "image", "acquire", "present");
+   for (unsigned i = 1; i <= STALL_RING; i++) {
+      const struct frame_record *r = &stall_ring[(stall->frame + i) % STALL_RING];
+      if (!r->frame)
+         continue;
+      fprintf(f, "%10llu %9.3f", (unsigned long long)r->frame, r->total_ms);
+      for (unsigned p = 0; p < PHASE_COUNT; p++)
+         fprintf(f, " %9.3f", r->phase_ms[p]);
+      if (r->gpu_ms >= 0.0f)
+         fprintf(f, " %9.3f", r->gpu_ms);
+      else
+         fprintf(f, " %9s", "-");
+      /* only the first window, the header has the others' current state */
+      fprintf(f, " %6u %7d %7d%s\n", r->image_index[0], r->acquire_result[0],
+              r->present_result[0], r == stall ? "  <- stall" : "");
+   }
+   fclose(f);
+   printf("stall: frame %llu took %.3f ms (median %.3f ms), dumped to %s\n",
+          (unsigned long long)stall->frame, stall->total_ms, stall_median_ms, path);
+}
+
+/*
+ * Compare a finished frame against the median, which is only recomputed
+ * every few frames to keep the sort off the common path.
+ */
+static void
+check_stall(const struct frame_record *r)
+{
+   if (r->frame % (STALL_RING / 8) == 0) {
+      float totals[STALL_RING];
+      unsigned count = 0;
+      for (unsigned i = 0; i < STALL_RING; i++) {
+         if (stall_ring[i].frame)
+            totals[count++] = stall_ring[i].total_ms;
+      }
+      qsort(totals, count, sizeof(float), compare_float);
+      stall_median_ms = totals[count / 2];
+   }
+
+   /* a full ring of history first, and no dump storms */
+   if (r->frame < STALL_RING || stall_median_ms <= 0.0f ||
+       r->total_ms < stall_factor * stall_median_ms ||
+       stall_dumps == STALL_MAX_DUMPS ||
+       (stall_last_dump && r->frame - stall_last_dump < STALL_RING / 4))
+      return;
+
+   stall_dumps++;
+   stall_last_dump = r->frame;
+   dump_stall(r);
+}
+
+static void control_command(const char *line, char *reply, size_t size);
+
+/*
+ * Per-view camera offsets, applied between the camera distance and the
+ * view rotation: an eye pair for stereo, otherwise cameras spaced evenly
+ * around the gears.
+ */
+static void
+set_view_matrices(float views[MAX_VIEWS][16])
+{
+   for (unsigned i = 0; i < MAX_VIEWS; i++) {
+      mat4_identity(views[i]);
+      if (i >= view_count)
+         continue;
+      if (multiview_stereo) {
+         float eye = 0.03f * scene.view_distance;
+         mat4_translate(views[i], i == 0 ? eye / 2 : -eye / 2, 0, 0);
+      } else {
+         mat4_rotate(views[i], 2 * M_PI * i / view_count, 0, 1, 0);
+      }
+   }
+}
+
+/* the projection every pass of a window uses, near plane at NEAR_PLANE */
+#define NEAR_PLANE 5.0f
+
+static void
+window_projection(const struct window *win, float *projection)
+{
+   int w, h;
+   view_extent(win, &w, &h);
+   float aspect = (float)h / w;
+   mat4_identity(projection);
+   mat4_frustum_vk(projection, -1.0, 1.0, -aspect, +aspect, NEAR_PLANE,
+                   scene.view_distance + scene.radius + 20.0f);
+}
+
+static uint64_t
+rect_area(VkRect2D r)
+{
+   return (uint64_t)r.extent.width * r.extent.height;
+}
+
+static VkRect2D
+rect_union(VkRect2D a, VkRect2D b)
+{
+   int32_t x0 = MIN2(a.offset.x, b.offset.x), y0 = MIN2(a.offset.y, b.offset.y);
+   int32_t x1 = MAX2(a.offset.x + (int32_t)a.extent.width, b.offset.x + (int32_t)b.extent.width);
+   int32_t y1 = MAX2(a.offset.y + (int32_t)a.extent.height, b.offset.y + (int32_t)b.extent.height);
+   return (VkRect2D) { { x0, y0 }, { x1 - x0, y1 - y0 } };
+}
+
+static bool
+rects_overlap(VkRect2D a, VkRect2D b)
+{
+   return a.offset.x < b.offset.x + (int32_t)b.extent.width &&
+          b.offset.x < a.offset.x + (int32_t)a.extent.width &&
+          a.offset.y < b.offset.y + (int32_t)b.extent.height &&
+          b.offset.y < a.offset.y + (int32_t)a.extent.height;
+}
+
+/*
+ * Add a rectangle to the damage. Overlapping rectangles are merged, as the
+ * overlap would be drawn twice, and past DAMAGE_MAX_RECTS the pair whose
+ * union adds the fewest pixels is.
+ */
+static void
+damage_add(struct damage *d, VkRect2D rect)
+{
+   if (d->full || rect.extent.width == 0 || rect.extent.height == 0)
+      return;
+   d->rects[d->count++] = rect;
+
+   for (;;) {
+      unsigned a = 0, b = 0;
+      uint64_t best = UINT64_MAX;
+      for (unsigned i = 0; i < d->count && best; i++) {
+         for (unsigned j = i + 1; j < d->count && best; j++) {
+            /* the bounds of disjoint rectangles cover at least both */
+            uint64_t cost = rects_overlap(d->rects[i], d->rects[j]) ? 0 :
+                            rect_area(rect_union(d->rects[i], d->rects[j])) -
+                            rect_area(d->rects[i]) - rect_area(d->rects[j]);
+            if (cost < best) {
+               best = cost;
+               a = i;
+               b = j;
+            }
+         }
+      }
+      if (best == UINT64_MAX || (best > 0 && d->count <= DAMAGE_MAX_RECTS))
+         return;
+      d->rects[a] = rect_union(d->rects[a], d->rects[b]);
+      d->rects[b] = d->rects[--d->count];
+   }
+}
+
+/*
+ * The damage of this frame in a window: the screen rectangle of every
+ * gear that can move, if the gears turned, or everything if the view, the
+ * render size or the sequences drawn changed. It becomes the newest entry
+ * of the window's history.
+ */
+static void
+track_damage(struct window *win, const struct push_constants *push)
+{
+   struct damage *d = &win->damage_history[++win->damage_serial % DAMAGE_HISTORY];
+   memset(d, 0, sizeof(*d));
+
+   float view[3] = { push->view_rot_0, push->view_rot_1, push->h };
+   d->full = memcmp(view, win->damage_view, sizeof(view)) != 0 ||
+             win->damage_sequences != sequence_count ||
+             win->damage_width != win->render_width ||
+             win->damage_height != win->render_height;
+   bool turned = push->angle != win->damage_angle;
+   memcpy(win->damage_view, view, sizeof(view));
+   win->damage_angle = push->angle;
+   win->damage_sequences = sequence_count;
+   win->damage_width = win->render_width;
+   win->damage_height = win->render_height;
+   if (d->full || !turned)
+      return;
+
+   float projection[16], modelview[16];
+   window_projection(win, projection);
+   mat4_identity(modelview);
+   mat4_translate(modelview, 0, 0, -scene.view_distance);
+   mat4_rotate(modelview, 2 * M_PI * push->view_rot_0 / 360.0, 1, 0, 0);
+   mat4_rotate(modelview, 2 * M_PI * push->view_rot_1 / 360.0, 0, 1, 0);
+
+   for (uint32_t i = 0; i < damage_gear_count && !d->full; i++) {
+      const float *p = scene.params[damage_gears[i]].position;
+      float c[3];
+      for (unsigned k = 0; k < 3; k++)
+         c[k] = modelview[k] * p[0] + modelview[4 + k] * p[1] +
+                modelview[8 + k] * p[2] + modelview[12 + k];
+
+      /* a sphere reaching the near plane has no bounded rectangle */
+      float r = damage_radius[i];
+      if (c[2] + r > -NEAR_PLANE) {
+         d->full = true;
+         break;
+      }
+
+      float lo[2] = { 1.0f, 1.0f }, hi[2] = { -1.0f, -1.0f };
+      for (unsigned k = 0; k < 8; k++) {
+         float x = c[0] + (k & 1 ? r : -r);
+         float y = c[1] + (k & 2 ? r : -r);
+         float z = c[2] + (k & 4 ? r : -r);
+         float w = projection[3] * x + projection[7] * y + projection[11] * z + projection[15];
+         float ndc[2] = {
+            (projection[0] * x + projection[4] * y + projection[8] * z + projection[12]) / w,
+            (projection[1] * x + projection[5] * y + projection[9] * z + projection[13]) / w,
+         };
+         for (unsigned a = 0; a < 2; a++) {
+            lo[a] = MIN2(lo[a], ndc[a]);
+            hi[a] = MAX2(hi[a], ndc[a]);
+         }
+      }
+
+      /* a pixel of margin for the rasterization rules */
+      int size[2] = { win->render_width, win->render_height };
+      int first[2], last[2];
+      for (unsigned a = 0; a < 2; a++) {
+         first[a] = MAX2((int)floorf((lo[a] * 0.5f + 0.5f) * size[a]) - 1, 0);
+         last[a] = MIN2((int)ceilf((hi[a] * 0.5f + 0.5f) * size[a]) + 1, size[a]);
+      }
+      if (first[0] < last[0] && first[1] < last[1])
+         damage_add(d, (VkRect2D) { { first[0], first[1] },
+                                    { last[0] - first[0], last[1] - first[1] } });
+   }
+}
+
+/*
+ * What the acquired image repaints: the damage of every frame since it was
+ * last drawn, or everything if that is further back than the history or a
+ * baseline frame wants it.
+ */
+static void
+image_damage(const struct window *win, bool baseline, struct damage *out)
+{
+   memset(out, 0, sizeof(*out));
+   uint64_t drawn = win->image_data[win->image_index].damage_serial;
+   out->full = baseline || drawn == 0 || win->damage_serial - drawn > DAMAGE_HISTORY;
+   for (uint64_t f = drawn + 1; f <= win->damage_serial && !out->full; f++) {
+      const struct damage *d = &win->damage_history[f % DAMAGE_HISTORY];
+      out->full = d->full;
+      for (unsigned i = 0; i < d->count; i++)
+         damage_add(out, d->rects[i]);
+   }
+}
+
+/*
+ * Write the projection and views of one pass. A pass covering a single
+ * view reaches its matrix through camera[1], as gl_ViewIndex is 0 there.
+ */
+static void
+update_ubo(VkCommandBuffer cmd_buffer, const struct window *win, unsigned first_view)
+{
+   struct ubo ubo = {
+      .camera = { scene.view_distance, first_view },
+   };
+   window_projection(win, ubo.projection);
+   set_view_matrices(ubo.views);
+
+   /* culling, sorting and software rasterizing read the matrices through their address */
+   bool compute = hiz_cull || sort_enabled || swr_threshold > 0.0f;
+   VkPipelineStageFlags stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                 (compute ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0);
+   buffer_barrier(cmd_buffer,
+      stages,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0, 0,
+      ubo_buffer, 0, sizeof(ubo));
+
+   vk.CmdUpdateBuffer(cmd_buffer, ubo_buffer, 0, sizeof(ubo), &ubo);
+
+   buffer_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      stages,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_UNIFORM_READ_BIT | (compute ? VK_ACCESS_SHADER_READ_BIT : 0),
+      ubo_buffer, 0, sizeof(ubo));
+}
+
+/* executes that do not preprocess separately all reuse the same buffer */
+static void
+preprocess_barrier(VkCommandBuffer cmd_buffer)
+{
+   buffer_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+      VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+      VK_ACCESS_COMMAND_PREPROCESS_WRITE_BIT_EXT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+      VK_ACCESS_COMMAND_PREPROCESS_WRITE_BIT_EXT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+      preprocess_buffer, 0, preprocess_size);
+}
+
+/*
+ * Begin a pass drawing the gears into pass_view, clearing it and the depth
+ * or, for a pass adding to what an earlier one drew, loading them. Depth
+ * is only stored for the depth pyramid and the shadow rays. A pass
+ * limited to area keeps the color around what it redraws and clears only
+ * the depth.
+ */
+static void
+begin_scene_pass(VkCommandBuffer cmd_buffer, struct window *win,
+                 VkImageView pass_view, uint32_t view_mask, bool load,
+                 const VkRect2D *area)
+{
+   bool msaa = sample_count != VK_SAMPLE_COUNT_1_BIT;
+   bool pass_resolve = msaa && resolve_mode == RESOLVE_PASS;
+   VkAttachmentLoadOp load_op = load ? VK_ATTACHMENT_LOAD_OP_LOAD :
+                                       VK_ATTACHMENT_LOAD_OP_CLEAR;
+   VkRect2D render_area = { { 0, 0 }, { win->render_width, win->render_height } };
+   if (area)
+      render_area = *area;
+
+   vk.CmdBeginRendering(cmd_buffer,
+      &(VkRenderingInfo) {
+         .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+         .renderArea = render_area,
+         .layerCount = 1,
+         .viewMask = view_mask,
+         .colorAttachmentCount = 1,
+         .pColorAttachments = (VkRenderingAttachmentInfo[]) { {
+            VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = msaa ? win->color_msaa_view : pass_view,
+            .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .resolveMode = pass_resolve ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
+            .resolveImageView = pass_resolve ? pass_view : VK_NULL_HANDLE,
+            .resolveImageLayout = pass_resolve ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+            .loadOp = area ? VK_ATTACHMENT_LOAD_OP_LOAD : load_op,
+            .storeOp = pass_resolve ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
+            .clearValue.color = { .float32 = { 0.0f, 0.0f, 0.0f, 1.0f } },
+         }},
+         .pDepthAttachment = &(VkRenderingAttachmentInfo) {
+            VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = win->depth_view,
+            .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .resolveMode = VK_RESOLVE_MODE_NONE,
+            .loadOp = load_op,
+            .storeOp = depth_sampled() ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .clearValue = { .depthStencil.depth = 1.0f },
+         }
+      });
+}
+
+/* everything a cull dispatch wrote, to the executes and the next dispatch */
+static void
+cull_barrier(VkCommandBuffer cmd_buffer)
+{
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+      VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT |
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0,
+      1, &(VkMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                          VK_ACCESS_COMMAND_PREPROCESS_READ_BIT_EXT |
+                          VK_ACCESS_SHADER_READ_BIT,
+      },
+      0, NULL,
+      0, NULL);
+}
+
+/* what one dispatch wrote, to the next */
+static void
+compute_barrier(VkCommandBuffer cmd_buffer)
+{
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0,
+      1, &(VkMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+      },
+      0, NULL,
+      0, NULL);
+}
+
+static void
+depth_barrier(VkCommandBuffer cmd_buffer, struct window *win,
+              VkPipelineStageFlags src_flags,
+              VkPipelineStageFlags dst_flags,
+              VkAccessFlags src_access,
+              VkAccessFlags dst_access,
+              VkImageLayout old_layout,
+              VkImageLayout new_layout)
+{
+   vk.CmdPipelineBarrier(cmd_buffer,
+      src_flags, dst_flags,
+      0,
+      0, NULL,
+      0, NULL,
+      1, &(VkImageMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+         .srcAccessMask = src_access,
+         .dstAccessMask = dst_access,
+         .oldLayout = old_layout,
+         .newLayout = new_layout,
+         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .image = win->depth_image,
+         .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = VK_REMAINING_ARRAY_LAYERS,
+         },
+      });
+}
+
+/*
+ * Reduce the depth of the pass just ended into the pyramid, a level per
+ * dispatch. Only the levels the current render size needs are built.
+ */
+static void
+build_hiz(VkCommandBuffer cmd_buffer, struct window *win, uint32_t levels)
+{
+   depth_barrier(cmd_buffer, win,
+      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiz_build_pipeline);
+   int src_width = win->render_width, src_height = win->render_height;
+   for (uint32_t l = 0; l < levels; l++) {
+      struct hiz_push push = {
+         .src_size = { src_width, src_height },
+         .dst_size = { MAX2(src_width >> 1, 1), MAX2(src_height >> 1, 1) },
+      };
+      vk.CmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                               hiz_build_pipeline_layout, 0, 1,
+                               &win->hiz_build_sets[l], 0, NULL);
+      vk.CmdPushConstants(cmd_buffer, hiz_build_pipeline_layout,
+                          VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+      vk.CmdDispatch(cmd_buffer, (push.dst_size[0] + 7) / 8,
+                     (push.dst_size[1] + 7) / 8, 1);
+      compute_barrier(cmd_buffer);
+      src_width = push.dst_size[0];
+      src_height = push.dst_size[1];
+   }
+
+   depth_barrier(cmd_buffer, win,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      0,
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+}
+
+static void
+cull_dispatch(VkCommandBuffer cmd_buffer, struct window *win,
+              const struct push_constants *push, VkDeviceAddress stream,
+              VkDeviceAddress counts, uint32_t phase, uint32_t levels)
+{
+   struct cull_push cull = {
+      .input = indirect_addr,
+      .output = stream + phase * cull_stream_size,
+      .count = counts,
+      .drawn = stream + 2 * cull_stream_size,
+      .ubo = get_buffer_address(ubo_buffer),
+      .gears = get_buffer_address(gear_buffer),
+      .instances = get_buffer_address(instance_buffer),
+      .radius = get_buffer_address(radius_buffer),
+      .view_rot_0 = push->view_rot_0,
+      .view_rot_1 = push->view_rot_1,
+      .sequence_count = sequence_count,
+      .phase = phase,
+      .render_size = { win->render_width, win->render_height },
+      .levels = levels,
+   };
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiz_cull_pipeline);
+   vk.CmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            hiz_cull_pipeline_layout, 0, 1, &win->hiz_cull_set,
+                            0, NULL);
+   vk.CmdPushConstants(cmd_buffer, hiz_cull_pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cull), &cull);
+   vk.CmdDispatch(cmd_buffer, (sequence_count + 63) / 64, 1, 1);
+   cull_barrier(cmd_buffer);
+}
+
+/*
+ * Sort a stream of sequences into the stream of a slot and return its
+ * address: a key per sequence, then a stable radix pass per byte the order
+ * uses, each a histogram per block, one scan and a scatter, and finally the
+ * sequences gathered in key order. With a count address only that many are
+ * sorted, the rest keep to the end.
+ */
+static VkDeviceAddress
+sort_sequences(VkCommandBuffer cmd_buffer, const struct push_constants *push,
+               VkDeviceAddress input, VkDeviceAddress count_addr, unsigned slot)
+{
+   VkDeviceSize n = sort_capacity;
+   VkDeviceAddress keys[2] = { sort_addr, sort_addr + 4 * n };
+   VkDeviceAddress values[2] = { sort_addr + 8 * n, sort_addr + 12 * n };
+   VkDeviceAddress histogram = sort_addr + 16 * n;
+   uint32_t blocks = (sequence_count + SORT_BLOCK - 1) / SORT_BLOCK;
+   VkDeviceAddress output = histogram + 256 * sort_blocks() * sizeof(uint32_t) +
+                            slot * n * sizeof(indirect_data);
+   /* the execution set index fits a byte, the depth takes two */
+   static const unsigned digits[] = {
+      [ORDER_STATE] = 1,
+      [ORDER_DEPTH] = 2,
+      [ORDER_STATE_DEPTH] = 3,
+   };
+
+   /* the last reads of the scratch and the stream may still be in flight */
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+      VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT |
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0, 0, NULL, 0, NULL, 0, NULL);
+
+   struct sort_push sort = {
+      .input = input,
+      .output = output,
+      .count = count_addr,
+      .ubo = get_buffer_address(ubo_buffer),
+      .gears = get_buffer_address(gear_buffer),
+      .instances = get_buffer_address(instance_buffer),
+      .view_rot_0 = push->view_rot_0,
+      .view_rot_1 = push->view_rot_1,
+      .total = sequence_count,
+      .blocks = blocks,
+      .use_count = count_addr != 0,
+      .order = sequence_order,
+      .histogram = histogram,
+   };
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, sort_pipeline);
+
+   unsigned k = 0;
+   sort.mode = SORT_KEYS;
+   sort.keys_out = keys[k];
+   sort.values_out = values[k];
+   vk.CmdPushConstants(cmd_buffer, sort_pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sort), &sort);
+   vk.CmdDispatch(cmd_buffer, blocks, 1, 1);
+   compute_barrier(cmd_buffer);
+
+   for (unsigned d = 0; d < digits[sequence_order]; d++) {
+      sort.shift = 8 * d;
+      sort.keys_in = keys[k];
+      sort.values_in = values[k];
+      sort.keys_out = keys[!k];
+      sort.values_out = values[!k];
+
+      static const enum sort_mode modes[] = { SORT_HISTOGRAM, SORT_SCAN, SORT_SCATTER };
+      for (unsigned m = 0; m < ARRAY_SIZE(modes); m++) {
+         sort.mode = modes[m];
+         vk.CmdPushConstants(cmd_buffer, sort_pipeline_layout,
+                             VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sort), &sort);
+         vk.CmdDispatch(cmd_buffer, modes[m] == SORT_SCAN ? 1 : blocks, 1, 1);
+         compute_barrier(cmd_buffer);
+      }
+      k = !k;
+   }
+
+   sort.mode = SORT_GATHER;
+   sort.values_in = values[k];
+   vk.CmdPushConstants(cmd_buffer, sort_pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sort), &sort);
+   vk.CmdDispatch(cmd_buffer, blocks, 1, 1);
+   cull_barrier(cmd_buffer);
+   return output;
+}
+
+#define HUD_RGBA(r, g, b, a) ((uint32_t)(r) | (uint32_t)(g) << 8 | \
+                              (uint32_t)(b) << 16 | (uint32_t)(a) << 24)
+#define HUD_MARGIN 8
+#define HUD_GRAPH_HEIGHT 64
+#define HUD_ROW_HEIGHT 14
+/* a digit is 6x10 pixels */
+#define HUD_DIGIT_WIDTH 6
+#define HUD_DIGIT_HEIGHT 10
+
+/* the quads and lines of -hud being built into a frame slot */
+struct hud_batch {
+   struct hud_vertex *quads, *lines;
+   uint32_t quad_count, line_count;
+};
+
+static void
+hud_quad(struct hud_batch *b, float x0, float y0, float x1, float y1, uint32_t color)
+{
+   if (b->quad_count == HUD_MAX_QUADS)
+      return;
+   struct hud_vertex *v = b->quads + 6 * b->quad_count++;
+   v[0] = (struct hud_vertex) { x0, y0, color };
+   v[1] = (struct hud_vertex) { x1, y0, color };
+   v[2] = (struct hud_vertex) { x0, y1, color };
+   v[3] = (struct hud_vertex) { x1, y0, color };
+   v[4] = (struct hud_vertex) { x1, y1, color };
+   v[5] = (struct hud_vertex) { x0, y1, color };
+}
+
+/* through the pixel centers, so a line lights whole pixels */
+static void
+hud_line(struct hud_batch *b, float x0, float y0, float x1, float y1, uint32_t color)
+{
+   if (b->line_count == HUD_MAX_LINES)
+      return;
+   struct hud_vertex *v = b->lines + 2 * b->line_count++;
+   v[0] = (struct hud_vertex) { x0 + 0.5f, y0 + 0.5f, color };
+   v[1] = (struct hud_vertex) { x1 + 0.5f, y1 + 0.5f, color };
+}
+
+/* digits, '.' and '-' as seven segment quads, returning where the text ends */
+static float
+hud_text(struct hud_batch *b, float x, float y, const char *text, uint32_t color)
+{
+   /* a to g, clockwise from the top then the middle */
+   static const float segments[7][4] = {
+      { 0, 0, 6, 2 }, { 4, 0, 6, 5 }, { 4, 5, 6, 10 }, { 0, 8, 6, 10 },
+      { 0, 5, 2, 10 }, { 0, 0, 2, 5 }, { 0, 4, 6, 6 },
+   };
+   static const uint8_t digits[10] = {
+      0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07, 0x7f, 0x6f,
+   };
+
+   for (const char *c = text; *c; c++) {
+      uint8_t mask = 0;
+      if (*c >= '0' && *c <= '9') {
+         mask = digits[*c - '0'];
+      } else if (*c == '-') {
+         mask = 1 << 6;
+      } else if (*c == '.') {
+         hud_quad(b, x, y + HUD_DIGIT_HEIGHT - 2, x + 2, y + HUD_DIGIT_HEIGHT, color);
+         x += 4;
+         continue;
+      }
+      for (unsigned i = 0; i < 7; i++) {
+         if (mask & (1 << i))
+            hud_quad(b, x + segments[i][0], y + segments[i][1],
+                     x + segments[i][2], y + segments[i][3], color);
+      }
+      x += HUD_DIGIT_WIDTH + 2;
+   }
+   return x;
+}
+
+/* a row of the HUD: a swatch of the color, then the value */
+static void
+hud_row(struct hud_batch *b, float x, float y, const char *text, uint32_t color)
+{
+   hud_quad(b, x, y + 1, x + 8, y + 9, color);
+   hud_text(b, x + 14, y, text, color);
+}
+
+/*
+ * Add up the HUD draws of the frame that last used this slot, once its
+ * fence has signaled, and take them out of the frame's GPU times, which
+ * were read from the same frame.
+ */
+static void
+read_hud_timer(unsigned frame_index, double *frame_gpu_ms)
+{
+   if (!hud_pending[frame_index])
+      return;
+   hud_pending[frame_index] = false;
+
+   double total = 0.0;
+   for (unsigned w = 0; w < window_count; w++) {
+      uint32_t query = HUD_QUERIES * frame_index + 2 * MAX_VIEWS * w;
+      uint64_t ts[2];
+      if (vk.GetQueryPoolResults(device, hud_pool, query, 1, sizeof(ts[0]), &ts[0],
+                                 sizeof(ts[0]), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS ||
+          vk.GetQueryPoolResults(device, hud_pool, query + MAX_VIEWS, 1, sizeof(ts[1]),
+                                 &ts[1], sizeof(ts[1]), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+         return;
+      double ms = ((ts[1] - ts[0]) & timestamp_mask) * timestamp_period / 1e6;
+      if (*frame_gpu_ms >= 0.0) {
+         gpu_phase_ms[1 + w] -= ms;
+         windows[w].gpu_time -= ms;
+      }
+      total += ms;
+   }
+   if (*frame_gpu_ms >= 0.0) {
+      *frame_gpu_ms -= total;
+      gpu_time -= total;
+   }
+   hud_draw_ms = total;
+   hud_gpu_time += total;
+   hud_gpu_frames++;
+}
+
+/*
+ * Build the HUD of this frame into its slot, from the frame time, the GPU
+ * times of the last timed frame and the counters of the last frame read
+ * back. What the HUD cost on the CPU last frame is shown, since this
+ * frame's is not known until it is recorded.
+ */
+static void
+build_hud(unsigned frame_index, float frame_ms, double gpu_ms)
+{
+   double start = current_time();
+   hud_cpu_ms = 1000.0 * hud_frame_cost;
+   hud_frame_cost = 0.0;
+
+   hud_frame_ms[hud_head] = frame_ms;
+   hud_gpu_ms[hud_head] = gpu_ms >= 0.0 ? gpu_ms : hud_gpu_ms[(hud_head + HUD_HISTORY - 1) % HUD_HISTORY];
+   hud_head = (hud_head + 1) % HUD_HISTORY;
+
+   struct hud_vertex *slot = hud_map + frame_index * HUD_SLOT_VERTICES;
+   struct hud_batch b = { slot, slot + 6 * HUD_MAX_QUADS, 0, 0 };
+   const uint32_t phase_colors[] = {
+      HUD_RGBA(160, 160, 160, 255), HUD_RGBA(80, 200, 255, 255),
+      HUD_RGBA(255, 96, 200, 255), HUD_RGBA(255, 230, 64, 255),
+   };
+   const uint32_t white = HUD_RGBA(255, 255, 255, 255);
+   const uint32_t orange = HUD_RGBA(255, 160, 32, 255);
+   unsigned phases = timer_pool ? 1 + window_count : 0;
+   unsigned rows = 3 + hiz_cull;
+   float x = HUD_MARGIN, y = HUD_MARGIN;
+   float bottom = y + HUD_GRAPH_HEIGHT + 6 + (phases + rows) * HUD_ROW_HEIGHT;
+   hud_quad(&b, x - 4, y - 4, x + HUD_HISTORY + 4, bottom, HUD_RGBA(0, 0, 0, 160));
+
+   /* the graph scales in steps of a 60 Hz frame, two of them at least */
+   float max_ms = 0.0f;
+   for (unsigned i = 0; i < HUD_HISTORY; i++)
+      max_ms = MAX2(max_ms, MAX2(hud_frame_ms[i], hud_gpu_ms[i]));
+   float step = 1000.0f / 60.0f;
+   float graph_ms = step * MAX2(2.0f, ceilf(max_ms / step));
+   float scale = HUD_GRAPH_HEIGHT / graph_ms;
+   for (unsigned i = 1; i <= 2; i++) {
+      float ly = y + HUD_GRAPH_HEIGHT - i * step * scale;
+      hud_line(&b, x, ly, x + HUD_HISTORY - 1, ly, HUD_RGBA(96, 96, 96, 255));
+   }
+   const float *series[] = { hud_frame_ms, hud_gpu_ms };
+   const uint32_t series_colors[] = { white, orange };
+   for (unsigned s = 0; s < ARRAY_SIZE(series); s++) {
+      if (s == 1 && !timer_pool)
+         break;
+      for (unsigned i = 1; i < HUD_HISTORY; i++) {
+         float v0 = series[s][(hud_head + i - 1) % HUD_HISTORY];
+         float v1 = series[s][(hud_head + i) % HUD_HISTORY];
+         hud_line(&b, x + i - 1, y + HUD_GRAPH_HEIGHT - MIN2(v0, graph_ms) * scale,
+                  x + i, y + HUD_GRAPH_HEIGHT - MIN2(v1, graph_ms) * scale,
+                  series_colors[s]);
+      }
+   }
+   y += HUD_GRAPH_HEIGHT + 6;
+
+   /* the bars share the graph's scale over what is left of the width */
+   char text[32];
+   float bar_width = HUD_HISTORY - 14 - 64;
+   for (unsigned p = 0; p < phases; p++) {
+      uint32_t color = phase_colors[p % ARRAY_SIZE(phase_colors)];
+      float width = MIN2(gpu_phase_ms[p] / graph_ms, 1.0f) * bar_width;
+      hud_quad(&b, x, y + 1, x + 8, y + 9, color);
+      hud_quad(&b, x + 14, y + 1, x + 14 + MAX2(width, 1.0f), y + 9, color);
+      snprintf(text, sizeof(text), "%.2f", MAX2(gpu_phase_ms[p], 0.0f));
+      hud_text(&b, x + 18 + bar_width, y, text, color);
+      y += HUD_ROW_HEIGHT;
+   }
+
+   VkDeviceSize attachments, resident;
+   attachment_totals(&attachments, &resident);
+   snprintf(text, sizeof(text), "%u", sequence_count);
+   hud_row(&b, x, y, text, HUD_RGBA(64, 255, 96, 255));
+   y += HUD_ROW_HEIGHT;
+   if (hiz_cull) {
+      snprintf(text, sizeof(text), "%u", hud_culled);
+      hud_row(&b, x, y, text, HUD_RGBA(255, 64, 64, 255));
+      y += HUD_ROW_HEIGHT;
+   }
+   snprintf(text, sizeof(text), "%.1f",
+            (attachments + preprocess_size) / (1024.0 * 1024.0));
+   hud_row(&b, x, y, text, HUD_RGBA(160, 128, 255, 255));
+   y += HUD_ROW_HEIGHT;
+   snprintf(text, sizeof(text), "%.3f", hud_cpu_ms);
+   hud_row(&b, x, y, text, orange);
+   if (hud_pool) {
+      snprintf(text, sizeof(text), "%.3f", hud_draw_ms);
+      hud_text(&b, x + HUD_HISTORY / 2, y, text, orange);
+   }
+
+   hud_quad_count = b.quad_count;
+   hud_line_count = b.line_count;
+   double elapsed = current_time() - start;
+   hud_frame_cost += elapsed;
+   hud_cpu_time += elapsed;
+}
+
+/*
+ * Draw the HUD built for this frame, from inside the window's last pass.
+ * The timestamps around it write a query per view of the pass.
+ */
+static void
+record_hud(VkCommandBuffer cmd_buffer, const struct window *win, unsigned frame_index)
+{
+   if (!hud_enabled)
+      return;
+   double start = current_time();
+   uint32_t query = HUD_QUERIES * frame_index + 2 * MAX_VIEWS * (win - windows);
+   if (hud_pool)
+      vk.CmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                           hud_pool, query);
+
+   vk.CmdSetViewport(cmd_buffer, 0, 1,
+      &(VkViewport) {
+         .x = 0,
+         .y = 0,
+         .width = win->render_width,
+         .height = win->render_height,
+         .minDepth = 0,
+         .maxDepth = 1,
+      });
+   vk.CmdSetScissor(cmd_buffer, 0, 1,
+      &(VkRect2D) { { 0, 0 }, { win->render_width, win->render_height } });
+   struct hud_push push = {
+      .vertices = hud_addr + frame_index * HUD_SLOT_VERTICES * sizeof(struct hud_vertex),
+      .scale = { 2.0f / win->render_width, 2.0f / win->render_height },
+   };
+   vk.CmdPushConstants(cmd_buffer, hud_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+                       0, sizeof(push), &push);
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, hud_pipelines[0]);
+   vk.CmdDraw(cmd_buffer, 6 * hud_quad_count, 1, 0, 0);
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, hud_pipelines[1]);
+   vk.CmdDraw(cmd_buffer, 2 * hud_line_count, 1, 6 * HUD_MAX_QUADS, 0);
+
+   if (hud_pool)
+      vk.CmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                           hud_pool, query + MAX_VIEWS);
+   double elapsed = current_time() - start;
+   hud_record_time += elapsed;
+   hud_frame_cost += elapsed;
+   hud_cpu_time += elapsed;
+}
+
+/*
+ * The two culled passes of a window. The first draws what the pyramid of
+ * the last frame does not hide; its depth then becomes the pyramid, which
+ * the second pass draws the rest against, catching what was disoccluded.
+ * A baseline frame draws everything in one pass and leaves the pyramid
+ * invalid, so the next frame's first pass also draws everything.
+ */
+static void
+record_culled_passes(VkCommandBuffer cmd_buffer, struct window *win,
+                     const struct push_constants *push, VkImageView color_view,
+                     unsigned frame_index)
+{
+   unsigned w = win - windows;
+   VkDeviceAddress stream = cull_addr + w * cull_window_size;
+   VkDeviceSize count_offset = (frame_index * WSI_MAX_WINDOWS + w) * 2 * sizeof(uint32_t);
+   VkDeviceAddress counts = cull_count_addr + count_offset;
+   uint32_t levels = MIN2(hiz_level_count(win->render_width, win->render_height),
+                          win->hiz_levels);
+
+   update_ubo(cmd_buffer, win, 0);
+
+   if (cull_baseline[frame_index]) {
+      VkDeviceAddress input = indirect_addr;
+      if (sequence_order != ORDER_SCENE)
+         input = sort_sequences(cmd_buffer, push, input, 0, 0);
+      begin_scene_pass(cmd_buffer, win, color_view, 0, false, NULL);
+      draw_gears(cmd_buffer, win, push, input, 0, NULL);
+      record_hud(cmd_buffer, win, frame_index);
+      vk.CmdEndRendering(cmd_buffer);
+      win->hiz_valid = false;
+      return;
+   }
+
+   /* the streams and counts may still be read by the last frame's executes */
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0, 0, NULL, 0, NULL, 0, NULL);
+   if (!win->hiz_valid) {
+      vk.CmdPipelineBarrier(cmd_buffer,
+         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         0,
+         0, NULL,
+         0, NULL,
+         1, &(VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = win->hiz_image,
+            .subresourceRange = {
+               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+               .baseMipLevel = 0,
+               .levelCount = VK_REMAINING_MIP_LEVELS,
+               .baseArrayLayer = 0,
+               .layerCount = 1,
+            },
+         });
+   }
+   vk.CmdFillBuffer(cmd_buffer, cull_count_buffer, count_offset,
+                    2 * sizeof(uint32_t), 0);
+   buffer_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+      cull_count_buffer, count_offset, 2 * sizeof(uint32_t));
+
+   cull_dispatch(cmd_buffer, win, push, stream, counts, 0,
+                 win->hiz_valid ? levels : 0);
+   VkDeviceAddress first = stream;
+   if (sequence_order != ORDER_SCENE)
+      first = sort_sequences(cmd_buffer, push, first, counts, 0);
+   begin_scene_pass(cmd_buffer, win, color_view, 0, false, NULL);
+   draw_gears(cmd_buffer, win, push, first, counts, NULL);
+   vk.CmdEndRendering(cmd_buffer);
+
+   build_hiz(cmd_buffer, win, levels);
+   win->hiz_valid = true;
+
+   cull_dispatch(cmd_buffer, win, push, stream, counts, 1, levels);
+   VkDeviceAddress second = stream + cull_stream_size;
+   if (sequence_order != ORDER_SCENE)
+      second = sort_sequences(cmd_buffer, push, second, counts + sizeof(uint32_t), 1);
+   preprocess_barrier(cmd_buffer);
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      0,
+      1, &(VkMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      },
+      0, NULL,
+      0, NULL);
+   begin_scene_pass(cmd_buffer, win, color_view, 0, true, NULL);
+   draw_gears(cmd_buffer, win, push, second, counts + sizeof(uint32_t), NULL);
+   record_hud(cmd_buffer, win, frame_index);
+   vk.CmdEndRendering(cmd_buffer);
+
+   buffer_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_ACCESS_HOST_READ_BIT,
+      cull_count_buffer, count_offset, 2 * sizeof(uint32_t));
+}
+
+/*
+ * Redraw the damage of an image, a pass per rectangle: the color around it
+ * is kept, the rectangle cleared and the sequences executed scissored to
+ * it. The executes share the preprocess buffer, so the passes cannot.
+ */
+static void
+record_damage(VkCommandBuffer cmd_buffer, struct window *win,
+              const struct push_constants *push, VkImageView color_view,
+              VkDeviceAddress stream, const struct damage *damage)
+{
+   for (unsigned i = 0; i < damage->count; i++) {
+      if (i > 0)
+         preprocess_barrier(cmd_buffer);
+      begin_scene_pass(cmd_buffer, win, color_view, 0, false, &damage->rects[i]);
+      vk.CmdClearAttachments(cmd_buffer, 1,
+         &(VkClearAttachment) {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .colorAttachment = 0,
+            .clearValue.color = { .float32 = { 0.0f, 0.0f, 0.0f, 1.0f } },
          },
-         NULL,
-         &red_module);
-      VkShaderModule green_module;
-      vkCreateShaderModule(device,
-         &(VkShaderModuleCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = sizeof(green_spirv_source),
-            .pCode = green_spirv_source,
+         1, &(VkClearRect) {
+            .rect = damage->rects[i],
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+         });
+      draw_gears(cmd_buffer, win, push, stream, 0, &damage->rects[i]);
+      vk.CmdEndRendering(cmd_buffer);
+   }
+}
+
+static void
+rt_timestamp(VkCommandBuffer cmd_buffer, unsigned frame_index, unsigned query)
+{
+   if (rt_pool)
+      vk.CmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                           rt_pool, RT_QUERIES * frame_index + query);
+}
+
+/*
+ * Bring the acceleration structures up to this frame's angles. The BLAS
+ * never change and are built once. The gears only turn and so stay in
+ * place, which suits an update of the TLAS in place from the instances
+ * written on the GPU, but each update loosens its bounds a little, so
+ * every RT_REBUILD_INTERVAL frames it is built anew.
+ */
+static void
+build_rt_scene(VkCommandBuffer cmd_buffer, unsigned frame_index)
+{
+   if (rt_pool) {
+      vk.CmdResetQueryPool(cmd_buffer, rt_pool, RT_QUERIES * frame_index, RT_QUERIES);
+      rt_pending[frame_index] = true;
+   }
+   rt_timestamp(cmd_buffer, frame_index, 0);
+
+   rt_blas_frame[frame_index] = !rt_blas_built;
+   if (!rt_blas_built) {
+      VkAccelerationStructureGeometryKHR geometries[scene.shape_count];
+      VkAccelerationStructureBuildRangeInfoKHR ranges[scene.shape_count];
+      VkAccelerationStructureBuildGeometryInfoKHR infos[scene.shape_count];
+      const VkAccelerationStructureBuildRangeInfoKHR *range_ptrs[scene.shape_count];
+      for (uint32_t s = 0; s < scene.shape_count; s++) {
+         rt_blas_geometry(s, &geometries[s], &ranges[s]);
+         range_ptrs[s] = &ranges[s];
+         infos[s] = (VkAccelerationStructureBuildGeometryInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+            .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+            .dstAccelerationStructure = rt_blas[s].as,
+            .geometryCount = 1,
+            .pGeometries = &geometries[s],
+            .scratchData.deviceAddress = rt_scratch_addr + rt_blas[s].scratch_offset,
+         };
+      }
+      vk.CmdBuildAccelerationStructuresKHR(cmd_buffer, scene.shape_count, infos, range_ptrs);
+      rt_blas_built = true;
+
+      /* the TLAS build reads them and reuses their scratch */
+      vk.CmdPipelineBarrier(cmd_buffer,
+         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+         0,
+         1, &(VkMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+            .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                             VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
          },
-         NULL,
-         &green_module);
-      VkShaderModule blue_module;
-      vkCreateShaderModule(device,
-         &(VkShaderModuleCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = sizeof(blue_spirv_source),
-            .pCode = blue_spirv_source,
+         0, NULL,
+         0, NULL);
+   }
+   rt_timestamp(cmd_buffer, frame_index, 1);
+
+   /* the previous frame's rays and build must be done with the instances */
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0,
+      0, NULL,
+      0, NULL,
+      0, NULL);
+   struct rt_instance_push push = {
+      .gears = get_buffer_address(gear_buffer),
+      .angles = get_buffer_address(angle_buffer),
+      .blas = rt_blas_ref_addr,
+      .instances = rt_instance_addr,
+      .gear_count = scene.gear_count,
+   };
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, rt_instance_pipeline);
+   vk.CmdPushConstants(cmd_buffer, rt_instance_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(push), &push);
+   vk.CmdDispatch(cmd_buffer, (scene.gear_count + 63) / 64, 1, 1);
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+      0,
+      1, &(VkMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                          VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                          VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+      },
+      0, NULL,
+      0, NULL);
+
+   bool rebuild = rt_frame++ % RT_REBUILD_INTERVAL == 0;
+   rt_rebuild_frame[frame_index] = rebuild;
+   VkAccelerationStructureGeometryKHR geometry = rt_tlas_geometry();
+   vk.CmdBuildAccelerationStructuresKHR(cmd_buffer, 1,
+      &(VkAccelerationStructureBuildGeometryInfoKHR) {
+         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+         .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+         .flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR |
+                  VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR,
+         .mode = rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR :
+                           VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+         .srcAccelerationStructure = rebuild ? VK_NULL_HANDLE : rt_tlas,
+         .dstAccelerationStructure = rt_tlas,
+         .geometryCount = 1,
+         .pGeometries = &geometry,
+         .scratchData.deviceAddress = rt_scratch_addr,
+      },
+      (const VkAccelerationStructureBuildRangeInfoKHR *[]) {
+         &(VkAccelerationStructureBuildRangeInfoKHR) {
+            .primitiveCount = scene.gear_count,
          },
-         NULL,
-         &blue_module);
-      VkShaderModule vs_modules[] = {red_module, green_module, blue_module};
+      });
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+      0,
+      1, &(VkMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+         .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+      },
+      0, NULL,
+      0, NULL);
+   rt_timestamp(cmd_buffer, frame_index, 2);
+}
+
+/*
+ * Trace a shadow ray per pixel of the pass just drawn, through a trace
+ * rays command generated from this frame's entry of the stream, then
+ * darken what the rays found shadowed and draw the HUD on top. The rays
+ * start from the depth, so the gears are only ever drawn once.
+ */
+static void
+record_rt_shadows(VkCommandBuffer cmd_buffer, struct window *win,
+                  const struct push_constants *push, VkImageView color_view,
+                  unsigned frame_index)
+{
+   unsigned w = win - windows;
+   unsigned slot = frame_index * WSI_MAX_WINDOWS + w;
+
+   float projection[16], view[16];
+   window_projection(win, projection);
+   mat4_identity(view);
+   mat4_translate(view, 0, 0, -scene.view_distance);
+   mat4_rotate(view, 2 * M_PI * push->view_rot_0 / 360.0, 1, 0, 0);
+   mat4_rotate(view, 2 * M_PI * push->view_rot_1 / 360.0, 0, 1, 0);
+
+   /* the light of the vertex shaders is fixed in eye space */
+   struct rt_params *params = &rt_params_map[slot];
+   const float light[3] = { 5.0f / sqrtf(150.0f), 5.0f / sqrtf(150.0f), 10.0f / sqrtf(150.0f) };
+   for (unsigned k = 0; k < 3; k++)
+      params->light[k] = view[4 * k] * light[0] + view[4 * k + 1] * light[1] +
+                         view[4 * k + 2] * light[2];
+   params->light[3] = 0.0f;
+   mat4_invert(view);
+   memcpy(params->inverse_view, view, sizeof(view));
+   params->projection[0] = projection[0];
+   params->projection[1] = projection[5];
+   params->projection[2] = projection[10];
+   params->projection[3] = projection[14];
+   params->tlas = rt_tlas_addr;
+   params->mask = win->rt_mask_addr;
+
+   VkDeviceAddress sbt = rt_sbt_addr;
+   rt_stream_map[slot] = (VkTraceRaysIndirectCommand2KHR) {
+      .raygenShaderRecordAddress = sbt,
+      .raygenShaderRecordSize = rt_record_size,
+      .missShaderBindingTableAddress = sbt + rt_record_size,
+      .missShaderBindingTableSize = rt_record_size,
+      .missShaderBindingTableStride = rt_record_size,
+      .width = win->render_width,
+      .height = win->render_height,
+      .depth = 1,
+   };
+
+   /* the rays read the stored depth, after the last composite read the mask */
+   depth_barrier(cmd_buffer, win,
+      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+   buffer_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+      0, 0,
+      win->rt_mask_buffer, 0, VK_WHOLE_SIZE);
+   if (w > 0)
+      buffer_barrier(cmd_buffer,
+         VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+         VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+         VK_ACCESS_COMMAND_PREPROCESS_WRITE_BIT_EXT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+         VK_ACCESS_COMMAND_PREPROCESS_WRITE_BIT_EXT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+         rt_preprocess_buffer, 0, rt_preprocess_size);
+
+   rt_timestamp(cmd_buffer, frame_index, 3 + 2 * w);
+   VkDeviceAddress params_addr = rt_params_addr + slot * sizeof(struct rt_params);
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rt_pipeline);
+   vk.CmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+                            rt_pipeline_layout, 0, 1, &win->rt_set, 0, NULL);
+   vk.CmdPushConstants(cmd_buffer, rt_pipeline_layout, VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+                       0, sizeof(params_addr), &params_addr);
+   vk.CmdExecuteGeneratedCommandsEXT(cmd_buffer, VK_FALSE,
+                                       &(VkGeneratedCommandsInfoEXT) {
+                                          .sType = VK_STRUCTURE_TYPE_GENERATED_COMMANDS_INFO_EXT,
+                                          .pNext = &(VkGeneratedCommandsPipelineInfoEXT) {
+                                             .sType = VK_STRUCTURE_TYPE_GENERATED_COMMANDS_PIPELINE_INFO_EXT,
+                                             .pipeline = rt_pipeline,
+                                          },
+                                          .shaderStages = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
+                                          .indirectCommandsLayout = rt_indirect_layout,
+                                          .indirectAddress = rt_stream_addr + slot * sizeof(VkTraceRaysIndirectCommand2KHR),
+                                          .indirectAddressSize = sizeof(VkTraceRaysIndirectCommand2KHR),
+                                          .preprocessAddress = rt_preprocess_addr,
+                                          .preprocessSize = rt_preprocess_size,
+                                          .maxSequenceCount = 1,
+                                       });
+   rt_timestamp(cmd_buffer, frame_index, 4 + 2 * w);
+
+   buffer_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      win->rt_mask_buffer, 0, VK_WHOLE_SIZE);
+   depth_barrier(cmd_buffer, win,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+      0,
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+   begin_scene_pass(cmd_buffer, win, color_view, pass_view_mask(), true, NULL);
+   vk.CmdSetViewport(cmd_buffer, 0, 1,
+      &(VkViewport) {
+         .x = 0,
+         .y = 0,
+         .width = win->render_width,
+         .height = win->render_height,
+         .minDepth = 0,
+         .maxDepth = 1,
+      });
+   vk.CmdSetScissor(cmd_buffer, 0, 1,
+      &(VkRect2D) { { 0, 0 }, { win->render_width, win->render_height } });
+   struct rt_composite_push composite = {
+      .mask = win->rt_mask_addr,
+      .width = win->render_width,
+   };
+   vk.CmdPushConstants(cmd_buffer, rt_composite_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT,
+                       0, sizeof(composite), &composite);
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, rt_composite_pipeline);
+   vk.CmdDraw(cmd_buffer, 3, 1, 0, 0);
+   record_hud(cmd_buffer, win, frame_index);
+   vk.CmdEndRendering(cmd_buffer);
+}
+
+/*
+ * Add up the builds and traces of the frame that last used this slot, once
+ * its fence has signaled.
+ */
+static void
+read_rt_timer(unsigned frame_index)
+{
+   if (!rt_pending[frame_index])
+      return;
+   rt_pending[frame_index] = false;
+
+   uint32_t count = 3 + 2 * window_count;
+   uint64_t ts[RT_QUERIES];
+   if (vk.GetQueryPoolResults(device, rt_pool, RT_QUERIES * frame_index,
+                              count, count * sizeof(ts[0]), ts, sizeof(ts[0]),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+      return;
+
+   if (rt_blas_frame[frame_index])
+      rt_blas_ms = ((ts[1] - ts[0]) & timestamp_mask) * timestamp_period / 1e6;
+   double tlas_ms = ((ts[2] - ts[1]) & timestamp_mask) * timestamp_period / 1e6;
+   if (rt_rebuild_frame[frame_index]) {
+      rt_build_ms += tlas_ms;
+      rt_builds++;
+   } else {
+      rt_refit_ms += tlas_ms;
+      rt_refits++;
+   }
+   for (unsigned w = 0; w < window_count; w++)
+      rt_trace_ms += ((ts[4 + 2 * w] - ts[3 + 2 * w]) & timestamp_mask) *
+                     timestamp_period / 1e6;
+   rt_trace_frames++;
+}
+
+/*
+ * Sort the gears of the first view into those small enough for the
+ * software rasterizer and the rest, rasterize the small ones into the
+ * window's visibility buffer and return the stream left to the generated
+ * commands, its count at *count_addr. The resolve of record_swr_resolve()
+ * merges the two through the depth test.
+ */
+static VkDeviceAddress
+record_swr(VkCommandBuffer cmd_buffer, struct window *win,
+           const struct push_constants *push, float threshold,
+           unsigned frame_index, VkDeviceAddress *count_addr)
+{
+   unsigned w = win - windows;
+   unsigned slot = frame_index * WSI_MAX_WINDOWS + w;
+   VkDeviceSize count_offset = slot * sizeof(struct swr_counts);
+   VkDeviceAddress stream = swr_addr + w * swr_window_size;
+   VkDeviceAddress small = stream + swr_stream_size;
+
+   /* the last frame's draws, raster and resolve are done with them */
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+      VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT |
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0,
+      0, NULL,
+      0, NULL,
+      0, NULL);
+   vk.CmdUpdateBuffer(cmd_buffer, swr_count_buffer, count_offset,
+                      sizeof(struct swr_counts),
+                      &(struct swr_counts) { .dispatch = { 0, 1, 1 } });
+   vk.CmdFillBuffer(cmd_buffer, win->swr_visibility_buffer, 0, VK_WHOLE_SIZE, 0xffffffff);
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0,
+      1, &(VkMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+      },
+      0, NULL,
+      0, NULL);
+
+   struct swr_classify_push classify = {
+      .input = indirect_addr,
+      .output = stream,
+      .small = small,
+      .count = swr_count_addr + count_offset,
+      .ubo = get_buffer_address(ubo_buffer),
+      .gears = get_buffer_address(gear_buffer),
+      .instances = get_buffer_address(instance_buffer),
+      .radius = get_buffer_address(radius_buffer),
+      .materials = get_buffer_address(swr_material_buffer),
+      .view_rot_0 = push->view_rot_0,
+      .view_rot_1 = push->view_rot_1,
+      .sequence_count = sequence_count,
+      .capacity = swr_capacity,
+      .threshold = threshold,
+      .render_height = win->render_height,
+   };
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, swr_classify_pipeline);
+   vk.CmdPushConstants(cmd_buffer, swr_classify_pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(classify), &classify);
+   vk.CmdDispatch(cmd_buffer, (sequence_count + 63) / 64, 1, 1);
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+      VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT,
+      0,
+      1, &(VkMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                          VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                          VK_ACCESS_COMMAND_PREPROCESS_READ_BIT_EXT,
+      },
+      0, NULL,
+      0, NULL);
+
+   /* a workgroup per small gear, as many as the classification wrote */
+   struct swr_raster_push raster = {
+      .small = small,
+      .vertices = get_buffer_address(vertex_buffer),
+      .visibility = win->swr_visibility_addr,
+      .ubo = get_buffer_address(ubo_buffer),
+      .gears = get_buffer_address(gear_buffer),
+      .angles = get_buffer_address(angle_buffer),
+      .view_rot_0 = push->view_rot_0,
+      .view_rot_1 = push->view_rot_1,
+      .render_size = { win->render_width, win->render_height },
+   };
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, swr_raster_pipeline);
+   vk.CmdPushConstants(cmd_buffer, swr_raster_pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(raster), &raster);
+   vk.CmdDispatchIndirect(cmd_buffer, swr_count_buffer,
+                          count_offset + offsetof(struct swr_counts, dispatch));
+   buffer_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      win->swr_visibility_buffer, 0, VK_WHOLE_SIZE);
+
+   *count_addr = swr_count_addr + count_offset + offsetof(struct swr_counts, sequences);
+   return stream;
+}
+
+/* draw the visibility buffer over the pass, where it is nearer than the gears */
+static void
+record_swr_resolve(VkCommandBuffer cmd_buffer, const struct window *win)
+{
+   vk.CmdSetViewport(cmd_buffer, 0, 1,
+      &(VkViewport) {
+         .x = 0,
+         .y = 0,
+         .width = win->render_width,
+         .height = win->render_height,
+         .minDepth = 0,
+         .maxDepth = 1,
+      });
+   vk.CmdSetScissor(cmd_buffer, 0, 1,
+      &(VkRect2D) { { 0, 0 }, { win->render_width, win->render_height } });
+   struct swr_resolve_push resolve = {
+      .visibility = win->swr_visibility_addr,
+      .width = win->render_width,
+   };
+   vk.CmdPushConstants(cmd_buffer, swr_resolve_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT,
+                       0, sizeof(resolve), &resolve);
+   vk.CmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, swr_resolve_pipeline);
+   vk.CmdDraw(cmd_buffer, 3, 1, 0, 0);
+}
+
+/*
+ * Add the GPU time of the frame that last used this slot to the total of
+ * its threshold and, for a regular frame, the gears it rasterized in
+ * software, once its fence has signaled.
+ */
+static void
+read_swr_counts(unsigned frame_index, double gpu_ms)
+{
+   if (!swr_pending[frame_index])
+      return;
+   swr_pending[frame_index] = false;
 
-      VkShaderModule fs_module;
-      vkCreateShaderModule(device,
-         &(VkShaderModuleCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = sizeof(fs_spirv_source),
-            .pCode = fs_spirv_source,
-         },
+   int probe = swr_probe[frame_index];
+   if (probe >= 0) {
+      if (gpu_ms >= 0.0) {
+         swr_probe_ms[probe] += gpu_ms;
+         swr_probe_frames[probe]++;
+      }
+      return;
+   }
+   if (gpu_ms >= 0.0) {
+      swr_gpu_ms += gpu_ms;
+      swr_gpu_frames++;
+   }
+   for (unsigned w = 0; w < window_count; w++) {
+      const struct swr_counts *counts = &swr_count_map[frame_index * WSI_MAX_WINDOWS + w];
+      swr_small_gears += counts->dispatch[0];
+      swr_gears += scene.gear_count;
+   }
+}
+
+/*
+ * Record one window's share of the frame: its projection, the gears seen
+ * from its own yaw and the resolve and upscale into its acquired image.
+ * With several views and no view mask every view gets its own pass and
+ * its own execute of the generated commands.
+ */
+static void
+record_window(VkCommandBuffer cmd_buffer, struct window *win, bool capture,
+              unsigned frame_index)
+{
+   VkImage image = win->image_data[win->image_index].image;
+   VkImageView view = win->image_data[win->image_index].view;
+   struct push_constants push = frame_push;
+   if (win != &windows[0]) {
+      int w, h;
+      view_extent(win, &w, &h);
+      push.view_rot_1 += win->yaw;
+      push.h = (float)h / w;
+   }
+
+   if (render_offscreen())
+      begin_render_target(cmd_buffer, win);
+
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      0,
+      0, NULL,
+      0, NULL,
+      1, &(VkImageMemoryBarrier) {
+         VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
          NULL,
-         &fs_module);
+         0,
+         VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,
+         !win->image_data[win->image_index].presented ?
+            VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+         0, 0,
+         image,
+         .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+         },
+      }
+   );
+   win->image_data[win->image_index].presented = true;
+
+   VkImage color_image = render_offscreen() ? win->res_color : image;
+   VkImageView color_view = render_offscreen() ? win->res_color_view : view;
+   bool msaa = sample_count != VK_SAMPLE_COUNT_1_BIT;
+   bool pass_resolve = msaa && resolve_mode == RESOLVE_PASS;
+   uint32_t view_mask = pass_view_mask();
+   unsigned passes = hiz_cull ? 0 : view_mask ? 1 : view_count;
+   VkDeviceAddress stream = indirect_addr, count_addr = 0;
+   /* a probe frame tries another threshold, 0 leaving every gear to the generated commands */
+   float swr = swr_threshold;
+   if (swr > 0.0f && swr_probe[frame_index] >= 0)
+      swr = swr_probe_thresholds[swr_probe[frame_index]];
+
+   /* everything is redrawn unless damage tracking tells otherwise */
+   struct damage damage = { .full = true };
+   if (damage_tracking) {
+      track_damage(win, &push);
+      image_damage(win, damage_baseline[frame_index], &damage);
+      win->image_data[win->image_index].damage_serial = win->damage_serial;
+
+      uint64_t pixels = (uint64_t)win->render_width * win->render_height;
+      uint64_t shaded = damage.full ? pixels : 0;
+      for (unsigned i = 0; i < damage.count; i++)
+         shaded += rect_area(damage.rects[i]);
+      if (!damage_baseline[frame_index]) {
+         damage_shaded += shaded;
+         damage_pixels += pixels;
+      }
+      damage_full[frame_index] &= damage.full;
+   }
 
-      VkPipelineRenderingCreateInfo pci = {
-         VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+   /* culling records its own passes */
+   if (hiz_cull)
+      record_culled_passes(cmd_buffer, win, &push, color_view, frame_index);
+
+   for (unsigned p = 0; p < passes; p++) {
+      if (p > 0) {
+         preprocess_barrier(cmd_buffer);
+         /* the passes share one layer of depth */
+         vk.CmdPipelineBarrier(cmd_buffer,
+            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+            0,
+            1, &(VkMemoryBarrier) {
+               .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+               .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+               .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            },
+            0, NULL,
+            0, NULL);
+      }
+      update_ubo(cmd_buffer, win, p);
+      /* the small gears the first view sees are left out of every pass */
+      if (p == 0 && swr > 0.0f)
+         stream = record_swr(cmd_buffer, win, &push, swr, frame_index, &count_addr);
+      /* the order the first view sees serves them all */
+      if (p == 0 && sequence_order != ORDER_SCENE)
+         stream = sort_sequences(cmd_buffer, &push, stream, count_addr, 0);
+      VkImageView pass_view = passes > 1 ? win->res_layer_views[p] : color_view;
+
+      /* the samples are cleared, so whatever last read them can be discarded */
+      if (msaa) {
+         image_barrier(cmd_buffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+            VK_PIPELINE_STAGE_TRANSFER_BIT |
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            0,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            win->color_msaa);
+      }
+      if (damage.full) {
+         begin_scene_pass(cmd_buffer, win, pass_view, view_mask, false, NULL);
+         draw_gears(cmd_buffer, win, &push, stream, count_addr, NULL);
+         if (swr > 0.0f)
+            record_swr_resolve(cmd_buffer, win);
+         /* without a view mask the HUD goes into the last view only */
+         if (p == passes - 1 && !rt_shadows)
+            record_hud(cmd_buffer, win, frame_index);
+         vk.CmdEndRendering(cmd_buffer);
+      } else {
+         record_damage(cmd_buffer, win, &push, pass_view, stream, &damage);
+      }
+   }
+   if (swr > 0.0f)
+      buffer_barrier(cmd_buffer,
+         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         VK_PIPELINE_STAGE_HOST_BIT,
+         VK_ACCESS_SHADER_WRITE_BIT,
+         VK_ACCESS_HOST_READ_BIT,
+         swr_count_buffer, 0, VK_WHOLE_SIZE);
+   if (rt_shadows)
+      record_rt_shadows(cmd_buffer, win, &push, color_view, frame_index);
+   if (msaa && !pass_resolve)
+      resolve_msaa(cmd_buffer, win, color_image, color_view);
+   if (render_offscreen())
+      blit_render_target(cmd_buffer, win, image);
+   if (capture)
+      record_capture(cmd_buffer, win);
+   vk.CmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      0,
+      0, NULL,
+      0, NULL,
+      1, &(VkImageMemoryBarrier) {
+         VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
          NULL,
+         VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,
          0,
-         1,
-         &image_format,
-         depth_format,
-      };
-      VkPipelineCreateFlags2CreateInfoKHR pipeline2 = {
-         VK_STRUCTURE_TYPE_PIPELINE_CREATE_FLAGS_2_CREATE_INFO_KHR,
-         &pci,
-         VK_PIPELINE_CREATE_2_INDIRECT_BINDABLE_BIT_EXT
-      };
-      for (unsigned i = 0; i < ARRAY_SIZE(vs_modules); i++) {
-         vkCreateGraphicsPipelines(device,
-            (VkPipelineCache) { VK_NULL_HANDLE },
-            1,
-            &(VkGraphicsPipelineCreateInfo) {
-               .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-               .pNext = &pipeline2,
-               .stageCount = 2,
-               .pStages = (VkPipelineShaderStageCreateInfo[]) {
-                     {
-                        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                        .stage = VK_SHADER_STAGE_VERTEX_BIT,
-                        .module = vs_modules[i],
-                        .pName = "main",
-                     },
-                     {
-                        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-                        .module = fs_module,
-                        .pName = "main",
-                     },
-               },
-               .pVertexInputState = &(VkPipelineVertexInputStateCreateInfo) {
-                  .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-                  .vertexBindingDescriptionCount = 2,
-                  .pVertexBindingDescriptions = (VkVertexInputBindingDescription[]) {
-                     {
-                        .binding = 0,
-                        .stride = 6 * sizeof(float),
-                        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
-                     },
-                     {
-                        .binding = 1,
-                        .stride = 6 * sizeof(float),
-                        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
-                     },
+         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+         VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+         0, 0,
+         image,
+         .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+         },
+      }
+   );
+}
+
+/*
+ * Render until a window is closed or, when duration is positive, for that
+ * many seconds. Frame times of the run are summarized into result.
+ */
+static void
+run(double duration, struct bench_result *result)
+{
+   int frames = 0;
+   unsigned frames_total = 0;
+   double tRot0 = -1.0, tRate0 = -1.0, tStart = 0.0;
+   uint32_t frame_index = 0;
+   double frame_start[MAX_CONCURRENT_FRAMES] = { 0.0 };
+   uint64_t slot_serial[MAX_CONCURRENT_FRAMES] = { 0 };
+   unsigned latency_count = 0;
+
+   for (unsigned w = 0; w < window_count; w++) {
+      windows[w].record_time = windows[w].record_mark = 0.0;
+      windows[w].gpu_time = windows[w].gpu_mark = 0.0;
+   }
+   bind_time = 0.0;
+   double bind_mark = 0.0;
+   gpu_time = 0.0;
+   gpu_frames = 0;
+   double gpu_mark = 0.0;
+   unsigned gpu_frames_mark = 0;
+
+   while (1) {
+      /* deterministic runs advance a fixed 60 Hz step per frame */
+      double dt, t = deterministic ? frames_total / 60.0 : current_time();
+      double begin = current_time();
+
+      if (tRot0 < 0.0)
+         tRot0 = tStart = t;
+      dt = t - tRot0;
+      tRot0 = t;
+
+      if (duration > 0.0 && t - tStart >= duration)
+         break;
+      if (frames_total > 0 && frames_total <= ARRAY_SIZE(frame_times))
+         frame_times[frames_total - 1] = dt * 1000.0;
+      frames_total++;
+      bool capture = capture_at && frames_total == capture_at;
+      struct frame_record *rec = begin_frame_record(++frame_serial);
+      double mark = begin;
+
+      /* commands run here, where no frame is being recorded */
+      if (control_path) {
+         control_poll(&control, control_command);
+         if (control_quit)
+            break;
+      }
+      mark_phase(rec, PHASE_CONTROL, &mark);
+      /* a capture asked for over the socket waits for a frame of its own */
+      char *requested_capture = capture ? NULL : control_capture_file;
+
+      if (animate && !replaying) {
+         /* advance rotation for next frame */
+         angle += 70.0 * dt;  /* 70 degrees per second */
+      }
+
+      mark_phase(rec, PHASE_OTHER, &mark);
+      if (wsi.update_window()) {
+         printf("update window failed\n");
+         break;
+      }
+      mark_phase(rec, PHASE_WSI, &mark);
+
+      for (unsigned w = 0; w < window_count; w++) {
+         struct window *win = &windows[w];
+         if (win->suboptimal ||
+             win->width != win->new_width || win->height != win->new_height)
+            recreate_swapchain(win);
+      }
+      mark_phase(rec, PHASE_RECREATE, &mark);
+
+      assert(frame_index < ARRAY_SIZE(frame_data));
+      vk.WaitForFences(device, 1, &frame_data[frame_index].fence, VK_TRUE, UINT64_MAX);
+      vk.ResetFences(device, 1, &frame_data[frame_index].fence);
+      mark_phase(rec, PHASE_FENCE, &mark);
+
+      /*
+       * latency: from the start of the frame that last used this slot
+       * until it is seen complete, so it includes waiting for a swapchain
+       * image and queueing behind the frames still in flight
+       */
+      if (frame_start[frame_index] > 0.0 && latency_count < ARRAY_SIZE(latency_times))
+         latency_times[latency_count++] = 1000.0 * (current_time() - frame_start[frame_index]);
+      frame_start[frame_index] = begin;
+
+      double frame_gpu_ms = read_gpu_timer(frame_index);
+      if (hiz_cull)
+         read_cull_counts(frame_index, frame_gpu_ms);
+      if (overdraw_pool)
+         read_overdraw(frame_index);
+      if (hud_pool)
+         read_hud_timer(frame_index, &frame_gpu_ms);
+      if (rt_pool)
+         read_rt_timer(frame_index);
+      if (swr_threshold > 0.0f)
+         read_swr_counts(frame_index, frame_gpu_ms);
+      if (damage_pending[frame_index] && frame_gpu_ms >= 0.0) {
+         damage_gpu_ms[damage_full[frame_index]] += frame_gpu_ms;
+         damage_gpu_frames[damage_full[frame_index]]++;
+      }
+      damage_pending[frame_index] = false;
+      if (frame_gpu_ms >= 0.0)
+         set_frame_gpu_time(slot_serial[frame_index], frame_gpu_ms);
+      slot_serial[frame_index] = frame_serial;
+      if (dynamic_res_target > 0.0f) {
+         for (unsigned w = 0; w < window_count; w++)
+            update_dynamic_res(&windows[w], frame_gpu_ms);
+      }
+
+      /* a suboptimal swapchain still presents, it is rebuilt next frame */
+      for (unsigned w = 0; w < window_count; w++) {
+         struct window *win = &windows[w];
+         VkResult result =
+            vk.AcquireNextImageKHR(device, win->swapchain, UINT64_MAX,
+                                   win->acquire_semaphore[frame_index], VK_NULL_HANDLE,
+                                   &win->image_index);
+         if (result == VK_SUBOPTIMAL_KHR)
+            win->suboptimal = true;
+         else
+            assert(result == VK_SUCCESS);
+         assert(win->image_index < ARRAY_SIZE(win->image_data));
+         rec->image_index[w] = win->image_index;
+         rec->acquire_result[w] = result;
+      }
+      mark_phase(rec, PHASE_ACQUIRE, &mark);
+
+      if (use_streaming)
+         stream_acquire();
+
+      if (replaying) {
+         const struct trace_frame *frame = &replay_trace.frames[replay_frame];
+         memcpy(&frame_push, frame->push, sizeof(frame_push));
+         frame_angle = frame->angle;
+         indirect_addr = replay_addr + frame->stream_offset;
+         sequence_count = frame->sequence_count;
+         replay_frame = (replay_frame + 1) % replay_trace.header->frame_count;
+      } else {
+         update_push_constants();
+      }
+
+      if (record_file &&
+          !trace_writer_add_frame(&trace_writer, &frame_push, frame_angle,
+                                  current_indirect_data(), sequence_count))
+         error("Failed to record a frame to %s", record_file);
+
+      VkCommandBuffer cmd_buffer = frame_data[frame_index].cmd_buffer;
+      vk.BeginCommandBuffer(cmd_buffer,
+         &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = 0
+         });
+
+      /* a baseline frame is only worth drawing when it can be timed */
+      if (hiz_cull) {
+         cull_baseline[frame_index] = timer_pool &&
+                                      ++cull_frame % HIZ_BASELINE_INTERVAL == 0;
+         cull_tested_sequences[frame_index] = window_count * sequence_count;
+         cull_pending[frame_index] = true;
+      }
+
+      if (damage_tracking) {
+         damage_baseline[frame_index] = timer_pool &&
+                                        ++damage_frame % DAMAGE_BASELINE_INTERVAL == 0;
+         damage_full[frame_index] = true;
+         damage_pending[frame_index] = true;
+      }
+
+      /* every few frames a timed one tries the next threshold of the sweep */
+      if (swr_threshold > 0.0f) {
+         swr_probe[frame_index] = timer_pool && ++swr_frame % SWR_PROBE_INTERVAL == 0 ?
+                                  (int)(swr_next_probe++ % SWR_PROBES) : -1;
+         swr_pending[frame_index] = true;
+      }
+
+      if (overdraw_pool) {
+         vk.CmdResetQueryPool(cmd_buffer, overdraw_pool, frame_index, 1);
+         vk.CmdBeginQuery(cmd_buffer, overdraw_pool, frame_index, 0);
+         overdraw_frame_pixels[frame_index] = 0;
+         for (unsigned w = 0; w < window_count; w++)
+            overdraw_frame_pixels[frame_index] +=
+               (uint64_t)windows[w].render_width * windows[w].render_height * view_count;
+         overdraw_pending[frame_index] = true;
+      }
+
+      if (hud_enabled) {
+         build_hud(frame_index, 1000.0 * dt, frame_gpu_ms);
+         if (hud_pool) {
+            vk.CmdResetQueryPool(cmd_buffer, hud_pool, HUD_QUERIES * frame_index,
+                                 HUD_QUERIES);
+            hud_pending[frame_index] = true;
+         }
+      }
+
+      begin_gpu_timer(cmd_buffer, frame_index);
+      animate_gears(cmd_buffer, frame_index);
+      if (rt_shadows)
+         build_rt_scene(cmd_buffer, frame_index);
+      mark_gpu_timer(cmd_buffer, frame_index, 1);
+
+      double frame_record = 0.0;
+      for (unsigned w = 0; w < window_count; w++) {
+         if (w > 0)
+            preprocess_barrier(cmd_buffer);
+
+         double record_start = current_time();
+         double hud_start = hud_record_time;
+         record_window(cmd_buffer, &windows[w], (capture || requested_capture) && w == 0,
+                       frame_index);
+         /* the HUD is reported on its own */
+         double record = current_time() - record_start - (hud_record_time - hud_start);
+         frame_record += record;
+         windows[w].record_time += record;
+         mark_gpu_timer(cmd_buffer, frame_index, 2 + w);
+      }
+
+      if (overdraw_pool)
+         vk.CmdEndQuery(cmd_buffer, overdraw_pool, frame_index);
+      end_gpu_timer(cmd_buffer, frame_index);
+      vk.EndCommandBuffer(cmd_buffer);
+      mark_phase(rec, PHASE_RECORD, &mark);
+
+      /* one submit waits for the images of all windows */
+      VkSemaphore wait_semaphores[WSI_MAX_WINDOWS + 1];
+      VkPipelineStageFlags wait_stages[WSI_MAX_WINDOWS + 1];
+      uint64_t wait_values[WSI_MAX_WINDOWS + 1];
+      for (unsigned w = 0; w < window_count; w++) {
+         wait_semaphores[w] = windows[w].acquire_semaphore[frame_index];
+         wait_stages[w] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+         wait_values[w] = 0;
+      }
+
+      if (use_streaming) {
+         /* wait for the generation we draw from, release it when done */
+         stream_gen[stream.current].last_use = ++graphics_value;
+         wait_semaphores[window_count] = transfer_timeline;
+         wait_stages[window_count] = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                                     VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                                     VK_PIPELINE_STAGE_COMMAND_PREPROCESS_BIT_EXT |
+                                     (hiz_cull || sort_enabled ?
+                                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0);
+         wait_values[window_count] = stream_gen[stream.current].upload_value;
+         vk.QueueSubmit(queue, 1,
+            &(VkSubmitInfo) {
+               .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+               .pNext = &(VkTimelineSemaphoreSubmitInfo) {
+                  .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                  .waitSemaphoreValueCount = window_count + 1,
+                  .pWaitSemaphoreValues = wait_values,
+                  .signalSemaphoreValueCount = 2,
+                  .pSignalSemaphoreValues = (uint64_t []) {
+                     0, graphics_value,
                   },
-                  .vertexAttributeDescriptionCount = 2,
-                  .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[]) {
-                     {
-                        .location = 0,
-                        .binding = 0,
-                        .format = VK_FORMAT_R32G32B32_SFLOAT,
-                        .offset = 0
-                     },
-                     {
-                        .location = 1,
-                        .binding = 1,
-                        .format = VK_FORMAT_R32G32B32_SFLOAT,
-                        .offset = 0
-                     },
-                  }
                },
-               .pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo) {
-                  .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-                  .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
-                  .primitiveRestartEnable = false,
+               .waitSemaphoreCount = window_count + 1,
+               .pWaitSemaphores = wait_semaphores,
+               .signalSemaphoreCount = 2,
+               .pSignalSemaphores = (VkSemaphore []) {
+                  present_semaphore,
+                  graphics_timeline,
                },
+               .pWaitDstStageMask = wait_stages,
+               .commandBufferCount = 1,
+               .pCommandBuffers = &cmd_buffer,
+            }, frame_data[frame_index].fence);
+      } else {
+         vk.QueueSubmit(queue, 1,
+            &(VkSubmitInfo) {
+               .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+               .waitSemaphoreCount = window_count,
+               .pWaitSemaphores = wait_semaphores,
+               .signalSemaphoreCount = 1,
+               .pSignalSemaphores = &present_semaphore,
+               .pWaitDstStageMask = wait_stages,
+               .commandBufferCount = 1,
+               .pCommandBuffers = &cmd_buffer,
+            }, frame_data[frame_index].fence);
+      }
+
+      mark_phase(rec, PHASE_SUBMIT, &mark);
+
+      VkSwapchainKHR swapchains[WSI_MAX_WINDOWS];
+      uint32_t image_indices[WSI_MAX_WINDOWS];
+      VkResult present_results[WSI_MAX_WINDOWS];
+      for (unsigned w = 0; w < window_count; w++) {
+         swapchains[w] = windows[w].swapchain;
+         image_indices[w] = windows[w].image_index;
+      }
+
+      /* the compositor only recomposes what this frame changed */
+      VkRectLayerKHR present_rects[WSI_MAX_WINDOWS][DAMAGE_MAX_RECTS + 1];
+      VkPresentRegionKHR present_regions[WSI_MAX_WINDOWS];
+      for (unsigned w = 0; enable_incremental_present && w < window_count; w++) {
+         const struct damage *d =
+            &windows[w].damage_history[windows[w].damage_serial % DAMAGE_HISTORY];
+         /* no rectangle means the whole image, an unchanged one gets an empty one */
+         present_rects[w][0] = (VkRectLayerKHR) { 0 };
+         for (unsigned i = 0; i < d->count; i++) {
+            present_rects[w][i] = (VkRectLayerKHR) {
+               .offset = d->rects[i].offset,
+               .extent = d->rects[i].extent,
+               .layer = 0,
+            };
+         }
+         present_regions[w] = (VkPresentRegionKHR) {
+            .rectangleCount = d->full ? 0 : MAX2(d->count, 1),
+            .pRectangles = present_rects[w],
+         };
+      }
+      VkPresentRegionsKHR present_damage = {
+         .sType = VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR,
+         .swapchainCount = window_count,
+         .pRegions = present_regions,
+      };
+
+      vk.QueuePresentKHR(queue,
+         &(VkPresentInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .pNext = enable_incremental_present ? &present_damage : NULL,
+            .pWaitSemaphores = &present_semaphore,
+            .waitSemaphoreCount = 1,
+            .swapchainCount = window_count,
+            .pSwapchains = swapchains,
+            .pImageIndices = image_indices,
+            .pResults = present_results,
+         });
+      for (unsigned w = 0; w < window_count; w++) {
+         rec->present_result[w] = present_results[w];
+         if (present_results[w] == VK_SUBOPTIMAL_KHR ||
+             present_results[w] == VK_ERROR_OUT_OF_DATE_KHR)
+            windows[w].suboptimal = true;
+      }
+      mark_phase(rec, PHASE_PRESENT, &mark);
+
+      if (capture) {
+         finish_capture(frame_data[frame_index].fence, capture_at, capture_file,
+                        compare_file);
+         break;
+      }
+      if (requested_capture) {
+         finish_capture(frame_data[frame_index].fence, frames_total,
+                        requested_capture, NULL);
+         free(control_capture_file);
+         control_capture_file = NULL;
+      }
+
+      if (stats.segment)
+         publish_stats(frames_total, t - tStart, 1000.0 * dt, 1000.0 * frame_record,
+                       frame_gpu_ms);
+
+      if (use_streaming)
+         stream_upload(t);
+
+      mark_phase(rec, PHASE_OTHER, &mark);
+      rec->total_ms = 1000.0 * (mark - begin);
+      if (stall_file)
+         check_stall(rec);
+
+      frames++;
+
+      /* the frames in flight may have been lowered over the control socket */
+      frame_index++;
+      if (frame_index >= concurrent_frames)
+         frame_index = 0;
+
+      if (tRate0 < 0.0)
+         tRate0 = t;
+      if (t - tRate0 >= 5.0) {
+         float seconds = t - tRate0;
+         float fps = frames / seconds;
+         printf("%d frames in %3.1f seconds = %6.3f FPS\n", frames, seconds,
+               fps);
+         printf("animation: %s, %.3f ms/frame CPU, %u bytes/frame uploaded for %u gears\n",
+                gpu_animation ? "gpu" : "cpu",
+                frames ? 1000.0 * tick_time / frames : 0.0,
+                frames ? (unsigned)(anim_bytes / frames) : 0, scene.gear_count);
+         printf("descriptors: %s, %.3f us/frame binding\n",
+                descriptor_model_names[descriptor_model],
+                frames ? 1e6 * (bind_time - bind_mark) / frames : 0.0);
+         bind_mark = bind_time;
+         unsigned timed = gpu_frames - gpu_frames_mark;
+         if (timer_pool)
+            printf("gpu: %.3f ms/frame\n", timed ? (gpu_time - gpu_mark) / timed : 0.0);
+         if (hiz_cull) {
+            printf("hiz: %.1f%% of sequences culled, %.1f%% drawn after disocclusion",
+                   cull_tested ? 100.0 * (cull_tested - cull_drawn[0] - cull_drawn[1]) / cull_tested : 0.0,
+                   cull_tested ? 100.0 * cull_drawn[1] / cull_tested : 0.0);
+            if (cull_gpu_frames[0] && cull_gpu_frames[1]) {
+               double culled = cull_gpu_ms[0] / cull_gpu_frames[0];
+               double unculled = cull_gpu_ms[1] / cull_gpu_frames[1];
+               printf(", %.3f ms/frame GPU vs %.3f unculled, %.3f ms saved",
+                      culled, unculled, unculled - culled);
+            }
+            printf("\n");
+            cull_tested = cull_drawn[0] = cull_drawn[1] = 0;
+            cull_gpu_ms[0] = cull_gpu_ms[1] = 0.0;
+            cull_gpu_frames[0] = cull_gpu_frames[1] = 0;
+         }
+         if (damage_tracking) {
+            printf("damage: %.1f%% of pixels shaded",
+                   damage_pixels ? 100.0 * damage_shaded / damage_pixels : 0.0);
+            if (damage_gpu_frames[0] && damage_gpu_frames[1]) {
+               double partial = damage_gpu_ms[0] / damage_gpu_frames[0];
+               double full = damage_gpu_ms[1] / damage_gpu_frames[1];
+               printf(", %.3f ms/frame GPU vs %.3f redrawn whole, %.3f ms saved",
+                      partial, full, full - partial);
+            }
+            printf("%s\n", enable_incremental_present ? ", incremental present" : "");
+            damage_shaded = damage_pixels = 0;
+            damage_gpu_ms[0] = damage_gpu_ms[1] = 0.0;
+            damage_gpu_frames[0] = damage_gpu_frames[1] = 0;
+         }
+         if (sort_enabled) {
+            printf("order: %s", sequence_order_names[sequence_order]);
+            if (overdraw_pixels)
+               printf(", %.2f fragments/pixel",
+                      (double)overdraw_fragments / overdraw_pixels);
+            printf("\n");
+            overdraw_fragments = overdraw_pixels = 0;
+         }
+         if (hud_enabled) {
+            printf("hud: %.3f ms/frame CPU", frames ? 1000.0 * hud_cpu_time / frames : 0.0);
+            if (hud_pool)
+               printf(", %.3f ms/frame GPU",
+                      hud_gpu_frames ? hud_gpu_time / hud_gpu_frames : 0.0);
+            printf(", left out of the record and GPU times\n");
+            hud_cpu_time = hud_gpu_time = 0.0;
+            hud_gpu_frames = 0;
+         }
+         if (rt_shadows && rt_pool) {
+            printf("rt: ");
+            if (rt_blas_ms >= 0.0)
+               printf("%.3f ms BLAS, ", rt_blas_ms);
+            printf("%.3f ms TLAS build, %.3f ms refit, %.3f ms/frame traced\n",
+                   rt_builds ? rt_build_ms / rt_builds : 0.0,
+                   rt_refits ? rt_refit_ms / rt_refits : 0.0,
+                   rt_trace_frames ? rt_trace_ms / rt_trace_frames : 0.0);
+            rt_build_ms = rt_refit_ms = rt_trace_ms = 0.0;
+            rt_builds = rt_refits = rt_trace_frames = 0;
+         }
+         if (swr_threshold > 0.0f) {
+            printf("sw raster: %.1f%% of gears below %g px", swr_gears ?
+                   100.0 * swr_small_gears / swr_gears : 0.0, swr_threshold);
+            if (swr_gpu_frames)
+               printf(", %.3f ms/frame GPU", swr_gpu_ms / swr_gpu_frames);
+            /* the sweep, threshold 0 being the generated commands alone */
+            int fastest = -1;
+            for (unsigned i = 0; i < SWR_PROBES; i++) {
+               if (!swr_probe_frames[i])
+                  continue;
+               double ms = swr_probe_ms[i] / swr_probe_frames[i];
+               if (i == 0)
+                  printf(", %.3f without", ms);
+               else
+                  printf(", %.3f below %g px", ms, swr_probe_thresholds[i]);
+               if (fastest < 0 || ms < swr_probe_ms[fastest] / swr_probe_frames[fastest])
+                  fastest = i;
+            }
+            if (fastest == 0)
+               printf(", the generated commands win");
+            else if (fastest > 0)
+               printf(", fastest below %g px", swr_probe_thresholds[fastest]);
+            printf("\n");
+            swr_small_gears = swr_gears = 0;
+            swr_gpu_ms = 0.0;
+            swr_gpu_frames = 0;
+            memset(swr_probe_ms, 0, sizeof(swr_probe_ms));
+            memset(swr_probe_frames, 0, sizeof(swr_probe_frames));
+         }
+         /* what -loader-dispatch costs shows in the recording */
+         double record = 0.0;
+         for (unsigned w = 0; w < window_count; w++)
+            record += windows[w].record_time - windows[w].record_mark;
+         printf("dispatch: %s, %u entry points, %.3f ms/frame CPU record\n",
+                loader_dispatch ? "loader" : "driver", vk_entry_points,
+                frames ? 1000.0 * record / frames : 0.0);
+         if (view_count > 1) {
+            printf("multiview: %u views, %s, %u executes/frame, %.3f ms/frame CPU record\n",
+                   view_count, multiview_mode_names[multiview_mode],
+                   window_count * (pass_view_mask() ? 1 : view_count),
+                   frames ? 1000.0 * record / frames : 0.0);
+         }
+         for (unsigned w = 0; w < window_count; w++) {
+            struct window *win = &windows[w];
+            if (window_count > 1) {
+               printf("window %u: %dx%d rendered at %dx%d, %.3f ms/frame CPU record",
+                      w, win->width, win->height, win->render_width, win->render_height,
+                      frames ? 1000.0 * (win->record_time - win->record_mark) / frames : 0.0);
+               if (timer_pool)
+                  printf(", %.3f ms/frame GPU",
+                         timed ? (win->gpu_time - win->gpu_mark) / timed : 0.0);
+               printf("\n");
+            }
+            win->record_mark = win->record_time;
+            win->gpu_mark = win->gpu_time;
+         }
+         gpu_mark = gpu_time;
+         gpu_frames_mark = gpu_frames;
+         print_attachment_memory();
+         if (dynamic_res_target > 0.0f && window_count == 1)
+            printf("dynamic resolution: %dx%d (scale %.2f), target %.3f ms\n",
+                   windows[0].render_width, windows[0].render_height,
+                   windows[0].res_scale, dynamic_res_target);
+         tick_time = 0.0;
+         anim_bytes = 0;
+         if (use_streaming) {
+            printf("stream: %u uploads, %6.1f MB/s, %.3f ms avg latency, %u stalls\n",
+                   stream.uploads, stream.bytes / seconds / (1024.0 * 1024.0),
+                   stream.uploads ? 1000.0 * stream.latency / stream.uploads : 0.0,
+                   stream.stalls);
+            stream.uploads = stream.stalls = 0;
+            stream.bytes = 0;
+            stream.latency = 0.0;
+         }
+         fflush(stdout);
+         tRate0 = t;
+         frames = 0;
+      }
+   }
+
+
+   vkDeviceWaitIdle(device);
+
+   /* the first frame only measures startup */
+   unsigned samples = frames_total > 1 ? frames_total - 1 : 0;
+   if (samples > ARRAY_SIZE(frame_times))
+      samples = ARRAY_SIZE(frame_times);
+   /* the runner needs them in frame order, the summary sorts them */
+   if (ab_collect && !ab_add_run(ab_collect, frame_times, samples))
+      error("Failed to keep the frame times of run %u", ab_collect->run_count + 1);
+   summarize_frame_times(samples, result);
+   summarize_latency(latency_count, result);
+   result->bind_us = frames_total ? 1e6 * bind_time / frames_total : 0.0;
+   result->gpu_ms = gpu_frames ? gpu_time / gpu_frames : 0.0;
+}
+
+static void
+print_result_header(void)
+{
+   printf("%-3s %-36s %-14s %8s %9s %8s %8s %8s %8s\n",
+          "#", "device", "type", "frames", "fps", "mean ms", "p50 ms",
+          "p99 ms", "max ms");
+}
+
+static void
+print_result(int index, const char *name, const char *type,
+             const struct bench_result *result)
+{
+   printf("%-3d %-36.36s %-14.14s %8u %9.2f %8.3f %8.3f %8.3f %8.3f\n",
+          index, name, type, result->frames, result->fps, result->mean_ms,
+          result->p50_ms, result->p99_ms, result->max_ms);
+}
+
+static bool
+check_device_support(void)
+{
+   if (!check_sample_count_support(sample_count)) {
+      fprintf(stderr, "Sample count not supported\n");
+      return false;
+   }
+
+   if (!check_indirect_commands_graphics_support(use_shader_object)) {
+      fprintf(stderr, "Indirect execution does not support graphics %s switching\n",
+              use_shader_object ? "shader" : "pipeline");
+      return false;
+   }
+
+   if (!check_depth_mode_support(depth_mode)) {
+      fprintf(stderr, "Depth format %s not supported\n", depth_mode_names[depth_mode]);
+      return false;
+   }
+
+   if (rt_shadows && !check_ray_tracing_support()) {
+      fprintf(stderr, "Ray traced shadows not supported\n");
+      return false;
+   }
+
+   if (swr_threshold > 0.0f && !check_swr_support()) {
+      fprintf(stderr, "Software rasterizing not supported\n");
+      return false;
+   }
+
+   if (sample_count != VK_SAMPLE_COUNT_1_BIT && resolve_mode == RESOLVE_SHADER) {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(physical_device, &properties);
+      if (!(properties.limits.sampledImageColorSampleCounts & sample_count)) {
+         fprintf(stderr, "Sample count cannot be resolved in a shader\n");
+         return false;
+      }
+   }
+
+   if (view_count > 1 && multiview_mode == MULTIVIEW_PASS) {
+      VkPhysicalDeviceMultiviewProperties multiview_props = {
+         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_PROPERTIES,
+      };
+      vkGetPhysicalDeviceProperties2(physical_device, &(VkPhysicalDeviceProperties2) {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &multiview_props,
+         });
+      if (multiview_props.maxMultiviewViewCount < view_count) {
+         fprintf(stderr, "Device renders at most %u views per pass\n",
+                 multiview_props.maxMultiviewViewCount);
+         return false;
+      }
+   }
 
-               .pViewportState = &(VkPipelineViewportStateCreateInfo) {
-                  .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-                  .viewportCount = 1,
-                  .scissorCount = 1,
-               },
+   enable_descriptor_buffer =
+      (requested_descriptor_models & (1u << DESCRIPTOR_MODEL_BUFFER)) &&
+      device_supports_extension(physical_device, VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+   enable_push_descriptor =
+      (requested_descriptor_models & (1u << DESCRIPTOR_MODEL_PUSH)) &&
+      device_supports_extension(physical_device, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+   /* without it the compositor recomposes the whole image, damage or not */
+   enable_incremental_present =
+      damage_tracking &&
+      device_supports_extension(physical_device, VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+   if ((descriptor_model == DESCRIPTOR_MODEL_BUFFER && !enable_descriptor_buffer) ||
+       (descriptor_model == DESCRIPTOR_MODEL_PUSH && !enable_push_descriptor)) {
+      fprintf(stderr, "Descriptor model '%s' not supported\n",
+              descriptor_model_names[descriptor_model]);
+      return false;
+   }
+   return true;
+}
 
-               .pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) {
-                  .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-                  .rasterizerDiscardEnable = false,
-                  .polygonMode = VK_POLYGON_MODE_FILL,
-                  .cullMode = VK_CULL_MODE_BACK_BIT,
-                  .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
-                  .lineWidth = 1.0f,
-               },
+/*
+ * Run the benchmark on every device exposing VK_EXT_device_generated_commands,
+ * reusing the instance and window, and print a comparison table.
+ */
+static void
+sweep_devices(double duration)
+{
+   struct bench_result results[physical_device_count];
+   bool ran[physical_device_count];
+
+   for (uint32_t i = 0; i < physical_device_count; i++) {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(physical_devices[i], &properties);
+      ran[i] = false;
+
+      if (!device_supports_extension(physical_devices[i],
+                                     VK_EXT_DEVICE_GENERATED_COMMANDS_EXTENSION_NAME)) {
+         printf("skipping %s: no %s\n", properties.deviceName,
+                VK_EXT_DEVICE_GENERATED_COMMANDS_EXTENSION_NAME);
+         continue;
+      }
 
-               .pMultisampleState = &(VkPipelineMultisampleStateCreateInfo) {
-                  .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-                  .rasterizationSamples = sample_count,
-               },
-               .pDepthStencilState = &(VkPipelineDepthStencilStateCreateInfo) {
-                  .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-                  .depthTestEnable = VK_TRUE,
-                  .depthWriteEnable = VK_TRUE,
-                  .depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
-               },
+      physical_device = physical_devices[i];
+      if (!check_device_support()) {
+         printf("skipping %s\n", properties.deviceName);
+         continue;
+      }
+      if (!create_surfaces()) {
+         printf("skipping %s: cannot present to the window\n", properties.deviceName);
+         continue;
+      }
 
-               .pColorBlendState = &(VkPipelineColorBlendStateCreateInfo) {
-                  .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-                  .attachmentCount = 1,
-                  .pAttachments = (VkPipelineColorBlendAttachmentState []) {
-                     { .colorWriteMask = VK_COLOR_COMPONENT_A_BIT |
-                                          VK_COLOR_COMPONENT_R_BIT |
-                                          VK_COLOR_COMPONENT_G_BIT |
-                                          VK_COLOR_COMPONENT_B_BIT },
-                  }
-               },
+      printf("running on %s for %.1f seconds\n", properties.deviceName, duration);
+      init_device();
+      init_swapchains();
+      init_gears();
+      run(duration, &results[i]);
+      fini_device();
+      ran[i] = true;
+   }
 
-               .pDynamicState = &(VkPipelineDynamicStateCreateInfo) {
-                  .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-                  .dynamicStateCount = 2,
-                  .pDynamicStates = (VkDynamicState[]) {
-                        VK_DYNAMIC_STATE_VIEWPORT,
-                        VK_DYNAMIC_STATE_SCISSOR,
-                  },
-               },
+   print_result_header();
+   for (uint32_t i = 0; i < physical_device_count; i++) {
+      if (!ran[i])
+         continue;
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(physical_devices[i], &properties);
+      print_result(i, properties.deviceName,
+                   get_devtype_str(properties.deviceType), &results[i]);
+   }
+}
 
-               .flags = 0,
-               .layout = pipeline_layout,
-               .subpass = 0,
-               .basePipelineHandle = (VkPipeline) { 0 },
-               .basePipelineIndex = 0
-            },
-            NULL,
-            &pipeline[i]);
-      }
+struct sweep_axes {
+   unsigned sample_count;
+   unsigned present_count;
+   unsigned binding_count;
+   unsigned instancing_count;
+   unsigned descriptor_count;
+   unsigned depth_count;
+   unsigned resolve_count;
+   unsigned multiview_count;
+   VkSampleCountFlagBits samples[7];
+   VkPresentModeKHR present[4];
+   bool shader_object[2];
+   bool instancing[2];
+   enum descriptor_model descriptor[3];
+   enum depth_mode depth[4];
+   enum resolve_mode resolve[3];
+   enum multiview_mode multiview[2];
+};
+
+static void
+parse_sweep_samples(struct sweep_axes *axes, char *list)
+{
+   axes->sample_count = 0;
+   for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      if (axes->sample_count < ARRAY_SIZE(axes->samples))
+         axes->samples[axes->sample_count++] = sample_count_flag(strtol(tok, NULL, 10));
    }
+}
 
-   CreateIndirectCommandsLayoutEXT(device,
-                                     &(VkIndirectCommandsLayoutCreateInfoEXT) {
-                                       .sType = VK_STRUCTURE_TYPE_INDIRECT_COMMANDS_LAYOUT_CREATE_INFO_EXT,
-                                       .flags = 0,
-                                       .shaderStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                                       .indirectStride = sizeof(indirect_data),
-                                       .pipelineLayout = pipeline_layout,
-                                       .tokenCount = 2,
-                                       .pTokens = (VkIndirectCommandsLayoutTokenEXT[]) {
-                                          {
-                                             .sType = VK_STRUCTURE_TYPE_INDIRECT_COMMANDS_LAYOUT_TOKEN_EXT,
-                                             .type = VK_INDIRECT_COMMANDS_TOKEN_TYPE_EXECUTION_SET_EXT,
-                                             .data = {
-                                                .pExecutionSet = &(VkIndirectCommandsExecutionSetTokenEXT) {
-                                                   .type = use_shader_object ? VK_INDIRECT_EXECUTION_SET_INFO_TYPE_SHADER_OBJECTS_EXT : VK_INDIRECT_EXECUTION_SET_INFO_TYPE_PIPELINES_EXT,
-                                                   .shaderStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                                                }
-                                             },
-                                             .offset = 0
-                                          },
-                                          {
-                                             .sType = VK_STRUCTURE_TYPE_INDIRECT_COMMANDS_LAYOUT_TOKEN_EXT,
-                                             .type = VK_INDIRECT_COMMANDS_TOKEN_TYPE_DRAW_EXT,
-                                             .offset = offsetof(indirect_data, draw)
-                                          },
-                                       }
-                                     },
-                                     NULL, &indirect_layout);
+static const VkPresentModeKHR known_present_modes[] = {
+   VK_PRESENT_MODE_IMMEDIATE_KHR,
+   VK_PRESENT_MODE_MAILBOX_KHR,
+   VK_PRESENT_MODE_FIFO_KHR,
+   VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+};
 
-   if (use_shader_object) {
-      CreateIndirectExecutionSetEXT(device,
-                                       &(VkIndirectExecutionSetCreateInfoEXT) {
-                                          .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_CREATE_INFO_EXT,
-                                          .type = VK_INDIRECT_EXECUTION_SET_INFO_TYPE_SHADER_OBJECTS_EXT,
-                                          .info = {
-                                             .pShaderInfo = &(VkIndirectExecutionSetShaderInfoEXT) {
-                                                .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_SHADER_INFO_EXT,
-                                                .shaderCount = 2,
-                                                .pInitialShaders = (VkShaderEXT[]) {
-                                                   vs_shaders[0],
-                                                   fs_shader,
-                                                },
-                                                .pSetLayoutInfos = (VkIndirectExecutionSetShaderLayoutInfoEXT[]) {
-                                                   {
-                                                      .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_SHADER_LAYOUT_INFO_EXT,
-                                                      .setLayoutCount = 1,
-                                                      .pSetLayouts = (VkDescriptorSetLayout[]) {
-                                                         set_layout
-                                                      }
-                                                   },
-                                                   {
-                                                      .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_SHADER_LAYOUT_INFO_EXT,
-                                                      .setLayoutCount = 0,
-                                                      .pSetLayouts = (VkDescriptorSetLayout[]) {
-                                                      }
-                                                   },
-                                                },
-                                                .maxShaderCount = 4,
-                                                .pushConstantRangeCount = 1,
-                                                .pPushConstantRanges = (VkPushConstantRange[]) {
-                                                   {
-                                                      .offset = 0,
-                                                      .size = sizeof(struct push_constants),
-                                                      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-                                                   },
-                                                },
-                                             },
-                                          },
-                                       },
-                                       NULL, &indirect_execution);
-      UpdateIndirectExecutionSetShaderEXT(device, indirect_execution,
-                                                2, (VkWriteIndirectExecutionSetShaderEXT[]) {
-                                                   {
-                                                   .sType = VK_STRUCTURE_TYPE_WRITE_INDIRECT_EXECUTION_SET_SHADER_EXT,
-                                                   .index = 2,
-                                                   .shader = vs_shaders[1],
-                                                   },
-                                                   {
-                                                   .sType = VK_STRUCTURE_TYPE_WRITE_INDIRECT_EXECUTION_SET_SHADER_EXT,
-                                                   .index = 3,
-                                                   .shader = vs_shaders[2],
-                                                   },
-                                                });
-   } else {
-      CreateIndirectExecutionSetEXT(device,
-                                       &(VkIndirectExecutionSetCreateInfoEXT) {
-                                          .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_CREATE_INFO_EXT,
-                                          .type = VK_INDIRECT_EXECUTION_SET_INFO_TYPE_PIPELINES_EXT,
-                                          .info = {
-                                             .pPipelineInfo = &(VkIndirectExecutionSetPipelineInfoEXT) {
-                                                .sType = VK_STRUCTURE_TYPE_INDIRECT_EXECUTION_SET_PIPELINE_INFO_EXT,
-                                                .initialPipeline = pipeline[0],
-                                                .maxPipelineCount = 3
-                                             },
-                                          },
-                                       },
-                                       NULL, &indirect_execution);
-      UpdateIndirectExecutionSetPipelineEXT(device, indirect_execution,
-                                                2, (VkWriteIndirectExecutionSetPipelineEXT[]) {
-                                                   {
-                                                   .sType = VK_STRUCTURE_TYPE_WRITE_INDIRECT_EXECUTION_SET_PIPELINE_EXT,
-                                                   .index = 1,
-                                                   .pipeline = pipeline[1],
-                                                   },
-                                                   {
-                                                   .sType = VK_STRUCTURE_TYPE_WRITE_INDIRECT_EXECUTION_SET_PIPELINE_EXT,
-                                                   .index = 2,
-                                                   .pipeline = pipeline[2],
-                                                   },
-                                                });
+static VkPresentModeKHR
+parse_present_mode(const char *name)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(known_present_modes); i++) {
+      if (strcmp(name, present_mode_str(known_present_modes[i])) == 0)
+         return known_present_modes[i];
+   }
+   error("Unknown present mode '%s'", name);
+   return VK_PRESENT_MODE_FIFO_KHR;
+}
 
+static void
+parse_sweep_present(struct sweep_axes *axes, char *list)
+{
+   axes->present_count = 0;
+   for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      VkPresentModeKHR mode = parse_present_mode(tok);
+      if (axes->present_count < ARRAY_SIZE(axes->present))
+         axes->present[axes->present_count++] = mode;
    }
+}
 
-   VkMemoryRequirements2 memreqs = {
-      VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
-   };
-   GetGeneratedCommandsMemoryRequirementsEXT(device,
-                                               &(VkGeneratedCommandsMemoryRequirementsInfoEXT) {
-                                                  .sType = VK_STRUCTURE_TYPE_GENERATED_COMMANDS_MEMORY_REQUIREMENTS_INFO_EXT,
-                                                  .indirectExecutionSet = indirect_execution,
-                                                  .indirectCommandsLayout = indirect_layout,
-                                                  .maxSequenceCount = 3,
-                                               },
-                                               &memreqs);
+static void
+parse_sweep_binding(struct sweep_axes *axes, char *list)
+{
+   axes->binding_count = 0;
+   for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      if (strcmp(tok, "pipeline") != 0 && strcmp(tok, "shader-object") != 0)
+         error("Unknown binding model '%s'", tok);
+      if (axes->binding_count < ARRAY_SIZE(axes->shader_object))
+         axes->shader_object[axes->binding_count++] = strcmp(tok, "shader-object") == 0;
+   }
+}
 
-   VkBufferUsageFlags2CreateInfoKHR busage = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_USAGE_FLAGS_2_CREATE_INFO_KHR,
-      .usage = VK_BUFFER_USAGE_2_PREPROCESS_BUFFER_BIT_EXT | VK_BUFFER_USAGE_2_SHADER_DEVICE_ADDRESS_BIT_KHR,
-   };
-   vkCreateBuffer(device,
-      &(VkBufferCreateInfo) {
-         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-         .pNext = &busage,
-         .size = memreqs.memoryRequirements.size,
-      },
-      NULL,
-      &preprocess_buffer);
-   VkMemoryAllocateFlagsInfo info = {
-      VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-      .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-   };
-   vkAllocateMemory(device,
-      &(VkMemoryAllocateInfo) {
-         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-         .pNext = &info,
-         .allocationSize = memreqs.memoryRequirements.size,
-         .memoryTypeIndex = ffs(memreqs.memoryRequirements.memoryTypeBits) - 1,
-      },
-      NULL,
-      &preprocess_mem);
-   vkBindBufferMemory(device, preprocess_buffer, preprocess_mem, 0);
-   preprocess_size = memreqs.memoryRequirements.size;
-   preprocess_addr = vkGetBufferDeviceAddress(device,
-                                              &(VkBufferDeviceAddressInfo) {
-                                                 .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-                                                 .buffer = preprocess_buffer
-                                              });
-
-#define MAX_VERTS 10000
-   float verts[MAX_VERTS * GEAR_VERTEX_STRIDE];
-
-   gears[0].first_vertex = 0;
-   gears[0].vertex_count = create_gear(verts + gears[0].first_vertex * GEAR_VERTEX_STRIDE,
-                                       1.0, 4.0, 1.0, 20, 0.7);
-   gears[1].first_vertex = gears[0].first_vertex + gears[0].vertex_count;
-   gears[1].vertex_count = create_gear(verts + gears[1].first_vertex * GEAR_VERTEX_STRIDE,
-                                       0.5, 2.0, 2.0, 10, 0.7);
-   gears[2].first_vertex = gears[1].first_vertex + gears[1].vertex_count;
-   gears[2].vertex_count = create_gear(verts + gears[2].first_vertex * GEAR_VERTEX_STRIDE,
-                                       1.3, 2.0, 0.5, 10, 0.7);
-
-   unsigned num_verts = gears[2].first_vertex + gears[2].vertex_count;
-   unsigned mem_size = sizeof(float) * GEAR_VERTEX_STRIDE * num_verts;
-   vertex_offset = 0;
-   normals_offset = sizeof(float) * 3;
-   ubo_buffer = create_buffer(sizeof(struct ubo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
-                                                  VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-   vertex_buffer = create_buffer(mem_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+static void
+parse_sweep_instancing(struct sweep_axes *axes, char *list)
+{
+   axes->instancing_count = 0;
+   for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      if (strcmp(tok, "off") != 0 && strcmp(tok, "on") != 0)
+         error("Unknown instancing setting '%s'", tok);
+      if (axes->instancing_count < ARRAY_SIZE(axes->instancing))
+         axes->instancing[axes->instancing_count++] = strcmp(tok, "on") == 0;
+   }
+}
 
-   ubo_mem = allocate_buffer_mem(ubo_buffer, sizeof(struct ubo));
-   vertex_mem = allocate_buffer_mem(vertex_buffer, mem_size);
-
-   size_t indirect_size = 3 * (sizeof(uint32_t) + sizeof(VkDrawIndirectCommand));
-   indirect_buffer = create_buffer(indirect_size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-   indirect_mem = allocate_buffer_mem(indirect_buffer, indirect_size);
-
-   indirect_data *indirect_map;
-   // VkDrawIndirectCommand *indirect;
-   // vkMapMemory(device, indirect_mem, 0, indirect_size, 0, (void*)&indirect);
-   // for (unsigned i = 0; i < ARRAY_SIZE(gears); i++) {
-   //    indirect[i].vertexCount = gears[i].vertex_count;
-   //    indirect[i].firstVertex = gears[i].first_vertex;
-   //    indirect[i].firstInstance = 0;
-   //    indirect[i].instanceCount = 1;
-   // }
-   vkMapMemory(device, indirect_mem, 0, indirect_size, 0, (void*)&indirect_map);
-   int pipeline_idx[] = {
-      0, 1, 2
-   };
-   /* VS are offset */
-   int shader_idx[] = {
-      0, 2, 3
-   };
-   for (unsigned i = 0; i < ARRAY_SIZE(gears); i++) {
-      indirect_map[i].ies[0] = use_shader_object ? shader_idx[i] : pipeline_idx[i];
-      indirect_map[i].ies[1] = 1;
-      indirect_map[i].draw.vertexCount = gears[i].vertex_count;
-      indirect_map[i].draw.firstVertex = gears[i].first_vertex;
-      indirect_map[i].draw.firstInstance = 0;
-      indirect_map[i].draw.instanceCount = 1;
-   }
-   vkUnmapMemory(device, indirect_mem);
-   vkBindBufferMemory(device, indirect_buffer, indirect_mem, 0);
-   indirect_addr = vkGetBufferDeviceAddress(device,
-                                             &(VkBufferDeviceAddressInfo) {
-                                                .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-                                                .buffer = indirect_buffer
-                                             });
+static enum descriptor_model
+parse_descriptor_model(const char *name)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(descriptor_model_names); i++) {
+      if (strcmp(name, descriptor_model_names[i]) == 0)
+         return i;
+   }
+   error("Unknown descriptor model '%s'", name);
+   return DESCRIPTOR_MODEL_SETS;
+}
 
-   void *map;
-   r = vkMapMemory(device, vertex_mem, 0, mem_size, 0, &map);
-   if (r != VK_SUCCESS)
-      error("vkMapMemory failed");
-   memcpy(map, verts, mem_size);
-   vkUnmapMemory(device, vertex_mem);
+static void
+parse_sweep_descriptor(struct sweep_axes *axes, char *list)
+{
+   axes->descriptor_count = 0;
+   for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      enum descriptor_model model = parse_descriptor_model(tok);
+      if (axes->descriptor_count < ARRAY_SIZE(axes->descriptor))
+         axes->descriptor[axes->descriptor_count++] = model;
+   }
+}
 
-   vkBindBufferMemory(device, ubo_buffer, ubo_mem, 0);
-   vkBindBufferMemory(device, vertex_buffer, vertex_mem, 0);
-
-   VkDescriptorPool desc_pool;
-   const VkDescriptorPoolCreateInfo create_info = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .maxSets = 1,
-      .poolSizeCount = 1,
-      .pPoolSizes = (VkDescriptorPoolSize[]) {
-         {
-            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = 1
-         },
-      }
-   };
+static enum depth_mode
+parse_depth_mode(const char *name)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(depth_mode_names); i++) {
+      if (strcmp(name, depth_mode_names[i]) == 0)
+         return i;
+   }
+   error("Unknown depth format '%s'", name);
+   return DEPTH_AUTO;
+}
 
-   vkCreateDescriptorPool(device, &create_info, NULL, &desc_pool);
+static void
+parse_sweep_depth(struct sweep_axes *axes, char *list)
+{
+   axes->depth_count = 0;
+   for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      enum depth_mode mode = parse_depth_mode(tok);
+      if (axes->depth_count < ARRAY_SIZE(axes->depth))
+         axes->depth[axes->depth_count++] = mode;
+   }
+}
 
-   vkAllocateDescriptorSets(device,
-      &(VkDescriptorSetAllocateInfo) {
-         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-         .descriptorPool = desc_pool,
-         .descriptorSetCount = 1,
-         .pSetLayouts = &set_layout,
-      }, &descriptor_set);
+static enum resolve_mode
+parse_resolve_mode(const char *name)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(resolve_mode_names); i++) {
+      if (strcmp(name, resolve_mode_names[i]) == 0)
+         return i;
+   }
+   error("Unknown resolve mode '%s'", name);
+   return RESOLVE_PASS;
+}
 
-   vkUpdateDescriptorSets(device, 1,
-      (VkWriteDescriptorSet []) {
-         {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = descriptor_set,
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorCount = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .pBufferInfo = &(VkDescriptorBufferInfo) {
-               .buffer = ubo_buffer,
-               .offset = 0,
-               .range = sizeof(struct ubo),
-            }
-         }
-      },
-      0, NULL);
+static void
+parse_sweep_resolve(struct sweep_axes *axes, char *list)
+{
+   axes->resolve_count = 0;
+   for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      enum resolve_mode mode = parse_resolve_mode(tok);
+      if (axes->resolve_count < ARRAY_SIZE(axes->resolve))
+         axes->resolve[axes->resolve_count++] = mode;
+   }
 }
 
-float angle = 0.0;
+static enum sequence_order
+parse_sequence_order(const char *name)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(sequence_order_names); i++) {
+      if (strcmp(name, sequence_order_names[i]) == 0)
+         return i;
+   }
+   error("Unknown sequence order '%s'", name);
+   return ORDER_SCENE;
+}
 
-#define G2L(x) ((x) < 0.04045 ? (x) / 12.92 : powf(((x) + 0.055) / 1.055, 2.4))
+static enum multiview_mode
+parse_multiview_mode(const char *name)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(multiview_mode_names); i++) {
+      if (strcmp(name, multiview_mode_names[i]) == 0)
+         return i;
+   }
+   error("Unknown multiview mode '%s'", name);
+   return MULTIVIEW_PASS;
+}
 
 static void
-draw_gears(VkCommandBuffer cmdbuf)
+parse_sweep_multiview(struct sweep_axes *axes, char *list)
 {
-   vkCmdBindVertexBuffers(cmdbuf, 0, 2,
-      (VkBuffer[]) {
-         vertex_buffer,
-         vertex_buffer,
-      },
-      (VkDeviceSize[]) {
-         vertex_offset,
-         normals_offset
-      });
+   axes->multiview_count = 0;
+   for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      enum multiview_mode mode = parse_multiview_mode(tok);
+      if (axes->multiview_count < ARRAY_SIZE(axes->multiview))
+         axes->multiview[axes->multiview_count++] = mode;
+   }
+}
 
-   if (use_shader_object)
-      CmdBindShadersEXT(cmdbuf, 2, (VkShaderStageFlagBits[]) { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT }, (VkShaderEXT[]){vs_shaders[0], fs_shader});
-   else
-      vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline[0]);
+static bool
+check_descriptor_model_support(enum descriptor_model model)
+{
+   switch (model) {
+   case DESCRIPTOR_MODEL_BUFFER:
+      return enable_descriptor_buffer;
+   case DESCRIPTOR_MODEL_PUSH:
+      return enable_push_descriptor;
+   default:
+      return true;
+   }
+}
 
-   vkCmdBindDescriptorSets(cmdbuf,
-      VK_PIPELINE_BIND_POINT_GRAPHICS,
-      pipeline_layout,
-      0, 1,
-      &descriptor_set, 0, NULL);
+/* one point of the configuration space a sweep walks */
+struct config {
+   bool shader_object;
+   VkSampleCountFlagBits samples;
+   VkPresentModeKHR present_mode;
+   bool instancing;
+   enum descriptor_model descriptor;
+   enum depth_mode depth;
+   enum resolve_mode resolve;
+   enum multiview_mode multiview;
+   uint32_t image_count;
+   unsigned frames_in_flight;
+};
 
+static void
+format_config(const struct config *c, char *buf, size_t size)
+{
+   snprintf(buf, size, "%s, %d samples, %s, instancing %s, %s descriptors, "
+            "%s depth, %s resolve, %s multiview, %u images, %u in flight",
+            c->shader_object ? "shader-object" : "pipeline", c->samples,
+            present_mode_str(c->present_mode), c->instancing ? "on" : "off",
+            descriptor_model_names[c->descriptor], depth_mode_names[c->depth],
+            resolve_mode_names[c->resolve], multiview_mode_names[c->multiview],
+            c->image_count, c->frames_in_flight);
+}
 
-   
-   if (use_shader_object) {
-      vkCmdSetViewportWithCount(cmdbuf, 1,
-         (VkViewport[]) {
-            {
-               .x = 0,
-               .y = 0,
-               .width = width,
-               .height = height,
-               .minDepth = 0,
-               .maxDepth = 1,
-            }
-         });
+/* the configuration the device currently runs */
+static void
+current_config(struct config *c)
+{
+   *c = (struct config) {
+      .shader_object = use_shader_object,
+      .samples = sample_count,
+      .present_mode = desidered_present_mode,
+      .instancing = use_instancing,
+      .descriptor = descriptor_model,
+      .depth = depth_mode,
+      .resolve = resolve_mode,
+      .multiview = multiview_mode,
+      .image_count = desired_image_count,
+      .frames_in_flight = concurrent_frames,
+   };
+}
 
-      vkCmdSetScissorWithCount(cmdbuf, 1,
-         (VkRect2D[]) {
-            {
-               .offset = { 0, 0 },
-               .extent = { width, height },
-            }
-         });
-      CmdSetVertexInputEXT(cmdbuf,
-            2, (VkVertexInputBindingDescription2EXT[]) {
-            {
-               .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT,
-               .binding = 0,
-               .stride = 6 * sizeof(float),
-               .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-               .divisor = 1,
-            },
-            {
-               .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT,
-               .binding = 1,
-               .stride = 6 * sizeof(float),
-               .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-               .divisor = 1,
-            },
-         },
-         2, (VkVertexInputAttributeDescription2EXT[]) {
-            {
-               .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT,
-               .location = 0,
-               .binding = 0,
-               .format = VK_FORMAT_R32G32B32_SFLOAT,
-               .offset = 0
-            },
-            {
-               .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT,
-               .location = 1,
-               .binding = 1,
-               .format = VK_FORMAT_R32G32B32_SFLOAT,
-               .offset = 0
-            },
-         }
-      );
-      CmdSetPrimitiveTopologyEXT(cmdbuf, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
-      CmdSetPrimitiveRestartEnableEXT(cmdbuf, VK_FALSE);
-      CmdSetRasterizerDiscardEnableEXT(cmdbuf, VK_FALSE);
-      CmdSetCullModeEXT(cmdbuf, VK_CULL_MODE_BACK_BIT);
-      CmdSetFrontFaceEXT(cmdbuf, VK_FRONT_FACE_COUNTER_CLOCKWISE);
-      CmdSetDepthTestEnableEXT(cmdbuf, VK_TRUE);
-      CmdSetDepthWriteEnableEXT(cmdbuf, VK_TRUE);
-      CmdSetDepthCompareOpEXT(cmdbuf, VK_COMPARE_OP_LESS_OR_EQUAL);
-      CmdSetDepthBoundsTestEnableEXT(cmdbuf, VK_FALSE);
-      CmdSetPolygonModeEXT(cmdbuf, VK_POLYGON_MODE_FILL);
-      CmdSetRasterizationSamplesEXT(cmdbuf, sample_count);
-      CmdSetLogicOpEnableEXT(cmdbuf, VK_FALSE);
-      CmdSetAlphaToCoverageEnableEXT(cmdbuf, VK_FALSE);
-      CmdSetAlphaToOneEnableEXT(cmdbuf, VK_FALSE);
-      CmdSetDepthClampEnableEXT(cmdbuf, VK_FALSE);
-      CmdSetSampleMaskEXT(cmdbuf, sample_count, (VkSampleMask[]){UINT32_MAX});
-      CmdSetColorWriteMaskEXT(cmdbuf, 0, 1, (VkColorComponentFlags[]){ VK_COLOR_COMPONENT_A_BIT |
-                                          VK_COLOR_COMPONENT_R_BIT |
-                                          VK_COLOR_COMPONENT_G_BIT |
-                                          VK_COLOR_COMPONENT_B_BIT});
-      CmdSetColorBlendEnableEXT(cmdbuf, 0, 1, (VkBool32[]){VK_FALSE});
-   } else {
-      vkCmdSetViewport(cmdbuf, 0, 1,
-         &(VkViewport) {
-            .x = 0,
-            .y = 0,
-            .width = width,
-            .height = height,
-            .minDepth = 0,
-            .maxDepth = 1,
-         });
+static bool
+check_resolve_mode_support(enum resolve_mode mode, VkSampleCountFlagBits samples)
+{
+   if (samples == VK_SAMPLE_COUNT_1_BIT || mode == RESOLVE_PASS)
+      return true;
 
-      vkCmdSetScissor(cmdbuf, 0, 1,
-         &(VkRect2D) {
-            .offset = { 0, 0 },
-            .extent = { width, height },
-         });
+   if (mode == RESOLVE_SHADER) {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(physical_device, &properties);
+      return properties.limits.sampledImageColorSampleCounts & samples;
    }
 
-   struct push_constants push_constants;
-   push_constants.angle = angle;
-   push_constants.view_rot_0 = view_rot[0];
-   push_constants.view_rot_1 = view_rot[1];
-   push_constants.h = (float)height / width;
-
-   vkCmdPushConstants(cmdbuf, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
-                      0, sizeof(push_constants), &push_constants);
-
-   // vkCmdDraw(cmdbuf, gears[0].vertex_count, 1, gears[0].first_vertex, 0);
-   // vkCmdDrawIndirect(cmdbuf, indirect_buffer, 0, 1, 0);
-   CmdExecuteGeneratedCommandsEXT(cmdbuf, VK_FALSE,
-                                    &(VkGeneratedCommandsInfoEXT) {
-                                       .sType = VK_STRUCTURE_TYPE_GENERATED_COMMANDS_INFO_EXT,
-                                       .shaderStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                                       .indirectExecutionSet = indirect_execution,
-                                       .indirectCommandsLayout = indirect_layout,
-                                       .indirectAddress = indirect_addr,
-                                       .indirectAddressSize = 3 * sizeof(indirect_data),
-                                       .preprocessAddress = preprocess_addr,
-                                       .preprocessSize = preprocess_size,
-                                       .maxSequenceCount = 3,
-                                    });
+   /* the transfer resolve writes the swapchain image unless it is upscaled */
+   if (render_offscreen())
+      return true;
+   for (unsigned w = 0; w < window_count; w++) {
+      VkSurfaceCapabilitiesKHR surface_caps;
+      vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, windows[w].surface,
+                                                &surface_caps);
+      if (!(surface_caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+         return false;
+   }
+   return true;
 }
 
+/* why a configuration cannot run on this device, or NULL if it can */
 static const char *
-get_devtype_str(VkPhysicalDeviceType devtype)
+config_unsupported(const struct config *c)
 {
-   static char buf[256];
-   switch (devtype) {
-   case VK_PHYSICAL_DEVICE_TYPE_OTHER:
-      return "other";
-   case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
-      return "integrated GPU";
-   case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
-      return "discrete GPU";
-   case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
-      return "virtual GPU";
-   case VK_PHYSICAL_DEVICE_TYPE_CPU:
-      return "CPU";
-   default:
-      snprintf(buf, sizeof(buf), "Unknown (%08x)", devtype);
-      return buf;
-   }
+   if (c->shader_object && !enable_shader_object)
+      return "shader objects not supported";
+   if (!check_indirect_commands_graphics_support(c->shader_object))
+      return "no indirect switching";
+   if (!check_sample_count_support(c->samples))
+      return "sample count not supported";
+   if (!check_descriptor_model_support(c->descriptor))
+      return "descriptor model not supported";
+   if (!check_depth_mode_support(c->depth))
+      return "depth format not supported";
+   if (!check_resolve_mode_support(c->resolve, c->samples))
+      return "resolve mode not supported";
+   if (view_count > 1 && c->samples != VK_SAMPLE_COUNT_1_BIT &&
+       c->resolve != RESOLVE_PASS)
+      return "multiview resolves in the pass";
+   if (hiz_cull && c->samples != VK_SAMPLE_COUNT_1_BIT)
+      return "culling needs a single sample";
+   if (damage_tracking && c->samples != VK_SAMPLE_COUNT_1_BIT)
+      return "damage tracking needs a single sample";
+   if (rt_shadows && c->samples != VK_SAMPLE_COUNT_1_BIT)
+      return "shadows need a single sample";
+   if (swr_threshold > 0.0f && c->samples != VK_SAMPLE_COUNT_1_BIT)
+      return "software rasterizing needs a single sample";
+   return NULL;
 }
 
+/*
+ * Switch the live device to another configuration, rebuilding only what the
+ * changed axes depend on:
+ *    descriptor model      every gear resource, since all layouts depend on it
+ *    binding model,        the programs, execution set, preprocess buffer
+ *    instancing            and indirect stream
+ *    samples, depth,       the programs too, when pipelines bake them in
+ *    multiview
+ *    samples, present,     the swapchains and their attachments
+ *    depth, resolve,
+ *    multiview, images
+ *    frames in flight      nothing, the device only needs to be idle
+ */
 static void
-usage(void)
+apply_config(const struct config *c)
 {
-   printf("Usage:\n");
-   printf("  -samples N              run in multisample mode with N samples\n");
-   printf("  -present-mailbox        run with present mode mailbox\n");
-   printf("  -present-immediate      run with present mode immediate\n");
-   printf("  -shader-object          run with shader objects\n");
-   printf("  -fullscreen             run in fullscreen mode\n");
-   printf("  -info                   display Vulkan device info\n");
-   printf("  -size WxH               window size\n");
+   if (c->descriptor != descriptor_model) {
+      vkDeviceWaitIdle(device);
+      fini_gears();
+      descriptor_model = c->descriptor;
+      use_shader_object = c->shader_object;
+      use_instancing = c->instancing;
+      init_gears();
+   }
+
+   bool rebuild_programs = c->shader_object != use_shader_object ||
+                           (!c->shader_object && (c->samples != sample_count ||
+                                                  c->depth != depth_mode ||
+                                                  c->multiview != multiview_mode)) ||
+                           c->instancing != use_instancing;
+   bool rebuild_swapchain = c->samples != sample_count ||
+                            c->present_mode != desidered_present_mode ||
+                            c->depth != depth_mode ||
+                            c->resolve != resolve_mode ||
+                            c->multiview != multiview_mode ||
+                            c->image_count != desired_image_count;
+
+   vkDeviceWaitIdle(device);
+   if (rebuild_programs)
+      destroy_gear_programs();
+   if (rebuild_swapchain)
+      fini_swapchains();
+
+   use_shader_object = c->shader_object;
+   sample_count = c->samples;
+   desidered_present_mode = c->present_mode;
+   use_instancing = c->instancing;
+   depth_mode = c->depth;
+   resolve_mode = c->resolve;
+   multiview_mode = c->multiview;
+   desired_image_count = c->image_count;
+   concurrent_frames = c->frames_in_flight;
+   max_sequence_count = sequence_count = scene_sequence_count();
+
+   if (rebuild_swapchain)
+      init_swapchains();
+   if (rebuild_programs) {
+      create_gear_programs();
+      refresh_indirect_data();
+   }
 }
 
+/*
+ * Benchmark every combination of the sweep axes on one device. The last
+ * axis varies fastest, so the expensive rebuilds (binding model, sample
+ * count) happen as rarely as possible.
+ */
 static void
-print_info()
+sweep_configs(const struct sweep_axes *axes, double duration)
 {
-   VkPhysicalDeviceProperties properties;
-   vkGetPhysicalDeviceProperties(physical_device, &properties);
-   printf("apiVersion       = %d.%d.%d\n",
-            VK_API_VERSION_MAJOR(properties.apiVersion),
-            VK_API_VERSION_MINOR(properties.apiVersion),
-            VK_API_VERSION_PATCH(properties.apiVersion));
-   printf("driverVersion    = %04x\n", properties.driverVersion);
-   printf("vendorID         = %04x\n", properties.vendorID);
-   printf("deviceID         = %04x\n", properties.deviceID);
-   printf("deviceType       = %s\n", get_devtype_str(properties.deviceType));
-   printf("deviceName       = %s\n", properties.deviceName);
+   const unsigned counts[] = {
+      axes->binding_count, axes->sample_count, axes->present_count,
+      axes->instancing_count, axes->descriptor_count, axes->depth_count,
+      axes->resolve_count, axes->multiview_count,
+   };
+   unsigned max_cells = 1;
+   for (unsigned i = 0; i < ARRAY_SIZE(counts); i++)
+      max_cells *= counts[i];
+   if (max_cells == 0)
+      return;
+   struct {
+      struct config config;
+      VkFormat depth_format;
+      uint32_t sequences;
+      VkDeviceSize preprocess_size;
+      VkDeviceSize attachment_size;
+      VkDeviceSize attachment_resident;
+      double setup_ms;
+      struct bench_result result;
+   } cells[max_cells];
+   unsigned num_cells = 0;
+
+   for (unsigned cell = 0; cell < max_cells; cell++) {
+      unsigned index[ARRAY_SIZE(counts)];
+      for (unsigned i = ARRAY_SIZE(counts), rest = cell; i-- > 0;) {
+         index[i] = rest % counts[i];
+         rest /= counts[i];
+      }
+      const struct config config = {
+         .shader_object = axes->shader_object[index[0]],
+         .samples = axes->samples[index[1]],
+         .present_mode = axes->present[index[2]],
+         .instancing = axes->instancing[index[3]],
+         .descriptor = axes->descriptor[index[4]],
+         .depth = axes->depth[index[5]],
+         .resolve = axes->resolve[index[6]],
+         .multiview = axes->multiview[index[7]],
+         .image_count = desired_image_count,
+         .frames_in_flight = concurrent_frames,
+      };
+      /* the resolve mode means nothing without samples to resolve */
+      if (config.samples == VK_SAMPLE_COUNT_1_BIT && index[6] > 0)
+         continue;
+      /* nor the multiview mode with a single view */
+      if (view_count == 1 && index[7] > 0)
+         continue;
 
-   uint32_t num_extensions = 0;
-   VkExtensionProperties *extensions;
-   vkEnumerateDeviceExtensionProperties(physical_device, NULL, &num_extensions, NULL);
-   if (num_extensions > 0) {
-      extensions = calloc(num_extensions, sizeof(VkExtensionProperties));
-      if (!extensions)
-         error("Failed to allocate memory");
+      char desc[192];
+      format_config(&config, desc, sizeof(desc));
+      const char *reason = config_unsupported(&config);
+      if (reason) {
+         printf("skipping %s: %s\n", desc, reason);
+         continue;
+      }
 
-      vkEnumerateDeviceExtensionProperties(physical_device, NULL, &num_extensions, extensions);
-      printf("deviceExtensions =\n");
-      for (int i = 0; i < num_extensions; ++i)
-         printf("\t%s\n", extensions[i].extensionName);
+      double t0 = current_time();
+      apply_config(&config);
+
+      cells[num_cells].config = config;
+      cells[num_cells].config.present_mode = windows[0].present_mode;
+      cells[num_cells].depth_format = depth_format;
+      cells[num_cells].sequences = max_sequence_count;
+      cells[num_cells].preprocess_size = preprocess_size;
+      cells[num_cells].setup_ms = 1000.0 * (current_time() - t0);
+      printf("running %s, %u sequences for %.1f seconds\n",
+             desc, max_sequence_count, duration);
+      run(duration, &cells[num_cells].result);
+      attachment_totals(&cells[num_cells].attachment_size,
+                        &cells[num_cells].attachment_resident);
+      num_cells++;
+   }
+
+   const double mb = 1024.0 * 1024.0;
+   printf("%-14s %7s %-12s %5s %-7s %-5s %-7s %-9s %9s %11s %9s %8s %8s %8s %8s %8s %8s %9s %11s %9s\n",
+          "binding", "samples", "present", "inst", "desc", "depth", "resolve",
+          "multiview",
+          "sequences", "preproc KB", "fps", "mean ms", "p50 ms", "p99 ms",
+          "max ms", "gpu ms", "bind us", "attach MB", "resident MB", "setup ms");
+   for (unsigned i = 0; i < num_cells; i++) {
+      const struct config *c = &cells[i].config;
+      printf("%-14s %7d %-12s %5s %-7s %-5s %-7s %-9s %9u %11.1f %9.2f %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %9.1f %11.1f %9.3f\n",
+             c->shader_object ? "shader-object" : "pipeline",
+             c->samples, present_mode_str(c->present_mode),
+             c->instancing ? "on" : "off",
+             descriptor_model_names[c->descriptor],
+             depth_format_name(cells[i].depth_format),
+             c->samples != VK_SAMPLE_COUNT_1_BIT ? resolve_mode_names[c->resolve] : "-",
+             view_count > 1 ? multiview_mode_names[c->multiview] : "-",
+             cells[i].sequences, cells[i].preprocess_size / 1024.0,
+             cells[i].result.fps, cells[i].result.mean_ms,
+             cells[i].result.p50_ms, cells[i].result.p99_ms,
+             cells[i].result.max_ms, cells[i].result.gpu_ms,
+             cells[i].result.bind_us, cells[i].attachment_size / mb,
+             cells[i].attachment_resident / mb, cells[i].setup_ms);
    }
 }
 
-static VkSampleCountFlagBits
-sample_count_flag(int sample_count)
+/*
+ * auto-tune: measure every swapchain depth, frames in flight and present
+ * mode the surface allows and keep the best for the goal, either the most
+ * frames per second or the lowest latency among the configurations that
+ * hold a frame rate floor. The pick is stored per device and driver
+ * version so later runs start with it.
+ */
+enum tune_goal {
+   TUNE_MAX_FPS,
+   TUNE_MIN_LATENCY,
+};
+static const char *tune_goal_names[] = { "fps", "latency" };
+static bool autotune;
+static bool autotune_retune;
+static enum tune_goal tune_goal;
+static float tune_fps_floor;
+static double tune_seconds = 1.0;
+
+static void
+parse_tune_goal(const char *spec)
 {
-   switch (sample_count) {
-   case 1:
-      return VK_SAMPLE_COUNT_1_BIT;
-   case 2:
-      return VK_SAMPLE_COUNT_2_BIT;
-   case 4:
-      return VK_SAMPLE_COUNT_4_BIT;
-   case 8:
-      return VK_SAMPLE_COUNT_8_BIT;
-   case 16:
-      return VK_SAMPLE_COUNT_16_BIT;
-   case 32:
-      return VK_SAMPLE_COUNT_32_BIT;
-   case 64:
-      return VK_SAMPLE_COUNT_64_BIT;
-   default:
-      error("Invalid sample count");
+   char name[16];
+   float floor = 0.0f;
+   if (sscanf(spec, "%15[^:]:%f", name, &floor) < 1)
+      error("Invalid auto-tune goal '%s'", spec);
+   for (unsigned i = 0; i < ARRAY_SIZE(tune_goal_names); i++) {
+      if (strcmp(name, tune_goal_names[i]) == 0) {
+         tune_goal = i;
+         tune_fps_floor = floor;
+         return;
+      }
    }
-   return VK_SAMPLE_COUNT_1_BIT;
+   error("Unknown auto-tune goal '%s'", spec);
 }
 
-static bool
-check_sample_count_support(VkSampleCountFlagBits sample_count)
+static void
+format_tune_goal(char *buf, size_t size)
 {
-   VkPhysicalDeviceProperties properties;
-   vkGetPhysicalDeviceProperties(physical_device, &properties);
+   if (tune_goal == TUNE_MIN_LATENCY && tune_fps_floor > 0.0f)
+      snprintf(buf, size, "%s:%g", tune_goal_names[tune_goal], tune_fps_floor);
+   else
+      snprintf(buf, size, "%s", tune_goal_names[tune_goal]);
+}
 
-   return (sample_count & properties.limits.framebufferColorSampleCounts) &&
-      (sample_count & properties.limits.framebufferDepthSampleCounts);
+static void
+tune_file_path(char *buf, size_t size)
+{
+   char uuid[33];
+   get_device_uuid(physical_device, uuid);
+
+   const char *dir = getenv("XDG_CACHE_HOME");
+   if (dir && *dir)
+      snprintf(buf, size, "%s/dgcgears-tune-%s", dir, uuid);
+   else if ((dir = getenv("HOME")))
+      snprintf(buf, size, "%s/.cache/dgcgears-tune-%s", dir, uuid);
+   else
+      snprintf(buf, size, "dgcgears-tune-%s", uuid);
 }
 
+/*
+ * The tune file has one line per goal:
+ *    <goal> <driver version> <present mode> <images> <frames in flight>
+ */
 static bool
-check_indirect_commands_graphics_support()
+load_tune(const char *path, const char *goal, uint32_t driver, struct config *c)
 {
-   VkPhysicalDeviceDeviceGeneratedCommandsPropertiesEXT dgcproperties = {
-      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DEVICE_GENERATED_COMMANDS_PROPERTIES_EXT,
-   };
-   VkPhysicalDeviceProperties2 properties = {
-      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
-      .pNext = &dgcproperties,
-   };
-   vkGetPhysicalDeviceProperties2(physical_device, &properties);
-
-   const VkShaderStageFlags flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-   if (use_shader_object)
-      return (dgcproperties.supportedIndirectCommandsShaderStagesShaderBinding & flags) == flags;
-   else
-      return (dgcproperties.supportedIndirectCommandsShaderStagesPipelineBinding & flags) == flags;
+   FILE *f = fopen(path, "r");
+   if (!f)
+      return false;
+
+   char line[128], name[32], present[32];
+   unsigned version, images, frames;
+   bool found = false;
+   while (!found && fgets(line, sizeof(line), f)) {
+      if (sscanf(line, "%31s %u %31s %u %u", name, &version, present,
+                 &images, &frames) != 5)
+         continue;
+      if (strcmp(name, goal) != 0 || version != driver)
+         continue;
+      if (images < 1 || images > ARRAY_SIZE(windows[0].image_data) ||
+          frames < 1 || frames > MAX_CONCURRENT_FRAMES)
+         continue;
+      c->present_mode = parse_present_mode(present);
+      c->image_count = images;
+      c->frames_in_flight = frames;
+      found = true;
+   }
+   fclose(f);
+   return found;
 }
 
+/* rewrite the file with this goal's line replaced, keeping the others */
 static void
-wsi_resize(int p_new_width, int p_new_height)
+save_tune(const char *path, const char *goal, uint32_t driver, const struct config *c)
+{
+   char lines[ARRAY_SIZE(tune_goal_names) * 8][128];
+   unsigned count = 0;
+
+   FILE *f = fopen(path, "r");
+   if (f) {
+      char line[128], name[32];
+      while (count < ARRAY_SIZE(lines) && fgets(line, sizeof(line), f)) {
+         if (sscanf(line, "%31s", name) == 1 && strcmp(name, goal) != 0)
+            memcpy(lines[count++], line, sizeof(line));
+      }
+      fclose(f);
+   }
+
+   /* the cache directory may not exist yet on a fresh home */
+   char dir[1024];
+   snprintf(dir, sizeof(dir), "%s", path);
+   char *slash = strrchr(dir, '/');
+   if (slash) {
+      *slash = '\0';
+      if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+         fprintf(stderr, "autotune: cannot create %s: %s\n", dir, strerror(errno));
+   }
+
+   f = fopen(path, "w");
+   if (!f) {
+      fprintf(stderr, "autotune: cannot write %s\n", path);
+      return;
+   }
+   for (unsigned i = 0; i < count; i++)
+      fputs(lines[i], f);
+   fprintf(f, "%s %u %s %u %u\n", goal, driver, present_mode_str(c->present_mode),
+           c->image_count, c->frames_in_flight);
+   fclose(f);
+}
+
+/* whether a measured configuration serves the goal better than another */
+static bool
+tune_better(const struct bench_result *a, const struct bench_result *b)
 {
-   new_width = p_new_width;
-   new_height = p_new_height;
+   if (tune_goal == TUNE_MAX_FPS)
+      return a->fps > b->fps;
+
+   bool a_holds = a->fps >= tune_fps_floor, b_holds = b->fps >= tune_fps_floor;
+   if (a_holds != b_holds)
+      return a_holds;
+   /* when nothing holds the floor, get as close to it as possible */
+   if (!a_holds)
+      return a->fps > b->fps;
+   return a->latency_ms < b->latency_ms;
 }
 
 static void
-wsi_key_press(bool down, enum wsi_key key) {
-   if (!down)
+run_autotune(void)
+{
+   VkPhysicalDeviceProperties properties;
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+   char goal[32], path[1024];
+   format_tune_goal(goal, sizeof(goal));
+   tune_file_path(path, sizeof(path));
+
+   struct config best;
+   current_config(&best);
+   if (!autotune_retune &&
+       load_tune(path, goal, properties.driverVersion, &best)) {
+      apply_config(&best);
+      printf("autotune: %s, %u images, %u frames in flight for %s from %s\n",
+             present_mode_str(best.present_mode), best.image_count,
+             best.frames_in_flight, goal, path);
       return;
-   switch (key) {
-      case WSI_KEY_ESC:
-         exit(0);
-      case WSI_KEY_UP:
-         view_rot[0] += 5.0;
-         break;
-      case WSI_KEY_DOWN:
-         view_rot[0] -= 5.0;
-         break;
-      case WSI_KEY_LEFT:
-         view_rot[1] += 5.0;
-         break;
-      case WSI_KEY_RIGHT:
-         view_rot[1] -= 5.0;
-         break;
-      case WSI_KEY_A:
-         animate = !animate;
-         break;
-      default:
-         break;
    }
+
+   VkSurfaceCapabilitiesKHR surface_caps;
+   vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, windows[0].surface,
+                                             &surface_caps);
+   uint32_t count;
+   vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, windows[0].surface,
+                                             &count, NULL);
+   VkPresentModeKHR supported[count];
+   vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, windows[0].surface,
+                                             &count, supported);
+
+   /* up to two images more than the surface needs */
+   uint32_t min_images = surface_caps.minImageCount > 2 ? surface_caps.minImageCount : 2;
+   uint32_t max_images = min_images + 2;
+   if (max_images > ARRAY_SIZE(windows[0].image_data))
+      max_images = ARRAY_SIZE(windows[0].image_data);
+   if (surface_caps.maxImageCount > 0 && max_images > surface_caps.maxImageCount)
+      max_images = surface_caps.maxImageCount;
+
+   printf("autotune: measuring for %s, %.1f seconds per configuration\n",
+          goal, tune_seconds);
+   printf("%-12s %6s %6s %9s %8s %8s %11s %11s\n", "present", "images",
+          "frames", "fps", "mean ms", "p99 ms", "latency ms", "lat p99 ms");
+
+   struct bench_result best_result = { 0 };
+   bool measured = false;
+   for (unsigned m = 0; m < ARRAY_SIZE(known_present_modes); m++) {
+      bool available = false;
+      for (uint32_t i = 0; i < count; i++)
+         available |= supported[i] == known_present_modes[m];
+      if (!available)
+         continue;
+
+      for (uint32_t images = min_images; images <= max_images; images++) {
+         for (unsigned frames = 1; frames <= MAX_CONCURRENT_FRAMES; frames++) {
+            struct config config;
+            current_config(&config);
+            config.present_mode = known_present_modes[m];
+            config.image_count = images;
+            config.frames_in_flight = frames;
+            apply_config(&config);
+
+            struct bench_result result;
+            run(tune_seconds, &result);
+            printf("%-12s %6u %6u %9.2f %8.3f %8.3f %11.3f %11.3f\n",
+                   present_mode_str(config.present_mode), images, frames,
+                   result.fps, result.mean_ms, result.p99_ms,
+                   result.latency_ms, result.latency_p99_ms);
+            if (!measured || tune_better(&result, &best_result)) {
+               best = config;
+               best_result = result;
+               measured = true;
+            }
+         }
+      }
+   }
+
+   apply_config(&best);
+   printf("autotune: picked %s, %u images, %u frames in flight for %s "
+          "(%.2f fps, %.3f ms latency)\n",
+          present_mode_str(best.present_mode), best.image_count,
+          best.frames_in_flight, goal, best_result.fps, best_result.latency_ms);
+   save_tune(path, goal, properties.driverVersion, &best);
 }
 
 static void
-wsi_exit()
+run_ab(double duration)
 {
-   exit(0);
+   static struct ab_set set;
+   struct config config;
+   current_config(&config);
+   format_config(&config, set.config, sizeof(set.config));
+   printf("ab: %u runs of %.1f seconds, %s\n", ab_runs, duration, set.config);
+
+   ab_collect = &set;
+   for (unsigned k = 0; k < ab_runs; k++) {
+      struct bench_result result;
+      run(duration, &result);
+      const struct ab_run *r = &set.runs[set.run_count - 1];
+      printf("ab: run %u: %u frames, %u warmup, %.3f ms median, %.3f ms p99\n",
+             k + 1, r->count, r->warmup, result.p50_ms, result.p99_ms);
+   }
+   ab_collect = NULL;
+
+   ab_reject_outliers(&set);
+   struct ab_summary summary;
+   ab_summarize(&set, &summary);
+   printf("ab: %u runs, %u rejected as outliers\n", summary.runs, summary.rejected);
+   printf("ab: median %.3f ms [%.3f, %.3f], p99 %.3f ms [%.3f, %.3f]\n",
+          summary.median.estimate, summary.median.low, summary.median.high,
+          summary.p99.estimate, summary.p99.low, summary.p99.high);
+   if (ab_output && !ab_save(&set, ab_output))
+      error("Failed to write %s", ab_output);
+   ab_free(&set);
 }
 
-static struct wsi_callbacks wsi_callbacks = {
-   .resize = wsi_resize,
-   .key_press = wsi_key_press,
-   .exit = wsi_exit,
-};
+/* compare two result files, failing if B regressed against A */
+static int
+compare_ab_files(const char *a_file, const char *b_file)
+{
+   static struct ab_set a, b;
+   if (!ab_load(&a, a_file))
+      error("Cannot read A/B results from %s", a_file);
+   if (!ab_load(&b, b_file))
+      error("Cannot read A/B results from %s", b_file);
+
+   printf("A: %s, %u runs\nB: %s, %u runs\n", a_file, a.run_count, b_file, b.run_count);
+   unsigned regressions = ab_compare(&a, &b, ab_threshold, stdout);
+   ab_free(&a);
+   ab_free(&b);
+   return regressions ? 1 : 0;
+}
+
+/* the index of name in names, or -1, for input that must not exit */
+static int
+find_name(const char *const *names, unsigned count, const char *name)
+{
+   for (unsigned i = 0; i < count; i++) {
+      if (strcmp(name, names[i]) == 0)
+         return i;
+   }
+   return -1;
+}
 
+/* change one setting of the running configuration */
 static void
-buffer_barrier(VkCommandBuffer cmd_buffer,
-               VkPipelineStageFlags src_flags,
-               VkPipelineStageFlags dst_flags,
-               VkAccessFlags src_access,
-               VkAccessFlags dst_access,
-               VkBuffer buffer,
-               VkDeviceSize offset,
-               VkDeviceSize size)
+control_set(const char *key, const char *value, char *reply, size_t size)
 {
-   vkCmdPipelineBarrier(cmd_buffer,
-      src_flags, dst_flags,
-      0, 0, NULL,
-      1, &(VkBufferMemoryBarrier) {
-         .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-         .pNext = NULL,
-         .srcAccessMask = src_access,
-         .dstAccessMask = dst_access,
-         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-         .buffer = buffer,
-         .offset = offset,
-         .size = size,
-      },
-      0, NULL);
+   /* the order is picked per frame, nothing needs rebuilding */
+   if (strcmp(key, "order") == 0) {
+      int index = find_name(sequence_order_names, ARRAY_SIZE(sequence_order_names), value);
+      if (index < 0) {
+         snprintf(reply, size, "error: bad setting '%s %s'", key, value);
+         return;
+      }
+      sequence_order = index;
+      snprintf(reply, size, "ok %s %s", key, value);
+      return;
+   }
+
+   struct config config;
+   current_config(&config);
+
+   static const char *binding_names[] = { "pipeline", "shader-object" };
+   static const char *switch_names[] = { "off", "on" };
+   const char *present_names[ARRAY_SIZE(known_present_modes)];
+   for (unsigned i = 0; i < ARRAY_SIZE(known_present_modes); i++)
+      present_names[i] = present_mode_str(known_present_modes[i]);
+
+   int index;
+   unsigned long n = strtoul(value, NULL, 10);
+   if (strcmp(key, "binding") == 0 &&
+       (index = find_name(binding_names, ARRAY_SIZE(binding_names), value)) >= 0) {
+      config.shader_object = index;
+   } else if (strcmp(key, "samples") == 0 && n >= 1 && n <= 64 && !(n & (n - 1))) {
+      config.samples = sample_count_flag(n);
+   } else if (strcmp(key, "present") == 0 &&
+              (index = find_name(present_names, ARRAY_SIZE(present_names), value)) >= 0) {
+      config.present_mode = known_present_modes[index];
+   } else if (strcmp(key, "instancing") == 0 &&
+              (index = find_name(switch_names, ARRAY_SIZE(switch_names), value)) >= 0) {
+      config.instancing = index;
+   } else if (strcmp(key, "descriptor") == 0 &&
+              (index = find_name(descriptor_model_names,
+                                 ARRAY_SIZE(descriptor_model_names), value)) >= 0) {
+      config.descriptor = index;
+   } else if (strcmp(key, "depth") == 0 &&
+              (index = find_name(depth_mode_names, ARRAY_SIZE(depth_mode_names), value)) >= 0) {
+      config.depth = index;
+   } else if (strcmp(key, "resolve") == 0 &&
+              (index = find_name(resolve_mode_names, ARRAY_SIZE(resolve_mode_names), value)) >= 0) {
+      config.resolve = index;
+   } else if (strcmp(key, "images") == 0 && n >= 1 &&
+              n <= ARRAY_SIZE(windows[0].image_data)) {
+      config.image_count = n;
+   } else if (strcmp(key, "frames") == 0 && n >= 1 && n <= MAX_CONCURRENT_FRAMES) {
+      config.frames_in_flight = n;
+   } else {
+      snprintf(reply, size, "error: bad setting '%s %s'", key, value);
+      return;
+   }
+
+   /* descriptor models the device was not created for stay unavailable */
+   const char *reason = config_unsupported(&config);
+   if (reason) {
+      snprintf(reply, size, "error: %s", reason);
+      return;
+   }
+   double t0 = current_time();
+   apply_config(&config);
+   snprintf(reply, size, "ok %s %s, %.1f ms", key, value, 1000.0 * (current_time() - t0));
+}
+
+/*
+ * One line of the control protocol:
+ *    stats                 summary of the last frame
+ *    sequences N           execute the first N sequences (gears without instancing)
+ *    set KEY VALUE         binding, samples, present, instancing, descriptor,
+ *                          depth, resolve, images, frames or order
+ *    capture FILE          write the next frame to FILE (PPM)
+ *    trace start FILE      start recording a DGC trace
+ *    trace stop            finish the trace
+ *    quit                  leave the render loop
+ */
+static void
+control_command(const char *line, char *reply, size_t size)
+{
+   char cmd[16] = "", arg[CONTROL_LINE_SIZE] = "", value[CONTROL_LINE_SIZE] = "";
+   int args = sscanf(line, "%15s %255s %255s", cmd, arg, value);
+   if (args < 1) {
+      snprintf(reply, size, "error: empty command");
+   } else if (strcmp(cmd, "help") == 0) {
+      snprintf(reply, size, "ok stats, sequences N, set KEY VALUE, capture FILE, "
+               "trace start FILE, trace stop, quit");
+   } else if (strcmp(cmd, "stats") == 0) {
+      snprintf(reply, size, "ok %u/%u sequences, %s, %d samples, %s, instancing %s, "
+               "%.3f ms gpu",
+               sequence_count, max_sequence_count,
+               use_shader_object ? "shader-object" : "pipeline", sample_count,
+               present_mode_str(windows[0].present_mode), use_instancing ? "on" : "off",
+               stats.segment ? stats.segment->gpu_ms : 0.0f);
+   } else if (strcmp(cmd, "sequences") == 0 && args == 2) {
+      unsigned long n = strtoul(arg, NULL, 10);
+      if (replaying)
+         snprintf(reply, size, "error: the replayed trace sets the sequence count");
+      else if (n < 1 || n > max_sequence_count)
+         snprintf(reply, size, "error: 1 to %u sequences", max_sequence_count);
+      else {
+         sequence_count = n;
+         snprintf(reply, size, "ok %u sequences", sequence_count);
+      }
+   } else if (strcmp(cmd, "set") == 0 && args == 3) {
+      if (replaying || record_file)
+         snprintf(reply, size, "error: the configuration is fixed while a trace is %s",
+                  replaying ? "replayed" : "recorded");
+      else
+         control_set(arg, value, reply, size);
+   } else if (strcmp(cmd, "capture") == 0 && args == 2) {
+      FILE *f;
+      if (!(windows[0].swapchain_usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+         snprintf(reply, size, "error: swapchain images cannot be captured");
+      else if (control_capture_file)
+         snprintf(reply, size, "error: a capture is already pending");
+      else if (!(f = fopen(arg, "wb")))
+         snprintf(reply, size, "error: cannot write %s", arg);
+      else {
+         fclose(f);
+         control_capture_file = strdup(arg);
+         snprintf(reply, size, "ok capturing the next frame to %s", arg);
+      }
+   } else if (strcmp(cmd, "trace") == 0 && args == 3 && strcmp(arg, "start") == 0) {
+      if (replaying || record_file)
+         snprintf(reply, size, "error: a trace is already %s",
+                  replaying ? "replayed" : "recorded");
+      else {
+         control_trace_file = strdup(value);
+         record_file = control_trace_file;
+         if (start_recording()) {
+            snprintf(reply, size, "ok recording to %s", value);
+         } else {
+            snprintf(reply, size, "error: cannot write %s", value);
+            record_file = NULL;
+            free(control_trace_file);
+            control_trace_file = NULL;
+         }
+      }
+   } else if (strcmp(cmd, "trace") == 0 && args == 2 && strcmp(arg, "stop") == 0) {
+      if (!record_file)
+         snprintf(reply, size, "error: no trace is recorded");
+      else {
+         unsigned frames = trace_writer.header.frame_count;
+         stop_recording();
+         snprintf(reply, size, "ok %u frames", frames);
+         record_file = NULL;
+         free(control_trace_file);
+         control_trace_file = NULL;
+      }
+   } else if (strcmp(cmd, "quit") == 0) {
+      control_quit = true;
+      snprintf(reply, size, "ok");
+   } else {
+      snprintf(reply, size, "error: unknown command '%s'", line);
+   }
+}
+
+/* sample the stats segment of another dgcgears process once a second */
+static int
+monitor_stats(const char *name)
+{
+   const struct stats_segment *segment = stats_attach(name);
+   if (!segment)
+      error("Cannot attach to stats segment %s", name);
+
+   struct stats_segment last = { 0 };
+   while (1) {
+      struct stats_segment cur;
+      if (stats_read(segment, &cur)) {
+         double seconds = cur.time - last.time;
+         printf("frame %llu: %.1f fps, %.3f ms, %.3f ms record, %.3f ms gpu "
+                "(%.3f ms shared), %u/%u sequences, %.1f MB attachments\n",
+                (unsigned long long)cur.frame,
+                seconds > 0.0 ? (cur.frame - last.frame) / seconds : 0.0,
+                cur.frame_ms, cur.record_ms, cur.gpu_ms, cur.gpu_animation_ms,
+                cur.sequence_count, cur.max_sequence_count,
+                cur.attachment_bytes / (1024.0 * 1024.0));
+         fflush(stdout);
+         last = cur;
+      }
+      sleep(1);
+   }
+   return 0;
 }
 
 int
 main(int argc, char *argv[])
 {
    bool printInfo = false;
+   bool sweep = false;
+   bool headless = false;
+   bool sweep_config = false;
+   struct sweep_axes axes = {
+      .sample_count = 4,
+      .samples = {
+         VK_SAMPLE_COUNT_1_BIT, VK_SAMPLE_COUNT_2_BIT,
+         VK_SAMPLE_COUNT_4_BIT, VK_SAMPLE_COUNT_8_BIT,
+      },
+      .present_count = 3,
+      .present = {
+         VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+         VK_PRESENT_MODE_IMMEDIATE_KHR,
+      },
+      .binding_count = 2,
+      .shader_object = { false, true },
+      .instancing_count = 0,
+   };
+   const char *device_selector = NULL;
+   double duration = 0.0;
    sample_count = VK_SAMPLE_COUNT_1_BIT;
    desidered_present_mode = VK_PRESENT_MODE_FIFO_KHR;
    width = 300;
@@ -1880,6 +10197,9 @@ main(int argc, char *argv[])
       else if (strcmp(argv[i], "-shader-object") == 0) {
          use_shader_object = true;
       }
+      else if (strcmp(argv[i], "-stream") == 0) {
+         use_streaming = true;
+      }
       else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
          i++;
          char *token;
@@ -1898,237 +10218,388 @@ main(int argc, char *argv[])
       else if (strcmp(argv[i], "-fullscreen") == 0) {
          fullscreen = true;
       }
+      else if (strcmp(argv[i], "-device") == 0 && i + 1 < argc) {
+         device_selector = argv[++i];
+      }
+      else if (strcmp(argv[i], "-sweep-devices") == 0) {
+         sweep = true;
+      }
+      else if (strcmp(argv[i], "-headless") == 0) {
+         headless = true;
+      }
+      else if (strcmp(argv[i], "-capture") == 0 && i + 1 < argc) {
+         capture_file = argv[++i];
+      }
+      else if (strcmp(argv[i], "-capture-frame") == 0 && i + 1 < argc) {
+         capture_at = strtoul(argv[++i], NULL, 10);
+      }
+      else if (strcmp(argv[i], "-compare") == 0 && i + 1 < argc) {
+         compare_file = argv[++i];
+      }
+      else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc) {
+         compare_tolerance = strtoul(argv[++i], NULL, 10);
+      }
+      else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc) {
+         record_file = argv[++i];
+      }
+      else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc) {
+         open_replay(argv[++i]);
+      }
+      else if (strcmp(argv[i], "-scene") == 0 && i + 1 < argc) {
+         scene_file = argv[++i];
+      }
+      else if (strcmp(argv[i], "-scene-export") == 0 && i + 1 < argc) {
+         scene_export = argv[++i];
+      }
+      else if (strcmp(argv[i], "-gpu-animation") == 0) {
+         gpu_animation = true;
+      }
+      else if (strcmp(argv[i], "-hiz-cull") == 0) {
+         hiz_cull = true;
+      }
+      else if (strcmp(argv[i], "-damage") == 0) {
+         damage_tracking = true;
+      }
+      else if (strcmp(argv[i], "-hud") == 0) {
+         hud_enabled = true;
+      }
+      else if (strcmp(argv[i], "-rt-shadows") == 0) {
+         rt_shadows = true;
+      }
+      else if (strcmp(argv[i], "-loader-dispatch") == 0) {
+         loader_dispatch = true;
+      }
+      else if (strcmp(argv[i], "-sw-raster") == 0 && i + 1 < argc) {
+         swr_threshold = strtof(argv[++i], NULL);
+      }
+      else if (strcmp(argv[i], "-sequence-order") == 0 && i + 1 < argc) {
+         sequence_order = parse_sequence_order(argv[++i]);
+         sort_enabled = true;
+      }
+      else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+         kinematics_threads = strtoul(argv[++i], NULL, 10);
+      }
+      else if (strcmp(argv[i], "-sweep-config") == 0) {
+         sweep_config = true;
+      }
+      else if (strcmp(argv[i], "-sweep-samples") == 0 && i + 1 < argc) {
+         sweep_config = true;
+         parse_sweep_samples(&axes, argv[++i]);
+      }
+      else if (strcmp(argv[i], "-sweep-present") == 0 && i + 1 < argc) {
+         sweep_config = true;
+         parse_sweep_present(&axes, argv[++i]);
+      }
+      else if (strcmp(argv[i], "-sweep-binding") == 0 && i + 1 < argc) {
+         sweep_config = true;
+         parse_sweep_binding(&axes, argv[++i]);
+      }
+      else if (strcmp(argv[i], "-sweep-instancing") == 0 && i + 1 < argc) {
+         sweep_config = true;
+         parse_sweep_instancing(&axes, argv[++i]);
+      }
+      else if (strcmp(argv[i], "-instancing") == 0) {
+         use_instancing = true;
+      }
+      else if (strcmp(argv[i], "-descriptor-model") == 0 && i + 1 < argc) {
+         descriptor_model = parse_descriptor_model(argv[++i]);
+      }
+      else if (strcmp(argv[i], "-sweep-descriptor") == 0 && i + 1 < argc) {
+         sweep_config = true;
+         parse_sweep_descriptor(&axes, argv[++i]);
+      }
+      else if (strcmp(argv[i], "-depth") == 0 && i + 1 < argc) {
+         depth_mode = parse_depth_mode(argv[++i]);
+      }
+      else if (strcmp(argv[i], "-resolve") == 0 && i + 1 < argc) {
+         resolve_mode = parse_resolve_mode(argv[++i]);
+      }
+      else if (strcmp(argv[i], "-sweep-depth") == 0 && i + 1 < argc) {
+         sweep_config = true;
+         parse_sweep_depth(&axes, argv[++i]);
+      }
+      else if (strcmp(argv[i], "-sweep-resolve") == 0 && i + 1 < argc) {
+         sweep_config = true;
+         parse_sweep_resolve(&axes, argv[++i]);
+      }
+      else if (strcmp(argv[i], "-dynamic-res") == 0 && i + 1 < argc) {
+         dynamic_res_target = strtof(argv[++i], NULL);
+      }
+      else if (strcmp(argv[i], "-dynamic-res-range") == 0 && i + 1 < argc) {
+         if (sscanf(argv[++i], "%f,%f", &dynamic_res_min, &dynamic_res_max) != 2 ||
+             dynamic_res_min <= 0.0f || dynamic_res_min > dynamic_res_max)
+            error("Invalid dynamic resolution range '%s'", argv[i]);
+      }
+      else if (strcmp(argv[i], "-windows") == 0 && i + 1 < argc) {
+         window_count = strtoul(argv[++i], NULL, 10);
+         if (window_count < 1 || window_count > WSI_MAX_WINDOWS)
+            error("-windows takes 1 to %d windows", WSI_MAX_WINDOWS);
+      }
+      else if (strcmp(argv[i], "-multiview") == 0 && i + 1 < argc) {
+         view_count = strtoul(argv[++i], NULL, 10);
+         if (view_count < 2 || view_count > MAX_VIEWS)
+            error("-multiview takes 2 to %d views", MAX_VIEWS);
+      }
+      else if (strcmp(argv[i], "-stereo") == 0) {
+         view_count = 2;
+         multiview_stereo = true;
+      }
+      else if (strcmp(argv[i], "-multiview-mode") == 0 && i + 1 < argc) {
+         multiview_mode = parse_multiview_mode(argv[++i]);
+      }
+      else if (strcmp(argv[i], "-sweep-multiview") == 0 && i + 1 < argc) {
+         sweep_config = true;
+         parse_sweep_multiview(&axes, argv[++i]);
+      }
+      else if (strcmp(argv[i], "-swapchain-images") == 0 && i + 1 < argc) {
+         desired_image_count = strtoul(argv[++i], NULL, 10);
+         if (desired_image_count < 1 ||
+             desired_image_count > ARRAY_SIZE(windows[0].image_data))
+            error("-swapchain-images takes 1 to %d images",
+                  (int)ARRAY_SIZE(windows[0].image_data));
+      }
+      else if (strcmp(argv[i], "-frames-in-flight") == 0 && i + 1 < argc) {
+         concurrent_frames = strtoul(argv[++i], NULL, 10);
+         if (concurrent_frames < 1 || concurrent_frames > MAX_CONCURRENT_FRAMES)
+            error("-frames-in-flight takes 1 to %d frames", MAX_CONCURRENT_FRAMES);
+      }
+      else if (strcmp(argv[i], "-autotune") == 0 && i + 1 < argc) {
+         autotune = true;
+         parse_tune_goal(argv[++i]);
+      }
+      else if (strcmp(argv[i], "-autotune-time") == 0 && i + 1 < argc) {
+         tune_seconds = strtod(argv[++i], NULL);
+      }
+      else if (strcmp(argv[i], "-autotune-retune") == 0) {
+         autotune_retune = true;
+      }
+      else if (strcmp(argv[i], "-stall-dump") == 0 && i + 1 < argc) {
+         stall_file = argv[++i];
+      }
+      else if (strcmp(argv[i], "-stall-threshold") == 0 && i + 1 < argc) {
+         stall_factor = strtof(argv[++i], NULL);
+         if (stall_factor <= 1.0f)
+            error("-stall-threshold takes a factor above 1");
+      }
+      else if (strcmp(argv[i], "-control") == 0 && i + 1 < argc) {
+         control_path = argv[++i];
+      }
+      else if (strcmp(argv[i], "-stats") == 0 && i + 1 < argc) {
+         stats_name = argv[++i];
+      }
+      else if (strcmp(argv[i], "-monitor") == 0 && i + 1 < argc) {
+         return monitor_stats(argv[++i]);
+      }
+      else if (strcmp(argv[i], "-duration") == 0 && i + 1 < argc) {
+         duration = strtod(argv[++i], NULL);
+      }
+      else if (strcmp(argv[i], "-ab-runs") == 0 && i + 1 < argc) {
+         ab_runs = strtoul(argv[++i], NULL, 10);
+         if (ab_runs < 2 || ab_runs > AB_MAX_RUNS)
+            error("-ab-runs takes 2 to %u runs", AB_MAX_RUNS);
+      }
+      else if (strcmp(argv[i], "-ab-output") == 0 && i + 1 < argc) {
+         ab_output = argv[++i];
+      }
+      else if (strcmp(argv[i], "-ab-compare") == 0 && i + 2 < argc) {
+         ab_inputs[0] = argv[++i];
+         ab_inputs[1] = argv[++i];
+      }
+      else if (strcmp(argv[i], "-ab-threshold") == 0 && i + 1 < argc) {
+         ab_threshold = strtod(argv[++i], NULL) / 100.0;
+      }
       else {
          usage();
          return -1;
       }
    }
 
-   new_width = width, new_height = height;
-
-   wsi = get_wsi_interface();
-   wsi.set_wsi_callbacks(wsi_callbacks);
-
-   wsi.init_display();
-   wsi.init_window("vkgears", width, height, fullscreen);
-
-   init_vk(wsi.required_extension_name);
-
-   if (!check_sample_count_support(sample_count))
-      error("Sample count not supported");
+   /* comparing saved results needs no device */
+   if (ab_inputs[0])
+      return compare_ab_files(ab_inputs[0], ab_inputs[1]);
 
-   if (!check_indirect_commands_graphics_support())
-      error("Indirect execution does not support graphics %s switching", use_shader_object ? "shader" : "pipeline");
+   /* every window looks at the same gears from its own side */
+   for (unsigned w = 0; w < window_count; w++) {
+      windows[w].width = windows[w].new_width = width;
+      windows[w].height = windows[w].new_height = height;
+      windows[w].res_scale = 1.0f;
+      windows[w].yaw = 360.0f * w / window_count;
+   }
 
-   if (printInfo)
-      print_info();
+   if (axes.instancing_count == 0) {
+      axes.instancing[0] = use_instancing;
+      axes.instancing_count = 1;
+   }
+   if (axes.descriptor_count == 0) {
+      axes.descriptor[0] = descriptor_model;
+      axes.descriptor_count = 1;
+   }
+   if (axes.depth_count == 0) {
+      axes.depth[0] = depth_mode;
+      axes.depth_count = 1;
+   }
+   if (axes.resolve_count == 0) {
+      axes.resolve[0] = resolve_mode;
+      axes.resolve_count = 1;
+   }
+   if (axes.multiview_count == 0) {
+      axes.multiview[0] = multiview_mode;
+      axes.multiview_count = 1;
+   }
+   requested_descriptor_models = 1u << descriptor_model;
+   for (unsigned i = 0; i < axes.descriptor_count; i++)
+      requested_descriptor_models |= 1u << axes.descriptor[i];
+
+   /* the pyramid is built from a single sampled, single view depth */
+   if (hiz_cull && (sample_count != VK_SAMPLE_COUNT_1_BIT || view_count > 1))
+      error("-hiz-cull cannot be combined with -samples or -multiview");
+   /* the damage is redrawn straight into the retained swapchain image */
+   if (damage_tracking && (sample_count != VK_SAMPLE_COUNT_1_BIT || view_count > 1 ||
+                           dynamic_res_target > 0.0f || hiz_cull || replaying))
+      error("-damage cannot be combined with -samples, -multiview, -dynamic-res, "
+            "-hiz-cull or -replay");
+   /* the HUD changes every frame, so there would be nothing left undamaged */
+   if (hud_enabled && damage_tracking)
+      error("-hud cannot be combined with -damage");
+   /* the rays start from one sampled depth, traced through the static meshes */
+   if (rt_shadows && (sample_count != VK_SAMPLE_COUNT_1_BIT || view_count > 1 ||
+                      use_streaming || hiz_cull || damage_tracking))
+      error("-rt-shadows cannot be combined with -samples, -multiview, -stream, "
+            "-hiz-cull or -damage");
+   /* the visibility buffer holds one sample of the first view of static meshes */
+   if (swr_threshold > 0.0f && (sample_count != VK_SAMPLE_COUNT_1_BIT || view_count > 1 ||
+                                use_streaming || hiz_cull || damage_tracking))
+      error("-sw-raster cannot be combined with -samples, -multiview, -stream, "
+            "-hiz-cull or -damage");
+   if (replaying && (use_streaming || record_file || sweep || sweep_config))
+      error("-replay cannot be combined with -stream, -record or sweeps");
+   if (record_file && (sweep || sweep_config))
+      error("-record cannot be combined with sweeps");
+   if (autotune && (sweep || sweep_config || record_file || capture_file || compare_file))
+      error("-autotune cannot be combined with sweeps, -record, -capture or -compare");
+   if (control_path && (sweep || sweep_config || autotune))
+      error("-control cannot be combined with sweeps or -autotune");
+   if (ab_runs && (sweep || sweep_config || autotune || control_path ||
+                   capture_file || compare_file))
+      error("-ab-runs cannot be combined with sweeps, -autotune, -control, "
+            "-capture or -compare");
+   if (ab_output && !ab_runs)
+      error("-ab-output needs -ab-runs");
+   /* the order can be switched live, so the sort is always ready */
+   if (control_path)
+      sort_enabled = true;
+   if (dynamic_res_target > 0.0f && (capture_file || compare_file))
+      error("-dynamic-res cannot be combined with -capture or -compare");
+   if (view_count > 1 && sample_count != VK_SAMPLE_COUNT_1_BIT &&
+       resolve_mode != RESOLVE_PASS)
+      error("-multiview resolves MSAA in the rendering pass only");
+   for (unsigned w = 0; w < window_count; w++) {
+      if (windows[w].res_scale > dynamic_res_max)
+         windows[w].res_scale = dynamic_res_max;
+   }
 
-   if (!wsi.create_surface(physical_device, instance, &surface))
-      error("Failed to create surface!");
+   if (capture_file || compare_file) {
+      if (!capture_at)
+         capture_at = 30;
+      deterministic = true;
+   } else {
+      capture_at = 0;
+   }
 
-   configure_swapchain();
-   create_swapchain();
-   init_gears();
+   load_scene();
 
-   bool first[4] = {false};
+   wsi = headless ? headless_wsi_interface() : get_wsi_interface();
+   wsi.set_wsi_callbacks(wsi_callbacks);
 
-   while (1) {
-      static int frames = 0;
-      static double tRot0 = -1.0, tRate0 = -1.0;
-      double dt, t = current_time();
+   wsi.init_display();
+   for (unsigned w = 0; w < window_count; w++) {
+      if (!wsi.init_window("vkgears", width, height, fullscreen))
+         error("Failed to open window %u", w);
+   }
 
-      if (tRot0 < 0.0)
-         tRot0 = t;
-      dt = t - tRot0;
-      tRot0 = t;
+   init_vk(wsi.required_extension_name);
+   enable_shader_object = use_shader_object;
 
-      if (animate) {
-         /* advance rotation for next frame */
-         angle += 70.0 * dt;  /* 70 degrees per second */
-         if (angle > 3600.0)
-            angle -= 3600.0;
-      }
+   if (sweep) {
+      sweep_devices(duration > 0.0 ? duration : 10.0);
+      wsi.fini_window();
+      wsi.fini_display();
+      return 0;
+   }
 
-      if (wsi.update_window()) {
-         printf("update window failed\n");
-         break;
-      }
+   physical_device = select_physical_device(device_selector);
 
-      static uint32_t frame_index;
-      assert(frame_index < ARRAY_SIZE(frame_data));
-      vkWaitForFences(device, 1, &frame_data[frame_index].fence, VK_TRUE, UINT64_MAX);
-      vkResetFences(device, 1, &frame_data[frame_index].fence);
-
-      uint32_t image_index;
-      VkResult result =
-         vkAcquireNextImageKHR(device, swapchain, UINT64_MAX,
-                               frame_data[frame_index].semaphore, VK_NULL_HANDLE,
-                               &image_index);
-      if (result == VK_SUBOPTIMAL_KHR ||
-          width != new_width || height != new_height) {
-         recreate_swapchain();
-         memset(first, 0, sizeof(first));
-         continue;
+   if (sweep_config) {
+      for (unsigned i = 0; i < axes.binding_count; i++) {
+         if (axes.shader_object[i])
+            enable_shader_object = device_supports_extension(physical_device,
+                                                             VK_EXT_SHADER_OBJECT_EXTENSION_NAME);
       }
-      assert(result == VK_SUCCESS);
-
-      assert(image_index < ARRAY_SIZE(image_data));
-
-      vkBeginCommandBuffer(frame_data[frame_index].cmd_buffer,
-         &(VkCommandBufferBeginInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-            .flags = 0
-         });
-
-      /* projection matrix */
-      float h = (float)height / width;
-      struct ubo ubo;
-      mat4_identity(ubo.projection);
-      mat4_frustum_vk(ubo.projection, -1.0, 1.0, -h, +h, 5.0f, 60.0f);
-
-      buffer_barrier(frame_data[frame_index].cmd_buffer,
-         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-         VK_PIPELINE_STAGE_TRANSFER_BIT,
-         0, 0,
-         ubo_buffer, 0, sizeof(ubo));
-
-      vkCmdUpdateBuffer(frame_data[frame_index].cmd_buffer, ubo_buffer, 0, sizeof(ubo), &ubo);
+      sample_count = axes.samples[0];
+      use_shader_object = axes.shader_object[0] && enable_shader_object;
+   }
 
-      buffer_barrier(frame_data[frame_index].cmd_buffer,
-         VK_PIPELINE_STAGE_TRANSFER_BIT,
-         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-         VK_ACCESS_TRANSFER_WRITE_BIT,
-         VK_ACCESS_UNIFORM_READ_BIT,
-         ubo_buffer, 0, sizeof(ubo));
+   if (!check_device_support())
+      exit(1);
 
-      vkCmdPipelineBarrier(frame_data[frame_index].cmd_buffer,
-         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-         0,
-         0, NULL,
-         0, NULL,
-         1, &(VkImageMemoryBarrier) {
-            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-            NULL,
-            0,
-            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,
-            !first[image_index] ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-            0, 0,
-            image_data[frame_index].image,
-            .subresourceRange = {
-               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-               .baseMipLevel = 0,
-               .levelCount = 1,
-               .baseArrayLayer = 0,
-               .layerCount = 1,
-            },
-         }
-      );
-      first[image_index] = true;
+   if (printInfo)
+      print_info();
 
-      vkCmdBeginRendering(frame_data[frame_index].cmd_buffer,
-         &(VkRenderingInfo) {
-            .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-            .renderArea = { { 0, 0 }, { width, height } },
-            .layerCount = 1,
-            .viewMask = 0,
-            .colorAttachmentCount = 1,
-            .pColorAttachments = (VkRenderingAttachmentInfo[]) { {
-               VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-               .imageView = sample_count != VK_SAMPLE_COUNT_1_BIT ? color_msaa_view : image_data[image_index].view,
-               .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-               .resolveMode = sample_count != VK_SAMPLE_COUNT_1_BIT ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
-               .resolveImageView = sample_count != VK_SAMPLE_COUNT_1_BIT ? image_data[image_index].view : VK_NULL_HANDLE,
-               .resolveImageLayout = sample_count != VK_SAMPLE_COUNT_1_BIT ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
-               .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-               .storeOp = sample_count != VK_SAMPLE_COUNT_1_BIT ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
-               .clearValue.color = { .float32 = { 0.0f, 0.0f, 0.0f, 1.0f } },
-            }},
-            .pDepthAttachment = &(VkRenderingAttachmentInfo) {
-               VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-               .imageView = depth_view,
-               .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-               .resolveMode = sample_count != VK_SAMPLE_COUNT_1_BIT ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
-               .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-               .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-               .clearValue = { .depthStencil.depth = 1.0f },
-            }
-         });
+   if (!create_surfaces())
+      error("Failed to create surface!");
 
-      draw_gears(frame_data[frame_index].cmd_buffer);
-      vkCmdEndRendering(frame_data[frame_index].cmd_buffer);
-      vkCmdPipelineBarrier(frame_data[frame_index].cmd_buffer,
-         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-         0,
-         0, NULL,
-         0, NULL,
-         1, &(VkImageMemoryBarrier) {
-            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-            NULL,
-            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,
-            0,
-            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-            0, 0,
-            image_data[frame_index].image,
-            .subresourceRange = {
-               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-               .baseMipLevel = 0,
-               .levelCount = 1,
-               .baseArrayLayer = 0,
-               .layerCount = 1,
-            },
-         }
-      );
-      vkEndCommandBuffer(frame_data[frame_index].cmd_buffer);
+   init_device();
+   init_swapchains();
+   init_gears();
 
-      vkQueueSubmit(queue, 1,
-         &(VkSubmitInfo) {
-            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &frame_data[frame_index].semaphore,
-            .signalSemaphoreCount = 1,
-            .pSignalSemaphores = &present_semaphore,
-            .pWaitDstStageMask = (VkPipelineStageFlags []) {
-               VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            },
-            .commandBufferCount = 1,
-            .pCommandBuffers = &frame_data[frame_index].cmd_buffer,
-         }, frame_data[frame_index].fence);
+   if (scene_file || use_instancing)
+      printf("dgc: %u sequences, %.1f KB preprocess buffer\n",
+             max_sequence_count, preprocess_size / 1024.0);
 
-      vkQueuePresentKHR(queue,
-         &(VkPresentInfoKHR) {
-            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-            .pWaitSemaphores = &present_semaphore,
-            .waitSemaphoreCount = 1,
-            .swapchainCount = 1,
-            .pSwapchains = (VkSwapchainKHR[]) { swapchain, },
-            .pImageIndices = (uint32_t[]) { image_index, },
-            .pResults = &result,
-         });
+   if (autotune)
+      run_autotune();
 
-      frames++;
+   if (sweep_config) {
+      sweep_configs(&axes, duration > 0.0 ? duration : 5.0);
+      fini_device();
+      wsi.fini_window();
+      wsi.fini_display();
+      return 0;
+   }
 
-      frame_index++;
-      if (frame_index == MAX_CONCURRENT_FRAMES)
-         frame_index = 0;
+   if (ab_runs) {
+      run_ab(duration > 0.0 ? duration : 10.0);
+      fini_device();
+      wsi.fini_window();
+      wsi.fini_display();
+      return 0;
+   }
 
-      if (tRate0 < 0.0)
-         tRate0 = t;
-      if (t - tRate0 >= 5.0) {
-         float seconds = t - tRate0;
-         float fps = frames / seconds;
-         printf("%d frames in %3.1f seconds = %6.3f FPS\n", frames, seconds,
-               fps);
-         fflush(stdout);
-         tRate0 = t;
-         frames = 0;
-      }
+   if (record_file && !start_recording())
+      error("Failed to open %s", record_file);
+   if (control_path && !control_open(&control, control_path))
+      error("Failed to listen on %s", control_path);
+   if (stats_name && !stats_open(&stats, stats_name))
+      error("Failed to create stats segment %s", stats_name);
+
+   struct bench_result result;
+   run(duration, &result);
+
+   if (record_file)
+      stop_recording();
+   if (control_path)
+      control_close(&control);
+   stats_close(&stats);
+   if (duration > 0.0) {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(physical_device, &properties);
+      print_result_header();
+      print_result(0, properties.deviceName,
+                   get_devtype_str(properties.deviceType), &result);
    }
+   fini_device();
 
    wsi.fini_window();
    wsi.fini_display();
-   return 0;
+   return capture_status;
 }
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+#
+# Copyright © 2024 Valve Corporation
+#
+# SPDX-License-Identifier: MIT
+
+"""
+Generate a device-level dispatch table from vulkan_core.h: a function
+pointer for every command whose first parameter is a VkDevice, VkQueue or
+VkCommandBuffer, and a function filling them through a loader callback.
+
+usage: gen_vk_dispatch.py vulkan_core.h vk_dispatch.h vk_dispatch.c
+"""
+
+import re
+import sys
+
+PFN = re.compile(r'^typedef\s+[^(]+\(VKAPI_PTR \*PFN_vk(\w+)\)\((\w+)')
+DISPATCHABLE = ('VkDevice', 'VkQueue', 'VkCommandBuffer')
+# the entry point the table is loaded through
+SKIP = ('GetDeviceProcAddr',)
+
+HEADER = '''/*
+ * Generated by gen_vk_dispatch.py from vulkan_core.h, do not edit.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef VK_DISPATCH_H
+#define VK_DISPATCH_H
+
+#include "vulkan/vulkan.h"
+
+/* every device-level command of vulkan_core.h, without its vk prefix */
+struct vk_device_dispatch {
+%s
+};
+
+/* returns the entry point name, NULL if there is none */
+typedef PFN_vkVoidFunction (*vk_dispatch_loader)(void *data, const char *name);
+
+/**
+ * Fills a dispatch table, an entry point at a time.
+ *
+ * @param d the table
+ * @param load the loader, vkGetDeviceProcAddr for the driver's own entry
+ *             points or vkGetInstanceProcAddr for the loader's trampolines
+ * @param data passed to load
+ * @return the number of entry points found
+ */
+unsigned
+vk_load_device_dispatch(struct vk_device_dispatch *d, vk_dispatch_loader load,
+                        void *data);
+
+#endif
+'''
+
+SOURCE = '''/*
+ * Generated by gen_vk_dispatch.py from vulkan_core.h, do not edit.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vk_dispatch.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static const struct {
+   const char *name;
+   size_t offset;
+} entries[] = {
+%s
+};
+
+unsigned
+vk_load_device_dispatch(struct vk_device_dispatch *d, vk_dispatch_loader load,
+                        void *data)
+{
+   unsigned found = 0;
+   for (unsigned i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+      PFN_vkVoidFunction fn = load(data, entries[i].name);
+      memcpy((char *)d + entries[i].offset, &fn, sizeof(fn));
+      found += fn != NULL;
+   }
+   return found;
+}
+'''
+
+
+def device_commands(path):
+    commands = []
+    with open(path) as f:
+        for line in f:
+            m = PFN.match(line)
+            if m and m.group(2) in DISPATCHABLE and m.group(1) not in SKIP:
+                if m.group(1) not in commands:
+                    commands.append(m.group(1))
+    return commands
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__.strip())
+    commands = device_commands(sys.argv[1])
+    if not commands:
+        sys.exit('%s: no device-level commands found' % sys.argv[1])
+
+    fields = '\n'.join('   PFN_vk%s %s;' % (c, c) for c in commands)
+    entries = '\n'.join('   { "vk%s", offsetof(struct vk_device_dispatch, %s) },' % (c, c)
+                        for c in commands)
+    with open(sys.argv[2], 'w') as f:
+        f.write(HEADER % fields)
+    with open(sys.argv[3], 'w') as f:
+        f.write(SOURCE % entries)
+
+
+if __name__ == '__main__':
+    main()
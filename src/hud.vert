@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+/* struct hud_vertex, pulled by index instead of through vertex input */
+struct hud_vertex {
+    vec2 position;  /* pixels from the top left */
+    uint color;     /* RGBA8 */
+    uint pad;
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer vertex_block {
+    hud_vertex vertices[];
+};
+
+layout(push_constant) uniform constants
+{
+    vertex_block vertices;
+    vec2 scale;     /* 2 / the render size */
+};
+
+layout(location = 0) out vec4 color;
+
+void main()
+{
+    hud_vertex v = vertices.vertices[gl_VertexIndex];
+    gl_Position = vec4(v.position * scale - 1.0, 0.0, 1.0);
+    color = unpackUnorm4x8(v.color);
+}
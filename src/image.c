@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "image.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool
+image_write_ppm(const char *filename, const struct image *img)
+{
+   FILE *f = fopen(filename, "wb");
+   if (!f)
+      return false;
+
+   size_t size = (size_t)img->width * img->height * 3;
+   fprintf(f, "P6\n%u %u\n255\n", img->width, img->height);
+   bool ok = fwrite(img->data, 1, size, f) == size;
+   return fclose(f) == 0 && ok;
+}
+
+static bool
+read_ppm_value(FILE *f, unsigned *value)
+{
+   int c;
+
+   /* skip whitespace and comments */
+   while ((c = fgetc(f)) != EOF) {
+      if (c == '#') {
+         while ((c = fgetc(f)) != EOF && c != '\n')
+            ;
+      } else if (!isspace(c)) {
+         break;
+      }
+   }
+
+   if (c == EOF || !isdigit(c))
+      return false;
+
+   *value = 0;
+   do {
+      *value = *value * 10 + (c - '0');
+   } while ((c = fgetc(f)) != EOF && isdigit(c));
+
+   /* a single whitespace character separates the header from the data */
+   return c != EOF && isspace(c);
+}
+
+bool
+image_read_ppm(const char *filename, struct image *img)
+{
+   FILE *f = fopen(filename, "rb");
+   if (!f)
+      return false;
+
+   char magic[2];
+   unsigned max_value;
+   if (fread(magic, 1, 2, f) != 2 || memcmp(magic, "P6", 2) != 0 ||
+       !read_ppm_value(f, &img->width) || !read_ppm_value(f, &img->height) ||
+       !read_ppm_value(f, &max_value) || max_value != 255) {
+      fclose(f);
+      return false;
+   }
+
+   size_t size = (size_t)img->width * img->height * 3;
+   img->data = malloc(size);
+   if (!img->data || fread(img->data, 1, size, f) != size) {
+      free(img->data);
+      img->data = NULL;
+      fclose(f);
+      return false;
+   }
+
+   fclose(f);
+   return true;
+}
+
+bool
+image_compare(const struct image *a, const struct image *b,
+              unsigned tolerance, struct image_diff *diff)
+{
+   memset(diff, 0, sizeof(*diff));
+   if (a->width != b->width || a->height != b->height)
+      return false;
+
+   size_t pixels = (size_t)a->width * a->height;
+   double sum = 0.0;
+   for (size_t i = 0; i < pixels; i++) {
+      unsigned pixel_diff = 0;
+      for (unsigned c = 0; c < 3; c++) {
+         unsigned d = abs((int)a->data[i * 3 + c] - (int)b->data[i * 3 + c]);
+         if (d > pixel_diff)
+            pixel_diff = d;
+         sum += d;
+      }
+      if (pixel_diff > diff->max_diff)
+         diff->max_diff = pixel_diff;
+      if (pixel_diff > tolerance)
+         diff->bad_pixels++;
+   }
+   diff->mean_diff = pixels ? sum / (pixels * 3) : 0.0;
+   return true;
+}
+
+void
+image_free(struct image *img)
+{
+   free(img->data);
+   img->data = NULL;
+}
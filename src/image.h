@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * An 8-bit RGB image, three bytes per pixel, rows top to bottom.
+ */
+struct image {
+   unsigned width, height;
+   uint8_t *data;
+};
+
+/**
+ * Result of comparing two images of the same size.
+ */
+struct image_diff {
+   unsigned max_diff;
+   double mean_diff;
+   unsigned bad_pixels;
+};
+
+/**
+ * Writes an image as a binary PPM (P6) file.
+ *
+ * @param filename the file to write
+ * @param img the image to write
+ * @return true on success
+ */
+bool
+image_write_ppm(const char *filename, const struct image *img);
+
+/**
+ * Reads a binary PPM (P6) file with a maximum value of 255.
+ *
+ * @param filename the file to read
+ * @param[out] img the image, to be released with image_free()
+ * @return true on success
+ */
+bool
+image_read_ppm(const char *filename, struct image *img);
+
+/**
+ * Compares two images channel by channel.
+ *
+ * A pixel is counted as bad when any of its channels differs by more than
+ * the tolerance.
+ *
+ * @param a the first image
+ * @param b the second image
+ * @param tolerance the largest per-channel difference still accepted
+ * @param[out] diff the comparison statistics
+ * @return false if the image sizes do not match
+ */
+bool
+image_compare(const struct image *a, const struct image *b,
+              unsigned tolerance, struct image_diff *diff);
+
+/**
+ * Releases the pixel data of an image.
+ *
+ * @param img the image to release
+ */
+void
+image_free(struct image *img);
+
+#endif /* IMAGE_H */
@@ -0,0 +1,464 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "kinematics.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* scenes smaller than this are not worth waking the workers for */
+#define MIN_GEARS_PER_THREAD 4096
+
+#define COAXIAL_EPSILON 1e-3f
+
+enum relation {
+   RELATION_NONE,
+   RELATION_MESH,
+   RELATION_SHAFT,
+};
+
+static const struct gear_shape *
+gear_shape(const struct kinematics *k, uint32_t gear)
+{
+   return &k->scene->shapes[k->scene->gear_shape[gear]];
+}
+
+static enum relation
+relate(const struct kinematics *k, uint32_t a, uint32_t b)
+{
+   const float *pa = k->scene->params[a].position;
+   const float *pb = k->scene->params[b].position;
+   const struct gear_shape *sa = gear_shape(k, a);
+   const struct gear_shape *sb = gear_shape(k, b);
+
+   float dx = pb[0] - pa[0], dy = pb[1] - pa[1];
+   float d = sqrtf(dx * dx + dy * dy);
+   if (d < COAXIAL_EPSILON)
+      return RELATION_SHAFT;
+
+   if (fabsf(pb[2] - pa[2]) >= 0.5f * (sa->width + sb->width))
+      return RELATION_NONE;
+   if (fabsf(d - (sa->outer_radius + sb->outer_radius)) >
+       0.5f * (sa->tooth_depth + sb->tooth_depth))
+      return RELATION_NONE;
+   return RELATION_MESH;
+}
+
+static uint32_t
+hash_cell(int32_t x, int32_t y)
+{
+   return (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u;
+}
+
+static void
+gear_cell(const struct kinematics *k, uint32_t gear, int32_t *x, int32_t *y)
+{
+   const float *p = k->scene->params[gear].position;
+   *x = (int32_t)floorf(p[0] / k->cell_size);
+   *y = (int32_t)floorf(p[1] / k->cell_size);
+}
+
+/* bucket the gears by grid cell with a counting sort */
+static bool
+build_grid(struct kinematics *k)
+{
+   float max_reach = 0.0f;
+   for (uint32_t i = 0; i < k->scene->shape_count; i++) {
+      const struct gear_shape *s = &k->scene->shapes[i];
+      float reach = s->outer_radius + s->tooth_depth;
+      if (reach > max_reach)
+         max_reach = reach;
+   }
+   k->cell_size = 2.0f * max_reach > 0.0f ? 2.0f * max_reach : 1.0f;
+
+   uint32_t buckets = 1;
+   while (buckets < 2 * k->gear_count)
+      buckets <<= 1;
+   k->bucket_mask = buckets - 1;
+
+   k->bucket_start = calloc(buckets + 1, sizeof(uint32_t));
+   k->bucket_gears = malloc(k->gear_count * sizeof(uint32_t));
+   if (!k->bucket_start || !k->bucket_gears)
+      return false;
+
+   for (uint32_t i = 0; i < k->gear_count; i++) {
+      int32_t x, y;
+      gear_cell(k, i, &x, &y);
+      k->bucket_start[(hash_cell(x, y) & k->bucket_mask) + 1]++;
+   }
+   for (uint32_t i = 0; i < buckets; i++)
+      k->bucket_start[i + 1] += k->bucket_start[i];
+
+   uint32_t *fill = malloc(buckets * sizeof(uint32_t));
+   if (!fill)
+      return false;
+   memcpy(fill, k->bucket_start, buckets * sizeof(uint32_t));
+   for (uint32_t i = 0; i < k->gear_count; i++) {
+      int32_t x, y;
+      gear_cell(k, i, &x, &y);
+      k->bucket_gears[fill[hash_cell(x, y) & k->bucket_mask]++] = i;
+   }
+   free(fill);
+   return true;
+}
+
+/* iterates over the gears related to a gear, through the 3x3 cells around it */
+struct neighbours {
+   uint32_t gear;
+   int32_t x, y;
+   int cell;
+   uint32_t i, end;
+};
+
+static void
+neighbours_begin(const struct kinematics *k, struct neighbours *n, uint32_t gear)
+{
+   n->gear = gear;
+   gear_cell(k, gear, &n->x, &n->y);
+   n->cell = -1;
+   n->i = n->end = 0;
+}
+
+static bool
+neighbours_next(const struct kinematics *k, struct neighbours *n,
+                uint32_t *other, enum relation *rel)
+{
+   for (;;) {
+      while (n->i == n->end) {
+         if (++n->cell == 9)
+            return false;
+         uint32_t b = hash_cell(n->x + n->cell % 3 - 1, n->y + n->cell / 3 - 1) &
+                      k->bucket_mask;
+         n->i = k->bucket_start[b];
+         n->end = k->bucket_start[b + 1];
+      }
+
+      *other = k->bucket_gears[n->i++];
+      if (*other == n->gear)
+         continue;
+      *rel = relate(k, n->gear, *other);
+      if (*rel != RELATION_NONE)
+         return true;
+   }
+}
+
+static uint32_t
+find_root(uint32_t *parent, uint32_t i)
+{
+   while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+   }
+   return i;
+}
+
+/* group gears by connected component, components ordered by lowest gear */
+static bool
+build_components(struct kinematics *k)
+{
+   uint32_t *parent = malloc(k->gear_count * sizeof(uint32_t));
+   if (!parent)
+      return false;
+   for (uint32_t i = 0; i < k->gear_count; i++)
+      parent[i] = i;
+
+   for (uint32_t i = 0; i < k->gear_count; i++) {
+      struct neighbours n;
+      uint32_t j;
+      enum relation rel;
+
+      neighbours_begin(k, &n, i);
+      while (neighbours_next(k, &n, &j, &rel)) {
+         uint32_t ri = find_root(parent, i), rj = find_root(parent, j);
+         /* the lowest index becomes the root, which drives the component */
+         if (ri < rj)
+            parent[rj] = ri;
+         else if (rj < ri)
+            parent[ri] = rj;
+      }
+   }
+
+   /* number the components in root order and count their gears */
+   uint32_t *component = malloc(k->gear_count * sizeof(uint32_t));
+   if (!component) {
+      free(parent);
+      return false;
+   }
+   k->component_count = 0;
+   for (uint32_t i = 0; i < k->gear_count; i++) {
+      if (find_root(parent, i) == i)
+         component[i] = k->component_count++;
+   }
+
+   k->component_start = calloc(k->component_count + 1, sizeof(uint32_t));
+   if (!k->component_start) {
+      free(component);
+      free(parent);
+      return false;
+   }
+   for (uint32_t i = 0; i < k->gear_count; i++) {
+      component[i] = component[find_root(parent, i)];
+      k->component_start[component[i] + 1]++;
+   }
+   for (uint32_t c = 0; c < k->component_count; c++)
+      k->component_start[c + 1] += k->component_start[c];
+
+   /* stable, so each component starts with its root */
+   memcpy(parent, k->component_start, k->component_count * sizeof(uint32_t));
+   for (uint32_t i = 0; i < k->gear_count; i++) {
+      k->slot[i] = parent[component[i]]++;
+      k->order[k->slot[i]] = i;
+   }
+
+   free(component);
+   free(parent);
+   return true;
+}
+
+/* split the components into contiguous ranges of about equal gear count */
+static void
+partition(struct kinematics *k)
+{
+   uint32_t c = 0;
+   k->thread_start[0] = 0;
+   for (unsigned t = 1; t < k->thread_count; t++) {
+      uint64_t target = (uint64_t)k->gear_count * t / k->thread_count;
+      while (c < k->component_count && k->component_start[c] < target)
+         c++;
+      k->thread_start[t] = c;
+   }
+   k->thread_start[k->thread_count] = k->component_count;
+}
+
+/*
+ * Teeth interlock when a tooth centre of one gear faces a gap centre of the
+ * other along the line between their axes. create_gear() puts the centre of
+ * tooth 0 at 3/8 of the angular pitch and the following gap at 7/8.
+ */
+static float
+mesh_phase(const struct kinematics *k, uint32_t a, uint32_t b)
+{
+   const float *pa = k->scene->params[a].position;
+   const float *pb = k->scene->params[b].position;
+   float pitch_a = 360.0f / gear_shape(k, a)->teeth;
+   float pitch_b = 360.0f / gear_shape(k, b)->teeth;
+
+   float dir = atan2f(pb[1] - pa[1], pb[0] - pa[0]) * (float)(180.0 / M_PI);
+   float tooth = (dir - k->phase[a]) / pitch_a - 0.375f;
+   float phase = dir + 180.0f - pitch_b * (0.875f - tooth);
+   return fmodf(phase, pitch_b);
+}
+
+/*
+ * Breadth-first from each component root. The component's slice of order[]
+ * doubles as the queue: a gear is swapped to the tail when it is reached,
+ * with slot[] tracking where each gear currently sits.
+ */
+static void
+solve_job(struct kinematics *k, unsigned thread)
+{
+   const struct scene *scene = k->scene;
+   unsigned conflicts = 0;
+
+   for (uint32_t c = k->thread_start[thread]; c < k->thread_start[thread + 1]; c++) {
+      uint32_t start = k->component_start[c], end = k->component_start[c + 1];
+      uint32_t head = start, tail = start + 1;
+      uint32_t root = k->order[start];
+
+      k->ratio[root] = scene->params[root].angle_ratio;
+      k->phase[root] = scene->params[root].phase;
+      for (uint32_t i = start + 1; i < end; i++)
+         k->ratio[k->order[i]] = NAN;
+
+      while (head < tail) {
+         uint32_t gear = k->order[head++];
+         struct neighbours n;
+         uint32_t other;
+         enum relation rel;
+
+         neighbours_begin(k, &n, gear);
+         while (neighbours_next(k, &n, &other, &rel)) {
+            float ratio = k->ratio[gear];
+            if (rel == RELATION_MESH)
+               ratio *= -(float)gear_shape(k, gear)->teeth / gear_shape(k, other)->teeth;
+
+            if (isnan(k->ratio[other])) {
+               k->ratio[other] = ratio;
+               k->phase[other] = rel == RELATION_MESH ? mesh_phase(k, gear, other) :
+                                                        k->phase[gear];
+               uint32_t from = k->slot[other];
+               k->order[from] = k->order[tail];
+               k->slot[k->order[from]] = from;
+               k->order[tail] = other;
+               k->slot[other] = tail++;
+            } else if (gear < other &&
+                       fabsf(k->ratio[other] - ratio) > 1e-4f * fabsf(ratio)) {
+               conflicts++;
+            }
+         }
+      }
+   }
+
+   k->thread_conflicts[thread] = conflicts;
+}
+
+static void
+tick_job(struct kinematics *k, unsigned thread)
+{
+   double angle = k->job_angle;
+   float *angles = k->job_angles;
+   uint32_t start = k->component_start[k->thread_start[thread]];
+   uint32_t end = k->component_start[k->thread_start[thread + 1]];
+
+   for (uint32_t i = start; i < end; i++) {
+      uint32_t gear = k->order[i];
+      angles[gear] = (float)fmod(k->ratio[gear] * angle + k->phase[gear], 360.0);
+   }
+}
+
+static void *
+worker(void *data)
+{
+   struct kinematics_worker *w = data;
+   struct kinematics *k = w->k;
+   unsigned thread = w->index;
+   uint64_t serial = 0;
+
+   pthread_mutex_lock(&k->mutex);
+   for (;;) {
+      while (!k->quit && k->job_serial == serial)
+         pthread_cond_wait(&k->work_cond, &k->mutex);
+      if (k->quit)
+         break;
+      serial = k->job_serial;
+      pthread_mutex_unlock(&k->mutex);
+
+      k->job(k, thread);
+
+      pthread_mutex_lock(&k->mutex);
+      if (--k->job_pending == 0)
+         pthread_cond_signal(&k->done_cond);
+   }
+   pthread_mutex_unlock(&k->mutex);
+   return NULL;
+}
+
+static void
+run_job(struct kinematics *k, void (*job)(struct kinematics *k, unsigned thread))
+{
+   if (k->thread_count == 1) {
+      job(k, 0);
+      return;
+   }
+
+   pthread_mutex_lock(&k->mutex);
+   k->job = job;
+   k->job_pending = k->thread_count - 1;
+   k->job_serial++;
+   pthread_cond_broadcast(&k->work_cond);
+   pthread_mutex_unlock(&k->mutex);
+
+   job(k, 0);
+
+   pthread_mutex_lock(&k->mutex);
+   while (k->job_pending)
+      pthread_cond_wait(&k->done_cond, &k->mutex);
+   pthread_mutex_unlock(&k->mutex);
+}
+
+bool
+kinematics_init(struct kinematics *k, const struct scene *scene,
+                unsigned thread_count)
+{
+   memset(k, 0, sizeof(*k));
+   k->scene = scene;
+   k->gear_count = scene->gear_count;
+
+   k->ratio = malloc(k->gear_count * sizeof(float));
+   k->phase = malloc(k->gear_count * sizeof(float));
+   k->order = malloc(k->gear_count * sizeof(uint32_t));
+   k->slot = malloc(k->gear_count * sizeof(uint32_t));
+   if (!k->ratio || !k->phase || !k->order || !k->slot || !build_grid(k) ||
+       !build_components(k)) {
+      kinematics_fini(k);
+      return false;
+   }
+
+   if (!thread_count) {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      thread_count = cpus > 0 ? cpus : 1;
+   }
+   if (thread_count > k->gear_count / MIN_GEARS_PER_THREAD)
+      thread_count = k->gear_count / MIN_GEARS_PER_THREAD;
+   if (thread_count > k->component_count)
+      thread_count = k->component_count;
+   if (thread_count > KINEMATICS_MAX_THREADS)
+      thread_count = KINEMATICS_MAX_THREADS;
+   k->thread_count = thread_count ? thread_count : 1;
+   partition(k);
+
+   pthread_mutex_init(&k->mutex, NULL);
+   pthread_cond_init(&k->work_cond, NULL);
+   pthread_cond_init(&k->done_cond, NULL);
+   pthread_mutex_lock(&k->mutex);
+   for (unsigned t = 1; t < k->thread_count; t++) {
+      k->workers[t] = (struct kinematics_worker) { k, t };
+      if (pthread_create(&k->threads[t], NULL, worker, &k->workers[t]) != 0) {
+         k->thread_count = t;
+         partition(k);
+         break;
+      }
+   }
+   pthread_mutex_unlock(&k->mutex);
+
+   run_job(k, solve_job);
+   for (unsigned t = 0; t < k->thread_count; t++)
+      k->conflicts += k->thread_conflicts[t];
+
+   /* the search structures are only needed to solve */
+   free(k->slot);
+   free(k->bucket_start);
+   free(k->bucket_gears);
+   k->slot = k->bucket_start = k->bucket_gears = NULL;
+   return true;
+}
+
+void
+kinematics_tick(struct kinematics *k, double angle, float *angles)
+{
+   k->job_angle = angle;
+   k->job_angles = angles;
+   run_job(k, tick_job);
+}
+
+void
+kinematics_fini(struct kinematics *k)
+{
+   if (k->thread_count > 1) {
+      pthread_mutex_lock(&k->mutex);
+      k->quit = true;
+      pthread_cond_broadcast(&k->work_cond);
+      pthread_mutex_unlock(&k->mutex);
+      for (unsigned t = 1; t < k->thread_count; t++)
+         pthread_join(k->threads[t], NULL);
+   }
+   if (k->thread_count) {
+      pthread_cond_destroy(&k->done_cond);
+      pthread_cond_destroy(&k->work_cond);
+      pthread_mutex_destroy(&k->mutex);
+   }
+
+   free(k->ratio);
+   free(k->phase);
+   free(k->order);
+   free(k->slot);
+   free(k->component_start);
+   free(k->bucket_start);
+   free(k->bucket_gears);
+   memset(k, 0, sizeof(*k));
+}
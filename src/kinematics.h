@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scene.h"
+
+#define KINEMATICS_MAX_THREADS 64
+
+struct kinematics;
+
+struct kinematics_worker {
+   struct kinematics *k;
+   unsigned index;
+};
+
+/*
+ * Gear-train kinematics.
+ *
+ * Two gears mesh when they overlap in depth and the distance between their
+ * axes is the sum of their pitch (outer) radii, within half the sum of their
+ * tooth depths. Gears sharing an axis are fixed to the same shaft. Each
+ * connected component is driven by its lowest-index gear, which keeps the
+ * ratio and phase given by the scene; every other gear in the component is
+ * solved so that its teeth interlock with the gear that reaches it first.
+ *
+ * Per-gear state is kept as a struct of arrays, with the gears of each
+ * component contiguous in order[] so that components can be distributed
+ * over worker threads.
+ */
+struct kinematics {
+   const struct scene *scene;
+   uint32_t gear_count;
+   uint32_t component_count;
+
+   float *ratio;
+   float *phase;
+   uint32_t *order;
+   uint32_t *slot;
+   uint32_t *component_start;
+   unsigned conflicts;
+
+   /* spatial hash over gear axes */
+   float cell_size;
+   uint32_t bucket_mask;
+   uint32_t *bucket_start;
+   uint32_t *bucket_gears;
+
+   /* worker pool, thread 0 is the caller */
+   unsigned thread_count;
+   uint32_t thread_start[KINEMATICS_MAX_THREADS + 1];
+   pthread_t threads[KINEMATICS_MAX_THREADS];
+   struct kinematics_worker workers[KINEMATICS_MAX_THREADS];
+   pthread_mutex_t mutex;
+   pthread_cond_t work_cond, done_cond;
+   uint64_t job_serial;
+   unsigned job_pending;
+   bool quit;
+   void (*job)(struct kinematics *k, unsigned thread);
+   double job_angle;
+   float *job_angles;
+   unsigned thread_conflicts[KINEMATICS_MAX_THREADS];
+};
+
+/**
+ * Builds the meshing graph of a scene and solves every gear's angular
+ * velocity ratio and phase.
+ *
+ * @param k the kinematics state to initialize
+ * @param scene the scene, which must outlive k
+ * @param thread_count worker threads to use, 0 picks one per CPU
+ * @return true on success
+ */
+bool
+kinematics_init(struct kinematics *k, const struct scene *scene,
+                unsigned thread_count);
+
+/**
+ * Computes the angle of every gear, in degrees.
+ *
+ * @param k the kinematics state
+ * @param angle the angle of a gear with ratio 1 and phase 0, unwrapped: it
+ *              is only reduced modulo 360 per gear, in double precision
+ * @param angles gear_count angles, indexed by gear
+ */
+void
+kinematics_tick(struct kinematics *k, double angle, float *angles);
+
+/**
+ * Stops the workers and releases the kinematics state.
+ *
+ * @param k the kinematics state
+ */
+void
+kinematics_fini(struct kinematics *k);
+
+#endif /* KINEMATICS_H */
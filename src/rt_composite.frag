@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer mask_block {
+    float visibility[];
+};
+
+layout(push_constant) uniform constants
+{
+    mask_block mask;
+    uint width;     /* the render width, the row pitch of the mask */
+};
+
+layout(location = 0) out vec4 color;
+
+/*
+ * What a shadowed pixel keeps of its color. The gears are shaded before
+ * their shadows are known, so the light blocked is taken away as a whole,
+ * ambient included, by a blend multiplying the color already drawn.
+ */
+#define SHADOW 0.5
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float visibility = mask.visibility[pixel.y * width + pixel.x];
+    color = vec4(vec3(mix(SHADOW, 1.0, visibility)), 1.0);
+}
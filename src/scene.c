@@ -0,0 +1,333 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "scene.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SCENE_ALIGN 16
+
+static uint64_t
+align_offset(uint64_t offset)
+{
+   return (offset + SCENE_ALIGN - 1) & ~(uint64_t)(SCENE_ALIGN - 1);
+}
+
+static void
+compute_radius(struct scene *scene)
+{
+   float max_outer = 0.0f;
+   for (uint32_t i = 0; i < scene->shape_count; i++) {
+      float outer = scene->shapes[i].outer_radius + scene->shapes[i].tooth_depth;
+      if (outer > max_outer)
+         max_outer = outer;
+   }
+
+   float radius = 0.0f;
+   for (uint32_t i = 0; i < scene->gear_count; i++) {
+      const float *p = scene->params[i].position;
+      float r = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+      if (r > radius)
+         radius = r;
+   }
+   scene->radius = radius + max_outer;
+}
+
+static bool
+validate(struct scene *scene)
+{
+   for (uint32_t i = 0; i < scene->gear_count; i++) {
+      if (scene->gear_shape[i] >= scene->shape_count) {
+         fprintf(stderr, "gear %u uses undefined shape %u\n", i,
+                 scene->gear_shape[i]);
+         return false;
+      }
+   }
+   for (uint32_t i = 0; i < scene->shape_count; i++) {
+      if (scene->shapes[i].teeth == 0) {
+         fprintf(stderr, "shape %u has no teeth\n", i);
+         return false;
+      }
+   }
+   compute_radius(scene);
+   return true;
+}
+
+struct cursor {
+   const char *p, *end;
+   unsigned line;
+};
+
+static void
+skip_blanks(struct cursor *c)
+{
+   while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\r'))
+      c->p++;
+}
+
+static void
+skip_line(struct cursor *c)
+{
+   while (c->p < c->end && *c->p != '\n')
+      c->p++;
+   if (c->p < c->end)
+      c->p++;
+   c->line++;
+}
+
+/* copy the next token into buf, which is NUL-terminated for strto*() */
+static bool
+next_token(struct cursor *c, char *buf, size_t buf_size)
+{
+   skip_blanks(c);
+   size_t len = 0;
+   while (c->p < c->end && *c->p != ' ' && *c->p != '\t' && *c->p != '\r' &&
+          *c->p != '\n' && *c->p != '#') {
+      if (len + 1 >= buf_size)
+         return false;
+      buf[len++] = *c->p++;
+   }
+   buf[len] = '\0';
+   return len > 0;
+}
+
+static bool
+parse_float(struct cursor *c, float *value)
+{
+   char buf[64], *end;
+   if (!next_token(c, buf, sizeof(buf)))
+      return false;
+   *value = strtof(buf, &end);
+   return *end == '\0';
+}
+
+static bool
+parse_uint(struct cursor *c, uint32_t *value)
+{
+   char buf[64], *end;
+   if (!next_token(c, buf, sizeof(buf)) || buf[0] == '-')
+      return false;
+   *value = strtoul(buf, &end, 10);
+   return *end == '\0';
+}
+
+static bool
+at_line_end(struct cursor *c)
+{
+   skip_blanks(c);
+   return c->p == c->end || *c->p == '\n' || *c->p == '#';
+}
+
+bool
+scene_parse_text(struct scene *scene, const char *text, size_t size)
+{
+   memset(scene, 0, sizeof(*scene));
+   scene->view_distance = 40.0f;
+
+   /* first pass: count statements */
+   uint32_t shape_count = 0, gear_count = 0;
+   struct cursor c = { text, text + size, 1 };
+   while (c.p < c.end) {
+      char keyword[16];
+      if (next_token(&c, keyword, sizeof(keyword))) {
+         if (strcmp(keyword, "shape") == 0)
+            shape_count++;
+         else if (strcmp(keyword, "gear") == 0)
+            gear_count++;
+      }
+      skip_line(&c);
+   }
+
+   size_t shapes_size = shape_count * sizeof(struct gear_shape);
+   size_t params_size = gear_count * sizeof(struct gear_params);
+   size_t index_size = gear_count * sizeof(uint32_t);
+   uint8_t *storage = malloc(shapes_size + params_size + 2 * index_size + 1);
+   if (!storage)
+      return false;
+
+   struct gear_params *params = (struct gear_params *)storage;
+   struct gear_shape *shapes = (struct gear_shape *)(storage + params_size);
+   uint32_t *gear_shape = (uint32_t *)(storage + params_size + shapes_size);
+   uint32_t *gear_material = gear_shape + gear_count;
+
+   scene->storage = storage;
+   scene->shapes = shapes;
+   scene->params = params;
+   scene->gear_shape = gear_shape;
+   scene->gear_material = gear_material;
+
+   /* second pass: fill the arrays in place */
+   c = (struct cursor) { text, text + size, 1 };
+   while (c.p < c.end) {
+      char keyword[16];
+      bool ok = true;
+
+      if (!next_token(&c, keyword, sizeof(keyword))) {
+         ok = at_line_end(&c);
+      } else if (strcmp(keyword, "view") == 0) {
+         ok = parse_float(&c, &scene->view_distance);
+      } else if (strcmp(keyword, "shape") == 0) {
+         struct gear_shape *s = &shapes[scene->shape_count++];
+         ok = parse_float(&c, &s->inner_radius) &&
+              parse_float(&c, &s->outer_radius) &&
+              parse_float(&c, &s->width) &&
+              parse_uint(&c, &s->teeth) &&
+              parse_float(&c, &s->tooth_depth);
+      } else if (strcmp(keyword, "gear") == 0) {
+         uint32_t i = scene->gear_count++;
+         struct gear_params *g = &params[i];
+         ok = parse_uint(&c, &gear_shape[i]) &&
+              parse_float(&c, &g->position[0]) &&
+              parse_float(&c, &g->position[1]) &&
+              parse_float(&c, &g->position[2]) &&
+              parse_float(&c, &g->color[0]) &&
+              parse_float(&c, &g->color[1]) &&
+              parse_float(&c, &g->color[2]) &&
+              parse_float(&c, &g->angle_ratio) &&
+              parse_float(&c, &g->phase) &&
+              parse_uint(&c, &gear_material[i]);
+      } else {
+         ok = false;
+      }
+
+      if (!ok || !at_line_end(&c)) {
+         fprintf(stderr, "scene: syntax error on line %u\n", c.line);
+         scene_free(scene);
+         return false;
+      }
+      skip_line(&c);
+   }
+
+   if (!validate(scene)) {
+      scene_free(scene);
+      return false;
+   }
+   return true;
+}
+
+static bool
+map_binary(struct scene *scene, void *map, size_t size)
+{
+   const struct scene_file_header *h = map;
+   if (size < sizeof(*h) || h->version != SCENE_VERSION)
+      return false;
+
+   uint64_t gears = h->gear_count;
+   if (h->shapes_offset + h->shape_count * sizeof(struct gear_shape) > size ||
+       h->params_offset + gears * sizeof(struct gear_params) > size ||
+       h->gear_shape_offset + gears * sizeof(uint32_t) > size ||
+       h->gear_material_offset + gears * sizeof(uint32_t) > size ||
+       (h->shapes_offset | h->params_offset | h->gear_shape_offset |
+        h->gear_material_offset) % 4)
+      return false;
+
+   const uint8_t *base = map;
+   scene->view_distance = h->view_distance;
+   scene->shape_count = h->shape_count;
+   scene->gear_count = h->gear_count;
+   scene->shapes = (const struct gear_shape *)(base + h->shapes_offset);
+   scene->params = (const struct gear_params *)(base + h->params_offset);
+   scene->gear_shape = (const uint32_t *)(base + h->gear_shape_offset);
+   scene->gear_material = (const uint32_t *)(base + h->gear_material_offset);
+   return validate(scene);
+}
+
+bool
+scene_load(struct scene *scene, const char *filename)
+{
+   memset(scene, 0, sizeof(*scene));
+
+   int fd = open(filename, O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return false;
+   }
+
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      return false;
+
+   if (st.st_size >= sizeof(struct scene_file_header) &&
+       memcmp(map, SCENE_MAGIC, 8) == 0) {
+      if (!map_binary(scene, map, st.st_size)) {
+         munmap(map, st.st_size);
+         memset(scene, 0, sizeof(*scene));
+         return false;
+      }
+      scene->map = map;
+      scene->map_size = st.st_size;
+      return true;
+   }
+
+   bool ok = scene_parse_text(scene, map, st.st_size);
+   munmap(map, st.st_size);
+   return ok;
+}
+
+bool
+scene_write_binary(const struct scene *scene, const char *filename)
+{
+   struct scene_file_header h = {
+      .version = SCENE_VERSION,
+      .shape_count = scene->shape_count,
+      .gear_count = scene->gear_count,
+      .view_distance = scene->view_distance,
+   };
+   memcpy(h.magic, SCENE_MAGIC, sizeof(h.magic));
+   h.shapes_offset = align_offset(sizeof(h));
+   h.params_offset = align_offset(h.shapes_offset +
+                                  scene->shape_count * sizeof(struct gear_shape));
+   h.gear_shape_offset = align_offset(h.params_offset +
+                                      scene->gear_count * sizeof(struct gear_params));
+   h.gear_material_offset = align_offset(h.gear_shape_offset +
+                                         scene->gear_count * sizeof(uint32_t));
+
+   FILE *f = fopen(filename, "wb");
+   if (!f)
+      return false;
+
+   static const uint8_t zero[SCENE_ALIGN];
+   bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+   struct {
+      uint64_t offset;
+      const void *data;
+      size_t size;
+   } sections[] = {
+      { h.shapes_offset, scene->shapes, scene->shape_count * sizeof(struct gear_shape) },
+      { h.params_offset, scene->params, scene->gear_count * sizeof(struct gear_params) },
+      { h.gear_shape_offset, scene->gear_shape, scene->gear_count * sizeof(uint32_t) },
+      { h.gear_material_offset, scene->gear_material, scene->gear_count * sizeof(uint32_t) },
+   };
+   for (unsigned i = 0; i < sizeof(sections) / sizeof(sections[0]) && ok; i++) {
+      long pos = ftell(f);
+      ok = pos >= 0 && sections[i].offset >= (uint64_t)pos &&
+           fwrite(zero, 1, sections[i].offset - pos, f) == sections[i].offset - pos &&
+           fwrite(sections[i].data, 1, sections[i].size, f) == sections[i].size;
+   }
+
+   return fclose(f) == 0 && ok;
+}
+
+void
+scene_free(struct scene *scene)
+{
+   if (scene->map)
+      munmap(scene->map, scene->map_size);
+   free(scene->storage);
+   memset(scene, 0, sizeof(*scene));
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A scene is a set of gear shapes and a list of gears instancing them.
+ *
+ * Text format, one statement per line, '#' starts a comment:
+ *
+ *    view <distance>
+ *    shape <inner radius> <outer radius> <width> <teeth> <tooth depth>
+ *    gear <shape> <x> <y> <z> <r> <g> <b> <angle ratio> <phase> <material>
+ *
+ * A gear's angle is angle_ratio * angle + phase, in degrees. The binary
+ * format stores the same data as arrays laid out the way the renderer
+ * consumes them, so a mapped file is used without any conversion:
+ *
+ *    struct scene_file_header
+ *    struct gear_shape[shape_count]
+ *    struct gear_params[gear_count]
+ *    uint32_t gear_shape[gear_count]
+ *    uint32_t gear_material[gear_count]
+ */
+
+#define SCENE_MAGIC "DGCSCENE"
+#define SCENE_VERSION 1
+
+struct gear_shape {
+   float inner_radius;
+   float outer_radius;
+   float width;
+   uint32_t teeth;
+   float tooth_depth;
+};
+
+/* matches the std430 layout of the gear buffer in the vertex shaders */
+struct gear_params {
+   float position[3];
+   float angle_ratio;
+   float color[3];
+   float phase;
+};
+
+struct scene_file_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t shape_count;
+   uint32_t gear_count;
+   float view_distance;
+   uint64_t shapes_offset;
+   uint64_t params_offset;
+   uint64_t gear_shape_offset;
+   uint64_t gear_material_offset;
+};
+
+struct scene {
+   float view_distance;
+   float radius;
+   uint32_t shape_count;
+   uint32_t gear_count;
+   const struct gear_shape *shapes;
+   const struct gear_params *params;
+   const uint32_t *gear_shape;
+   const uint32_t *gear_material;
+
+   /* backing storage: a file mapping or a single allocation */
+   void *map;
+   size_t map_size;
+   void *storage;
+};
+
+/**
+ * Loads a scene file, binary or text depending on its contents.
+ *
+ * @param scene the scene to initialize
+ * @param filename the file to load
+ * @return true on success
+ */
+bool
+scene_load(struct scene *scene, const char *filename);
+
+/**
+ * Parses a scene from text.
+ *
+ * The text is parsed twice: once to count the statements, once to fill a
+ * single allocation holding every array.
+ *
+ * @param scene the scene to initialize
+ * @param text the scene text, not necessarily NUL-terminated
+ * @param size the length of the text
+ * @return true on success
+ */
+bool
+scene_parse_text(struct scene *scene, const char *text, size_t size);
+
+/**
+ * Writes a scene in the binary format.
+ *
+ * @param scene the scene to write
+ * @param filename the file to write
+ * @return true on success
+ */
+bool
+scene_write_binary(const struct scene *scene, const char *filename);
+
+/**
+ * Releases the storage of a scene.
+ *
+ * @param scene the scene to release
+ */
+void
+scene_free(struct scene *scene);
+
+#endif /* SCENE_H */
@@ -0,0 +1,52 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+/* the texels of the software rasterizer, color then depth bits */
+layout(buffer_reference, std430, buffer_reference_align = 8) readonly buffer visibility_block {
+    uvec2 texels[];
+};
+
+layout(push_constant) uniform constants
+{
+    visibility_block visibility;
+    uint width;     /* the render width, the row pitch of the texels */
+};
+
+layout(location = 0) out vec4 color;
+
+/*
+ * Merge what the software rasterizer drew into the pass: its depth goes
+ * through the same depth test as the gears drawn by the generated
+ * commands, so whichever is nearer shows.
+ */
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    uvec2 texel = visibility.texels[pixel.y * width + pixel.x];
+    if (texel.y == 0xffffffffu)
+        discard;
+    gl_FragDepth = uintBitsToFloat(texel.y);
+    color = unpackUnorm4x8(texel.x);
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRACE_ALIGN 16
+
+static uint64_t
+align_file(FILE *f)
+{
+   long pos = ftell(f);
+   while (pos % TRACE_ALIGN) {
+      fputc(0, f);
+      pos++;
+   }
+   return pos;
+}
+
+bool
+trace_writer_open(struct trace_writer *w, const char *filename,
+                  const struct trace_header *header)
+{
+   memset(w, 0, sizeof(*w));
+   if (header->push_size > TRACE_MAX_PUSH || header->ies_count > TRACE_MAX_IES)
+      return false;
+
+   w->file = fopen(filename, "wb");
+   if (!w->file)
+      return false;
+
+   w->header = *header;
+   memcpy(w->header.magic, TRACE_MAGIC, sizeof(w->header.magic));
+   w->header.version = TRACE_VERSION;
+   w->header.frame_count = 0;
+
+   /* placeholder, rewritten on close */
+   fwrite(&w->header, sizeof(w->header), 1, w->file);
+   w->header.streams_offset = align_file(w->file);
+   return true;
+}
+
+bool
+trace_writer_add_frame(struct trace_writer *w, const void *push, double angle,
+                       const void *stream, uint32_t sequence_count)
+{
+   if (w->header.frame_count == w->capacity) {
+      unsigned capacity = w->capacity ? w->capacity * 2 : 1024;
+      struct trace_frame *frames = realloc(w->frames, capacity * sizeof(*frames));
+      if (!frames)
+         return false;
+      w->frames = frames;
+      w->capacity = capacity;
+   }
+
+   size_t size = (size_t)sequence_count * w->header.indirect_stride;
+   if (!w->last_stream || size != w->last_size ||
+       memcmp(stream, w->last_stream, size) != 0) {
+      void *copy = realloc(w->last_stream, size ? size : 1);
+      if (!copy)
+         return false;
+      memcpy(copy, stream, size);
+      w->last_stream = copy;
+      w->last_size = size;
+      w->last_offset = align_file(w->file) - w->header.streams_offset;
+      if (fwrite(stream, 1, size, w->file) != size)
+         return false;
+   }
+
+   struct trace_frame *frame = &w->frames[w->header.frame_count++];
+   memset(frame, 0, sizeof(*frame));
+   memcpy(frame->push, push, w->header.push_size);
+   frame->sequence_count = sequence_count;
+   frame->stream_offset = w->last_offset;
+   frame->angle = angle;
+   return true;
+}
+
+bool
+trace_writer_close(struct trace_writer *w)
+{
+   if (!w->file)
+      return false;
+
+   w->header.frames_offset = align_file(w->file);
+   w->header.streams_size = w->header.frames_offset - w->header.streams_offset;
+   bool ok = fwrite(w->frames, sizeof(struct trace_frame), w->header.frame_count,
+                    w->file) == w->header.frame_count;
+
+   ok = ok && fseek(w->file, 0, SEEK_SET) == 0 &&
+        fwrite(&w->header, sizeof(w->header), 1, w->file) == 1;
+   ok = fclose(w->file) == 0 && ok;
+
+   free(w->frames);
+   free(w->last_stream);
+   memset(w, 0, sizeof(*w));
+   return ok;
+}
+
+bool
+trace_open(struct trace *t, const char *filename)
+{
+   memset(t, 0, sizeof(*t));
+
+   int fd = open(filename, O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct trace_header)) {
+      close(fd);
+      return false;
+   }
+
+   t->size = st.st_size;
+   t->map = mmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (t->map == MAP_FAILED) {
+      t->map = NULL;
+      return false;
+   }
+
+   const struct trace_header *h = t->map;
+   if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) != 0 ||
+       h->version != TRACE_VERSION ||
+       h->push_size > TRACE_MAX_PUSH || h->ies_count > TRACE_MAX_IES ||
+       h->frame_count == 0 ||
+       h->streams_offset + h->streams_size > t->size ||
+       h->frames_offset + (uint64_t)h->frame_count * sizeof(struct trace_frame) > t->size) {
+      trace_close(t);
+      return false;
+   }
+
+   for (uint32_t i = 0; i < h->frame_count; i++) {
+      const struct trace_frame *frame =
+         (const struct trace_frame *)((const uint8_t *)t->map + h->frames_offset) + i;
+      if (frame->sequence_count > h->max_sequence_count ||
+          frame->stream_offset + (uint64_t)frame->sequence_count * h->indirect_stride >
+          h->streams_size) {
+         trace_close(t);
+         return false;
+      }
+   }
+
+   t->header = h;
+   t->streams = (const uint8_t *)t->map + h->streams_offset;
+   t->frames = (const struct trace_frame *)((const uint8_t *)t->map + h->frames_offset);
+   return true;
+}
+
+void
+trace_close(struct trace *t)
+{
+   if (t->map)
+      munmap(t->map, t->size);
+   memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A DGC trace records, per frame, everything CmdExecuteGeneratedCommandsEXT
+ * consumes: the push constants, the indirect stream and its sequence count,
+ * plus the execution set contents once in the header.
+ *
+ * File layout, all little-endian and naturally aligned so that the file can
+ * be used in place after mmap():
+ *
+ *    struct trace_header
+ *    indirect streams (deduplicated, 16-byte aligned)
+ *    struct trace_frame[frame_count]
+ */
+
+#define TRACE_MAGIC "DGCTRACE"
+#define TRACE_VERSION 2
+#define TRACE_MAX_IES 16
+#define TRACE_MAX_PUSH 32
+
+#define TRACE_FLAG_SHADER_OBJECT (1u << 0)
+
+struct trace_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t flags;
+   uint32_t indirect_stride;
+   uint32_t max_sequence_count;
+   uint32_t push_size;
+   uint32_t ies_count;
+   uint32_t ies[TRACE_MAX_IES];
+   uint32_t frame_count;
+   uint32_t pad;
+   uint64_t streams_offset;
+   uint64_t streams_size;
+   uint64_t frames_offset;
+};
+
+struct trace_frame {
+   uint8_t push[TRACE_MAX_PUSH];
+   uint32_t sequence_count;
+   uint32_t pad;
+   uint64_t stream_offset;
+   /* the push constant angle before it was reduced modulo 360 */
+   double angle;
+};
+
+struct trace_writer {
+   FILE *file;
+   struct trace_header header;
+   struct trace_frame *frames;
+   unsigned capacity;
+   void *last_stream;
+   size_t last_size;
+   uint64_t last_offset;
+};
+
+struct trace {
+   void *map;
+   size_t size;
+   const struct trace_header *header;
+   const struct trace_frame *frames;
+   const uint8_t *streams;
+};
+
+/**
+ * Starts writing a trace.
+ *
+ * @param w the writer to initialize
+ * @param filename the file to write
+ * @param header the stream description; counts and offsets are filled in
+ * @return true on success
+ */
+bool
+trace_writer_open(struct trace_writer *w, const char *filename,
+                  const struct trace_header *header);
+
+/**
+ * Appends a frame. The indirect stream is only stored again if it differs
+ * from the previous frame's.
+ *
+ * @param w the writer
+ * @param push the push constants, header.push_size bytes
+ * @param angle the unreduced frame angle
+ * @param stream the indirect stream, sequence_count records
+ * @param sequence_count the number of sequences executed
+ * @return false if the frame could not be stored, leaving the trace unusable
+ */
+bool
+trace_writer_add_frame(struct trace_writer *w, const void *push, double angle,
+                       const void *stream, uint32_t sequence_count);
+
+/**
+ * Writes the frame table, finalizes the header and closes the file.
+ *
+ * @param w the writer
+ * @return true on success
+ */
+bool
+trace_writer_close(struct trace_writer *w);
+
+/**
+ * Maps a trace file and validates its header.
+ *
+ * @param t the trace to initialize
+ * @param filename the file to map
+ * @return true on success
+ */
+bool
+trace_open(struct trace *t, const char *filename);
+
+/**
+ * Unmaps a trace file.
+ *
+ * @param t the trace to release
+ */
+void
+trace_close(struct trace *t);
+
+#endif /* TRACE_H */
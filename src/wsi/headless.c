@@ -0,0 +1,106 @@
+/*
+ * Copyright © 2024 Valve Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <vulkan/vulkan.h>
+
+#include "wsi.h"
+
+static struct wsi_callbacks wsi_callbacks;
+static unsigned window_count;
+
+static void
+init_display()
+{
+}
+
+static void
+fini_display()
+{
+}
+
+static bool
+init_window(const char *title, int width, int height, bool fullscreen)
+{
+   if (window_count == WSI_MAX_WINDOWS)
+      return false;
+   window_count++;
+   return true;
+}
+
+static bool
+update_window()
+{
+   return false;
+}
+
+static void
+fini_window()
+{
+   window_count = 0;
+}
+
+static void
+set_wsi_callbacks(struct wsi_callbacks callbacks)
+{
+   wsi_callbacks = callbacks;
+}
+
+static bool
+create_surface(VkPhysicalDevice physical_device, VkInstance instance,
+               unsigned window, VkSurfaceKHR *surface)
+{
+   PFN_vkCreateHeadlessSurfaceEXT create_headless_surface =
+      (PFN_vkCreateHeadlessSurfaceEXT)vkGetInstanceProcAddr(instance,
+                                                            "vkCreateHeadlessSurfaceEXT");
+   if (!create_headless_surface) {
+      fprintf(stderr, "Failed to load extension functions\n");
+      return false;
+   }
+
+   return create_headless_surface(instance,
+                                  &(VkHeadlessSurfaceCreateInfoEXT) {
+                                     .sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+                                  },
+                                  NULL,
+                                  surface) == VK_SUCCESS;
+}
+
+struct wsi_interface
+headless_wsi_interface(void) {
+   return (struct wsi_interface) {
+      .required_extension_name = VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME,
+
+      .init_display = init_display,
+      .fini_display = fini_display,
+
+      .init_window = init_window,
+      .update_window = update_window,
+      .fini_window = fini_window,
+
+      .set_wsi_callbacks = set_wsi_callbacks,
+
+      .create_surface = create_surface,
+   };
+}
@@ -23,6 +23,8 @@
 
 static struct wsi_callbacks wsi_callbacks;
 static AppDelegate *app_delegate;
+/* the delegate drives a single window and layer */
+static bool window_created;
 
 @implementation AppDelegate
 - (void)init:(const char *)title
@@ -89,7 +91,7 @@ static AppDelegate *app_delegate;
 - (void)windowDidResize:(NSNotification *)notification
 {
    CGSize size = [[_window contentView] frame].size;
-   wsi_callbacks.resize(size.width, size.height);
+   wsi_callbacks.resize(0, size.width, size.height);
 }
 @end
 
@@ -146,15 +148,20 @@ static void fini_display()
 {
 }
 
-static void init_window(const char *title, int width, int height,
+static bool init_window(const char *title, int width, int height,
                         bool fullscreen)
 {
+   if (window_created)
+      return false;
+   window_created = true;
+
    @autoreleasepool {
       [app_delegate init:title
                withWidth:width
             withHeight:height
             isFullscreen:fullscreen];
    }
+   return true;
 }
 
 static bool
@@ -194,7 +201,7 @@ set_wsi_callbacks(struct wsi_callbacks callbacks)
 
 static bool
 create_surface(VkPhysicalDevice physical_device,
-               VkInstance instance, VkSurfaceKHR *surface)
+               VkInstance instance, unsigned window, VkSurfaceKHR *surface)
 {
    GET_INSTANCE_PROC(vkCreateMetalSurfaceEXT)
 
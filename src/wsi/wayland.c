@@ -65,13 +65,16 @@ static struct {
 } keyboard_data;
 static struct wl_compositor *compositor;
 static struct libdecor *decor_context;
-static struct libdecor_frame *frame;
 
-struct wl_surface *surface;
-bool window_open;
-bool configured;
-int floating_width;
-int floating_height;
+static struct window {
+   struct wl_surface *surface;
+   struct libdecor_frame *frame;
+   bool open;
+   bool configured;
+   int floating_width;
+   int floating_height;
+} windows[WSI_MAX_WINDOWS];
+static unsigned window_count;
 
 static void
 dispatch_key(xkb_keycode_t xkb_key, enum wl_keyboard_key_state state)
@@ -297,16 +300,17 @@ frame_configure(struct libdecor_frame *frame,
                 struct libdecor_configuration *configuration,
                 void *user_data)
 {
+   struct window *window = user_data;
    struct libdecor_state *state;
    int width, height;
 
    if (!libdecor_configuration_get_content_size(configuration, frame,
                                           &width, &height)) {
-      width = floating_width;
-      height = floating_height;
+      width = window->floating_width;
+      height = window->floating_height;
    }
 
-   wsi_callbacks.resize(width, height);
+   wsi_callbacks.resize(window - windows, width, height);
 
    state = libdecor_state_new(width, height);
    libdecor_frame_commit(frame, state, configuration);
@@ -314,18 +318,20 @@ frame_configure(struct libdecor_frame *frame,
 
    /* store floating dimensions */
    if (libdecor_frame_is_floating(frame)) {
-      floating_width = width;
-      floating_height = height;
+      window->floating_width = width;
+      window->floating_height = height;
    }
 
-   configured = true;
+   window->configured = true;
 }
 
 static void
 frame_close(struct libdecor_frame *frame, void *user_data)
 {
+   struct window *window = user_data;
+
    wsi_callbacks.exit();
-   window_open = false;
+   window->open = false;
 }
 
 static void
@@ -339,42 +345,68 @@ static struct libdecor_frame_interface frame_interface = {
    .commit = frame_commit,
 };
 
-static void init_window(const char *title, int width, int height, bool fullscreen)
+static bool init_window(const char *title, int width, int height, bool fullscreen)
 {
    assert(compositor);
 
-   surface = wl_compositor_create_surface(compositor);
-
-   decor_context = libdecor_new(display,
-                                &libdecor_interface);
-   frame = libdecor_decorate(decor_context,
-                             surface,
-                             &frame_interface,
-                             NULL);
-   floating_width = width;
-   floating_height = height;
-   libdecor_frame_set_app_id(frame, title);
-   libdecor_frame_set_title(frame, title);
-   libdecor_frame_map(frame);
-
-   libdecor_frame_set_min_content_size(frame, 1, 1);
-
-   wl_surface_commit(surface);
-
-   while (!configured) {
+   if (window_count == WSI_MAX_WINDOWS)
+      return false;
+   struct window *window = &windows[window_count++];
+
+   window->surface = wl_compositor_create_surface(compositor);
+
+   /* every window shares the libdecor context */
+   if (!decor_context)
+      decor_context = libdecor_new(display,
+                                   &libdecor_interface);
+   window->frame = libdecor_decorate(decor_context,
+                                     window->surface,
+                                     &frame_interface,
+                                     window);
+   window->floating_width = width;
+   window->floating_height = height;
+   window->open = true;
+   libdecor_frame_set_app_id(window->frame, title);
+   libdecor_frame_set_title(window->frame, title);
+   libdecor_frame_map(window->frame);
+
+   libdecor_frame_set_min_content_size(window->frame, 1, 1);
+
+   wl_surface_commit(window->surface);
+
+   while (!window->configured) {
       if (libdecor_dispatch(decor_context, 0) < 0) {
          printf("error: unable to initialize libdecor\n");
       }
    }
 
    if (fullscreen)
-      libdecor_frame_set_fullscreen(frame, NULL);
+      libdecor_frame_set_fullscreen(window->frame, NULL);
+   return true;
+}
+
+static bool
+any_window_open(void)
+{
+   for (unsigned i = 0; i < window_count; i++) {
+      if (windows[i].open)
+         return true;
+   }
+   return false;
 }
 
 static void fini_window()
 {
+   for (unsigned i = 0; i < window_count; i++) {
+      libdecor_frame_unref(windows[i].frame);
+      wl_surface_destroy(windows[i].surface);
+   }
+   memset(windows, 0, sizeof(windows));
+   window_count = 0;
+
    if (decor_context)
       libdecor_unref(decor_context);
+   decor_context = NULL;
 }
 
 
@@ -439,7 +471,7 @@ static bool update_window()
          pollfds[0].events &= ~POLLOUT; /* successfully flushed */
 
       if (pollfds[1].revents & POLLIN) {
-         if (window_open && libdecor_dispatch(decor_context, 0) < 0) {
+         if (any_window_open() && libdecor_dispatch(decor_context, 0) < 0) {
             ret = 1;
             break;
          }
@@ -472,7 +504,7 @@ set_wsi_callbacks(struct wsi_callbacks callbacks)
 
 static bool
 create_surface(VkPhysicalDevice physical_device, VkInstance instance,
-               VkSurfaceKHR *psurface)
+               unsigned window, VkSurfaceKHR *psurface)
 {
    GET_INSTANCE_PROC(vkGetPhysicalDeviceWaylandPresentationSupportKHR)
    GET_INSTANCE_PROC(vkCreateWaylandSurfaceKHR)
@@ -494,7 +526,7 @@ create_surface(VkPhysicalDevice physical_device, VkInstance instance,
                                 &(VkWaylandSurfaceCreateInfoKHR) {
            .sType = VK_STRUCTURE_TYPE_WAYLAND_SURFACE_CREATE_INFO_KHR,
            .display = display,
-           .surface = surface,
+           .surface = windows[window].surface,
         }, NULL, psurface);
 
    return result == VK_SUCCESS;
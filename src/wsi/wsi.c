@@ -39,5 +39,7 @@ get_wsi_interface(void)
    return xcb_wsi_interface();
 #elif defined(METAL_SUPPORT)
    return metal_wsi_interface();
+#else
+   return headless_wsi_interface();
 #endif
 }
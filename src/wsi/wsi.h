@@ -42,9 +42,15 @@ struct wsi_interface
 metal_wsi_interface(void);
 #endif
 
+struct wsi_interface
+headless_wsi_interface(void);
+
 struct wsi_interface
 get_wsi_interface(void);
 
+/* most windows a backend keeps open at once */
+#define WSI_MAX_WINDOWS 8
+
 enum wsi_key {
    WSI_KEY_UP,
    WSI_KEY_DOWN,
@@ -56,7 +62,7 @@ enum wsi_key {
 };
 
 struct wsi_callbacks {
-   void (*resize)(int new_width, int new_height);
+   void (*resize)(unsigned window, int new_width, int new_height);
    void (*key_press)(bool down, enum wsi_key key);
    void (*exit)();
 };
@@ -67,14 +73,17 @@ struct wsi_interface {
    void (*init_display)();
    void (*fini_display)();
 
-   void (*init_window)(const char *title, int width, int height, bool fullscreen);
+   /* opens the next window, numbered from 0, or returns false if it cannot */
+   bool (*init_window)(const char *title, int width, int height, bool fullscreen);
+   /* dispatches the events of every window */
    bool (*update_window)();
+   /* closes every window */
    void (*fini_window)();
 
    void (*set_wsi_callbacks)(struct wsi_callbacks);
 
    bool (*create_surface)(VkPhysicalDevice physical_device, VkInstance instance,
-               VkSurfaceKHR *surface);
+               unsigned window, VkSurfaceKHR *surface);
 };
 
 #endif // WSI_H_
@@ -42,7 +42,8 @@ static struct wsi_callbacks wsi_callbacks;
 
 static xcb_connection_t *connection;
 static xcb_screen_iterator_t screen_iterator;
-static xcb_window_t window;
+static xcb_window_t windows[WSI_MAX_WINDOWS];
+static unsigned window_count;
 static struct {
    struct xkb_context *xkb_context;
    struct xkb_keymap *xkb_keymap;
@@ -98,10 +99,24 @@ fini_display()
 
 }
 
-static void
+static int
+find_window(xcb_window_t window)
+{
+   for (unsigned i = 0; i < window_count; i++) {
+      if (windows[i] == window)
+         return i;
+   }
+   return -1;
+}
+
+static bool
 init_window(const char *title, int width, int height, bool fullscreen)
 {
-   window = xcb_generate_id(connection);
+   if (window_count == WSI_MAX_WINDOWS)
+      return false;
+
+   xcb_window_t window = xcb_generate_id(connection);
+   windows[window_count++] = window;
    xcb_create_window(connection,
                      XCB_COPY_FROM_PARENT,
                      window,
@@ -146,6 +161,7 @@ init_window(const char *title, int width, int height, bool fullscreen)
 
    xcb_map_window(connection, window);
    xcb_flush(connection);
+   return true;
 }
 
 static bool
@@ -161,12 +177,16 @@ update_window()
    event.generic = xcb_wait_for_event(connection);
    while(event.generic) {
       switch (event.generic->response_type & 0x7f) {
-      case XCB_CONFIGURE_NOTIFY:
-         wsi_callbacks.resize(event.configure_event->width, event.configure_event->height);
+      case XCB_CONFIGURE_NOTIFY: {
+         int index = find_window(event.configure_event->window);
+         if (index >= 0)
+            wsi_callbacks.resize(index, event.configure_event->width,
+                                 event.configure_event->height);
          break;
+      }
 
       case XCB_CLIENT_MESSAGE:
-         if (event.client_message->window == window &&
+         if (find_window(event.client_message->window) >= 0 &&
              event.client_message->type == wm_protocols_atom &&
              event.client_message->data.data32[0] == delete_atom)
             wsi_callbacks.exit();
@@ -213,10 +233,10 @@ update_window()
 
    client_message.response_type = XCB_CLIENT_MESSAGE;
    client_message.format = 32;
-   client_message.window = window;
+   client_message.window = windows[0];
    client_message.type = XCB_ATOM_NOTICE;
 
-   xcb_send_event(connection, 0, window,
+   xcb_send_event(connection, 0, windows[0],
                   0, (char *) &client_message);
 
    xcb_flush(connection);
@@ -227,7 +247,10 @@ update_window()
 static void
 fini_window()
 {
-
+   for (unsigned i = 0; i < window_count; i++)
+      xcb_destroy_window(connection, windows[i]);
+   window_count = 0;
+   xcb_flush(connection);
 }
 
 static void
@@ -241,7 +264,7 @@ set_wsi_callbacks(struct wsi_callbacks callbacks)
 
 static bool
 create_surface(VkPhysicalDevice physical_device, VkInstance instance,
-               VkSurfaceKHR *surface)
+               unsigned window, VkSurfaceKHR *surface)
 {
 
    GET_INSTANCE_PROC(vkGetPhysicalDeviceXcbPresentationSupportKHR)
@@ -265,7 +288,7 @@ create_surface(VkPhysicalDevice physical_device, VkInstance instance,
                          &(VkXcbSurfaceCreateInfoKHR){
                             .sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR,
                             .connection = connection,
-                            .window = window,
+                            .window = windows[window],
                          },
                          NULL,
                          surface);